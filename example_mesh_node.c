@@ -130,7 +130,12 @@ int main()
 
     printf("\n=== MESH NETWORK ACTIVE ===\n");
     printf("Listening for P2P connections...\n");
+    #if WINC_MESH_TRICKLE
+    printf("Sending beacons every %u-%u ms (adaptive)\n",
+           WINC_MESH_TRICKLE_IMIN_MS, WINC_MESH_TRICKLE_IMAX_MS);
+    #else
     printf("Sending beacons every %u ms\n", WINC_MESH_BEACON_INTERVAL_MS);
+    #endif
     #if TARGET_NODE > 0 && TEST_SEND_INTERVAL > 0
     printf("Sending test messages to node %u every %u ms\n",
            TARGET_NODE, TEST_SEND_INTERVAL);
@@ -175,6 +180,14 @@ int main()
             printf("Uptime: %lu seconds\n", now / 1000);
             printf("Active routes: %u\n", winc_mesh_get_node_count());
             winc_mesh_print_routes();
+
+            winc_mesh_beacon_stats_t bs;
+            winc_mesh_get_beacon_stats(&bs);
+            printf("Beacons: sent %lu, suppressed %lu, heard %lu, interval %lu ms\n",
+                   bs.beacons_sent, bs.beacons_suppressed, bs.beacons_received,
+                   bs.interval_ms);
+            printf("Topology changes: %lu (last convergence %lu ms)\n",
+                   bs.inconsistencies, bs.convergence_ms);
             printf("------------------------\n\n");
 
             last_status = now;
@@ -182,8 +195,12 @@ int main()
 
         loop_count++;
 
-        // Small delay to prevent busy-waiting
-        sleep_ms(1);
+        // Sleep until the mesh, the WINC or our own next job needs us
+        uint32_t next_job = last_status + 30000 - now;
+        #if TARGET_NODE > 0 && TEST_SEND_INTERVAL > 0
+        next_job = MIN(next_job, last_send + TEST_SEND_INTERVAL - now);
+        #endif
+        winc_idle(next_job);
     }
 
     return 0;
@@ -0,0 +1,432 @@
+// ATWINC1500 Mesh Benchmark
+// Goodput, loss, reordering and latency between mesh nodes
+//
+// Usage:
+// 1. Build one image per board, choosing its role:
+//      cmake -DMY_NODE_ID=1 -DBENCH_ROLE=BENCH_SOURCE -DBENCH_DSTS=3 ..
+//      cmake -DMY_NODE_ID=2 -DBENCH_ROLE=BENCH_FORWARDER ..
+//      cmake -DMY_NODE_ID=3 -DBENCH_ROLE=BENCH_SINK ..
+//      make mesh_bench
+// 2. Capture each board's USB serial output; every report is one JSON
+//    object on a line of its own, starting with {"bench":
+//      grep '^{"bench"' node1.log > node1.jsonl
+//
+// A source sends BENCH_PAYLOAD byte messages to each node in BENCH_DSTS at
+// BENCH_RATE_PPS per destination. Every BENCH_ECHO_EVERY-th message asks
+// the receiver to echo its timestamp back, which gives the source round
+// trip percentiles without synchronised clocks. Sinks (and sources, for
+// traffic in both directions) count what arrives per sender. Forwarders
+// only relay and report their own queue and pool statistics.
+//
+// Records, all cumulative except goodput_bps (over the last interval):
+//   {"bench":"start", node, role, build, fw, payload, rate_pps, flags, ...}
+//   {"bench":"path",  node, dst, hops, path}             (source, once per dst)
+//   {"bench":"tx",    t_ms, node, dst, sent, failed, echoes, rtt_p50_us, ...}
+//   {"bench":"rx",    t_ms, node, src, rx, bytes, goodput_bps, lost, reordered, dup}
+//   {"bench":"mesh",  t_ms, node, routes, pool_hw, pool_exhausted, q_dropped, ...}
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "winc_lib.h"
+
+// ============================================================================
+// CONFIGURATION - CHANGE FOR EACH BOARD
+// ============================================================================
+
+#define BENCH_FORWARDER  0
+#define BENCH_SOURCE     1
+#define BENCH_SINK       2
+
+#ifndef MY_NODE_ID
+#define MY_NODE_ID  1
+#endif
+
+#ifndef MY_NODE_NAME
+#define MY_NODE_NAME "Bench"
+#endif
+
+#ifndef BENCH_ROLE
+#define BENCH_ROLE  BENCH_SINK
+#endif
+
+// Destinations of a source, comma separated
+#ifndef BENCH_DSTS
+#define BENCH_DSTS  2
+#endif
+
+// Message size in bytes, header included (fragmented above WINC_MESH_MTU)
+#ifndef BENCH_PAYLOAD
+#define BENCH_PAYLOAD  256
+#endif
+
+// Messages per second to each destination
+#ifndef BENCH_RATE_PPS
+#define BENCH_RATE_PPS  20
+#endif
+
+// winc_mesh_send_ex() flags, e.g. WINC_MESH_RELIABLE or WINC_MESH_BULK
+#ifndef BENCH_FLAGS
+#define BENCH_FLAGS  0
+#endif
+
+// One message in this many asks for a timestamp echo
+#ifndef BENCH_ECHO_EVERY
+#define BENCH_ECHO_EVERY  8
+#endif
+
+#ifndef BENCH_REPORT_MS
+#define BENCH_REPORT_MS  5000
+#endif
+
+// Time for routes to form before a source starts sending
+#ifndef BENCH_WARMUP_MS
+#define BENCH_WARMUP_MS  15000
+#endif
+
+// Stop sending after this long (0 = never)
+#ifndef BENCH_DURATION_MS
+#define BENCH_DURATION_MS  0
+#endif
+
+#define BENCH_MAX_PEERS    16    // Senders a node keeps receive counters for
+#define BENCH_RTT_SAMPLES  128   // Most recent round trips kept per destination
+
+#define BENCH_MAGIC      0xBE
+#define BENCH_KIND_DATA  1
+#define BENCH_KIND_ECHO  2
+
+// Start of every benchmark message; filler follows up to BENCH_PAYLOAD
+typedef struct __attribute__((packed)) {
+    uint8_t magic;
+    uint8_t kind;          // BENCH_KIND_*
+    uint8_t echo;          // Receiver should echo this one
+    uint8_t reserved;
+    uint32_t seq;          // Per destination, from 0
+    uint32_t sent_us;      // Source's time_us_32(), returned in echoes
+} bench_hdr_t;
+
+#if BENCH_PAYLOAD > WINC_MESH_MAX_MESSAGE
+#error "BENCH_PAYLOAD must be at most WINC_MESH_MAX_MESSAGE"
+#endif
+_Static_assert(BENCH_PAYLOAD >= sizeof(bench_hdr_t), "BENCH_PAYLOAD must hold a bench_hdr_t");
+
+// ============================================================================
+// STATE
+// ============================================================================
+
+// What a source knows about one destination
+typedef struct {
+    uint8_t node;
+    uint8_t hops;
+    uint32_t seq;
+    uint32_t sent;
+    uint32_t failed;              // Refused by winc_mesh_send_ex()
+    uint32_t echoes;
+    uint32_t rtt[BENCH_RTT_SAMPLES];
+    uint8_t rtt_next;
+    uint8_t rtt_count;
+    uint64_t next_us;             // When the next message is due
+} bench_dst_t;
+
+// What a receiver knows about one sender
+typedef struct {
+    uint8_t node;                 // 0 = free
+    bool started;
+    uint32_t top_seq;             // Highest seq received
+    uint32_t rx;
+    uint32_t bytes;
+    uint32_t bytes_reported;      // bytes at the last report
+    uint32_t lost;                // Gaps below top_seq not filled yet
+    uint32_t reordered;           // Arrived after a higher seq
+    uint32_t dup;
+} bench_peer_t;
+
+static const uint8_t bench_dst_nodes[] = {BENCH_DSTS};
+#define BENCH_NUM_DSTS  (sizeof(bench_dst_nodes) / sizeof(bench_dst_nodes[0]))
+
+static bench_dst_t dsts[BENCH_NUM_DSTS];
+static bench_peer_t peers[BENCH_MAX_PEERS];
+static uint8_t txbuf[BENCH_PAYLOAD];
+
+static const char *role_name(void) {
+    return BENCH_ROLE == BENCH_SOURCE ? "source" :
+           BENCH_ROLE == BENCH_SINK ? "sink" : "forwarder";
+}
+
+// ============================================================================
+// RECEIVE
+// ============================================================================
+
+static bench_peer_t *peer_get(uint8_t node) {
+    for (int i = 0; i < BENCH_MAX_PEERS; i++) {
+        if (peers[i].node == node)
+            return &peers[i];
+    }
+    for (int i = 0; i < BENCH_MAX_PEERS; i++) {
+        if (!peers[i].node) {
+            peers[i].node = node;
+            return &peers[i];
+        }
+    }
+    return NULL;
+}
+
+static void bench_rx_data(uint8_t src_node, const bench_hdr_t *h, uint16_t len) {
+    bench_peer_t *p = peer_get(src_node);
+
+    if (!p)
+        return;
+
+    if (!p->started) {
+        p->started = true;
+        p->top_seq = h->seq;
+    } else if (h->seq > p->top_seq) {
+        p->lost += h->seq - p->top_seq - 1;
+        p->top_seq = h->seq;
+    } else if (h->seq == p->top_seq) {
+        p->dup++;
+        return;
+    } else if (p->lost) {
+        // A late arrival fills a gap counted as lost. A duplicate of an old
+        // message is counted here too; the window is not worth the RAM.
+        p->lost--;
+        p->reordered++;
+    } else {
+        p->dup++;
+        return;
+    }
+    p->rx++;
+    p->bytes += len;
+
+    if (h->echo) {
+        bench_hdr_t e = *h;
+        e.kind = BENCH_KIND_ECHO;
+        winc_mesh_send(src_node, (uint8_t*)&e, sizeof(e));
+    }
+}
+
+static void bench_rx_echo(uint8_t src_node, const bench_hdr_t *h) {
+    for (unsigned i = 0; i < BENCH_NUM_DSTS; i++) {
+        bench_dst_t *d = &dsts[i];
+        if (d->node != src_node)
+            continue;
+        d->echoes++;
+        d->rtt[d->rtt_next] = time_us_32() - h->sent_us;
+        d->rtt_next = (d->rtt_next + 1) % BENCH_RTT_SAMPLES;
+        if (d->rtt_count < BENCH_RTT_SAMPLES)
+            d->rtt_count++;
+        return;
+    }
+}
+
+void bench_data_received(uint8_t src_node, uint8_t *data, uint16_t len)
+{
+    bench_hdr_t h;
+
+    if (len < sizeof(h))
+        return;
+    memcpy(&h, data, sizeof(h));
+    if (h.magic != BENCH_MAGIC)
+        return;
+
+    if (h.kind == BENCH_KIND_DATA && BENCH_ROLE != BENCH_FORWARDER)
+        bench_rx_data(src_node, &h, len);
+    else if (h.kind == BENCH_KIND_ECHO)
+        bench_rx_echo(src_node, &h);
+}
+
+// ============================================================================
+// SEND
+// ============================================================================
+
+static void bench_send(bench_dst_t *d) {
+    bench_hdr_t h;
+
+    h.magic = BENCH_MAGIC;
+    h.kind = BENCH_KIND_DATA;
+    h.echo = d->seq % BENCH_ECHO_EVERY == 0;
+    h.reserved = 0;
+    h.seq = d->seq;
+    h.sent_us = time_us_32();
+    memcpy(txbuf, &h, sizeof(h));
+
+    // A refused message keeps its seq so the sink does not count it lost
+    if (winc_mesh_send_ex(d->node, txbuf, sizeof(txbuf), BENCH_FLAGS)) {
+        d->seq++;
+        d->sent++;
+    } else {
+        d->failed++;
+    }
+}
+
+// Trace each destination once, so every result can be filed by hop count
+static void bench_trace(void) {
+    winc_mesh_ping_result_t pr;
+
+    for (unsigned i = 0; i < BENCH_NUM_DSTS; i++) {
+        dsts[i].node = bench_dst_nodes[i];
+        winc_mesh_ping(dsts[i].node, 3, 0, &pr);
+        dsts[i].hops = pr.hops;
+
+        printf("{\"bench\":\"path\",\"node\":%u,\"dst\":%u,\"hops\":%u,\"rtt_avg_us\":%lu,\"path\":[",
+               MY_NODE_ID, dsts[i].node, pr.hops, (unsigned long)pr.avg_us);
+        for (int h = 0; h < pr.hops; h++)
+            printf("%s%u", h ? "," : "", pr.path[h]);
+        printf("]}\n");
+    }
+}
+
+// ============================================================================
+// REPORTS
+// ============================================================================
+
+static int cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report_tx(uint32_t now) {
+    static uint32_t sorted[BENCH_RTT_SAMPLES];
+
+    for (unsigned i = 0; i < BENCH_NUM_DSTS; i++) {
+        bench_dst_t *d = &dsts[i];
+        int n = d->rtt_count;
+        uint32_t p50 = 0, p90 = 0, p99 = 0, max = 0;
+
+        if (n) {
+            memcpy(sorted, d->rtt, n * sizeof(uint32_t));
+            qsort(sorted, n, sizeof(uint32_t), cmp_u32);
+            p50 = sorted[n * 50 / 100];
+            p90 = sorted[n * 90 / 100];
+            p99 = sorted[n * 99 / 100];
+            max = sorted[n - 1];
+        }
+        printf("{\"bench\":\"tx\",\"t_ms\":%lu,\"node\":%u,\"dst\":%u,\"hops\":%u,"
+               "\"sent\":%lu,\"failed\":%lu,\"echoes\":%lu,"
+               "\"rtt_p50_us\":%lu,\"rtt_p90_us\":%lu,\"rtt_p99_us\":%lu,\"rtt_max_us\":%lu}\n",
+               (unsigned long)now, MY_NODE_ID, d->node, d->hops,
+               (unsigned long)d->sent, (unsigned long)d->failed, (unsigned long)d->echoes,
+               (unsigned long)p50, (unsigned long)p90, (unsigned long)p99, (unsigned long)max);
+    }
+}
+
+static void report_rx(uint32_t now, uint32_t interval_ms) {
+    for (int i = 0; i < BENCH_MAX_PEERS; i++) {
+        bench_peer_t *p = &peers[i];
+        uint32_t bps;
+
+        if (!p->node)
+            continue;
+        bps = (uint64_t)(p->bytes - p->bytes_reported) * 8000 / interval_ms;
+        p->bytes_reported = p->bytes;
+        printf("{\"bench\":\"rx\",\"t_ms\":%lu,\"node\":%u,\"src\":%u,\"rx\":%lu,\"bytes\":%lu,"
+               "\"goodput_bps\":%lu,\"lost\":%lu,\"reordered\":%lu,\"dup\":%lu}\n",
+               (unsigned long)now, MY_NODE_ID, p->node, (unsigned long)p->rx,
+               (unsigned long)p->bytes, (unsigned long)bps, (unsigned long)p->lost,
+               (unsigned long)p->reordered, (unsigned long)p->dup);
+    }
+}
+
+static void report_mesh(uint32_t now) {
+    winc_mesh_tx_stats_t ts;
+    winc_mesh_queue_stats_t qs;
+    winc_mesh_pool_stats_t ps;
+    uint32_t q_dropped = 0;
+
+    winc_mesh_get_tx_stats(&ts);
+    winc_mesh_get_queue_stats(&qs);
+    winc_mesh_get_pool_stats(&ps);
+    for (int c = 0; c < WINC_MESH_CLASSES; c++)
+        q_dropped += qs.dropped[c];
+
+    printf("{\"bench\":\"mesh\",\"t_ms\":%lu,\"node\":%u,\"routes\":%u,\"pool_hw\":%u,"
+           "\"pool_exhausted\":%lu,\"q_dropped\":%lu,\"retransmits\":%lu,\"rtx_dropped\":%lu}\n",
+           (unsigned long)now, MY_NODE_ID, winc_mesh_get_node_count(), ps.high_water,
+           (unsigned long)ps.exhausted, (unsigned long)q_dropped,
+           (unsigned long)ts.retransmits, (unsigned long)ts.dropped);
+}
+
+// ============================================================================
+// MAIN
+// ============================================================================
+
+int main()
+{
+    uint8_t fw_major, fw_minor, fw_patch;
+
+    stdio_init_all();
+    sleep_ms(2000);   // Give the USB host time to open the port
+
+    if (!winc_init(MY_NODE_ID, MY_NODE_NAME)) {
+        printf("{\"bench\":\"error\",\"node\":%u,\"what\":\"winc_init\"}\n", MY_NODE_ID);
+        return -1;
+    }
+    winc_mesh_set_callback(bench_data_received);
+
+    winc_get_firmware_version(&fw_major, &fw_minor, &fw_patch);
+    printf("{\"bench\":\"start\",\"node\":%u,\"role\":\"%s\",\"build\":\"%s %s\","
+           "\"fw\":\"%u.%u.%u\",\"payload\":%u,\"rate_pps\":%u,\"flags\":%u,"
+           "\"echo_every\":%u,\"report_ms\":%u,\"dsts\":%u}\n",
+           MY_NODE_ID, role_name(), __DATE__, __TIME__, fw_major, fw_minor, fw_patch,
+           BENCH_PAYLOAD, BENCH_RATE_PPS, BENCH_FLAGS, BENCH_ECHO_EVERY, BENCH_REPORT_MS,
+           BENCH_ROLE == BENCH_SOURCE ? (unsigned)BENCH_NUM_DSTS : 0);
+
+    uint32_t start = to_ms_since_boot(get_absolute_time());
+    uint32_t last_report = start;
+    #if BENCH_ROLE == BENCH_SOURCE
+    bool sending = false, finished = false;
+    #endif
+
+    while (true)
+    {
+        winc_poll();
+
+        uint32_t now = to_ms_since_boot(get_absolute_time());
+        uint64_t now_us = time_us_64();
+        uint64_t next_us = now_us + BENCH_REPORT_MS * 1000ull;
+
+        #if BENCH_ROLE == BENCH_SOURCE
+        if (!sending && !finished && now - start >= BENCH_WARMUP_MS) {
+            bench_trace();
+            for (unsigned i = 0; i < BENCH_NUM_DSTS; i++)
+                dsts[i].next_us = time_us_64();
+            sending = true;
+        }
+        #if BENCH_DURATION_MS > 0
+        if (sending && now - start >= BENCH_WARMUP_MS + BENCH_DURATION_MS) {
+            sending = false;
+            finished = true;
+        }
+        #endif
+        for (unsigned i = 0; sending && i < BENCH_NUM_DSTS; i++) {
+            bench_dst_t *d = &dsts[i];
+
+            // After a stall, skip ahead rather than bursting to catch up
+            if (now_us > d->next_us + 100000)
+                d->next_us = now_us;
+            while (d->next_us <= now_us) {
+                bench_send(d);
+                d->next_us += 1000000 / BENCH_RATE_PPS;
+            }
+            next_us = MIN(next_us, d->next_us);
+        }
+        #endif
+
+        if (now - last_report >= BENCH_REPORT_MS) {
+            if (BENCH_ROLE == BENCH_SOURCE)
+                report_tx(now);
+            report_rx(now, now - last_report);
+            report_mesh(now);
+            last_report = now;
+        }
+
+        // Sleep until the mesh, the WINC, the next message or the next report
+        uint32_t next_job = MIN((uint32_t)((next_us - now_us) / 1000),
+                                last_report + BENCH_REPORT_MS - now);
+        winc_idle(next_job);
+    }
+
+    return 0;
+}
@@ -0,0 +1,2774 @@
+// Host-side mesh simulator
+//
+// Runs N instances of the real winc_mesh.c in one Linux process. The mesh
+// code reaches its state through g_ctx and mesh_ctx; here both names are
+// redirected to per-node pointers, so switching node is a pointer swap.
+// put_sock_sendto() hands frames to a virtual radio that delivers them to
+// linked neighbours on a virtual clock.
+//
+// Usage:
+//   mesh_sim line <n>         Converge a line of n nodes, then send end to end
+//   mesh_sim line-cut <n>     Cut a line in the middle; routes across must vanish
+//   mesh_sim dv-bench [max]   Convergence time versus hop count, lines 2..max
+//   mesh_sim etx [loss]       Lossy direct link versus a clean two-hop path
+//   mesh_sim agg-bench        Small-message throughput over two hops
+//   mesh_sim frag [loss]      4-16 KB messages over three hops
+//   mesh_sim rel-bench [loss] Best effort versus hop-by-hop ACKs over three hops
+//   mesh_sim prio-bench       Alarm latency while bulk traffic saturates two hops
+//   mesh_sim ping [n]         Ping and trace the far end of a line of n nodes
+//   mesh_sim pin              Pinned route through a diamond as a link is cut
+//   mesh_sim order [loss]     Reliable and best-effort order along a lossy line
+//   mesh_sim stream [loss]    64 KB as datagrams versus a stream, 1-3 hops
+//   mesh_sim failover [ms]    Kill the group owner of a 5-node BSS; ms is how
+//                             long the WINC takes to report the loss, 0 = never
+//   mesh_sim sync [n]         Mesh time across a line of n drifting clocks
+//   mesh_sim tdma-bench       Contention versus transmit slots, 8-24 nodes
+//   mesh_sim flood-bench      Blind flooding versus multipoint relays
+//   mesh_sim bp-bench         Bulk traffic into one sink, backpressure on and off
+//   mesh_sim pubsub           Publish versus unicast to each subscriber of a tree
+//   mesh_sim rpc [loss]       Calls to the far end of a lossy line, 1-3 hops
+//   mesh_sim kv               Replicated store versus broadcasting the table
+//   mesh_sim run <file>       Play a scenario file (see sim/scenarios/)
+//   mesh_sim wheel            Timer wheel against a brute-force model
+//
+// mesh_sim_noagg is the same program built with WINC_MESH_AGGREGATE=0.
+
+#define _POSIX_C_SOURCE 200809L   // strtok_r
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int sim_trace(const char *fmt, ...);
+
+// The mesh layer's globals become pointer declarations:
+//   extern winc_ctx_t g_ctx;    ->  extern winc_ctx_t (*sim_ctx);
+//   static mesh_ctx_t mesh_ctx; ->  static mesh_ctx_t (*sim_mesh);
+#define g_ctx    (*sim_ctx)
+#define mesh_ctx (*sim_mesh)
+#define printf   sim_trace
+#include "../winc_mesh.c"
+#include "../winc_timer.h"
+#undef printf
+#undef mesh_ctx
+#undef g_ctx
+
+#define SIM_MAX_NODES   WINC_MESH_MAX_NODES
+#define SIM_TICK_US     1000
+#define SIM_TX_BACKLOG_US 20000   // Radio queue depth before sendto fails
+
+winc_ctx_t *sim_ctx;
+uint64_t sim_now_us = 1000000;
+
+// ===== VIRTUAL RADIO =====
+
+typedef struct {
+    bool up;
+    uint32_t delay_us;        // Propagation + processing delay
+    double loss;              // Frame loss probability
+    uint32_t bytes_per_s;     // Link bandwidth, 0 = unlimited
+    uint64_t busy_until;      // Last frame on this link finishes arriving
+} sim_link_t;
+
+typedef struct sim_frame {
+    struct sim_frame *next;
+    uint64_t at_us;
+    uint32_t air;             // Its transmission on a shared medium, 0 = none
+    int to;
+    int len;
+    uint8_t data[];
+} sim_frame_t;
+
+typedef struct {
+    winc_ctx_t ctx;
+    mesh_ctx_t mesh;
+    bool up;
+    uint32_t rx_data;         // Application deliveries
+    uint32_t rx_hash;         // Hash of the last delivery
+    uint16_t rx_len;
+    uint32_t rx_bytes;
+    uint32_t alarms;          // prio-bench alarm deliveries and their latency
+    uint64_t alarm_lat_sum_us;
+    uint64_t alarm_lat_max_us;
+    uint32_t bcasts;          // flood-bench broadcast deliveries
+    uint32_t topic_rx;        // pubsub: publications delivered
+    uint32_t kv_changes;      // kv: change callbacks
+    uint64_t tx_busy_until;   // Radio airtime already committed
+    bool ap;                  // BSS mode: running the AP, or starting it
+    int assoc;                // BSS mode: AP node we are associated with, -1 = none
+    uint64_t ap_at_us;        // AP beaconing from then, 0 = already up
+    uint64_t join_at_us;      // Association and DHCP finish then, 0 = idle
+    uint64_t lose_at_us;      // Our AP vanished; the WINC reports it then
+    int64_t clock_offset_us;  // time_us_64() is sim_now_us shifted and scaled
+    double clock_ppm;
+    int64_t sync_owd_us;      // sync: one-way delay measured in mesh time
+    uint64_t sync_rx_at_us;   // and when that message really arrived
+} sim_node_t;
+
+static sim_node_t sim_nodes[SIM_MAX_NODES];
+static sim_link_t sim_links[SIM_MAX_NODES][SIM_MAX_NODES];
+static int sim_node_count;
+static int sim_cur = -1;
+static sim_frame_t *sim_queue;
+static sim_frame_t *sim_rx;
+static int sim_verbose;
+static uint32_t sim_frames_sent;
+static uint32_t sim_type_frames[16];  // Frames and bytes sent, by msg_type
+static uint32_t sim_type_bytes[16];
+static uint64_t sim_rng = 0x243F6A8885A308D3ull;
+
+// Airtime per datagram (HIF command, preamble, ACK, backoff) and per byte.
+// Zero means frames are sent instantly and sendto never fails.
+static uint32_t sim_airtime_frame_us;
+static uint32_t sim_airtime_byte_ns;
+
+// BSS mode models the real radio: one node runs the AP and the others are
+// its stations. Links follow association, so when the AP dies every node
+// drops off the air until someone else takes over.
+#define SIM_AP_START_US  300000   // winc_ap_begin() to the AP beaconing
+#define SIM_JOIN_US      600000   // winc_sta_begin() to associated with an address
+
+static bool sim_bss;
+static uint32_t sim_bss_loss_us;  // AP loss to disconnect event, 0 = never reported
+static int sim_bss_max_aps;       // Most APs seen up at once
+
+// Shared medium: every node hears every transmission, as in one BSS. A node
+// defers while the channel is busy, then backs off a random number of
+// slots (CSMA/CA); two that start within one slot of each other collide
+// and both frames are lost. Needs airtime set.
+#define SIM_AIR_SLOT_US  9
+#define SIM_AIR_DIFS_US  34
+#define SIM_AIR_CW       16        // Backoff slots
+#define SIM_AIR_JITTER_US 200      // Spread of send calls made in the same tick
+#define SIM_AIR_LOG      1024      // Transmissions remembered
+
+typedef struct {
+    uint32_t serial;
+    uint64_t start_us, end_us;
+    bool collided;
+} sim_air_t;
+
+static bool sim_medium;
+static sim_air_t sim_air[SIM_AIR_LOG];
+static uint32_t sim_air_serial;
+static uint32_t sim_air_tx, sim_air_collided;
+static uint64_t sim_air_busy_us;  // Airtime of transmissions that got through,
+                                  // once they leave the log
+
+// Deterministic PRNG so runs are repeatable
+static double sim_random(void) {
+    sim_rng ^= sim_rng << 13;
+    sim_rng ^= sim_rng >> 7;
+    sim_rng ^= sim_rng << 17;
+    return (sim_rng >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int sim_trace(const char *fmt, ...) {
+    va_list ap;
+    int n;
+
+    if (!sim_verbose)
+        return 0;
+    if (fmt[0] != '\n')
+        fprintf(stdout, "%8.3f n%-2d ", sim_now_us / 1e6, sim_cur + 1);
+    va_start(ap, fmt);
+    n = vfprintf(stdout, fmt, ap);
+    va_end(ap);
+    return n;
+}
+
+uint64_t sim_clock_us(void) {
+    sim_node_t *n = &sim_nodes[sim_cur];
+
+    if (sim_cur < 0)
+        return sim_now_us;
+    return sim_now_us + n->clock_offset_us + (int64_t)(sim_now_us * n->clock_ppm * 1e-6);
+}
+
+static void sim_select(int i) {
+    sim_cur = i;
+    sim_ctx = &sim_nodes[i].ctx;
+    sim_mesh = &sim_nodes[i].mesh;
+}
+
+static void sim_link(int a, int b, bool up) {
+    sim_links[a][b].up = sim_links[b][a].up = up;
+    sim_links[a][b].delay_us = sim_links[b][a].delay_us = 1000;
+    sim_links[a][b].loss = sim_links[b][a].loss = 0;
+}
+
+static void sim_enqueue(sim_frame_t *f) {
+    sim_frame_t **pp = &sim_queue;
+
+    while (*pp && (*pp)->at_us <= f->at_us)
+        pp = &(*pp)->next;
+    f->next = *pp;
+    *pp = f;
+}
+
+// First moment from ready_us at which CSMA/CA lets a frame of dur_us start:
+// after any transmission already on the air, plus DIFS and a backoff.
+// Starting within a slot of another counts as not having heard it.
+static uint64_t sim_air_start(uint64_t ready_us, uint64_t dur_us) {
+    uint64_t start = ready_us;
+
+    for (int tries = 0; tries < 64; tries++) {
+        bool busy = false;
+
+        for (int k = 0; k < SIM_AIR_LOG && !busy; k++) {
+            sim_air_t *a = &sim_air[k];
+
+            if (!a->serial || a->end_us <= start || a->start_us >= start + dur_us)
+                continue;
+            if (a->start_us + SIM_AIR_SLOT_US > start && start + SIM_AIR_SLOT_US > a->start_us)
+                continue;   // Simultaneous start: a collision, not a deferral
+            start = a->end_us + SIM_AIR_DIFS_US +
+                    (uint64_t)(sim_random() * SIM_AIR_CW) * SIM_AIR_SLOT_US;
+            busy = true;
+        }
+        if (!busy)
+            break;
+    }
+    return start;
+}
+
+// Put a transmission on the air, marking any it collides with
+static uint32_t sim_air_log(uint64_t start_us, uint64_t dur_us) {
+    sim_air_t *slot = &sim_air[sim_air_serial % SIM_AIR_LOG];
+
+    if (slot->serial && !slot->collided)
+        sim_air_busy_us += slot->end_us - slot->start_us;
+    slot->serial = ++sim_air_serial;
+    slot->start_us = start_us;
+    slot->end_us = start_us + dur_us;
+    slot->collided = false;
+    sim_air_tx++;
+    for (int k = 0; k < SIM_AIR_LOG; k++) {
+        sim_air_t *a = &sim_air[k];
+
+        if (a != slot && a->serial && a->end_us > start_us && a->start_us < slot->end_us) {
+            sim_air_collided += !a->collided + !slot->collided;
+            a->collided = slot->collided = true;
+        }
+    }
+    return slot->serial;
+}
+
+// Airtime of every transmission so far that got through
+static uint64_t sim_air_good_us(void) {
+    uint64_t us = sim_air_busy_us;
+
+    for (int k = 0; k < SIM_AIR_LOG; k++) {
+        if (sim_air[k].serial && !sim_air[k].collided)
+            us += sim_air[k].end_us - sim_air[k].start_us;
+    }
+    return us;
+}
+
+// Whether a frame's transmission got through
+static bool sim_air_ok(sim_frame_t *f) {
+    sim_air_t *a = &sim_air[(f->air - 1) % SIM_AIR_LOG];
+
+    return !f->air || a->serial != f->air || !a->collided;
+}
+
+// Deliver every frame that is due, each into its receiver's context
+static void sim_deliver(void) {
+    while (sim_queue && sim_queue->at_us <= sim_now_us) {
+        sim_frame_t *f = sim_queue;
+        sim_queue = f->next;
+
+        if (sim_nodes[f->to].up && sim_air_ok(f)) {
+            sim_select(f->to);
+            sim_rx = f;
+            int sock = sim_ctx->mesh.udp_socket;
+            if (sock >= 0 && sim_ctx->sockets[sock].handler)
+                sim_ctx->sockets[sock].handler(sock, f->len);
+            sim_rx = NULL;
+        }
+        free(f);
+    }
+}
+
+// ===== WINC_LIB STUBS =====
+
+bool hif_put(uint16_t gop, void *dp1, int dlen1, void *dp2, int dlen2, int oset) {
+    return true;
+}
+
+bool put_sock_sendto(uint8_t sock, void *data, int len) {
+    sim_node_t *me = &sim_nodes[sim_cur];
+    uint64_t tx_end = sim_now_us;
+
+    uint32_t air = 0;
+
+    if (sim_airtime_frame_us) {
+        uint64_t start = me->tx_busy_until > sim_now_us ? me->tx_busy_until : sim_now_us;
+        uint64_t dur = sim_airtime_frame_us + (uint64_t)len * sim_airtime_byte_ns / 1000;
+        if (start - sim_now_us > SIM_TX_BACKLOG_US)
+            return false;
+        if (sim_medium) {
+            start = sim_air_start(start + (uint64_t)(sim_random() * SIM_AIR_JITTER_US), dur);
+            air = sim_air_log(start, dur);
+        }
+        tx_end = start + dur;
+        me->tx_busy_until = tx_end;
+    }
+    sim_frames_sent++;
+    sim_type_frames[((uint8_t*)data)[0] & 15]++;
+    sim_type_bytes[((uint8_t*)data)[0] & 15] += len;
+
+    for (int j = 0; j < sim_node_count; j++) {
+        sim_link_t *l = &sim_links[sim_cur][j];
+        uint64_t at = tx_end;
+
+        if (j == sim_cur || !l->up)
+            continue;
+        if (l->loss > 0 && sim_random() < l->loss)
+            continue;
+
+        // A slow link serialises its frames one after another
+        if (l->bytes_per_s) {
+            if (l->busy_until > at)
+                at = l->busy_until;
+            at += (uint64_t)len * 1000000 / l->bytes_per_s;
+            l->busy_until = at;
+        }
+
+        sim_frame_t *f = malloc(sizeof(*f) + len);
+        f->at_us = at + l->delay_us;
+        f->air = air;
+        f->to = j;
+        f->len = len;
+        memcpy(f->data, data, len);
+        sim_enqueue(f);
+    }
+    return true;
+}
+
+bool get_sock_data(uint8_t sock, void *data, int len) {
+    if (!sim_rx || len > sim_rx->len)
+        return false;
+    memcpy(data, sim_rx->data, len);
+    return true;
+}
+
+int open_sock_server(int portnum, bool tcp, void (*handler)(uint8_t, int)) {
+    SOCKET *sp = &sim_ctx->sockets[MIN_UDP_SOCK];
+
+    memset(sp, 0, sizeof(*sp));
+    sp->localport = portnum;
+    sp->handler = handler;
+    sp->state = STATE_BOUND;
+    return MIN_UDP_SOCK;
+}
+
+// Outside BSS mode every node is on the air as soon as it asks
+bool winc_ap_begin(const char *ssid, const char *password, uint8_t channel) {
+    sim_node_t *me = &sim_nodes[sim_cur];
+
+    me->ap = true;
+    me->assoc = -1;
+    me->join_at_us = me->lose_at_us = 0;
+    me->ap_at_us = sim_bss ? sim_now_us + SIM_AP_START_US : 0;
+    sim_ctx->connection_state.connected = !sim_bss;
+    sim_ctx->connection_state.dhcp_done = !sim_bss;
+    sim_ctx->connection_state.ap_mode = true;
+    return true;
+}
+
+bool winc_sta_begin(const char *ssid, const char *password, uint8_t channel) {
+    sim_node_t *me = &sim_nodes[sim_cur];
+
+    me->ap = false;
+    me->assoc = -1;
+    me->ap_at_us = me->lose_at_us = 0;
+    me->join_at_us = sim_bss ? sim_now_us + SIM_JOIN_US : 0;
+    sim_ctx->connection_state.connected = !sim_bss;
+    sim_ctx->connection_state.dhcp_done = !sim_bss;
+    sim_ctx->connection_state.ap_mode = false;
+    return true;
+}
+
+void winc_poll(void) {
+}
+
+// The simulator raises ap_mode as soon as the AP is asked for, the WINC only
+// once it is up together with the other two, so readiness leaves it out
+bool winc_is_network_ready(void) {
+    return sim_ctx->connection_state.connected && sim_ctx->connection_state.dhcp_done;
+}
+
+bool winc_is_connected(void) {
+    return sim_ctx->connection_state.connected;
+}
+
+// ===== SIMULATION =====
+
+static uint32_t sim_hash(const uint8_t *data, int len) {
+    uint32_t h = 2166136261u;
+
+    while (len--)
+        h = (h ^ *data++) * 16777619u;
+    return h;
+}
+
+// Scenario traffic: count messages of size bytes from src to dst, one every
+// interval_us. Each starts with a sim_probe_t so the receiver can time it.
+typedef struct {
+    int src, dst;
+    uint32_t left;
+    uint32_t interval_us;
+    uint64_t next_us;
+    uint16_t size;
+    uint8_t flags;
+} sim_flow_t;
+
+typedef struct {
+    uint8_t magic;            // 'T'
+    uint8_t hops;             // Route length when sent
+    uint64_t sent_us;
+} __attribute__((packed)) sim_probe_t;
+
+typedef struct {
+    uint32_t offered;         // Sends attempted
+    uint32_t accepted;        // Sends the mesh took
+    uint32_t delivered;
+    uint64_t lat_sum_us;
+    uint64_t lat_max_us;
+    uint64_t hop_lat_sum_us;  // Latency divided by route length
+    uint32_t out_of_order;    // Delivered after a later message from its source
+    uint64_t last_sent_us[SIM_MAX_NODES];  // Newest delivered, by source
+} sim_traffic_t;
+
+#define SIM_MAX_FLOWS 32
+#define SIM_LAT_LOG   65536
+
+static sim_flow_t sim_flows[SIM_MAX_FLOWS];
+static int sim_flow_count;
+static sim_traffic_t sim_traffic;
+static uint32_t sim_lat_log[SIM_LAT_LOG];  // Flow latencies, for percentiles
+
+static int sim_next_hop(int i, int j);
+
+// Hops node i's routes take to node j right now, 0 if there is no path
+static int sim_path_len(int i, int j) {
+    int hops = 0;
+
+    while (i != j && i >= 0 && hops < SIM_MAX_NODES) {
+        i = sim_next_hop(i, j);
+        hops++;
+    }
+    return i == j ? hops : 0;
+}
+
+static void sim_flows_process(void) {
+    static uint8_t msg[WINC_MESH_MAX_MESSAGE];
+
+    for (int k = 0; k < sim_flow_count; k++) {
+        sim_flow_t *f = &sim_flows[k];
+        sim_probe_t probe = {'T', 0, sim_now_us};
+
+        if (!f->left || sim_now_us < f->next_us || !sim_nodes[f->src].up)
+            continue;
+
+        probe.hops = sim_path_len(f->src, f->dst);
+        memset(msg, 0x54, f->size);
+        memcpy(msg, &probe, sizeof(probe));
+        sim_select(f->src);
+        sim_traffic.offered++;
+        sim_traffic.accepted += winc_mesh_send_ex(f->dst + 1, msg, f->size, f->flags);
+        f->left--;
+        f->next_us += f->interval_us;
+    }
+}
+
+static void sim_data_received(uint8_t src_node, uint8_t *data, uint16_t len) {
+    sim_nodes[sim_cur].rx_data++;
+    sim_nodes[sim_cur].rx_hash = sim_hash(data, len);
+    sim_nodes[sim_cur].rx_len = len;
+    sim_nodes[sim_cur].rx_bytes += len;
+
+    if (sim_flow_count && len >= sizeof(sim_probe_t) && data[0] == 'T') {
+        sim_probe_t probe;
+        uint64_t lat;
+
+        memcpy(&probe, data, sizeof(probe));
+        lat = sim_now_us - probe.sent_us;
+        if (sim_traffic.delivered < SIM_LAT_LOG)
+            sim_lat_log[sim_traffic.delivered] = lat;
+        sim_traffic.delivered++;
+        sim_traffic.lat_sum_us += lat;
+        if (lat > sim_traffic.lat_max_us)
+            sim_traffic.lat_max_us = lat;
+        sim_traffic.hop_lat_sum_us += lat / (probe.hops ? probe.hops : 1);
+        if (probe.sent_us < sim_traffic.last_sent_us[src_node - 1])
+            sim_traffic.out_of_order++;
+        else
+            sim_traffic.last_sent_us[src_node - 1] = probe.sent_us;
+    }
+
+    // sync: 'S' then the sender's mesh time
+    if (len == 1 + sizeof(uint64_t) && data[0] == 'S') {
+        uint64_t sent;
+
+        memcpy(&sent, data + 1, sizeof(sent));
+        sim_nodes[sim_cur].sync_owd_us = (int64_t)(winc_mesh_time_us(NULL) - sent);
+        sim_nodes[sim_cur].sync_rx_at_us = sim_now_us;
+    }
+
+    if (len >= 1 && data[0] == 'B')
+        sim_nodes[sim_cur].bcasts++;
+
+    // prio-bench alarms: 'A' then the send time
+    if (len == 1 + sizeof(uint64_t) && data[0] == 'A') {
+        sim_node_t *n = &sim_nodes[sim_cur];
+        uint64_t sent_us, lat;
+
+        memcpy(&sent_us, data + 1, sizeof(sent_us));
+        lat = sim_now_us - sent_us;
+        n->alarms++;
+        n->alarm_lat_sum_us += lat;
+        if (lat > n->alarm_lat_max_us)
+            n->alarm_lat_max_us = lat;
+    }
+}
+
+static int sim_cmp_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// Latency percentile of the flows' deliveries so far, in microseconds
+static uint32_t sim_lat_pct(double pct) {
+    uint32_t n = MIN(sim_traffic.delivered, SIM_LAT_LOG);
+
+    if (!n)
+        return 0;
+    qsort(sim_lat_log, n, sizeof(sim_lat_log[0]), sim_cmp_u32);
+    return sim_lat_log[(uint32_t)((n - 1) * pct / 100)];
+}
+
+static void sim_reset(int n) {
+    while (sim_queue) {
+        sim_frame_t *f = sim_queue;
+        sim_queue = f->next;
+        free(f);
+    }
+    memset(sim_nodes, 0, sizeof(sim_nodes));
+    memset(sim_links, 0, sizeof(sim_links));
+    sim_node_count = n;
+    sim_frames_sent = 0;
+    memset(sim_type_frames, 0, sizeof(sim_type_frames));
+    memset(sim_type_bytes, 0, sizeof(sim_type_bytes));
+    sim_flow_count = 0;
+    memset(&sim_traffic, 0, sizeof(sim_traffic));
+    sim_airtime_frame_us = 0;
+    sim_airtime_byte_ns = 0;
+    sim_bss = false;
+    sim_bss_loss_us = 0;
+    sim_bss_max_aps = 0;
+    sim_medium = false;
+    memset(sim_air, 0, sizeof(sim_air));
+    sim_air_serial = sim_air_tx = sim_air_collided = 0;
+    sim_air_busy_us = 0;
+}
+
+static void sim_start(void) {
+    char name[16];
+
+    for (int i = 0; i < sim_node_count; i++) {
+        sim_select(i);
+        snprintf(name, sizeof(name), "Sim%d", i + 1);
+        winc_mesh_init(i + 1, name);
+        winc_mesh_set_callback(sim_data_received);
+        sim_nodes[i].up = true;
+    }
+}
+
+void winc_mesh_set_callback(void (*callback)(uint8_t src_node, uint8_t *data, uint16_t len)) {
+    sim_ctx->mesh.data_callback = callback;
+}
+
+// An AP that is up and beaconing
+static bool sim_bss_ap_up(int i) {
+    return i >= 0 && sim_nodes[i].up && sim_nodes[i].ap && !sim_nodes[i].ap_at_us;
+}
+
+static bool sim_bss_on_air(int i) {
+    return sim_nodes[i].up && (sim_bss_ap_up(i) || sim_bss_ap_up(sim_nodes[i].assoc));
+}
+
+// Finish AP starts and joins that are due, report lost APs, and rebuild the
+// links from who is on the air
+static void sim_bss_process(void) {
+    int aps = 0;
+
+    for (int i = 0; i < sim_node_count; i++) {
+        sim_node_t *n = &sim_nodes[i];
+        winc_ctx_t *c = &n->ctx;
+
+        if (!n->up)
+            continue;
+        if (n->ap && n->ap_at_us && sim_now_us >= n->ap_at_us) {
+            n->ap_at_us = 0;
+            c->connection_state.connected = c->connection_state.dhcp_done = true;
+        }
+        if (n->join_at_us && sim_now_us >= n->join_at_us) {
+            n->join_at_us = 0;
+            for (int a = 0; a < sim_node_count; a++) {
+                if (sim_bss_ap_up(a)) {
+                    n->assoc = a;
+                    c->connection_state.connected = c->connection_state.dhcp_done = true;
+                    break;
+                }
+            }
+        }
+        if (n->assoc >= 0 && !sim_bss_ap_up(n->assoc) && sim_bss_loss_us) {
+            if (!n->lose_at_us) {
+                n->lose_at_us = sim_now_us + sim_bss_loss_us;
+            } else if (sim_now_us >= n->lose_at_us) {
+                n->assoc = -1;
+                n->lose_at_us = 0;
+                c->connection_state.connected = c->connection_state.dhcp_done = false;
+            }
+        }
+        aps += sim_bss_ap_up(i);
+    }
+    if (aps > sim_bss_max_aps)
+        sim_bss_max_aps = aps;
+
+    for (int i = 0; i < sim_node_count; i++) {
+        for (int j = i + 1; j < sim_node_count; j++) {
+            bool up = sim_bss_on_air(i) && sim_bss_on_air(j);
+            if (up != sim_links[i][j].up)
+                sim_link(i, j, up);
+        }
+    }
+}
+
+// One virtual millisecond: deliver due frames, then poll every live node
+static void sim_tick(void) {
+    if (sim_bss)
+        sim_bss_process();
+    sim_flows_process();
+    sim_deliver();
+    for (int i = 0; i < sim_node_count; i++) {
+        if (sim_nodes[i].up) {
+            sim_select(i);
+            winc_mesh_process();
+        }
+    }
+    sim_now_us += SIM_TICK_US;
+}
+
+// Route metric from node i to node j, or WINC_MESH_METRIC_INFINITY
+static int sim_metric(int i, int j) {
+    winc_ctx_t *c = &sim_nodes[i].ctx;
+
+    for (int k = 0; k < c->mesh.route_count; k++) {
+        if (c->mesh.routes[k].active && c->mesh.routes[k].node_id == j + 1)
+            return c->mesh.routes[k].hop_count;
+    }
+    return WINC_MESH_METRIC_INFINITY;
+}
+
+// Next hop node i uses towards node j, or -1
+static int sim_next_hop(int i, int j) {
+    winc_ctx_t *c = &sim_nodes[i].ctx;
+
+    for (int k = 0; k < c->mesh.route_count; k++) {
+        if (c->mesh.routes[k].active && c->mesh.routes[k].node_id == j + 1)
+            return c->mesh.routes[k].next_hop - 1;
+    }
+    return -1;
+}
+
+// Line topology: converged once every node knows every other at |i - j| hops
+static bool sim_line_converged(void) {
+    for (int i = 0; i < sim_node_count; i++) {
+        for (int j = 0; j < sim_node_count; j++) {
+            if (i != j && sim_metric(i, j) != abs(i - j))
+                return false;
+        }
+    }
+    return true;
+}
+
+static bool sim_run_until(uint32_t timeout_ms, bool (*done)(void), uint32_t *elapsed_ms) {
+    uint64_t start = sim_now_us;
+
+    while (sim_now_us - start < (uint64_t)timeout_ms * 1000) {
+        sim_tick();
+        if (done && done()) {
+            if (elapsed_ms)
+                *elapsed_ms = (sim_now_us - start) / 1000;
+            return true;
+        }
+    }
+    if (elapsed_ms)
+        *elapsed_ms = timeout_ms;
+    return !done;
+}
+
+static bool sim_line(int n, uint32_t *conv_ms, uint32_t *frames) {
+    sim_reset(n);
+    for (int i = 0; i + 1 < n; i++)
+        sim_link(i, i + 1, true);
+    sim_start();
+
+    if (!sim_run_until(120000, sim_line_converged, conv_ms))
+        return false;
+    if (frames)
+        *frames = sim_frames_sent;
+    return true;
+}
+
+static int cmd_line(int n) {
+    uint32_t conv_ms = 0;
+    char msg[] = "end to end";
+
+    if (n < 2 || n > SIM_MAX_NODES || n - 1 > WINC_MESH_MAX_HOPS) {
+        fprintf(stderr, "line length must be 2..%d\n", SIM_MAX_NODES);
+        return 2;
+    }
+
+    if (!sim_line(n, &conv_ms, NULL)) {
+        printf("line %d: NOT converged after 120 s\n", n);
+        return 1;
+    }
+    printf("line %d: converged in %u ms\n", n, conv_ms);
+
+    sim_select(0);
+    if (!winc_mesh_send(n, (uint8_t*)msg, sizeof(msg))) {
+        printf("line %d: send from node 1 failed\n", n);
+        return 1;
+    }
+    sim_run_until(1000, NULL, NULL);
+    printf("line %d: node %d received %u frame(s)\n", n, n, sim_nodes[n - 1].rx_data);
+
+    // Each relay credits the frame to the node before it and forwards it
+    for (int i = 1; i + 1 < n; i++) {
+        winc_mesh_neighbor_stats_t ns[SIM_MAX_NODES];
+        int count, fwd = -1;
+
+        sim_select(i);
+        count = winc_mesh_get_neighbor_stats(ns, SIM_MAX_NODES);
+        for (int k = 0; k < count; k++) {
+            if (ns[k].node_id == i)
+                fwd = ns[k].forwarded;
+        }
+        if (fwd != 1) {
+            printf("line %d: node %d forwarded %d frame(s) from node %d\n", n, i + 1, fwd, i);
+            return 1;
+        }
+    }
+    return sim_nodes[n - 1].rx_data == 1 ? 0 : 1;
+}
+
+// After a cut at cut_at, nothing should still reach across it
+static int sim_cut_at;
+
+static bool sim_cut_converged(void) {
+    for (int i = 0; i < sim_node_count; i++) {
+        for (int j = 0; j < sim_node_count; j++) {
+            bool across = (i <= sim_cut_at) != (j <= sim_cut_at);
+            int m = sim_metric(i, j);
+            if (i != j && (across ? m != WINC_MESH_METRIC_INFINITY : m != abs(i - j)))
+                return false;
+        }
+    }
+    return true;
+}
+
+static int cmd_line_cut(int n) {
+    uint32_t conv_ms = 0;
+
+    if (n < 3 || n > SIM_MAX_NODES || n - 1 > WINC_MESH_MAX_HOPS) {
+        fprintf(stderr, "line length must be 3..%d\n", SIM_MAX_NODES);
+        return 2;
+    }
+    if (!sim_line(n, &conv_ms, NULL)) {
+        printf("line-cut %d: NOT converged before cut\n", n);
+        return 1;
+    }
+
+    sim_cut_at = (n - 1) / 2;
+    sim_link(sim_cut_at, sim_cut_at + 1, false);
+
+    if (!sim_run_until(120000, sim_cut_converged, &conv_ms)) {
+        printf("line-cut %d: stale routes remain after 120 s\n", n);
+        return 1;
+    }
+    printf("line-cut %d: routes across the cut withdrawn in %u ms\n", n, conv_ms);
+    return 0;
+}
+
+// Ping the far end of a line: every reply must come back, and the traced
+// path must be the line itself
+static int cmd_ping(int n) {
+    static const uint16_t sizes[] = {0, 256, WINC_MESH_MTU};
+    winc_mesh_ping_result_t r;
+    int failed = 0;
+
+    if (n < 2 || n > SIM_MAX_NODES || n - 1 > WINC_MESH_MAX_HOPS) {
+        fprintf(stderr, "line length must be 2..%d\n", SIM_MAX_NODES);
+        return 2;
+    }
+    if (!sim_line(n, NULL, NULL)) {
+        printf("ping: line did not converge\n");
+        return 1;
+    }
+
+    printf(" size  sent  recv  min_us  avg_us  max_us  jitter_us  path\n");
+    for (int k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++) {
+        sim_select(0);
+        if (!winc_mesh_ping_start(n, 10, sizes[k])) {
+            printf("ping: start failed\n");
+            return 1;
+        }
+        for (int t = 0; t < 5000; t++) {
+            sim_select(0);
+            if (winc_mesh_ping_result(&r))
+                break;
+            sim_tick();
+        }
+
+        printf("%5u  %4u  %4u  %6u  %6u  %6u  %9u  1", sizes[k], r.sent, r.received,
+               r.min_us, r.avg_us, r.max_us, r.jitter_us);
+        for (int h = 0; h < r.hops; h++)
+            printf("-%u", r.path[h]);
+        printf("\n");
+
+        if (!r.done || r.received != 10 || r.hops != n - 1)
+            failed = 1;
+        for (int h = 0; h < r.hops; h++) {
+            if (r.path[h] != h + 2)
+                failed = 1;
+        }
+    }
+    return failed;
+}
+
+static void sim_restart(int i);
+static bool sim_graph_converged(void);
+static void sim_reachable(int i, bool *seen);
+
+// Diamond 1-2-4 / 1-3-4. Node 1 learns its route to 4, then pins the
+// other branch and sends to 4 while the learned branch's first link is
+// cut and restored. The routed flow is hit by the cut; the pinned flow
+// must not notice it, and the learned branch must carry none of it.
+static int cmd_pin(void) {
+    static const char *names[] = {"routed", "pinned"};
+    uint8_t path[WINC_MESH_MAX_PATH], other[2];
+    int count, learned = -1, failed = 0;
+
+    printf("flow    sent  delivered  p50_ms  p99_ms  max_ms  via_learned\n");
+    for (int mode = 0; mode < 2; mode++) {
+        winc_mesh_neighbor_stats_t ns[4];
+        uint32_t via0 = 0, via1 = 0;
+        int k;
+
+        sim_reset(4);
+        sim_link(0, 1, true);
+        sim_link(1, 3, true);
+        sim_link(0, 2, true);
+        sim_link(2, 3, true);
+        sim_start();
+        if (!sim_run_until(60000, sim_graph_converged, NULL)) {
+            printf("pin: diamond did not converge\n");
+            return 1;
+        }
+        sim_run_until(20000, NULL, NULL);   // Link estimates settle
+
+        sim_select(0);
+        if (!winc_mesh_learn_path(4))
+            return 1;
+        sim_run_until(500, NULL, NULL);
+        sim_select(0);
+        count = winc_mesh_get_path(4, path, sizeof(path));
+        if (count != 2 || path[1] != 4 || path[0] != sim_next_hop(0, 3) + 1) {
+            printf("pin: learned path of %d hops, expected %d-4\n", count, sim_next_hop(0, 3) + 1);
+            return 1;
+        }
+        learned = path[0];
+        other[0] = learned == 2 ? 3 : 2;
+        other[1] = 4;
+        if (mode)
+            winc_mesh_set_path(4, other, 2);
+
+        sim_select(learned - 1);
+        k = winc_mesh_get_neighbor_stats(ns, 4);
+        for (int i = 0; i < k; i++)
+            via0 += ns[i].node_id == 1 ? ns[i].forwarded : 0;
+
+        sim_flows[0] = (sim_flow_t){0, 3, 800, 50000, sim_now_us, 64, mode ? WINC_MESH_PINNED : 0};
+        sim_flow_count = 1;
+        sim_run_until(2000, NULL, NULL);
+        sim_link(0, learned - 1, false);
+        sim_run_until(18000, NULL, NULL);
+        sim_link(0, learned - 1, true);
+        sim_run_until(21000, NULL, NULL);
+
+        sim_select(learned - 1);
+        k = winc_mesh_get_neighbor_stats(ns, 4);
+        for (int i = 0; i < k; i++)
+            via1 += ns[i].node_id == 1 ? ns[i].forwarded : 0;
+
+        printf("%-6s  %4u  %8.1f%%  %6.1f  %6.1f  %6.1f  %11u\n", names[mode], sim_traffic.offered,
+               100.0 * sim_traffic.delivered / sim_traffic.offered, sim_lat_pct(50) / 1000.0,
+               sim_lat_pct(99) / 1000.0, sim_traffic.lat_max_us / 1000.0, via1 - via0);
+        // Pinned: everything, on the pinned branch, at the same latency
+        if (mode && (sim_traffic.delivered != sim_traffic.offered || via1 != via0 ||
+                     sim_traffic.lat_max_us > sim_lat_pct(50) + 1000))
+            failed = 1;
+    }
+    return failed;
+}
+
+// Reliable and best-effort flows along a lossy 4-node line. Retransmitted
+// frames arrive after frames sent later unless WINC_MESH_ORDERED puts them
+// back in order; best effort then loses frames but must never reorder them.
+static int cmd_order(double loss) {
+    static const char *names[] = {"reliable", "reliable+ordered", "ordered"};
+    static const uint8_t flags[] = {WINC_MESH_RELIABLE, WINC_MESH_RELIABLE | WINC_MESH_ORDERED,
+                                    WINC_MESH_ORDERED};
+    uint32_t out_of_order[3] = {0}, delivered[3] = {0};
+
+    printf("mode              delivered  out_of_order  reordered  depth  gaps  late  p99_ms\n");
+    for (int mode = 0; mode < 3; mode++) {
+        winc_mesh_order_stats_t os;
+
+        if (!sim_line(4, NULL, NULL)) {
+            printf("order: line did not converge\n");
+            return 1;
+        }
+        for (int i = 0; i + 1 < 4; i++)
+            sim_links[i][i + 1].loss = sim_links[i + 1][i].loss = loss;
+        sim_flows[0] = (sim_flow_t){3, 0, 1000, 5000, sim_now_us, 64, flags[mode]};
+        sim_flow_count = 1;
+        sim_run_until(8000, NULL, NULL);
+
+        sim_select(0);
+        winc_mesh_get_order_stats(&os);
+        out_of_order[mode] = sim_traffic.out_of_order;
+        delivered[mode] = sim_traffic.delivered;
+        printf("%-16s  %8.1f%%  %12u  %9lu  %5u  %4lu  %4lu  %6.1f\n", names[mode],
+               100.0 * sim_traffic.delivered / sim_traffic.offered, sim_traffic.out_of_order,
+               (unsigned long)os.reordered, os.max_depth, (unsigned long)os.gaps,
+               (unsigned long)os.late, sim_lat_pct(99) / 1000.0);
+    }
+
+    // A source we have no history for, whose seq_nums also go elsewhere:
+    // the frame its first one names goes up on arrival, whatever it names
+    {
+        winc_mesh_hdr_t hdr = {.msg_type = MESH_MSG_DATA, .src_node = 9, .dst_node = 2,
+                               .flags = WINC_MESH_ORDERED};
+        uint8_t frame[sizeof(winc_mesh_order_t) + 4] = {0};
+        winc_mesh_order_stats_t before, after;
+
+        sim_select(1);
+        winc_mesh_get_order_stats(&before);
+        hdr.seq_num = 12;
+        frame[0] = 10;          // prev_seq, little endian
+        mesh_order_input(&hdr, frame, sizeof(frame));
+        hdr.seq_num = 10;
+        frame[0] = 5;
+        mesh_order_input(&hdr, frame, sizeof(frame));
+        winc_mesh_get_order_stats(&after);
+        if (after.delivered - before.delivered != 2 || after.gaps != before.gaps) {
+            printf("order: frame named by a new source held back\n");
+            return 1;
+        }
+    }
+
+    // The lossy line must reorder, ordering must undo it at no loss
+    return !out_of_order[0] || out_of_order[1] || out_of_order[2] ||
+           delivered[1] < delivered[0] * 99 / 100;
+}
+
+#if WINC_MESH_STREAMS
+// Stream bench payload: a byte that depends on its offset
+static uint8_t sim_stream_byte(uint32_t off) {
+    return (uint8_t)(off * 31 + (off >> 9));
+}
+
+// Move 64 KB from the far end of a lossy line to node 1 over 1, 2 and 3
+// hops: as datagrams sent as fast as the mesh takes them, the same with
+// WINC_MESH_RELIABLE, and over a stream with and without it. Goodput counts
+// the bytes that arrived (intact and in order, for streams) over the time
+// to the last of them.
+static int cmd_stream(double loss) {
+    static const char *names[] = {"datagram", "reliable", "stream", "stream+reliable"};
+    static uint8_t buf[WINC_MESH_STREAM_MSS];
+    const uint32_t total = 65536;
+    int failed = 0;
+
+    printf("stream loss %.2f per link, %lu bytes to node 1\n", loss, (unsigned long)total);
+    printf("hops  mode             delivered_%%  time_ms  goodput_KBps  hop_rtx  e2e_rtx  timeouts  srtt_ms\n");
+    for (int hops = 1; hops <= 3; hops++) {
+        for (int mode = 0; mode < 4; mode++) {
+            int src = hops, sd = -1, rd = -1, n = 0, leaked = 0;
+            uint32_t sent = 0, got = 0, bad = 0, last_ms = 0, hop_rtx = 0;
+            uint64_t start_us;
+            bool done = false;
+            mesh_stream_t *ss;
+
+            if (!sim_line(hops + 1, NULL, NULL)) {
+                printf("stream: line did not converge\n");
+                return 1;
+            }
+            sim_airtime_frame_us = 300;
+            sim_airtime_byte_ns = 1000;
+            sim_medium = true;
+            for (int i = 0; i < hops; i++)
+                sim_links[i][i + 1].loss = sim_links[i + 1][i].loss = loss;
+
+            if (mode >= 2) {
+                sim_select(0);
+                winc_mesh_stream_listen(7);
+                sim_select(src);
+                sd = winc_mesh_stream_connect(1, 7, mode == 3 ? WINC_MESH_RELIABLE : 0);
+            }
+
+            start_us = sim_now_us;
+            while (!done && sim_now_us - start_us < 60000000ull) {
+                uint32_t now_ms = (sim_now_us - start_us) / 1000;
+
+                sim_select(src);
+                if (mode < 2) {
+                    memset(buf, 'D', sizeof(buf));
+                    while (sent < total &&
+                           winc_mesh_send_ex(1, buf, sizeof(buf), mode ? WINC_MESH_RELIABLE : 0))
+                        sent += sizeof(buf);
+                } else if (sd >= 0 && sent < total) {
+                    int w;
+
+                    do {
+                        n = MIN(sizeof(buf), total - sent);
+                        for (int i = 0; i < n; i++)
+                            buf[i] = sim_stream_byte(sent + i);
+                        w = winc_mesh_stream_write(sd, buf, n);
+                        sent += MAX(w, 0);
+                    } while (w > 0 && sent < total);
+                    if (sent == total)
+                        winc_mesh_stream_close(sd);
+                }
+                sim_tick();
+
+                sim_select(0);
+                if (mode < 2) {
+                    if (sim_nodes[0].rx_bytes != got) {
+                        got = sim_nodes[0].rx_bytes;
+                        last_ms = now_ms;
+                    }
+                    // Whatever is still on its way after 2 s is lost
+                    done = sent == total && now_ms - last_ms > 2000;
+                    continue;
+                }
+                if (rd < 0)
+                    rd = winc_mesh_stream_accept(7);
+                while (rd >= 0 && (n = winc_mesh_stream_read(rd, buf, sizeof(buf))) > 0) {
+                    for (int i = 0; i < n; i++)
+                        bad += buf[i] != sim_stream_byte(got + i);
+                    got += n;
+                    last_ms = now_ms;
+                }
+                if (rd >= 0 && n < 0) {
+                    winc_mesh_stream_close(rd);
+                    done = true;
+                }
+            }
+
+            // Both ends let go once the closing handshake is over
+            sim_run_until(3000, NULL, NULL);
+            for (int i = 0; i <= hops; i++) {
+                winc_mesh_tx_stats_t ts;
+
+                sim_select(i);
+                winc_mesh_get_tx_stats(&ts);
+                hop_rtx += ts.retransmits;
+                for (int k = 0; k < WINC_MESH_STREAMS; k++)
+                    leaked += sim_nodes[i].mesh.stream.socks[k].state != 0;
+            }
+
+            ss = sd >= 0 ? &sim_nodes[src].mesh.stream.socks[sd] : NULL;
+            printf("%4d  %-15s  %11.1f  %7u  %12.1f  %7u  %7lu  %8lu  %7.1f\n", hops, names[mode],
+                   100.0 * got / total, last_ms, last_ms ? got / 1.024 / last_ms : 0.0, hop_rtx,
+                   ss ? (unsigned long)ss->stats.retransmits : 0UL,
+                   ss ? (unsigned long)ss->stats.timeouts : 0UL, ss ? ss->srtt_us / 1000.0 : 0.0);
+
+            // A stream delivers everything, intact, and cleans up after itself
+            if (mode >= 2 && (got != total || bad || !done || leaked)) {
+                printf("stream: %u of %u bytes, %u bad, %s, %d streams left open\n", got, total,
+                       bad, done ? "closed" : "not closed", leaked);
+                failed = 1;
+            }
+        }
+    }
+    return failed;
+}
+#else
+static int cmd_stream(double loss) {
+    fprintf(stderr, "stream: built with WINC_MESH_STREAMS=0\n");
+    return 2;
+}
+#endif
+
+// BSS settled: every live node has its mesh up as client or owner, under a
+// single AP
+static bool sim_bss_settled(void) {
+    int owners = 0;
+
+    for (int i = 0; i < sim_node_count; i++) {
+        uint8_t role = sim_nodes[i].mesh.role.state;
+
+        if (!sim_nodes[i].up)
+            continue;
+        if (!sim_bss_on_air(i) || !sim_nodes[i].ctx.mesh.enabled ||
+            (role != WINC_MESH_ROLE_CLIENT && role != WINC_MESH_ROLE_OWNER))
+            return false;
+        owners += role == WINC_MESH_ROLE_OWNER;
+    }
+    return owners == 1;
+}
+
+static int sim_bss_owner(void) {
+    for (int i = 0; i < sim_node_count; i++) {
+        if (sim_nodes[i].up && sim_nodes[i].mesh.role.state == WINC_MESH_ROLE_OWNER)
+            return i;
+    }
+    return -1;
+}
+
+// Five nodes in one BSS: kill the group owner, time the outage until the
+// survivors are back on a new owner's AP, then bring the old owner back
+static int cmd_failover(int detect_ms) {
+    const int n = 5;
+    char msg[] = "after failover";
+    winc_mesh_role_stats_t rs;
+    uint32_t t_ms = 0;
+    int owner, failed = 0;
+
+    sim_reset(n);
+    sim_bss = true;
+    sim_bss_loss_us = detect_ms * 1000;
+    sim_start();
+
+    if (!sim_run_until(60000, sim_bss_settled, &t_ms)) {
+        printf("failover: BSS did not form\n");
+        return 1;
+    }
+    owner = sim_bss_owner();
+    printf("failover: BSS formed in %u ms, group owner node %d\n", t_ms, owner + 1);
+    if (owner != 0)
+        failed = 1;
+    sim_run_until(10000, sim_graph_converged, NULL);
+
+    sim_nodes[owner].up = false;
+    if (!sim_run_until(60000, sim_bss_settled, &t_ms)) {
+        printf("failover: no new group owner after 60 s\n");
+        return 1;
+    }
+    owner = sim_bss_owner();
+    printf("failover: node 1 down, back on the air in %u ms under node %d\n", t_ms, owner + 1);
+    if (owner != 1)
+        failed = 1;
+
+    // Clients learn the new owner from its first beacon
+    sim_run_until(5000, NULL, NULL);
+    printf(" node  role         detect_ms  outage_ms\n");
+    for (int i = 1; i < n; i++) {
+        sim_select(i);
+        winc_mesh_get_role_stats(&rs);
+        printf("%5d  %-11s  %9u  %9u\n", i + 1, mesh_role_name(rs.role),
+               rs.last_detect_ms, rs.last_outage_ms);
+        if (rs.go_node != owner + 1 || rs.elections != 1)
+            failed = 1;
+    }
+
+    sim_select(2);
+    winc_mesh_send(n, (uint8_t*)msg, sizeof(msg));
+    sim_run_until(1000, NULL, NULL);
+    if (sim_nodes[n - 1].rx_data != 1) {
+        printf("failover: node 3 -> node %d not delivered\n", n);
+        failed = 1;
+    }
+
+    // The old owner must rejoin as a client, not take the AP back
+    sim_restart(0);
+    if (!sim_run_until(60000, sim_bss_settled, &t_ms) || sim_bss_owner() != owner) {
+        printf("failover: node 1 did not rejoin as a client\n");
+        failed = 1;
+    } else {
+        printf("failover: node 1 rejoined as a client in %u ms\n", t_ms);
+    }
+
+    if (sim_bss_max_aps > 1) {
+        printf("failover: %d APs were up at once\n", sim_bss_max_aps);
+        failed = 1;
+    }
+
+    // Two owners within earshot of each other (outside BSS mode, where the
+    // radio would keep them apart): the higher id hands over
+    sim_reset(3);
+    sim_link(0, 1, true);
+    sim_link(1, 2, true);
+    sim_link(0, 2, true);
+    sim_start();
+    sim_run_until(5000, NULL, NULL);
+    for (int i = 0; i < 3; i += 2) {
+        sim_select(i);
+        mesh_role_start_ap(MESH_NOW_MS());
+    }
+    sim_run_until(10000, NULL, NULL);
+    sim_select(2);
+    winc_mesh_get_role_stats(&rs);
+    printf("failover: second owner is a %s under node %u after %u handover(s)\n",
+           mesh_role_name(rs.role), rs.go_node, rs.handovers);
+    if (sim_bss_owner() != 0 || rs.role != WINC_MESH_ROLE_CLIENT || rs.go_node != 1 ||
+        rs.handovers != 1)
+        failed = 1;
+    return failed;
+}
+
+// Line of n nodes whose clocks start seconds apart and drift up to
+// +-50 ppm. Every node's mesh time is compared with node 1's (the root) at
+// the same instant for a minute, after two minutes to settle.
+static int cmd_sync(int n) {
+    int64_t max_err[SIM_MAX_NODES] = {0};
+    uint32_t bound[SIM_MAX_NODES] = {0}, over[SIM_MAX_NODES] = {0};
+    uint8_t msg[1 + sizeof(uint64_t)] = {'S'};
+    winc_mesh_sync_stats_t ss;
+    uint64_t t, sent_us;
+    int failed = 0;
+
+    if (n < 2 || n > SIM_MAX_NODES || n - 1 > WINC_MESH_MAX_HOPS) {
+        fprintf(stderr, "line length must be 2..%d\n", SIM_MAX_NODES);
+        return 2;
+    }
+    sim_reset(n);
+    for (int i = 0; i < n; i++) {
+        sim_nodes[i].clock_offset_us = (int64_t)(sim_random() * 10e6);
+        sim_nodes[i].clock_ppm = (sim_random() - 0.5) * 100;
+    }
+    for (int i = 0; i + 1 < n; i++)
+        sim_link(i, i + 1, true);
+    sim_start();
+    if (!sim_run_until(120000, sim_line_converged, NULL)) {
+        printf("sync: line did not converge\n");
+        return 1;
+    }
+    sim_run_until(120000, NULL, NULL);
+
+    for (int k = 0; k < 600; k++) {
+        sim_select(0);
+        t = winc_mesh_time_us(NULL);
+        for (int i = 1; i < n; i++) {
+            uint32_t err;
+            int64_t e;
+
+            sim_select(i);
+            e = (int64_t)(winc_mesh_time_us(&err) - t);
+            if (e < 0)
+                e = -e;
+            if (e > max_err[i])
+                max_err[i] = e;
+            if (e > err)
+                over[i]++;
+            bound[i] = err;
+        }
+        sim_run_until(100, NULL, NULL);
+    }
+
+    // One-way delay end to end, timed with mesh time on both sides
+    sim_select(0);
+    t = winc_mesh_time_us(NULL);
+    memcpy(msg + 1, &t, sizeof(t));
+    sent_us = sim_now_us;
+    winc_mesh_send(n, msg, sizeof(msg));
+    sim_run_until(1000, NULL, NULL);
+
+    printf(" node  root  depth  parent  delay_us  skew_ppb  true_ppb  max_err_us  err_us  over\n");
+    for (int i = 1; i < n; i++) {
+        double truth = (sim_nodes[0].clock_ppm - sim_nodes[i].clock_ppm) /
+                       (1 + sim_nodes[i].clock_ppm * 1e-6) * 1000;
+
+        sim_select(i);
+        winc_mesh_get_sync_stats(&ss);
+        printf("%5d  %4u  %5u  %6u  %8u  %8ld  %8.0f  %10lld  %6u  %4u\n", i + 1, ss.root,
+               ss.depth, ss.parent, ss.delay_us, (long)ss.skew_ppb, truth,
+               (long long)max_err[i], bound[i], over[i]);
+        if (!ss.synced || ss.root != 1 || ss.depth != i || max_err[i] > 100 || over[i])
+            failed = 1;
+    }
+    printf("one-way delay 1 -> %d: %lld us by mesh time, %llu us true\n", n,
+           (long long)sim_nodes[n - 1].sync_owd_us,
+           (unsigned long long)(sim_nodes[n - 1].sync_rx_at_us - sent_us));
+    if (!sim_nodes[n - 1].sync_rx_at_us ||
+        llabs(sim_nodes[n - 1].sync_owd_us - (int64_t)(sim_nodes[n - 1].sync_rx_at_us - sent_us)) > 100)
+        failed = 1;
+    return failed;
+}
+
+// Triangle 1-2-3 where the direct 1-3 link drops `loss` of its frames
+static int cmd_etx(double loss) {
+    int direct = 0, total = 0;
+
+    sim_reset(3);
+    sim_link(0, 1, true);
+    sim_link(1, 2, true);
+    sim_link(0, 2, true);
+    sim_links[0][2].loss = sim_links[2][0].loss = loss;
+    sim_start();
+
+    // Sample node 1's choice once a second for five minutes
+    for (int s = 0; s < 300; s++) {
+        sim_run_until(1000, NULL, NULL);
+        total++;
+        direct += sim_next_hop(0, 2) == 2;
+    }
+
+    sim_select(0);
+    if (sim_verbose)
+        mesh_print_routing_table();
+    printf("etx loss %.2f: node 1 -> 3 direct %d%% of the time, via node 2 %d%%\n",
+           loss, direct * 100 / total, (total - direct) * 100 / total);
+
+    // Node 3 credits a relayed frame to node 2 from the header, not from
+    // its own route back to node 1, which may well be the direct link
+    if (sim_next_hop(0, 2) == 1) {
+        winc_mesh_neighbor_stats_t ns[SIM_MAX_NODES];
+        uint8_t msg[] = "etx";
+        int hop = 2, count, got = 0;
+        uint32_t before = 0;
+
+        sim_select(2);
+        count = winc_mesh_get_neighbor_stats(ns, SIM_MAX_NODES);
+        for (int k = 0; k < count; k++)
+            before += ns[k].node_id == hop ? ns[k].rx_frames : 0;
+        sim_select(0);
+        winc_mesh_send(3, msg, sizeof(msg));
+        for (int tries = 0; tries < 10 && !got; tries++) {
+            sim_run_until(10, NULL, NULL);
+            sim_select(2);
+            count = winc_mesh_get_neighbor_stats(ns, SIM_MAX_NODES);
+            for (int k = 0; k < count; k++)
+                got |= ns[k].node_id == hop && ns[k].rx_frames > before;
+        }
+        if (!got) {
+            printf("etx: node 3 did not credit the frame to node %d\n", hop);
+            return 1;
+        }
+    }
+
+    // At 50% loss or worse the relay is clearly cheaper and should carry
+    // most of the traffic
+    return loss >= 0.5 && direct * 2 > total ? 1 : 0;
+}
+
+// Node 1 sends as many small messages to node 3 (two hops) as the mesh
+// accepts for two seconds. Radios cost 400 us per datagram plus 1 us per
+// byte, roughly an 802.11b/g frame with the HIF command in front. With
+// aggregation, messages of up to 32 bytes must take fewer datagrams than
+// there were messages.
+static int cmd_agg_bench(void) {
+    static const int sizes[] = {8, 16, 32, 64, 128, 256};
+    uint8_t payload[256];
+    int failed = 0;
+
+    memset(payload, 0xA5, sizeof(payload));
+    printf("payload  sent_msgs  delivered  msgs_per_s  datagrams\n");
+
+    for (int k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++) {
+        uint32_t sent = 0, frames;
+
+        if (!sim_line(3, NULL, NULL)) {
+            printf("agg-bench: line did not converge\n");
+            return 1;
+        }
+        sim_airtime_frame_us = 400;
+        sim_airtime_byte_ns = 1000;
+        sim_run_until(100, NULL, NULL);
+        frames = sim_frames_sent;
+
+        for (int t = 0; t < 2000; t++) {
+            sim_select(0);
+            for (int m = 0; m < 100 && winc_mesh_send(3, payload, sizes[k]); m++)
+                sent++;
+            sim_tick();
+        }
+        sim_select(0);
+        winc_mesh_flush();
+        sim_run_until(200, NULL, NULL);
+
+        printf("%7d  %9u  %9u  %10u  %9u\n", sizes[k], sent, sim_nodes[2].rx_data,
+               sim_nodes[2].rx_data / 2, sim_frames_sent - frames);
+        if (sim_nodes[2].rx_data != sent)
+            failed = 1;
+#if WINC_MESH_AGGREGATE
+        // Packed, small messages must cost less than a datagram each even
+        // though every one crosses two hops
+        if (sizes[k] <= 32 && sim_frames_sent - frames >= sent) {
+            printf("agg-bench: %d-byte messages were not aggregated\n", sizes[k]);
+            failed = 1;
+        }
+#endif
+    }
+    return failed;
+}
+
+// Messages of several fragments from node 1 to node 4, checked byte for
+// byte. With loss, a message either arrives whole or not at all.
+static int cmd_frag(double loss) {
+    static const int sizes[] = {1401, 4096, 10000, WINC_MESH_MAX_MESSAGE};
+    static uint8_t msg[WINC_MESH_MAX_MESSAGE];
+    int delivered = 0, corrupt = 0, tries = loss > 0 ? 20 : 1;
+
+    if (!sim_line(4, NULL, NULL)) {
+        printf("frag: line did not converge\n");
+        return 1;
+    }
+    for (int i = 0; i + 1 < 4; i++)
+        sim_links[i][i + 1].loss = sim_links[i + 1][i].loss = loss;
+
+    for (int k = 0; k < (int)(sizeof(sizes) / sizeof(sizes[0])); k++) {
+        for (int t = 0; t < tries; t++) {
+            uint32_t before = sim_nodes[3].rx_data;
+
+            for (int i = 0; i < sizes[k]; i++)
+                msg[i] = (uint8_t)(i * 7 + k + t);
+            sim_select(0);
+            if (!winc_mesh_send(4, msg, sizes[k]))
+                continue;
+            sim_run_until(500, NULL, NULL);
+
+            if (sim_nodes[3].rx_data == before)
+                continue;
+            if (sim_nodes[3].rx_len != sizes[k] ||
+                sim_nodes[3].rx_hash != sim_hash(msg, sizes[k]))
+                corrupt++;
+            else
+                delivered++;
+        }
+    }
+
+    // Let every partial message time out and give its fragments back
+    sim_run_until(WINC_MESH_REASM_TIMEOUT_MS + 1000, NULL, NULL);
+#if WINC_MESH_REASM_SLOTS
+    for (int i = 0; i < WINC_MESH_REASM_SLOTS; i++) {
+        if (sim_nodes[3].mesh.reasm[i].active)
+            corrupt++;
+    }
+#endif
+    if (sim_nodes[3].mesh.pool.stats.in_use)
+        corrupt++;
+
+    printf("frag loss %.2f: %d of %d messages delivered intact, %d bad\n", loss,
+           delivered, tries * (int)(sizeof(sizes) / sizeof(sizes[0])), corrupt);
+    if (corrupt)
+        return 1;
+    return loss > 0 || delivered == (int)(sizeof(sizes) / sizeof(sizes[0])) ? 0 : 1;
+}
+
+// Node 1 sends 1000 64-byte messages to node 4, one every 2 ms, over three
+// links that each drop `loss` of frames, first best effort, then with
+// WINC_MESH_RELIABLE.
+static int cmd_rel_bench(double loss) {
+    static const char *names[] = {"best-effort", "reliable"};
+    uint8_t payload[64];
+    int failed = 0;
+
+    memset(payload, 0x5A, sizeof(payload));
+    printf("rel-bench loss %.2f per link, 3 hops\n", loss);
+    printf("mode         accepted  delivered  lost_%%  goodput_Bps  retransmits  gave_up  pool_peak\n");
+
+    for (int mode = 0; mode < 2; mode++) {
+        winc_mesh_tx_stats_t ts, sum = {0};
+        winc_mesh_pool_stats_t ps;
+        uint32_t accepted = 0;
+        int peak = 0, leaked = 0;
+
+        if (!sim_line(4, NULL, NULL)) {
+            printf("rel-bench: line did not converge\n");
+            return 1;
+        }
+        sim_airtime_frame_us = 400;
+        sim_airtime_byte_ns = 1000;
+        for (int i = 0; i + 1 < 4; i++)
+            sim_links[i][i + 1].loss = sim_links[i + 1][i].loss = loss;
+
+        for (int m = 0; m < 1000; m++) {
+            sim_select(0);
+            accepted += winc_mesh_send_ex(4, payload, sizeof(payload),
+                                          mode ? WINC_MESH_RELIABLE : 0);
+            sim_run_until(2, NULL, NULL);
+        }
+        sim_run_until(5000, NULL, NULL);
+
+        for (int i = 0; i < 4; i++) {
+            sim_select(i);
+            winc_mesh_get_tx_stats(&ts);
+            sum.retransmits += ts.retransmits;
+            sum.dropped += ts.dropped;
+            winc_mesh_get_pool_stats(&ps);
+            peak = MAX(peak, ps.high_water);
+            leaked += ps.in_use;
+        }
+
+        // Goodput over the 2 s the sender was active
+        uint32_t got = sim_nodes[3].rx_data;
+        printf("%-11s  %8u  %9u  %6.2f  %11u  %11u  %7u  %9d\n", names[mode], accepted, got,
+               accepted ? 100.0 * ((double)accepted - got) / accepted : 0.0,
+               got * (uint32_t)sizeof(payload) / 2, sum.retransmits, sum.dropped, peak);
+
+        // Never more deliveries than sends; reliable must beat best effort;
+        // every pool frame is back once the mesh is idle
+        if (got > accepted || (mode && loss > 0 && got < accepted * 98 / 100) || leaked) {
+            if (leaked)
+                printf("rel-bench: %d pool frames still in use\n", leaked);
+            failed = 1;
+        }
+    }
+    return failed;
+}
+
+// Line 1-2-3. Nodes 1 and 2 push 1200-byte bulk frames to node 3 as fast as
+// the mesh accepts them, while node 1 sends a small alarm every 50 ms. Run
+// once with everything in the normal class (plain FIFO), then with bulk
+// and alarm classes.
+static int cmd_prio_bench(void) {
+    static const char *names[] = {"fifo", "classes"};
+    uint8_t bulk[1200];
+    uint8_t alarm[1 + sizeof(uint64_t)];
+    uint32_t avg[2] = {0}, max[2] = {0};
+
+    memset(bulk, 0xB0, sizeof(bulk));
+    printf("mode     alarms  avg_lat_ms  max_lat_ms  bulk_kBps  bulk_refused\n");
+
+    for (int mode = 0; mode < 2; mode++) {
+        uint8_t bulk_flags = mode ? WINC_MESH_BULK : 0;
+        uint8_t alarm_flags = mode ? WINC_MESH_ALARM : 0;
+        winc_mesh_queue_stats_t qs;
+        uint32_t dropped = 0;
+
+        if (!sim_line(3, NULL, NULL)) {
+            printf("prio-bench: line did not converge\n");
+            return 1;
+        }
+        sim_airtime_frame_us = 400;
+        sim_airtime_byte_ns = 1000;
+        // Queueing alone: backpressure would refuse most of fifo's alarms
+        for (int n = 0; n < 3; n++) {
+            sim_select(n);
+            winc_mesh_set_backpressure(false);
+        }
+
+        for (int t = 0; t < 3000; t++) {
+            for (int n = 0; n < 2; n++) {
+                sim_select(n);
+                for (int m = 0; m < 4 && winc_mesh_send_ex(3, bulk, sizeof(bulk), bulk_flags); m++)
+                    ;
+            }
+            if (t % 50 == 0) {
+                sim_select(0);
+                alarm[0] = 'A';
+                memcpy(alarm + 1, &sim_now_us, sizeof(sim_now_us));
+                winc_mesh_send_ex(3, alarm, sizeof(alarm), alarm_flags);
+            }
+            sim_tick();
+        }
+        sim_run_until(500, NULL, NULL);
+
+        for (int n = 0; n < 2; n++) {
+            sim_select(n);
+            winc_mesh_get_queue_stats(&qs);
+            dropped += qs.dropped[mode ? WINC_MESH_CLASS_BULK : WINC_MESH_CLASS_NORMAL];
+        }
+
+        sim_node_t *dst = &sim_nodes[2];
+        if (dst->alarms) {
+            avg[mode] = dst->alarm_lat_sum_us / dst->alarms;
+            max[mode] = dst->alarm_lat_max_us;
+        }
+        printf("%-7s  %6u  %10.2f  %10.2f  %9u  %12u\n", names[mode], dst->alarms,
+               avg[mode] / 1000.0, max[mode] / 1000.0,
+               (dst->rx_bytes - dst->alarms * (uint32_t)sizeof(alarm)) / 3000, dropped);
+        if (dst->alarms < 60)
+            return 1;
+    }
+
+    // With classes, alarms must not queue behind bulk frames
+    return max[1] < 10000 && max[1] * 2 < max[0] ? 0 : 1;
+}
+
+// n nodes in one collision domain all send 200-byte readings to node 1
+// every 100 ms, in phase. Free CSMA/CA contention against one 2 ms slot per
+// node, for 8, 16 and 24 nodes.
+static int cmd_tdma_bench(void) {
+    static const int counts[] = {8, 16, 24};
+    static const char *names[] = {"csma", "tdma"};
+    double p99[2] = {0};
+    int failed = 0;
+
+    printf("nodes  mode  delivered  collided  air_ok  p50_ms  p99_ms  max_ms\n");
+    for (int k = 0; k < 3; k++) {
+        int n = counts[k];
+
+        for (int mode = 0; mode < 2; mode++) {
+            uint64_t start_us;
+            uint32_t tx0;
+
+            sim_reset(n);
+            for (int i = 0; i < n; i++) {
+                for (int j = i + 1; j < n; j++)
+                    sim_link(i, j, true);
+            }
+            sim_start();
+            if (!sim_run_until(60000, sim_graph_converged, NULL)) {
+                printf("tdma-bench: %d nodes did not converge\n", n);
+                return 1;
+            }
+            sim_run_until(20000, NULL, NULL);   // Mesh time settles
+
+            sim_airtime_frame_us = 300;
+            sim_airtime_byte_ns = 1000;
+            sim_medium = true;
+            for (int i = 0; i < n; i++) {
+                sim_select(i);
+                winc_mesh_set_tdma(mode ? n : 0, 2000);
+            }
+            for (int i = 1; i < n; i++) {
+                sim_flow_t *f = &sim_flows[sim_flow_count++];
+                f->src = i;
+                f->dst = 0;
+                f->left = 200;
+                f->interval_us = 100000;
+                f->next_us = sim_now_us;
+                f->size = 200;
+                f->flags = WINC_MESH_RELIABLE;
+            }
+            start_us = sim_now_us;
+            tx0 = sim_air_tx;
+            sim_run_until(23000, NULL, NULL);
+
+            p99[mode] = sim_lat_pct(99) / 1000.0;
+            printf("%5d  %s  %8.1f%%  %7.1f%%  %5.1f%%  %6.1f  %6.1f  %6.1f\n", n, names[mode],
+                   100.0 * sim_traffic.delivered / sim_traffic.offered,
+                   100.0 * sim_air_collided / (sim_air_tx - tx0 ? sim_air_tx - tx0 : 1),
+                   100.0 * sim_air_good_us() / (sim_now_us - start_us),
+                   sim_lat_pct(50) / 1000.0, p99[mode], sim_traffic.lat_max_us / 1000.0);
+            if (sim_traffic.delivered < sim_traffic.offered * 95 / 100)
+                failed = 1;
+        }
+        // The schedule must cut the tail where contention is worst
+        if (n >= 16 && p99[1] >= p99[0])
+            failed = 1;
+    }
+    return failed;
+}
+
+// Every node broadcasts twice, over a 5x5 grid and over 30 nodes scattered
+// in a square with a short radio range. Blind flooding sends a broadcast
+// once from every node; multipoint relays must reach the same nodes, each
+// exactly once, with fewer transmissions.
+static int cmd_flood_bench(void) {
+    static const char *names[] = {"grid", "random"};
+    uint8_t msg[32];
+    int failed = 0;
+
+    memset(msg, 'B', sizeof(msg));
+    printf("topology  nodes  broadcasts  reached  dup_rx  tx_per_bcast  blind  relays_avg\n");
+    for (int t = 0; t < 2; t++) {
+        int n = t ? 30 : 25, sent = 0, dups = 0;
+        uint32_t reached = 0, tx0, relays = 0;
+        double x[SIM_MAX_NODES], y[SIM_MAX_NODES];
+        bool seen[SIM_MAX_NODES];
+        winc_mesh_flood_stats_t fs;
+
+        sim_reset(n);
+        if (!t) {
+            for (int i = 0; i < n; i++) {
+                if (i % 5 < 4)
+                    sim_link(i, i + 1, true);
+                if (i + 5 < n)
+                    sim_link(i, i + 5, true);
+            }
+        } else {
+            // Scatter until the graph is connected
+            do {
+                memset(sim_links, 0, sizeof(sim_links));
+                for (int i = 0; i < n; i++) {
+                    x[i] = sim_random();
+                    y[i] = sim_random();
+                    sim_nodes[i].up = true;
+                    for (int j = 0; j < i; j++) {
+                        if ((x[i] - x[j]) * (x[i] - x[j]) + (y[i] - y[j]) * (y[i] - y[j]) < 0.3 * 0.3)
+                            sim_link(i, j, true);
+                    }
+                }
+                sim_reachable(0, seen);
+            } while (memchr(seen, false, n));
+        }
+        sim_start();
+        if (!sim_run_until(60000, sim_graph_converged, NULL)) {
+            printf("flood-bench: %s did not converge\n", names[t]);
+            return 1;
+        }
+        sim_run_until(10000, NULL, NULL);
+
+        tx0 = sim_type_frames[MESH_MSG_FLOOD];
+        for (int k = 0; k < 2; k++) {
+            for (int i = 0; i < n; i++) {
+                sim_select(i);
+                sent += winc_mesh_send(WINC_MESH_BROADCAST, msg, sizeof(msg));
+                sim_run_until(100, NULL, NULL);
+            }
+        }
+        sim_run_until(2000, NULL, NULL);
+
+        for (int i = 0; i < n; i++) {
+            sim_select(i);
+            winc_mesh_get_flood_stats(&fs);
+            relays += fs.relays;
+            reached += sim_nodes[i].bcasts;
+            if (sim_nodes[i].bcasts > (uint32_t)(sent - fs.sent))
+                dups++;
+        }
+        printf("%-8s  %5d  %10d  %6.1f%%  %6d  %12.1f  %5d  %10.1f\n", names[t], n, sent,
+               100.0 * reached / (sent * (n - 1)), dups,
+               (double)(sim_type_frames[MESH_MSG_FLOOD] - tx0) / sent, n, (double)relays / n);
+        // Everyone, once each, for clearly less than blind flooding
+        if (sent != 2 * n || reached != (uint32_t)sent * (n - 1) || dups ||
+            (sim_type_frames[MESH_MSG_FLOOD] - tx0) >= (uint32_t)sent * n * 4 / 5)
+            failed = 1;
+    }
+    return failed;
+}
+
+// rpc: completions seen by the caller
+static int sim_rpc_ok, sim_rpc_bad, sim_rpc_timeouts, sim_rpc_status;
+
+static uint8_t sim_rpc_arg(int call, int i) {
+    return (uint8_t)(call * 7 + i);
+}
+
+// Returns its arguments reversed, each xor 0x5A
+static int sim_rpc_handler(uint8_t src_node, const uint8_t *args, uint16_t len,
+                           uint8_t *result, uint16_t max) {
+    for (int i = 0; i < len && i < max; i++)
+        result[i] = args[len - 1 - i] ^ 0x5A;
+    return len;
+}
+
+static void sim_rpc_done(int status, uint8_t *result, uint16_t len, void *arg) {
+    int call = (int)(intptr_t)arg;
+    bool intact = len == 32;
+
+    for (int i = 0; i < len && intact; i++)
+        intact = result[i] == (sim_rpc_arg(call, len - 1 - i) ^ 0x5A);
+    sim_rpc_status = status;
+    if (status == WINC_MESH_RPC_TIMEOUT)
+        sim_rpc_timeouts++;
+    else if (status != WINC_MESH_RPC_OK || !intact)
+        sim_rpc_bad++;
+    else
+        sim_rpc_ok++;
+}
+
+// Node 1 calls a method on the far end of a lossy line, 1 to 3 hops away,
+// keeping four calls outstanding, with and without WINC_MESH_RELIABLE.
+// Every call must complete exactly once with the right result, and the
+// handler never run more often than calls were made. Then a call to an
+// unregistered method, and one across a cut link, must fail as such.
+static int cmd_rpc(double loss) {
+    static const char *names[] = {"datagram", "reliable"};
+    const int total = 200, window = 4;
+    const uint32_t deadline_ms = 5000;
+    uint8_t args[32];
+    int failed = 0;
+
+    printf("hops  mode      calls  ok  timeouts  retries  replayed  served  avg_ms  max_ms  calls_per_s\n");
+    for (int hops = 1; hops <= 3; hops++) {
+        for (int mode = 0; mode < 2; mode++) {
+            winc_mesh_rpc_stats_t cs, ss;
+            uint64_t start;
+            int issued = 0;
+
+            if (!sim_line(hops + 1, NULL, NULL)) {
+                printf("rpc: line did not converge\n");
+                return 1;
+            }
+            sim_select(hops);
+            winc_mesh_rpc_register(1, sim_rpc_handler);
+            for (int i = 0; i < hops; i++)
+                sim_links[i][i + 1].loss = sim_links[i + 1][i].loss = loss;
+            sim_rpc_ok = sim_rpc_bad = sim_rpc_timeouts = 0;
+
+            start = sim_now_us;
+            while (sim_rpc_ok + sim_rpc_bad + sim_rpc_timeouts < total &&
+                   sim_now_us - start < 120000000ull) {
+                sim_select(0);
+                winc_mesh_get_rpc_stats(&cs);
+                while (issued < total && cs.outstanding < window) {
+                    for (int i = 0; i < (int)sizeof(args); i++)
+                        args[i] = sim_rpc_arg(issued, i);
+                    if (winc_mesh_rpc_call(hops + 1, 1, args, sizeof(args),
+                                           mode ? WINC_MESH_RELIABLE : 0, deadline_ms,
+                                           sim_rpc_done, (void*)(intptr_t)issued) < 0)
+                        break;
+                    issued++;
+                    winc_mesh_get_rpc_stats(&cs);
+                }
+                sim_tick();
+            }
+
+            sim_select(0);
+            winc_mesh_get_rpc_stats(&cs);
+            sim_select(hops);
+            winc_mesh_get_rpc_stats(&ss);
+            printf("%4d  %-8s  %5d  %3d  %8d  %7lu  %8lu  %6lu  %6.1f  %6.1f  %11.1f\n", hops,
+                   names[mode], total, sim_rpc_ok, sim_rpc_timeouts, (unsigned long)cs.retries,
+                   (unsigned long)ss.replayed, (unsigned long)ss.served,
+                   cs.latency_avg_us / 1000.0, cs.latency_max_us / 1000.0,
+                   sim_rpc_ok * 1e6 / (sim_now_us - start));
+            if (sim_rpc_ok + sim_rpc_timeouts != total || sim_rpc_bad || cs.outstanding ||
+                ss.served > (uint32_t)total || sim_rpc_ok < total * 95 / 100)
+                failed = 1;
+        }
+    }
+
+    // No handler there, then no way there
+    sim_select(0);
+    sim_rpc_status = 1;
+    winc_mesh_rpc_call(2, 9, NULL, 0, 0, deadline_ms, sim_rpc_done, NULL);
+    sim_run_until(2000, NULL, NULL);
+    printf("unregistered method: status %d\n", sim_rpc_status);
+    failed |= sim_rpc_status != WINC_MESH_RPC_NO_METHOD;
+
+    sim_link(0, 1, false);
+    sim_rpc_status = 1;
+    sim_select(0);
+    winc_mesh_rpc_call(2, 1, args, sizeof(args), 0, 1000, sim_rpc_done, NULL);
+    sim_run_until(999, NULL, NULL);
+    failed |= sim_rpc_status != 1;
+    sim_run_until(2, NULL, NULL);
+    printf("cut link: status %d after 1 s\n", sim_rpc_status);
+    failed |= sim_rpc_status != WINC_MESH_RPC_TIMEOUT;
+    return failed;
+}
+
+static void sim_topic_received(uint8_t src_node, uint16_t topic, uint8_t *data, uint16_t len) {
+    sim_nodes[sim_cur].topic_rx++;
+}
+
+// Data frames node i has taken in, publications included
+static uint32_t sim_rx_frames(int i) {
+    uint32_t n = 0;
+
+    for (int k = 0; k < WINC_MESH_MAX_NODES; k++)
+        n += sim_nodes[i].mesh.nbr[k].rx_frames;
+    return n;
+}
+
+// Data datagrams on the air so far, aggregates counted once, and their bytes
+static uint32_t sim_data_frames(void) {
+    return sim_type_frames[MESH_MSG_DATA] + sim_type_frames[MESH_MSG_AGGREGATE] +
+           sim_type_frames[MESH_MSG_PUBLISH];
+}
+
+static uint32_t sim_data_bytes(void) {
+    return sim_type_bytes[MESH_MSG_DATA] + sim_type_bytes[MESH_MSG_AGGREGATE] +
+           sim_type_bytes[MESH_MSG_PUBLISH];
+}
+
+static int sim_pubsub_want;
+
+static bool sim_pubsub_learned(void) {
+    winc_mesh_pubsub_stats_t ps;
+
+    sim_select(0);
+    winc_mesh_get_pubsub_stats(&ps);
+    return ps.subscribers == sim_pubsub_want;
+}
+
+// Telemetry from node 1 to six subscribers behind a hub (node 2): four
+// leaves, and two more behind node 7. Nodes 10 and 11 hang off the hub on
+// their own branch; 11 takes another topic. Each sample is sent once by
+// unicast to every subscriber, then published, then published again after
+// node 8 unsubscribes. Publishing must reach the same nodes with one
+// transmission per branch, in fewer bytes than unicast even when
+// aggregation packs those into one datagram per hop, and keep the idle
+// branch quiet.
+static int cmd_pubsub(void) {
+    static const char *names[] = {"unicast each", "publish", "publish, one left"};
+    static const int subs[] = {2, 3, 4, 5, 7, 8};
+    const int n = 11, count = 20, nsubs = sizeof(subs) / sizeof(subs[0]);
+    uint16_t telemetry = winc_mesh_topic("telemetry"), other = winc_mesh_topic("alarms");
+    uint8_t msg[24];
+    uint32_t learn_ms, bytes[3];
+    int failed = 0;
+
+    sim_reset(n);
+    sim_link(0, 1, true);
+    for (int i = 2; i <= 6; i++)
+        sim_link(1, i, true);
+    sim_link(6, 7, true);
+    sim_link(6, 8, true);
+    sim_link(1, 9, true);
+    sim_link(9, 10, true);
+    sim_start();
+    if (!sim_run_until(60000, sim_graph_converged, NULL)) {
+        printf("pubsub: tree did not converge\n");
+        return 1;
+    }
+
+    for (int k = 0; k < nsubs; k++) {
+        sim_select(subs[k]);
+        winc_mesh_subscribe(telemetry, sim_topic_received);
+    }
+    sim_select(10);
+    winc_mesh_subscribe(other, sim_topic_received);
+    sim_pubsub_want = nsubs + 1;
+    if (!sim_run_until(10000, sim_pubsub_learned, &learn_ms)) {
+        printf("pubsub: node 1 never learned the subscriptions\n");
+        return 1;
+    }
+    printf("subscriptions learned in %u ms\n", learn_ms);
+
+    memset(msg, 'P', sizeof(msg));
+    printf("mode               subscribers  messages  delivered  tx_per_msg  bytes_per_msg  idle_branch_rx\n");
+    for (int mode = 0; mode < 3; mode++) {
+        int want = mode == 2 ? nsubs - 1 : nsubs;
+        uint32_t rx0[SIM_MAX_NODES], idle0 = sim_rx_frames(9) + sim_rx_frames(10), tx0, b0;
+        uint32_t got = 0, stray = 0, tx, idle;
+
+        if (mode == 2) {
+            sim_select(7);
+            winc_mesh_unsubscribe(telemetry);
+            sim_pubsub_want = nsubs;
+            if (!sim_run_until(10000, sim_pubsub_learned, NULL)) {
+                printf("pubsub: node 1 never saw node 8 leave\n");
+                return 1;
+            }
+        }
+        for (int i = 0; i < n; i++)
+            rx0[i] = sim_nodes[i].rx_data + sim_nodes[i].topic_rx;
+        tx0 = sim_data_frames();
+        b0 = sim_data_bytes();
+
+        for (int c = 0; c < count; c++) {
+            sim_select(0);
+            if (!mode) {
+                for (int k = 0; k < nsubs; k++)
+                    winc_mesh_send(subs[k] + 1, msg, sizeof(msg));
+            } else {
+                winc_mesh_publish(telemetry, msg, sizeof(msg), 0);
+            }
+            sim_run_until(100, NULL, NULL);
+        }
+        sim_run_until(1000, NULL, NULL);
+
+        for (int i = 0; i < n; i++) {
+            uint32_t d = sim_nodes[i].rx_data + sim_nodes[i].topic_rx - rx0[i];
+            bool sub = false;
+
+            for (int k = 0; k < nsubs; k++)
+                sub |= subs[k] == i && !(mode == 2 && i == 7);
+            if (sub)
+                got += d;
+            else
+                stray += d;
+        }
+        tx = sim_data_frames() - tx0;
+        bytes[mode] = sim_data_bytes() - b0;
+        idle = sim_rx_frames(9) + sim_rx_frames(10) - idle0;
+        printf("%-17s  %11d  %8d  %8.1f%%  %10.1f  %13.0f  %14u\n", names[mode], want, count,
+               100.0 * got / (count * want), (double)tx / count, (double)bytes[mode] / count, idle);
+        // Publications: hub link, the hub's branches, node 7's subscribers
+        if (got != (uint32_t)(count * want) || stray || idle ||
+            (mode && tx != (uint32_t)(1 + 5 + want - 4) * count))
+            failed = 1;
+    }
+    return failed || bytes[1] >= bytes[0];
+}
+
+// kv: the store every node should hold, key names k0..k15
+#define SIM_KV_KEYS   WINC_MESH_KV_KEYS
+#define SIM_KV_VALUE  8
+
+static uint8_t sim_kv_state[SIM_KV_KEYS][SIM_KV_VALUE];
+static uint8_t sim_kv_blob[SIM_KV_KEYS * (2 + SIM_KV_VALUE)];
+static int sim_kv_mode;
+
+static uint16_t sim_kv_key(int k) {
+    char name[8];
+
+    snprintf(name, sizeof(name), "k%d", k);
+    return winc_mesh_kv_key(name);
+}
+
+static void sim_kv_changed(uint16_t key, const uint8_t *value, uint8_t len, uint8_t origin) {
+    sim_nodes[sim_cur].kv_changes++;
+}
+
+// Node i holds sim_kv_state for every key
+static bool sim_kv_holds(int i) {
+    uint8_t v[SIM_KV_VALUE];
+
+    sim_select(i);
+    for (int k = 0; k < SIM_KV_KEYS; k++) {
+        if (winc_mesh_kv_get(sim_kv_key(k), v, sizeof(v)) != SIM_KV_VALUE ||
+            memcmp(v, sim_kv_state[k], SIM_KV_VALUE))
+            return false;
+    }
+    return true;
+}
+
+// Every node has the current state, from the store or the last broadcast
+static bool sim_kv_converged(void) {
+    uint32_t h = sim_hash(sim_kv_blob, sizeof(sim_kv_blob));
+
+    for (int i = 0; i < sim_node_count; i++) {
+        if (sim_kv_mode ? !sim_kv_holds(i) : i && sim_nodes[i].rx_hash != h)
+            return false;
+    }
+    return true;
+}
+
+// Node 1 writes k, as a store write or into the state it broadcasts
+static void sim_kv_write(int k, uint8_t fill) {
+    memset(sim_kv_state[k], fill, SIM_KV_VALUE);
+    memcpy(sim_kv_blob + k * (2 + SIM_KV_VALUE) + 2, sim_kv_state[k], SIM_KV_VALUE);
+    if (sim_kv_mode) {
+        sim_select(0);
+        winc_mesh_kv_set(sim_kv_key(k), sim_kv_state[k], SIM_KV_VALUE);
+    }
+}
+
+// Bytes on the air for the shared state so far: broadcasts, or the
+// store's own messages and its part of the beacons
+static uint32_t sim_kv_bytes(void) {
+    winc_mesh_kv_stats_t ks;
+    uint32_t b;
+
+    if (!sim_kv_mode)
+        return sim_type_bytes[MESH_MSG_FLOOD];
+    b = sim_type_bytes[MESH_MSG_KV];
+    for (int i = 0; i < sim_node_count; i++) {
+        sim_select(i);
+        winc_mesh_get_kv_stats(&ks);
+        b += ks.beacon_bytes;
+    }
+    return b;
+}
+
+// Configuration shared across a 5x5 grid. Node 1 sets 16 keys of 8 bytes,
+// then changes one, first by broadcasting the whole table each time, then
+// through the replicated store. Both must reach every node, and the store
+// must move fewer bytes than the broadcast for the single change. Then
+// nodes 1 and 25 write one key at once and every node must keep the same
+// value, a write past the store's size must be refused, and a node cut
+// off while a key changed must catch up from its neighbours' digests once
+// back.
+static int cmd_kv(void) {
+    static const char *names[] = {"broadcast", "store"}, *steps[] = {"16 keys", "1 key"};
+    const int n = 25;
+    const uint32_t window_ms = 5000;
+    uint32_t bytes[2][2] = {{0}}, catch_ms;
+    uint8_t v[SIM_KV_VALUE];
+    bool cut[SIM_MAX_NODES], caught;
+    int failed = 0;
+
+    printf("mode       change   converge_ms  bytes  exchanges  changes_seen\n");
+    for (int mode = 0; mode < 2; mode++) {
+        sim_kv_mode = mode;
+        sim_reset(n);
+        for (int i = 0; i < n; i++) {
+            if (i % 5 < 4)
+                sim_link(i, i + 1, true);
+            if (i + 5 < n)
+                sim_link(i, i + 5, true);
+        }
+        sim_start();
+        for (int i = 0; i < n; i++) {
+            sim_select(i);
+            winc_mesh_kv_set_callback(sim_kv_changed);
+        }
+        if (!sim_run_until(60000, sim_graph_converged, NULL)) {
+            printf("kv: grid did not converge\n");
+            return 1;
+        }
+        sim_run_until(10000, NULL, NULL);
+        memset(sim_kv_state, 0, sizeof(sim_kv_state));
+        memset(sim_kv_blob, 0, sizeof(sim_kv_blob));
+        for (int k = 0; k < SIM_KV_KEYS; k++) {
+            uint16_t key = sim_kv_key(k);
+            memcpy(sim_kv_blob + k * (2 + SIM_KV_VALUE), &key, 2);
+        }
+
+        for (int step = 0; step < 2; step++) {
+            uint32_t b0 = sim_kv_bytes(), conv_ms, changes = 0, exchanges = 0;
+            winc_mesh_kv_stats_t ks;
+            bool done;
+
+            for (int i = 0; i < n; i++)
+                sim_nodes[i].kv_changes = 0;
+
+            for (int k = 0; k < (step ? 1 : SIM_KV_KEYS); k++)
+                sim_kv_write(step ? 5 : k, (uint8_t)(step * 0x40 + k + 1));
+            if (!mode) {
+                sim_select(0);
+                winc_mesh_send(WINC_MESH_BROADCAST, sim_kv_blob, sizeof(sim_kv_blob));
+            }
+            done = sim_run_until(window_ms, sim_kv_converged, &conv_ms);
+            sim_run_until(window_ms - conv_ms, NULL, NULL);
+
+            bytes[mode][step] = sim_kv_bytes() - b0;
+            for (int i = 0; i < n; i++) {
+                sim_select(i);
+                winc_mesh_get_kv_stats(&ks);
+                exchanges += ks.exchanges;
+                changes += i ? sim_nodes[i].kv_changes : 0;
+            }
+            printf("%-9s  %-7s  %11u  %5u  %9u  %12u\n", names[mode], steps[step],
+                   done ? conv_ms : 0, bytes[mode][step], exchanges, changes);
+            // Every other node told of each change once
+            if (!done || (mode && changes != (uint32_t)(n - 1) * (step ? 1 : SIM_KV_KEYS)))
+                failed = 1;
+        }
+    }
+    if (bytes[1][1] >= bytes[0][1])
+        failed = 1;
+
+    // Same key, same moment, two ends of the grid
+    sim_select(0);
+    winc_mesh_kv_set(sim_kv_key(3), (const uint8_t*)"from n1", SIM_KV_VALUE);
+    sim_select(n - 1);
+    winc_mesh_kv_set(sim_kv_key(3), (const uint8_t*)"fromn25", SIM_KV_VALUE);
+    sim_select(n - 1);
+    winc_mesh_kv_get(sim_kv_key(3), sim_kv_state[3], SIM_KV_VALUE);
+    sim_run_until(window_ms, NULL, NULL);
+    for (int i = 0; i < n; i++) {
+        if (!sim_kv_holds(i)) {
+            printf("kv: node %d kept another value for a contended key\n", i + 1);
+            failed = 1;
+        }
+    }
+    sim_select(0);
+    winc_mesh_kv_get(sim_kv_key(3), v, sizeof(v));
+    printf("contended key: every node kept \"%.7s\"\n", (const char*)v);
+
+    sim_select(0);
+    if (winc_mesh_kv_set(winc_mesh_kv_key("one too many"), v, 1)) {
+        printf("kv: a full store took another key\n");
+        failed = 1;
+    }
+
+    // Node 13, in the middle, misses a change
+    for (int j = 0; j < n; j++) {
+        cut[j] = sim_links[12][j].up;
+        if (cut[j])
+            sim_link(12, j, false);
+    }
+    sim_kv_write(7, 0x77);
+    sim_run_until(window_ms, NULL, NULL);
+    failed |= sim_kv_holds(12);
+    for (int j = 0; j < n; j++) {
+        if (cut[j])
+            sim_link(12, j, true);
+    }
+    caught = sim_run_until(20000, sim_kv_converged, &catch_ms);
+    printf("node cut off during a change: %s after %u ms\n", caught ? "caught up" : "still behind",
+           catch_ms);
+    return failed || !caught;
+}
+
+static int cmd_dv_bench(int max) {
+    printf("hops  nodes  converge_ms  beacons\n");
+    for (int n = 2; n <= max && n <= SIM_MAX_NODES; n++) {
+        uint32_t conv_ms = 0, frames = 0;
+
+        if (!sim_line(n, &conv_ms, &frames)) {
+            printf("%4d  %5d  not converged\n", n - 1, n);
+            return 1;
+        }
+        printf("%4d  %5d  %11u  %7u\n", n - 1, n, conv_ms, frames);
+    }
+    return 0;
+}
+
+// Four nodes at the far end of a six-node line, in one collision domain,
+// send 200-byte bulk readings to node 1 at rising rates. Without
+// backpressure the sources take airtime the forwarders need and frames die
+// in full queues near the sink; with it they are refused at the source.
+// Then a detour: nodes 5 and 6 flood node 1 through node 2, and node 4,
+// with equally good routes through nodes 2 and 3, should move to node 3.
+static int cmd_bp_bench(void) {
+    static const uint32_t intervals_ms[] = {40, 20, 10, 5, 3, 2};
+    static const char *names[] = {"off", "on"};
+    double goodput[2][6] = {{0}}, peak[2] = {0};
+    uint32_t detour[2] = {0}, rerouted = 0;
+    uint8_t bulk[200];
+    int failed = 0;
+
+    printf("offered_fps  bp   accepted  delivered  goodput_fps  p99_ms  throttled  held  q_drops\n");
+    for (int k = 0; k < 6; k++) {
+        for (int mode = 0; mode < 2; mode++) {
+            uint32_t throttled = 0, held = 0, drops = 0;
+            uint64_t start_us;
+
+            if (!sim_line(6, NULL, NULL)) {
+                printf("bp-bench: line did not converge\n");
+                return 1;
+            }
+            sim_airtime_frame_us = 300;
+            sim_airtime_byte_ns = 1000;
+            sim_medium = true;
+            for (int i = 0; i < 6; i++) {
+                sim_select(i);
+                winc_mesh_set_backpressure(mode);
+            }
+            for (int i = 2; i < 6; i++) {
+                sim_flow_t *f = &sim_flows[sim_flow_count++];
+                f->src = i;
+                f->dst = 0;
+                f->left = 5000 / intervals_ms[k];
+                f->interval_us = intervals_ms[k] * 1000;
+                f->next_us = sim_now_us + i * 997;
+                f->size = 200;
+                f->flags = WINC_MESH_BULK;
+            }
+            start_us = sim_now_us;
+            sim_run_until(5000, NULL, NULL);
+            goodput[mode][k] = sim_traffic.delivered * 1e6 / (sim_now_us - start_us);
+            peak[mode] = MAX(peak[mode], goodput[mode][k]);
+            sim_run_until(1000, NULL, NULL);
+
+            for (int i = 0; i < 6; i++) {
+                winc_mesh_bp_stats_t bs;
+                winc_mesh_queue_stats_t qs;
+
+                sim_select(i);
+                winc_mesh_get_bp_stats(&bs);
+                winc_mesh_get_queue_stats(&qs);
+                throttled += bs.throttled;
+                held += bs.held;
+                drops += qs.dropped[WINC_MESH_CLASS_BULK];
+            }
+            printf("%11u  %-3s  %8u  %9u  %11.1f  %6.1f  %9u  %4u  %7u\n",
+                   4000 / intervals_ms[k], names[mode], sim_traffic.accepted,
+                   sim_traffic.delivered, goodput[mode][k], sim_lat_pct(99) / 1000.0,
+                   throttled, held, drops);
+        }
+    }
+
+    memset(bulk, 'X', sizeof(bulk));
+    for (int mode = 0; mode < 2; mode++) {
+        winc_mesh_bp_stats_t bs;
+
+        // Node 4 learns the way through node 3 only once it has a route
+        // through node 2, which as no better it then keeps
+        sim_reset(6);
+        sim_link(0, 1, true);
+        sim_link(0, 2, true);
+        sim_link(1, 3, true);
+        sim_link(1, 4, true);
+        sim_link(1, 5, true);
+        sim_start();
+        if (!sim_run_until(60000, sim_graph_converged, NULL)) {
+            printf("bp-bench: detour did not converge\n");
+            return 1;
+        }
+        sim_link(2, 3, true);
+        sim_run_until(20000, NULL, NULL);
+        if (sim_next_hop(3, 0) != 1) {
+            printf("bp-bench: node 4 does not route through node 2\n");
+            return 1;
+        }
+        sim_airtime_frame_us = 300;
+        sim_airtime_byte_ns = 1000;
+        for (int i = 0; i < 6; i++) {
+            sim_select(i);
+            winc_mesh_set_backpressure(mode);
+        }
+        sim_flows[0] = (sim_flow_t){3, 0, 500, 10000, sim_now_us, 200, WINC_MESH_BULK};
+        sim_flow_count = 1;
+        for (int t = 0; t < 6000; t++) {
+            for (int n = 4; n < 6; n++) {
+                sim_select(n);
+                for (int m = 0; m < 4 && winc_mesh_send_ex(1, bulk, sizeof(bulk), WINC_MESH_BULK); m++)
+                    ;
+            }
+            sim_tick();
+        }
+        sim_run_until(1000, NULL, NULL);
+        detour[mode] = sim_traffic.delivered;
+        sim_select(3);
+        winc_mesh_get_bp_stats(&bs);
+        rerouted += bs.rerouted;
+        printf("detour bp %-3s: node 4 delivered %u of %u, rerouted %lu\n", names[mode],
+               sim_traffic.delivered, sim_traffic.offered, (unsigned long)bs.rerouted);
+    }
+
+    // No cost below saturation; beyond it goodput holds near its peak
+    // instead of collapsing, and the detour is taken
+    for (int k = 0; k < 6; k++) {
+        if (goodput[1][k] < goodput[0][k] * 0.95)
+            failed = 1;
+    }
+    if (goodput[1][5] < peak[1] * 0.8 || goodput[1][5] < goodput[0][5] * 1.5)
+        failed = 1;
+    if (!rerouted || detour[1] < detour[0] * 3 / 2)
+        failed = 1;
+    return failed;
+}
+
+// ===== SCENARIOS =====
+//
+// A scenario file is one command per line; '#' starts a comment. Nodes are
+// numbered from 1.
+//
+//   nodes <n>                     Start n fresh nodes with no links
+//   seed <n>                      Reseed the radio's loss PRNG
+//   airtime <frame_us> <byte_ns>  Per-datagram and per-byte radio cost
+//   link <a> <b> [opts]           Bring up a link; opts are loss <p>,
+//   line <a> <b> [opts]             delay <ms> and bw <bytes/s>. line
+//   grid <w> <h> [opts]             chains a..b, grid links nodes 1..w*h
+//   cut <a> <b>                   Take a link down
+//   down <n> / up <n>             Power a node off / reboot it
+//   converge [timeout_ms]         Run until routes match reachability
+//   traffic <src> <dst> <count> <interval_ms> <size> [reliable|alarm|bulk]...
+//   run <ms>                      Advance the clock
+//   mark                          Start the report's counters over from here
+//   report                        Print the metrics gathered so far
+//   expect <metric> <op> <value>  Fail the scenario unless it holds; op is
+//                                 one of < <= > >=, metric one of the
+//                                 report's names
+
+static uint32_t scn_converge_ms;
+static uint64_t scn_start_us;
+
+// Nodes j that node i can reach over up links and up nodes
+static void sim_reachable(int i, bool *seen) {
+    int stack[SIM_MAX_NODES], top = 0;
+
+    memset(seen, 0, sizeof(bool) * SIM_MAX_NODES);
+    seen[i] = true;
+    stack[top++] = i;
+    while (top) {
+        int a = stack[--top];
+        for (int b = 0; b < sim_node_count; b++) {
+            if (!seen[b] && sim_nodes[b].up && sim_links[a][b].up) {
+                seen[b] = true;
+                stack[top++] = b;
+            }
+        }
+    }
+}
+
+// Any topology: every live node has a route to exactly the nodes it can
+// reach, through a neighbour it still has a link to
+static bool sim_graph_converged(void) {
+    bool seen[SIM_MAX_NODES];
+
+    for (int i = 0; i < sim_node_count; i++) {
+        if (!sim_nodes[i].up)
+            continue;
+        sim_reachable(i, seen);
+        for (int j = 0; j < sim_node_count; j++) {
+            int hop = sim_next_hop(i, j);
+            bool routed = i != j && sim_metric(i, j) != WINC_MESH_METRIC_INFINITY;
+
+            if (i == j)
+                continue;
+            if (routed != seen[j])
+                return false;
+            if (routed && (hop < 0 || !sim_links[i][hop].up || !sim_nodes[hop].up))
+                return false;
+        }
+    }
+    return true;
+}
+
+static double scn_metric(const char *name) {
+    uint32_t secs = (sim_now_us - scn_start_us) / 1000000;
+    uint32_t all = 0;
+    int live = 0;
+
+    for (int t = 0; t < 16; t++)
+        all += sim_type_bytes[t];
+    for (int i = 0; i < sim_node_count; i++)
+        live += sim_nodes[i].up;
+
+    if (!strcmp(name, "converge_ms"))
+        return scn_converge_ms;
+    if (!strcmp(name, "delivery"))
+        return sim_traffic.offered ? (double)sim_traffic.delivered / sim_traffic.offered : 1.0;
+    if (!strcmp(name, "accepted"))
+        return sim_traffic.offered ? (double)sim_traffic.accepted / sim_traffic.offered : 1.0;
+    if (!strcmp(name, "latency_ms"))
+        return sim_traffic.delivered ? sim_traffic.lat_sum_us / 1000.0 / sim_traffic.delivered : 0;
+    if (!strcmp(name, "max_latency_ms"))
+        return sim_traffic.lat_max_us / 1000.0;
+    if (!strcmp(name, "hop_latency_ms"))
+        return sim_traffic.delivered ? sim_traffic.hop_lat_sum_us / 1000.0 / sim_traffic.delivered : 0;
+    if (!strcmp(name, "beacons_per_node_min"))
+        return secs && live ? sim_type_frames[MESH_MSG_BEACON] * 60.0 / secs / live : 0;
+    if (!strcmp(name, "beacon_bytes_per_node_min"))
+        return secs && live ? sim_type_bytes[MESH_MSG_BEACON] * 60.0 / secs / live : 0;
+    if (!strcmp(name, "beacon_share"))
+        return all ? (double)sim_type_bytes[MESH_MSG_BEACON] / all : 0;
+    return -1;
+}
+
+static void scn_report(void) {
+    printf("  converge_ms           %u\n", scn_converge_ms);
+    printf("  offered               %u (accepted %u)\n", sim_traffic.offered, sim_traffic.accepted);
+    printf("  delivered             %u\n", sim_traffic.delivered);
+    printf("  delivery              %.3f\n", scn_metric("delivery"));
+    printf("  latency_ms            %.2f (max %.2f)\n", scn_metric("latency_ms"),
+           scn_metric("max_latency_ms"));
+    printf("  hop_latency_ms        %.2f\n", scn_metric("hop_latency_ms"));
+    printf("  beacons_per_node_min  %.1f\n", scn_metric("beacons_per_node_min"));
+    printf("  beacon_bytes_per_node_min  %.0f\n", scn_metric("beacon_bytes_per_node_min"));
+    printf("  beacon_share          %.3f (%u of %u datagrams)\n", scn_metric("beacon_share"),
+           sim_type_frames[MESH_MSG_BEACON], sim_frames_sent);
+}
+
+// Parse "loss <p> delay <ms> bw <bytes/s>" into a link template
+static bool scn_link_opts(char **tok, sim_link_t *l) {
+    l->up = true;
+    l->delay_us = 1000;
+    for (char *k = strtok_r(NULL, " \t\r\n", tok); k; k = strtok_r(NULL, " \t\r\n", tok)) {
+        char *v = strtok_r(NULL, " \t\r\n", tok);
+        if (!v)
+            return false;
+        if (!strcmp(k, "loss"))
+            l->loss = atof(v);
+        else if (!strcmp(k, "delay"))
+            l->delay_us = atof(v) * 1000;
+        else if (!strcmp(k, "bw"))
+            l->bytes_per_s = atoi(v);
+        else
+            return false;
+    }
+    return true;
+}
+
+static void scn_link(int a, int b, const sim_link_t *l) {
+    sim_links[a][b] = sim_links[b][a] = *l;
+}
+
+static bool scn_node_ok(int n) {
+    return n >= 1 && n <= sim_node_count;
+}
+
+static void sim_restart(int i) {
+    char name[16];
+
+    memset(&sim_nodes[i].ctx, 0, sizeof(sim_nodes[i].ctx));
+    memset(&sim_nodes[i].mesh, 0, sizeof(sim_nodes[i].mesh));
+    sim_select(i);
+    snprintf(name, sizeof(name), "Sim%d", i + 1);
+    winc_mesh_init(i + 1, name);
+    winc_mesh_set_callback(sim_data_received);
+    sim_nodes[i].up = true;
+}
+
+static int cmd_run(const char *path) {
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    int lineno = 0, failed = 0;
+
+    if (!fp) {
+        perror(path);
+        return 2;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        char *tok, *cmd, *hash = strchr(line, '#');
+        int a = 0, b = 0;
+        sim_link_t l = {0};
+
+        lineno++;
+        if (hash)
+            *hash = '\0';
+        cmd = strtok_r(line, " \t\r\n", &tok);
+        if (!cmd)
+            continue;
+
+#define SCN_ARG(v)  do {                                    \
+            char *t_ = strtok_r(NULL, " \t\r\n", &tok);      \
+            if (!t_)                                        \
+                goto bad;                                   \
+            v = atoi(t_);                                   \
+        } while (0)
+
+        if (!strcmp(cmd, "nodes")) {
+            SCN_ARG(a);
+            if (a < 1 || a > SIM_MAX_NODES)
+                goto bad;
+            sim_reset(a);
+            sim_start();
+            scn_converge_ms = 0;
+            scn_start_us = sim_now_us;
+        } else if (!strcmp(cmd, "seed")) {
+            SCN_ARG(a);
+            sim_rng = 0x243F6A8885A308D3ull ^ ((uint64_t)a * 0x9E3779B97F4A7C15ull);
+        } else if (!strcmp(cmd, "airtime")) {
+            SCN_ARG(a);
+            SCN_ARG(b);
+            sim_airtime_frame_us = a;
+            sim_airtime_byte_ns = b;
+        } else if (!strcmp(cmd, "link") || !strcmp(cmd, "line")) {
+            SCN_ARG(a);
+            SCN_ARG(b);
+            if (!scn_node_ok(a) || !scn_node_ok(b) || a == b || !scn_link_opts(&tok, &l))
+                goto bad;
+            if (!strcmp(cmd, "link")) {
+                scn_link(a - 1, b - 1, &l);
+            } else {
+                for (int i = MIN(a, b); i < MAX(a, b); i++)
+                    scn_link(i - 1, i, &l);
+            }
+        } else if (!strcmp(cmd, "grid")) {
+            SCN_ARG(a);
+            SCN_ARG(b);
+            if (a < 1 || b < 1 || a * b > sim_node_count || !scn_link_opts(&tok, &l))
+                goto bad;
+            for (int y = 0; y < b; y++) {
+                for (int x = 0; x < a; x++) {
+                    if (x + 1 < a)
+                        scn_link(y * a + x, y * a + x + 1, &l);
+                    if (y + 1 < b)
+                        scn_link(y * a + x, (y + 1) * a + x, &l);
+                }
+            }
+        } else if (!strcmp(cmd, "cut")) {
+            SCN_ARG(a);
+            SCN_ARG(b);
+            if (!scn_node_ok(a) || !scn_node_ok(b))
+                goto bad;
+            sim_links[a - 1][b - 1].up = sim_links[b - 1][a - 1].up = false;
+        } else if (!strcmp(cmd, "down") || !strcmp(cmd, "up")) {
+            SCN_ARG(a);
+            if (!scn_node_ok(a))
+                goto bad;
+            if (cmd[0] == 'd')
+                sim_nodes[a - 1].up = false;
+            else
+                sim_restart(a - 1);
+        } else if (!strcmp(cmd, "converge")) {
+            char *t = strtok_r(NULL, " \t\r\n", &tok);
+            uint32_t timeout = t ? atoi(t) : 120000;
+
+            if (!sim_run_until(timeout, sim_graph_converged, &scn_converge_ms)) {
+                printf("%s:%d: NOT converged after %u ms\n", path, lineno, timeout);
+                failed = 1;
+            } else {
+                printf("%s:%d: converged in %u ms\n", path, lineno, scn_converge_ms);
+            }
+        } else if (!strcmp(cmd, "traffic")) {
+            sim_flow_t *f = &sim_flows[sim_flow_count];
+            int count, interval, size;
+
+            SCN_ARG(a);
+            SCN_ARG(b);
+            SCN_ARG(count);
+            SCN_ARG(interval);
+            SCN_ARG(size);
+            if (sim_flow_count == SIM_MAX_FLOWS || !scn_node_ok(a) || !scn_node_ok(b) ||
+                a == b || count < 1 || interval < 1 ||
+                size < (int)sizeof(sim_probe_t) || size > WINC_MESH_MAX_MESSAGE)
+                goto bad;
+            memset(f, 0, sizeof(*f));
+            for (char *o = strtok_r(NULL, " \t\r\n", &tok); o; o = strtok_r(NULL, " \t\r\n", &tok)) {
+                if (!strcmp(o, "reliable"))
+                    f->flags |= WINC_MESH_RELIABLE;
+                else if (!strcmp(o, "alarm"))
+                    f->flags |= WINC_MESH_ALARM;
+                else if (!strcmp(o, "bulk"))
+                    f->flags |= WINC_MESH_BULK;
+                else
+                    goto bad;
+            }
+            f->src = a - 1;
+            f->dst = b - 1;
+            f->left = count;
+            f->interval_us = interval * 1000;
+            f->next_us = sim_now_us;
+            f->size = size;
+            sim_flow_count++;
+        } else if (!strcmp(cmd, "run")) {
+            SCN_ARG(a);
+            sim_run_until(a, NULL, NULL);
+        } else if (!strcmp(cmd, "mark")) {
+            sim_frames_sent = 0;
+            memset(sim_type_frames, 0, sizeof(sim_type_frames));
+            memset(sim_type_bytes, 0, sizeof(sim_type_bytes));
+            memset(&sim_traffic, 0, sizeof(sim_traffic));
+            scn_start_us = sim_now_us;
+        } else if (!strcmp(cmd, "report")) {
+            printf("%s:%d: after %.1f s\n", path, lineno, (sim_now_us - scn_start_us) / 1e6);
+            scn_report();
+        } else if (!strcmp(cmd, "expect")) {
+            char *name = strtok_r(NULL, " \t\r\n", &tok);
+            char *op = strtok_r(NULL, " \t\r\n", &tok);
+            char *val = strtok_r(NULL, " \t\r\n", &tok);
+            double v, want;
+            bool ok;
+
+            if (!name || !op || !val || (v = scn_metric(name)) < 0)
+                goto bad;
+            want = atof(val);
+            if (!strcmp(op, "<"))
+                ok = v < want;
+            else if (!strcmp(op, "<="))
+                ok = v <= want;
+            else if (!strcmp(op, ">"))
+                ok = v > want;
+            else if (!strcmp(op, ">="))
+                ok = v >= want;
+            else
+                goto bad;
+            if (!ok) {
+                printf("%s:%d: FAILED: %s is %g, expected %s %s\n", path, lineno, name, v, op, val);
+                failed = 1;
+            }
+        } else {
+            goto bad;
+        }
+        continue;
+#undef SCN_ARG
+
+    bad:
+        fprintf(stderr, "%s:%d: bad command\n", path, lineno);
+        fclose(fp);
+        return 2;
+    }
+
+    fclose(fp);
+    return failed;
+}
+
+// ===== TIMER WHEEL CHECK =====
+
+// 2000 timers from 0 ms to beyond the wheel's span, started just before the
+// 32-bit ms clock wraps. Callbacks restart and cancel timers at random; the
+// clock advances by random steps or straight to winc_timer_next_ms(). No
+// timer may fire early, be overdue after a run, or outlive its expiry
+// unnoticed by winc_timer_next_ms().
+#define WHEEL_TIMERS 2000
+
+static winc_timer_t wheel_timers[WHEEL_TIMERS];
+static uint32_t wheel_expires[WHEEL_TIMERS];
+static uint32_t wheel_now;
+static int wheel_errors;
+
+static void wheel_fn(winc_timer_t *t, void *arg) {
+    int i = (int)(intptr_t)arg;
+
+    if ((int32_t)(wheel_now - wheel_expires[i]) < 0)
+        wheel_errors++;
+    if (sim_random() < 0.3) {
+        wheel_expires[i] = wheel_now + (uint32_t)(sim_random() * 100000);
+        winc_timer_start(t->wheel, t, wheel_expires[i]);
+    }
+    if (sim_random() < 0.2)
+        winc_timer_cancel(&wheel_timers[(int)(sim_random() * WHEEL_TIMERS)]);
+}
+
+static int cmd_wheel(void) {
+    static winc_timer_wheel_t w;
+    uint32_t steps = 0;
+
+    wheel_now = 0xFFFF0000u;
+    winc_timer_wheel_init(&w, wheel_now);
+    for (int i = 0; i < WHEEL_TIMERS; i++) {
+        winc_timer_init(&wheel_timers[i], wheel_fn, (void*)(intptr_t)i);
+        wheel_expires[i] = wheel_now + (uint32_t)(sim_random() < 0.8 ? sim_random() * 5000 :
+                                                  sim_random() * 20000000);
+        winc_timer_start(&w, &wheel_timers[i], wheel_expires[i]);
+    }
+
+    while (w.pending && steps++ < 200000) {
+        uint32_t next = winc_timer_next_ms(&w, wheel_now);
+
+        for (int i = 0; steps % 1000 == 0 && i < WHEEL_TIMERS; i++) {
+            if (winc_timer_pending(&wheel_timers[i]) &&
+                (int32_t)(wheel_expires[i] - (wheel_now + next)) < 0)
+                wheel_errors++;
+        }
+        wheel_now += sim_random() < 0.25 ? next : (uint32_t)(sim_random() * 50);
+        winc_timer_run(&w, wheel_now);
+        for (int i = 0; steps % 1000 == 0 && i < WHEEL_TIMERS; i++) {
+            if (winc_timer_pending(&wheel_timers[i]) &&
+                (int32_t)(wheel_now - wheel_expires[i]) >= 0)
+                wheel_errors++;
+        }
+    }
+
+    printf("wheel: %u callbacks in %u steps, %u still pending, %d errors\n",
+           w.fired, steps, w.pending, wheel_errors);
+    return wheel_errors || w.pending ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+    int argi = 1;
+
+    if (argi < argc && !strcmp(argv[argi], "-v")) {
+        sim_verbose = 1;
+        argi++;
+    }
+
+    if (argi < argc && !strcmp(argv[argi], "line"))
+        return cmd_line(argi + 1 < argc ? atoi(argv[argi + 1]) : 5);
+    if (argi < argc && !strcmp(argv[argi], "line-cut"))
+        return cmd_line_cut(argi + 1 < argc ? atoi(argv[argi + 1]) : 5);
+    if (argi < argc && !strcmp(argv[argi], "etx"))
+        return cmd_etx(argi + 1 < argc ? atof(argv[argi + 1]) : 0.5);
+    if (argi < argc && !strcmp(argv[argi], "dv-bench"))
+        return cmd_dv_bench(argi + 1 < argc ? atoi(argv[argi + 1]) : 10);
+    if (argi < argc && !strcmp(argv[argi], "agg-bench"))
+        return cmd_agg_bench();
+    if (argi < argc && !strcmp(argv[argi], "rel-bench"))
+        return cmd_rel_bench(argi + 1 < argc ? atof(argv[argi + 1]) : 0.1);
+    if (argi < argc && !strcmp(argv[argi], "prio-bench"))
+        return cmd_prio_bench();
+    if (argi < argc && !strcmp(argv[argi], "ping"))
+        return cmd_ping(argi + 1 < argc ? atoi(argv[argi + 1]) : 5);
+    if (argi < argc && !strcmp(argv[argi], "pin"))
+        return cmd_pin();
+    if (argi < argc && !strcmp(argv[argi], "order"))
+        return cmd_order(argi + 1 < argc ? atof(argv[argi + 1]) : 0.1);
+    if (argi < argc && !strcmp(argv[argi], "stream"))
+        return cmd_stream(argi + 1 < argc ? atof(argv[argi + 1]) : 0.05);
+    if (argi < argc && !strcmp(argv[argi], "tdma-bench"))
+        return cmd_tdma_bench();
+    if (argi < argc && !strcmp(argv[argi], "flood-bench"))
+        return cmd_flood_bench();
+    if (argi < argc && !strcmp(argv[argi], "bp-bench"))
+        return cmd_bp_bench();
+    if (argi < argc && !strcmp(argv[argi], "sync"))
+        return cmd_sync(argi + 1 < argc ? atoi(argv[argi + 1]) : 5);
+    if (argi < argc && !strcmp(argv[argi], "failover"))
+        return cmd_failover(argi + 1 < argc ? atoi(argv[argi + 1]) : 3000);
+    if (argi < argc && !strcmp(argv[argi], "frag"))
+        return cmd_frag(argi + 1 < argc ? atof(argv[argi + 1]) : 0);
+    if (argi < argc && !strcmp(argv[argi], "pubsub"))
+        return cmd_pubsub();
+    if (argi < argc && !strcmp(argv[argi], "rpc"))
+        return cmd_rpc(argi + 1 < argc ? atof(argv[argi + 1]) : 0.05);
+    if (argi < argc && !strcmp(argv[argi], "kv"))
+        return cmd_kv();
+    if (argi < argc && !strcmp(argv[argi], "wheel"))
+        return cmd_wheel();
+    if (argi + 1 < argc && !strcmp(argv[argi], "run"))
+        return cmd_run(argv[argi + 1]);
+
+    fprintf(stderr, "usage: %s [-v] line <n> | line-cut <n> | dv-bench [max] | etx [loss] | agg-bench | frag [loss] | rel-bench [loss] | prio-bench | ping [n] | pin | order [loss] | stream [loss] | failover [ms] | sync [n] | tdma-bench | flood-bench | bp-bench | pubsub | rpc [loss] | kv | run <file> | wheel\n",
+            argv[0]);
+    return 2;
+}
@@ -0,0 +1,44 @@
+// Host stand-in for the Pico SDK's pico/stdlib.h, used by the mesh simulator
+//
+// Only the clock functions the mesh layer needs are provided. Time comes
+// from the simulator's virtual clock (sim_now_us) rather than a hardware timer.
+
+#ifndef SIM_PICO_STDLIB_H
+#define SIM_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef uint64_t absolute_time_t;
+
+extern uint64_t sim_now_us;
+
+static inline absolute_time_t get_absolute_time(void) {
+    return sim_now_us;
+}
+
+static inline uint32_t to_ms_since_boot(absolute_time_t t) {
+    return (uint32_t)(t / 1000);
+}
+
+static inline uint64_t to_us_since_boot(absolute_time_t t) {
+    return t;
+}
+
+static inline uint32_t time_us_32(void) {
+    return (uint32_t)sim_now_us;
+}
+
+// The current node's own clock, offset and drifting from the virtual one
+uint64_t sim_clock_us(void);
+
+static inline uint64_t time_us_64(void) {
+    return sim_clock_us();
+}
+
+// Init loops only wait for conditions the simulator sets up front
+static inline void sleep_ms(uint32_t ms) {
+    (void)ms;
+}
+
+#endif // SIM_PICO_STDLIB_H
@@ -0,0 +1,127 @@
+// Driver context shared by winc_lib.c and winc_mesh.c
+//
+// Both files touch g_ctx directly, so its layout must be defined once: a
+// private copy that drifts (a smaller response union, fields in another
+// order) puts the mesh layer's reads on the wrong bytes with no warning.
+// Not part of the public API; applications use the winc_lib.h accessors.
+
+#ifndef WINC_CTX_H
+#define WINC_CTX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "winc_lib.h"
+
+// Socket address (network byte order)
+typedef struct {
+    uint16_t family, port;
+    uint32_t ip;
+} SOCK_ADDR;
+
+// Socket handler callback
+typedef void (* SOCK_HANDLER)(uint8_t sock, int rxlen);
+
+// Response messages
+typedef struct {
+    uint32_t self, gate, dns, mask, lease;
+} DHCP_RESP_MSG;
+
+typedef struct {
+    uint8_t sock, status;
+    uint16_t session;
+} BIND_RESP_MSG;
+
+typedef struct {
+    SOCK_ADDR addr;
+    uint8_t listen_sock, conn_sock;
+    uint16_t oset;
+} ACCEPT_RESP_MSG;
+
+typedef struct {
+    SOCK_ADDR addr;
+    int16_t dlen;
+    uint16_t oset;
+    uint8_t sock, x;
+    uint16_t session;
+} RECV_RESP_MSG;
+
+// Response message union
+typedef union {
+    uint8_t data[16];
+    int val;
+    DHCP_RESP_MSG dhcp;
+    BIND_RESP_MSG bind;
+    ACCEPT_RESP_MSG accept;
+    RECV_RESP_MSG recv;
+} RESP_MSG;
+
+// Socket storage structure
+typedef struct {
+    SOCK_ADDR addr;
+    uint16_t localport, session;
+    int state, conn_sock;
+    uint32_t hif_data_addr;
+    SOCK_HANDLER handler;
+} SOCKET;
+
+// ===== GLOBAL CONTEXT (some from winc_sock)=====
+typedef struct {
+    // Hardware pins
+    struct {
+        uint8_t sck, mosi, miso, cs, wake, reset, irq;
+    } pins;
+
+    // SPI buffer
+    uint8_t txbuf[1600];
+    uint8_t rxbuf[1600];
+    uint8_t tx_zeros[1024];
+
+    // Socket
+    SOCKET sockets[10];
+    uint8_t databuf[1600];
+    RESP_MSG resp_msg;
+
+    // Config
+    int verbose;
+    bool use_crc;
+
+    // Firmware
+    uint8_t fw_major, fw_minor, fw_patch;
+    uint8_t mac[6];
+
+    // Mesh state
+    struct {
+        uint8_t my_node_id;
+        char my_name[16];
+        bool enabled;
+        int udp_socket;
+
+        // Routing table
+        struct {
+            uint8_t node_id;
+            uint8_t next_hop;
+            uint8_t hop_count;
+            uint32_t last_seen;
+            bool active;
+        } routes[WINC_MESH_MAX_NODES];
+        uint8_t route_count;
+
+        uint16_t seq_num;
+        uint32_t last_beacon;
+
+        // Data callback
+        void (*data_callback)(uint8_t, uint8_t*, uint16_t);
+    } mesh;
+
+    // Connection state tracking
+    struct {
+        bool connected;
+        bool dhcp_done;
+        bool ap_mode;
+        uint32_t my_ip;
+    } connection_state;
+} winc_ctx_t;
+
+extern winc_ctx_t g_ctx;    // Defined in winc_lib.c
+
+#endif // WINC_CTX_H
@@ -9,6 +9,7 @@ adapted for global use as simplified API for Pico microcontroller platform */
 #include "hardware/spi.h"
 #include "hardware/gpio.h"
 #include "winc_lib.h"
+#include "winc_ctx.h"
 
 
 // Header for incoming HIF message
@@ -17,15 +18,6 @@ typedef struct {
     uint16_t len;
 } HIF_HDR;
 
-// Socket address (network byte order)
-typedef struct {
-    uint16_t family, port;
-    uint32_t ip;
-} SOCK_ADDR;
-
-// Socket handler callback
-typedef void (* SOCK_HANDLER)(uint8_t sock, int rxlen);
-
 // Socket bind command
 typedef struct {
     SOCK_ADDR saddr;
@@ -75,49 +67,6 @@ typedef struct {
     uint16_t reserved;     
 } CONNECT_RESP_MSG;
 
-// Response messages
-typedef struct {
-    uint32_t self, gate, dns, mask, lease;
-} DHCP_RESP_MSG;
-
-typedef struct {
-    uint8_t sock, status;
-    uint16_t session;
-} BIND_RESP_MSG;
-
-typedef struct {
-    SOCK_ADDR addr;
-    uint8_t listen_sock, conn_sock;
-    uint16_t oset;
-} ACCEPT_RESP_MSG;
-
-typedef struct {
-    SOCK_ADDR addr;
-    int16_t dlen;
-    uint16_t oset;
-    uint8_t sock, x;
-    uint16_t session;
-} RECV_RESP_MSG;
-
-// Response message union
-typedef union {
-    uint8_t data[16];
-    int val;
-    DHCP_RESP_MSG dhcp;
-    BIND_RESP_MSG bind;
-    ACCEPT_RESP_MSG accept;
-    RECV_RESP_MSG recv;
-} RESP_MSG;
-
-// Socket storage structure
-typedef struct {
-    SOCK_ADDR addr;
-    uint16_t localport, session;
-    int state, conn_sock;
-    uint32_t hif_data_addr;
-    SOCK_HANDLER handler;
-} SOCKET;
-
 // P2P enable command
 typedef struct {
     uint8_t channel;
@@ -129,64 +78,6 @@ static void sock_state(uint8_t sock, int news);
 bool winc_mesh_init(uint8_t node_id, const char *node_name);
 void winc_mesh_process(void);
 
-// ===== GLOBAL CONTEXT (some from winc_sock)=====
-typedef struct {
-    // Hardware pins
-    struct {
-        uint8_t sck, mosi, miso, cs, wake, reset, irq;
-    } pins;
-
-    // SPI buffer
-    uint8_t txbuf[1600];
-    uint8_t rxbuf[1600];
-    uint8_t tx_zeros[1024];
-    
-    // Socket 
-    SOCKET sockets[10];
-    uint8_t databuf[1600];
-    RESP_MSG resp_msg;
-
-    // Config
-    int verbose;
-    bool use_crc;
-
-    // Firmware
-    uint8_t fw_major, fw_minor, fw_patch;
-    uint8_t mac[6];
-
-    // Mesh state
-    struct {
-        uint8_t my_node_id;
-        char my_name[16];
-        bool enabled;
-        int udp_socket;
-
-        // Routing table
-        struct {
-            uint8_t node_id;
-            uint8_t next_hop;
-            uint8_t hop_count;
-            uint32_t last_seen;
-            bool active;
-        } routes[8];
-        uint8_t route_count;
-
-        uint16_t seq_num;
-        uint32_t last_beacon;
-
-        // Data callback
-        void (*data_callback)(uint8_t, uint8_t*, uint16_t);
-    } mesh;
-
-    // Connection state tracking
-    struct {
-        bool connected;
-        bool dhcp_done;
-        bool ap_mode;
-        uint32_t my_ip;
-    } connection_state;
-} winc_ctx_t;
-
 winc_ctx_t g_ctx;    // Global context (accessible to winc_mesh.c)
 
 // ====== UTILITY FUNCTIONS (from winc_wifi and winc_sock) ====== 
@@ -519,9 +410,9 @@ static bool hif_rx_done(void) {
             spi_write_reg(RCV_CTRL_REG0, val | 2));
 }
 
-static bool join_net(char *ssid, char *pass) {
+static bool join_net(char *ssid, char *pass, uint8_t channel) {
 #if NEW_JOIN
-    CONN_HDR ch = {pass ? 0x98 : 0x2c, CRED_STORE, ANY_CHAN, strlen(ssid), "",
+    CONN_HDR ch = {pass ? 0x98 : 0x2c, CRED_STORE, channel, strlen(ssid), "",
                    pass ? AUTH_PSK : AUTH_OPEN, {0, 0, 0}};
     PSK_DATA pd;
 
@@ -535,7 +426,7 @@ static bool join_net(char *ssid, char *pass) {
     }
     return hif_put(GOP_CONN_REQ_NEW, &ch, sizeof(CONN_HDR), 0, 0, 0);
 #else
-    OLD_CONN_HDR och = {"", pass ? AUTH_PSK : AUTH_OPEN, {0, 0}, ANY_CHAN, "", 1, {0, 0}};
+    OLD_CONN_HDR och = {"", pass ? AUTH_PSK : AUTH_OPEN, {0, 0}, channel, "", 1, {0, 0}};
 
     strcpy(och.ssid, ssid);
     strcpy(och.psk, pass ? pass : "");
@@ -904,12 +795,16 @@ void interrupt_handler(void) {
 
 // ====== AP MODE FUNCTIONS ======
 
-// Start AP mode (SoftAP)
-bool winc_start_ap(const char *ssid, const char *password, uint8_t channel) {
+// Ask for AP mode; the connection state is set when the WINC reports it up
+bool winc_ap_begin(const char *ssid, const char *password, uint8_t channel) {
     AP_CONFIG ap_cfg;
 
     printf("Starting AP mode: %s (channel %u)\n", ssid, channel);
 
+    g_ctx.connection_state.connected = false;
+    g_ctx.connection_state.dhcp_done = false;
+    g_ctx.connection_state.ap_mode = false;
+
     memset(&ap_cfg, 0, sizeof(ap_cfg));
     strncpy(ap_cfg.ssid, ssid, 32);
     ap_cfg.channel = channel;
@@ -927,10 +822,15 @@ bool winc_start_ap(const char *ssid, const char *password, uint8_t channel) {
 
     bool ok = hif_put(GOP_AP_ENABLE, &ap_cfg, sizeof(ap_cfg), 0, 0, 0);
 
-    if (!ok) {
+    if (!ok)
         printf("ERROR: Failed to start AP mode\n");
+    return ok;
+}
+
+// Start AP mode (SoftAP)
+bool winc_start_ap(const char *ssid, const char *password, uint8_t channel) {
+    if (!winc_ap_begin(ssid, password, channel))
         return false;
-    }
 
     printf("AP mode command sent, waiting for ready...\n");
 
@@ -941,6 +841,8 @@ bool winc_start_ap(const char *ssid, const char *password, uint8_t channel) {
         if (gpio_get(g_ctx.pins.irq) == 0) {
             interrupt_handler();
         }
+        if (g_ctx.connection_state.connected && g_ctx.connection_state.dhcp_done)
+            break;
         sleep_ms(100);
     }
 
@@ -954,11 +856,19 @@ bool winc_stop_ap(void) {
     return hif_put(GOP_AP_DISABLE, NULL, 0, 0, 0, 0);
 }
 
+// Ask to join an AP; the connection state is set on association and DHCP
+bool winc_sta_begin(const char *ssid, const char *password, uint8_t channel) {
+    g_ctx.connection_state.connected = false;
+    g_ctx.connection_state.dhcp_done = false;
+    g_ctx.connection_state.ap_mode = false;
+    return join_net((char*)ssid, (char*)password, channel);
+}
+
 // Connect to AP (station mode)
 bool winc_connect_sta(const char *ssid, const char *password) {
     printf("Connecting to AP: %s\n", ssid);
 
-    if (!join_net((char*)ssid, (char*)password)) {
+    if (!winc_sta_begin(ssid, password, ANY_CHAN)) {
         printf("ERROR: Failed to start connection\n");
         return false;
     }
@@ -1051,9 +961,23 @@ bool winc_init(uint8_t node_id, const char *node_name) {
     chip_get_info();
     printf("Firmware version: %d.%d.%d\n", g_ctx.fw_major, g_ctx.fw_minor, g_ctx.fw_patch);
 
-    // Initialize mesh networking (will configure AP or Client mode based on node_id)
+    // Initialize mesh networking; it joins or starts the AP in the background
     printf("\nStarting mesh initialization...\n");
     bool mesh_result = winc_mesh_init(node_id, node_name);
+
+    // Wait for the role election: while we are joining, until our turn at
+    // the AP has come and an AP start has had time to finish
+    while (mesh_result && !g_ctx.mesh.enabled) {
+        winc_mesh_role_stats_t rs;
+
+        winc_mesh_get_role_stats(&rs);
+        if (rs.role != WINC_MESH_ROLE_JOINING &&
+            (int32_t)(to_ms_since_boot(get_absolute_time()) - rs.takeover_at) >= WINC_MESH_AP_START_MS)
+            break;
+        winc_poll();
+        winc_idle(100);
+    }
+    mesh_result = mesh_result && g_ctx.mesh.enabled;
     printf("Mesh init returned: %s\n", mesh_result ? "SUCCESS" : "FAILURE");
 
     return mesh_result;
@@ -1069,12 +993,44 @@ void winc_poll(void) {
     winc_mesh_process();
 }
 
+// The interrupt itself ends the WFE in winc_idle(); nothing to do here
+static void winc_irq_wake(uint gpio, uint32_t events) {
+}
+
+void winc_idle(uint32_t max_ms) {
+    static bool irq_armed = false;
+    absolute_time_t until = make_timeout_time_ms(MIN(max_ms, winc_mesh_next_deadline_ms()));
+
+    if (!irq_armed) {
+        gpio_set_irq_enabled_with_callback(g_ctx.pins.irq, GPIO_IRQ_EDGE_FALL, true, winc_irq_wake);
+        irq_armed = true;
+    }
+
+    // The IRQ line stays low until serviced, so an edge missed before
+    // sleeping is still seen here
+    while (gpio_get(g_ctx.pins.irq) != 0 && !time_reached(until))
+        best_effort_wfe_or_timeout(until);
+}
+
 void winc_mesh_set_callback(void (*callback)(uint8_t src_node, uint8_t *data, uint16_t len)) {
     g_ctx.mesh.data_callback = callback;
 }
 
 // winc_mesh_send is implemented in winc_mesh.c
 
+bool winc_mesh_ping(uint8_t dst_node, uint8_t count, uint16_t size,
+                    winc_mesh_ping_result_t *result) {
+    if (!winc_mesh_ping_start(dst_node, count, size)) {
+        memset(result, 0, sizeof(*result));
+        return false;
+    }
+    while (!winc_mesh_ping_result(result)) {
+        winc_poll();
+        winc_idle(WINC_MESH_PING_INTERVAL_MS);
+    }
+    return result->received > 0;
+}
+
 void winc_mesh_print_routes(void) {
     printf("Mesh Routing Table (Node %u - \"%s\"):\n", g_ctx.mesh.my_node_id, g_ctx.mesh.my_name);
     for (int i = 0; i < g_ctx.mesh.route_count; i++) {
@@ -1131,6 +1087,10 @@ bool winc_is_network_ready(void) {
     return g_ctx.connection_state.ap_mode;
 }
 
+bool winc_is_connected(void) {
+    return g_ctx.connection_state.connected;
+}
+
 bool winc_wait_for_network(uint32_t timeout_ms) {
     uint32_t start = to_ms_since_boot(get_absolute_time());
 
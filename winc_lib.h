@@ -56,6 +56,50 @@
 #define WINC_MESH_PORT  1025  // UDP port for mesh communication
 #endif
 
+// Group owner election
+// One node runs the access point (the group owner) and the rest join it
+// as stations. The lowest live node id wins: at boot every node first
+// tries to join for WINC_MESH_BOOT_JOIN_MS, then ranks itself by id among
+// the nodes it has heard and the k-th in line waits a further
+// k * WINC_MESH_GO_TAKEOVER_MS before starting its own AP. A node that has
+// heard nobody has only its id to go on and takes rank id - 1. When the
+// owner is lost the survivors rank themselves the same way, and an owner
+// that hears a lower-id owner hands the AP over to it.
+#ifndef WINC_MESH_SSID
+#define WINC_MESH_SSID                "CAPSULE-MESH"
+#endif
+
+#ifndef WINC_MESH_PASSWORD
+#define WINC_MESH_PASSWORD            "capsule123"
+#endif
+
+#ifndef WINC_MESH_BOOT_JOIN_MS
+#define WINC_MESH_BOOT_JOIN_MS        3000
+#endif
+
+#ifndef WINC_MESH_GO_TAKEOVER_MS
+#define WINC_MESH_GO_TAKEOVER_MS      12000  // Must cover an AP start plus a join
+#endif
+
+#ifndef WINC_MESH_JOIN_RETRY_MS
+#define WINC_MESH_JOIN_RETRY_MS       1500
+#endif
+
+#ifndef WINC_MESH_AP_START_MS
+#define WINC_MESH_AP_START_MS         10000  // Give up on an AP start after this
+#endif
+
+// The owner beacons at least every WINC_MESH_GO_HEARTBEAT_MS; stations
+// that hear nothing from it for WINC_MESH_GO_TIMEOUT_MS hold an election
+// even if the WINC still reports the link up
+#ifndef WINC_MESH_GO_HEARTBEAT_MS
+#define WINC_MESH_GO_HEARTBEAT_MS     2000
+#endif
+
+#ifndef WINC_MESH_GO_TIMEOUT_MS
+#define WINC_MESH_GO_TIMEOUT_MS       (3 * WINC_MESH_GO_HEARTBEAT_MS)
+#endif
+
 #ifndef WINC_MESH_BEACON_INTERVAL_MS
 #define WINC_MESH_BEACON_INTERVAL_MS  5000  // 5 seconds
 #endif
@@ -65,93 +109,1467 @@
 #endif
 
 #ifndef WINC_MESH_MAX_NODES
-#define WINC_MESH_MAX_NODES 8
+#define WINC_MESH_MAX_NODES 8   // A full beacon must still fit WINC_MESH_MTU (checked)
+#endif
+
+#ifndef WINC_MESH_MAX_HOPS
+#define WINC_MESH_MAX_HOPS  15  // Longest usable route
+#endif
+
+// Route metric is cumulative ETX (expected transmissions) in fixed point
+#define WINC_MESH_ETX_ONE          16     // ETX 1.0, a perfect link
+#define WINC_MESH_METRIC_INFINITY  255    // Unreachable
+
+#ifndef WINC_MESH_ETX_MAX_LINK
+#define WINC_MESH_ETX_MAX_LINK      (8 * WINC_MESH_ETX_ONE)  // Worse links are unusable
+#endif
+
+#ifndef WINC_MESH_HOLDDOWN_MS
+#define WINC_MESH_HOLDDOWN_MS       3000   // Ignore worse paths after a route fails
+#endif
+
+// Trickle beacon scheduling (RFC 6206 style)
+// The beacon interval doubles from IMIN to IMAX while the topology is stable
+// and resets to IMIN on any change. Set WINC_MESH_TRICKLE=0 to fall back to
+// a fixed WINC_MESH_BEACON_INTERVAL_MS.
+#ifndef WINC_MESH_TRICKLE
+#define WINC_MESH_TRICKLE  1
+#endif
+
+#ifndef WINC_MESH_TRICKLE_IMIN_MS
+#define WINC_MESH_TRICKLE_IMIN_MS     500
+#endif
+
+#ifndef WINC_MESH_TRICKLE_IMAX_MS
+#define WINC_MESH_TRICKLE_IMAX_MS     8000   // Beacons never gap more than route timeout / 3
+#endif
+
+#ifndef WINC_MESH_TRICKLE_K
+#define WINC_MESH_TRICKLE_K           2      // Suppress after K consistent beacons
+#endif
+
+// Fragmentation
+// Payloads above WINC_MESH_MTU are split into fragments that are routed on
+// their own and reassembled by the destination, which holds up to
+// WINC_MESH_REASM_SLOTS partial messages in pool frames and copies each
+// complete one into a single WINC_MESH_MAX_MESSAGE buffer. With
+// WINC_MESH_REASM_SLOTS=0 there is no buffer and fragments are dropped.
+#ifndef WINC_MESH_MTU
+#define WINC_MESH_MTU                 1400   // Largest payload sent in one frame
+#endif
+
+#ifndef WINC_MESH_MAX_MESSAGE
+#define WINC_MESH_MAX_MESSAGE         16384  // Largest winc_mesh_send() payload
+#endif
+
+#ifndef WINC_MESH_REASM_SLOTS
+#define WINC_MESH_REASM_SLOTS         2
+#endif
+
+#ifndef WINC_MESH_REASM_TIMEOUT_MS
+#define WINC_MESH_REASM_TIMEOUT_MS    5000   // Drop a message missing fragments
+#endif
+
+// Hop-by-hop reliability for frames sent with WINC_MESH_RELIABLE
+// Each hop ACKs what it receives; unACKed frames are resent after an RTO
+// derived from the measured RTT of that link, up to WINC_MESH_MAX_RETRIES.
+#ifndef WINC_MESH_RTX_SLOTS
+#define WINC_MESH_RTX_SLOTS           16     // Frames awaiting ACK, all neighbours
+#endif
+
+#ifndef WINC_MESH_MAX_RETRIES
+#define WINC_MESH_MAX_RETRIES         4
+#endif
+
+#ifndef WINC_MESH_RTO_INIT_MS
+#define WINC_MESH_RTO_INIT_MS         100    // Until the link has an RTT sample
+#endif
+
+#ifndef WINC_MESH_RTO_MIN_MS
+#define WINC_MESH_RTO_MIN_MS          5
+#endif
+
+#ifndef WINC_MESH_RTO_MAX_MS
+#define WINC_MESH_RTO_MAX_MS          2000
+#endif
+
+#ifndef WINC_MESH_DUP_CACHE
+#define WINC_MESH_DUP_CACHE           WINC_MESH_MAX_NODES  // Sources tracked for resends
+#endif
+
+// Frame pool
+// Every mesh frame buffer - queued for the radio, kept for retransmission or
+// collecting an aggregate - comes from one static pool, so sending and
+// forwarding never allocate. Each frame holds one WINC_MESH_MTU datagram.
+#ifndef WINC_MESH_POOL_FRAMES
+#define WINC_MESH_POOL_FRAMES         32     // Frame buffers shared by all queues (max 127)
+#endif
+
+// Transmit queues
+// Frames wait in one queue per priority class. Control and alarm queues are
+// served strictly first, normal and bulk share the rest by weight (deficit
+// round robin). Frames are handed to the WINC only while the estimated
+// airtime already queued in it is below WINC_MESH_TX_BACKLOG_US, so an
+// alarm never waits behind a burst of bulk data inside the module.
+
+#ifndef WINC_MESH_TXQ_DEPTH
+#define WINC_MESH_TXQ_DEPTH           12     // Most frames one class may queue (a 16 KB message)
+#endif
+
+#ifndef WINC_MESH_WEIGHT_NORMAL
+#define WINC_MESH_WEIGHT_NORMAL       4      // Share of normal vs bulk traffic
+#endif
+
+#ifndef WINC_MESH_WEIGHT_BULK
+#define WINC_MESH_WEIGHT_BULK         1
+#endif
+
+#ifndef WINC_MESH_TX_FRAME_US
+#define WINC_MESH_TX_FRAME_US         400    // Airtime estimate: per datagram
+#endif
+
+#ifndef WINC_MESH_TX_BYTE_NS
+#define WINC_MESH_TX_BYTE_NS          1000   // Airtime estimate: per byte
+#endif
+
+#ifndef WINC_MESH_TX_BACKLOG_US
+#define WINC_MESH_TX_BACKLOG_US       1000   // Airtime allowed inside the WINC
+#endif
+
+// Slotted transmission
+// With WINC_MESH_TDMA_SLOTS set, mesh time is cut into superframes of that
+// many WINC_MESH_TDMA_SLOT_US slots, and node n may start normal and bulk
+// frames only in slot (n - 1) % slots, leaving WINC_MESH_TDMA_GUARD_US at
+// both ends for clock error. Control and alarm frames go at once. Until a
+// node has mesh time it sends freely. winc_mesh_set_tdma() changes this at
+// run time.
+#ifndef WINC_MESH_TDMA_SLOTS
+#define WINC_MESH_TDMA_SLOTS          0      // 0 = off
+#endif
+
+#ifndef WINC_MESH_TDMA_SLOT_US
+#define WINC_MESH_TDMA_SLOT_US        2000
+#endif
+
+#ifndef WINC_MESH_TDMA_GUARD_US
+#define WINC_MESH_TDMA_GUARD_US       150
+#endif
+
+// Data frame aggregation
+// Small data frames for the same next hop are packed into one datagram and
+// sent when WINC_MESH_AGG_MAX_BYTES would be exceeded or WINC_MESH_AGG_DELAY_US
+// after the first one was queued, checked in microseconds on every
+// winc_mesh_process() call. Set WINC_MESH_AGGREGATE=0 to send every frame on
+// its own (needed when talking to nodes without aggregation).
+#ifndef WINC_MESH_AGGREGATE
+#define WINC_MESH_AGGREGATE  1
+#endif
+
+#ifndef WINC_MESH_AGG_DELAY_US
+#define WINC_MESH_AGG_DELAY_US        2000   // Longest a frame waits for company
+#endif
+
+#ifndef WINC_MESH_AGG_MAX_BYTES
+#define WINC_MESH_AGG_MAX_BYTES       1024   // Sub-frame bytes per datagram
+#endif
+
+#ifndef WINC_MESH_AGG_MAX_FRAME
+#define WINC_MESH_AGG_MAX_FRAME       128    // Larger payloads are sent alone
+#endif
+
+#ifndef WINC_MESH_AGG_QUEUES
+#define WINC_MESH_AGG_QUEUES          4      // Next hops batched at once
+#endif
+
+// Network-wide broadcast
+// Data sent to WINC_MESH_BROADCAST reaches every node. Each transmitter
+// picks the fewest neighbours whose own neighbours, as their beacons list
+// them, cover all its two-hop neighbours (its multipoint relays), and only
+// those send it on. The last WINC_MESH_FLOOD_CACHE broadcasts are
+// remembered so each node delivers and relays one only once.
+// WINC_MESH_MPR=0 has every neighbour relay (blind flooding).
+#ifndef WINC_MESH_MPR
+#define WINC_MESH_MPR                 1
+#endif
+
+#ifndef WINC_MESH_FLOOD_CACHE
+#define WINC_MESH_FLOOD_CACHE         32
+#endif
+
+// Pinned paths
+// winc_mesh_set_path() or winc_mesh_learn_path() pins a path of up to
+// WINC_MESH_MAX_PATH hops to a destination, for up to WINC_MESH_PATH_SLOTS
+// destinations. Frames sent with WINC_MESH_PINNED carry that path and each
+// forwarder sends them to the next hop it names, never consulting its
+// routing table, so route changes elsewhere leave them alone.
+#ifndef WINC_MESH_MAX_PATH
+#define WINC_MESH_MAX_PATH            8
+#endif
+
+#ifndef WINC_MESH_PATH_SLOTS
+#define WINC_MESH_PATH_SLOTS          4
+#endif
+
+// Backpressure
+// Every datagram's header carries its sender's queue pressure, 0-3, from
+// how full its frame pool and normal and bulk queues are. A report holds
+// for WINC_MESH_BP_HOLD_MS; a node beacons when it reaches level 2 or
+// drops below it, and twice per hold in between.
+// Towards a next hop at level 2 or more, normal and bulk frames take an
+// alternate neighbour whose route is at most one ETX worse; failing that
+// the source refuses new bulk frames, and at level 3 lets normal frames
+// through only every WINC_MESH_BP_PACE_MS and holds queued bulk frames
+// back. Alarm and control traffic are never throttled.
+#ifndef WINC_MESH_BACKPRESSURE
+#define WINC_MESH_BACKPRESSURE        1
+#endif
+
+#ifndef WINC_MESH_BP_HOLD_MS
+#define WINC_MESH_BP_HOLD_MS          1000
+#endif
+
+#ifndef WINC_MESH_BP_PACE_MS
+#define WINC_MESH_BP_PACE_MS          20
+#endif
+
+// In-order delivery
+// A frame sent with WINC_MESH_ORDERED names the seq_num of the previous
+// ordered frame to the same destination, which hands them to data_callback
+// in that order. Up to WINC_MESH_REORDER_WINDOW early frames per source,
+// for WINC_MESH_REORDER_SLOTS sources, wait in pool frames for the ones
+// before them, leaving the last quarter of the pool to the transmit
+// queues. A missing frame is given up on after
+// WINC_MESH_REORDER_TIMEOUT_MS or when the window is full; if it turns up
+// after that it is dropped as late.
+#ifndef WINC_MESH_REORDER_SLOTS
+#define WINC_MESH_REORDER_SLOTS       4
+#endif
+
+#ifndef WINC_MESH_REORDER_WINDOW
+#define WINC_MESH_REORDER_WINDOW      8
+#endif
+
+#ifndef WINC_MESH_REORDER_TIMEOUT_MS
+#define WINC_MESH_REORDER_TIMEOUT_MS  300
+#endif
+
+// Streams
+// Connection-oriented byte streams between any two nodes, however many
+// hops apart. Each of the WINC_MESH_STREAMS sockets buffers
+// WINC_MESH_STREAM_BUF bytes each way (a power of two). The receive buffer
+// bounds what the peer may have in flight; within it a congestion window
+// grows until the path starts losing segments and halves when it does.
+// Segments carry up to WINC_MESH_STREAM_MSS bytes. One is sent again as
+// soon as selective ACKs show it missing, else once the retransmit timeout
+// (from measured round trips, WINC_MESH_STREAM_RTO_MIN_MS to _MAX_MS)
+// passes; WINC_MESH_STREAM_RETRIES timeouts in a row reset the connection.
+// ACKs for in-order data wait up to WINC_MESH_STREAM_ACK_DELAY_MS for a
+// second segment to cover.
+#ifndef WINC_MESH_STREAMS
+#define WINC_MESH_STREAMS             2      // 0 compiles streams and their buffers out
+#endif
+
+#ifndef WINC_MESH_STREAM_BUF
+#define WINC_MESH_STREAM_BUF          8192   // Bytes each way, per stream
+#endif
+
+#ifndef WINC_MESH_STREAM_MSS
+#define WINC_MESH_STREAM_MSS          1024
+#endif
+
+#ifndef WINC_MESH_STREAM_RTO_INIT_MS
+#define WINC_MESH_STREAM_RTO_INIT_MS  250    // Until the first round trip is measured
+#endif
+
+#ifndef WINC_MESH_STREAM_RTO_MIN_MS
+#define WINC_MESH_STREAM_RTO_MIN_MS   20
 #endif
 
-// ============================================================================
-// PUBLIC API
-// ============================================================================
+#ifndef WINC_MESH_STREAM_RTO_MAX_MS
+#define WINC_MESH_STREAM_RTO_MAX_MS   4000
+#endif
+
+#ifndef WINC_MESH_STREAM_RETRIES
+#define WINC_MESH_STREAM_RETRIES      10
+#endif
+
+#ifndef WINC_MESH_STREAM_ACK_DELAY_MS
+#define WINC_MESH_STREAM_ACK_DELAY_MS 10
+#endif
+
+// Publish/subscribe
+// Topic names hash to 16-bit ids. A node subscribes to up to
+// WINC_MESH_TOPICS of them, each with its own handler. Beacons carry every
+// node's topic list under a version number, so each node learns who wants
+// what. A publication leaves as one copy per next hop towards its
+// subscribers, naming the ones that copy is for; each forwarder delivers it
+// if named and splits the rest the same way, so branches without
+// subscribers never carry it.
+#ifndef WINC_MESH_TOPICS
+#define WINC_MESH_TOPICS              8
+#endif
+
+// RPC
+// winc_mesh_rpc_call() runs a method registered on another node and
+// completes through a callback, from winc_poll(), with the result or once
+// its deadline passes. Up to WINC_MESH_RPC_CALLS calls (a power of two)
+// are outstanding at once; a reply's correlation id names its call's slot,
+// so matching it takes no search. A request still unanswered after
+// WINC_MESH_RPC_RETRY_MS is sent again, the wait doubling each time. A
+// node remembers its last WINC_MESH_RPC_REPLIES replies and answers a
+// repeated request from them, so a handler runs once per call. Arguments
+// and results are up to WINC_MESH_RPC_MAX bytes each.
+#ifndef WINC_MESH_RPC_CALLS
+#define WINC_MESH_RPC_CALLS           8
+#endif
+
+#ifndef WINC_MESH_RPC_METHODS
+#define WINC_MESH_RPC_METHODS         8      // Handlers registered at once
+#endif
+
+#ifndef WINC_MESH_RPC_REPLIES
+#define WINC_MESH_RPC_REPLIES         4
+#endif
+
+#ifndef WINC_MESH_RPC_RETRY_MS
+#define WINC_MESH_RPC_RETRY_MS        200
+#endif
+
+#ifndef WINC_MESH_RPC_MAX
+#define WINC_MESH_RPC_MAX             256
+#endif
+
+// Replicated key-value store
+// Every node keeps a copy of up to WINC_MESH_KV_KEYS entries of at most
+// WINC_MESH_KV_VALUE_MAX bytes; the newest write to a key wins everywhere.
+// An entry written or newly learned rides in the node's next beacon, sent
+// within WINC_MESH_KV_PACE_MS, with up to WINC_MESH_KV_BEACON_MAX bytes of
+// such entries per beacon. Beacons also carry a digest of the store. Once
+// nothing has changed for WINC_MESH_KV_HOLD_MS, a node whose neighbour's
+// digest still differs from its own sends it the versions it holds, and
+// each side then sends only the entries the other lacks, at most once per
+// neighbour per WINC_MESH_KV_HOLD_MS.
+#ifndef WINC_MESH_KV_KEYS
+#define WINC_MESH_KV_KEYS             16
+#endif
+
+#ifndef WINC_MESH_KV_VALUE_MAX
+#define WINC_MESH_KV_VALUE_MAX        32
+#endif
+
+#ifndef WINC_MESH_KV_BEACON_MAX
+#define WINC_MESH_KV_BEACON_MAX       128
+#endif
+
+#ifndef WINC_MESH_KV_PACE_MS
+#define WINC_MESH_KV_PACE_MS          40
+#endif
+
+#ifndef WINC_MESH_KV_HOLD_MS
+#define WINC_MESH_KV_HOLD_MS          500
+#endif
+
+// Ping
+// winc_mesh_ping() sends one echo request every WINC_MESH_PING_INTERVAL_MS
+// and waits WINC_MESH_PING_TIMEOUT_MS after the last for stragglers.
+#ifndef WINC_MESH_PING_INTERVAL_MS
+#define WINC_MESH_PING_INTERVAL_MS    100
+#endif
+
+#ifndef WINC_MESH_PING_TIMEOUT_MS
+#define WINC_MESH_PING_TIMEOUT_MS     2000
+#endif
+
+// Time synchronisation
+// Beacons carry the sender's mesh time. Each node fits offset and drift to
+// its last WINC_MESH_SYNC_SAMPLES readings from the node towards the time
+// root (the lowest id). A node that hears no newer root time for
+// WINC_MESH_SYNC_TIMEOUT_MS, or none within WINC_MESH_SYNC_CLAIM_MS of
+// joining, becomes a root itself.
+#ifndef WINC_MESH_SYNC_SAMPLES
+#define WINC_MESH_SYNC_SAMPLES        8
+#endif
+
+#ifndef WINC_MESH_SYNC_CLAIM_MS
+#define WINC_MESH_SYNC_CLAIM_MS       5000
+#endif
+
+#ifndef WINC_MESH_SYNC_TIMEOUT_MS
+#define WINC_MESH_SYNC_TIMEOUT_MS     (2 * WINC_MESH_ROUTE_TIMEOUT_MS)
+#endif
+
+#ifndef WINC_MESH_SYNC_STEP_US
+#define WINC_MESH_SYNC_STEP_US        2000   // Reading this far off the fit restarts it
+#endif
+
+// ============================================================================
+// PUBLIC API
+// ============================================================================
+
+/**
+ * Initialize WINC1500 and start mesh network
+ *
+ * Joins the mesh's access point, or starts it if no node with a lower id
+ * has (see WINC_MESH_BOOT_JOIN_MS), and returns once the mesh socket is up.
+ *
+ * @param node_id Unique node ID (1-255)
+ * @param node_name Human-readable name (max 15 chars)
+ * @return true on success, false on failure
+ *
+ * Example:
+ *   if (!winc_init(1, "Pico1")) {
+ *       printf("WINC init failed\n");
+ *       return -1;
+ *   }
+ */
+bool winc_init(uint8_t node_id, const char *node_name);
+
+/**
+ * Poll for events - CALL THIS IN YOUR MAIN LOOP
+ *
+ * Handles:
+ * - Interrupt processing
+ * - Beacon sending
+ * - Route maintenance
+ * - Data reception
+ *
+ * Example:
+ *   while (1) {
+ *       winc_poll();
+ *       // Your application code
+ *   }
+ */
+void winc_poll(void);
+
+/**
+ * Sleep until there is work for winc_poll()
+ *
+ * Returns at the next mesh deadline (beacon, retransmit, route expiry...),
+ * when the WINC raises its interrupt line, or after max_ms, whichever comes
+ * first. Uses the GPIO IRQ callback of the calling core for the WINC pin.
+ *
+ * @param max_ms Longest sleep, e.g. time to the application's next job
+ *
+ * Example:
+ *   while (1) {
+ *       winc_poll();
+ *       // Your application code
+ *       winc_idle(next_app_job_ms);
+ *   }
+ */
+void winc_idle(uint32_t max_ms);
+
+/**
+ * Set callback for received mesh data
+ *
+ * @param callback Function to call when data received
+ *                 Parameters: src_node, data, len
+ *
+ * Example:
+ *   void my_handler(uint8_t src, uint8_t *data, uint16_t len) {
+ *       printf("From %u: %.*s\n", src, len, data);
+ *   }
+ *   winc_mesh_set_callback(my_handler);
+ */
+void winc_mesh_set_callback(void (*callback)(uint8_t src_node, uint8_t *data, uint16_t len));
+
+// Destination that reaches every node (see WINC_MESH_MPR)
+#define WINC_MESH_BROADCAST      0xFF
+
+// Largest broadcast payload: one frame, room left for a full relay list
+#define WINC_MESH_BROADCAST_MAX  (WINC_MESH_MTU - sizeof(winc_mesh_flood_t) - WINC_MESH_MAX_NODES)
+
+/**
+ * Send data to another mesh node
+ *
+ * @param dst_node Destination node ID, or WINC_MESH_BROADCAST for all
+ * @param data Data buffer to send
+ * @param len Length of data (max WINC_MESH_MAX_MESSAGE bytes; above
+ *            WINC_MESH_MTU it is sent as fragments; broadcasts at most
+ *            WINC_MESH_BROADCAST_MAX)
+ * @return true if sent or queued for aggregation, false if no route or error
+ *
+ * Example:
+ *   char msg[] = "Hello from node 1!";
+ *   if (winc_mesh_send(2, (uint8_t*)msg, strlen(msg))) {
+ *       printf("Sent to node 2\n");
+ *   } else {
+ *       printf("No route to node 2\n");
+ *   }
+ */
+bool winc_mesh_send(uint8_t dst_node, uint8_t *data, uint16_t len);
+
+// Priority classes, in the order the header carries them
+#define WINC_MESH_CLASS_NORMAL   0
+#define WINC_MESH_CLASS_ALARM    1  // Strict priority over normal and bulk
+#define WINC_MESH_CLASS_BULK     2
+#define WINC_MESH_CLASS_CONTROL  3  // Beacons and ACKs
+#define WINC_MESH_CLASSES        4
+
+// Send options for winc_mesh_send_ex()
+#define WINC_MESH_RELIABLE   0x01  // ACK and retransmit on every hop
+#define WINC_MESH_PINNED     0x02  // Follow the path pinned for dst_node
+#define WINC_MESH_ORDERED    0x40  // Delivered in the order sent
+#define WINC_MESH_PRIO(cls)  ((cls) << 2)
+#define WINC_MESH_ALARM      WINC_MESH_PRIO(WINC_MESH_CLASS_ALARM)
+#define WINC_MESH_BULK       WINC_MESH_PRIO(WINC_MESH_CLASS_BULK)
+#define WINC_MESH_FLAGS_CLASS(flags)  (((flags) >> 2) & 3)
+
+/**
+ * Send data to another mesh node with options
+ *
+ * @param dst_node Destination node ID
+ * @param data Data buffer to send
+ * @param len Length of data
+ * @param flags WINC_MESH_RELIABLE, WINC_MESH_PINNED, WINC_MESH_ORDERED
+ *              and/or a class (WINC_MESH_ALARM, WINC_MESH_BULK); 0 behaves
+ *              like winc_mesh_send()
+ * @return true if sent or queued, false if no route (or no pinned path),
+ *         error, the transmit or retransmit queue is full, or backpressure
+ *         from a busy next hop refused it (see winc_mesh_get_bp_stats())
+ *
+ * A reliable frame is retried on each hop until that hop ACKs it, so
+ * delivery survives losses that would compound over several hops. It can
+ * still be lost if a hop gives up after WINC_MESH_MAX_RETRIES; see
+ * winc_mesh_get_tx_stats(). Broadcasts are never ACKed and ignore
+ * WINC_MESH_RELIABLE.
+ *
+ * A pinned frame goes the way winc_mesh_set_path() or
+ * winc_mesh_learn_path() fixed, even if routes change meanwhile, and
+ * must fit in one frame with its path (WINC_MESH_MTU - 2 - hops).
+ *
+ * Ordered frames reach data_callback in the order they were sent to that
+ * destination, even when retransmissions or a route change overtake one
+ * with another; see winc_mesh_get_order_stats(). They must fit in one
+ * frame (WINC_MESH_MTU - 2).
+ *
+ * Example:
+ *   if (!winc_mesh_send_ex(3, log_chunk, len, WINC_MESH_RELIABLE | WINC_MESH_BULK))
+ *       printf("Mesh busy, retry later\n");
+ *   winc_mesh_send_ex(1, alarm, sizeof(alarm), WINC_MESH_RELIABLE | WINC_MESH_ALARM);
+ */
+bool winc_mesh_send_ex(uint8_t dst_node, uint8_t *data, uint16_t len, uint8_t flags);
+
+/**
+ * Pin the path that WINC_MESH_PINNED frames to a node take
+ *
+ * @param dst_node Destination node ID
+ * @param hops Nodes after this one, the last being dst_node
+ * @param count Entries in hops (max WINC_MESH_MAX_PATH), 0 to unpin
+ * @return false if the path is malformed or all WINC_MESH_PATH_SLOTS are
+ *         in use
+ *
+ * Example:
+ *   uint8_t via[] = {2, 5, 9};
+ *   winc_mesh_set_path(9, via, 3);
+ *   winc_mesh_send_ex(9, cmd, len, WINC_MESH_PINNED | WINC_MESH_ALARM);
+ */
+bool winc_mesh_set_path(uint8_t dst_node, const uint8_t *hops, uint8_t count);
+
+/**
+ * Learn the current route to a node and pin it
+ *
+ * Sends a route request that records every node it passes on the way;
+ * the destination returns the record and the path is pinned when it
+ * arrives. Until then, and if the request is lost, the old path (if
+ * any) stays.
+ *
+ * @param dst_node Destination node ID
+ * @return false if there is no route or no free path slot
+ *
+ * Example:
+ *   winc_mesh_learn_path(9);
+ *   // ...later
+ *   uint8_t path[WINC_MESH_MAX_PATH];
+ *   int n = winc_mesh_get_path(9, path, sizeof(path));
+ */
+bool winc_mesh_learn_path(uint8_t dst_node);
+
+/**
+ * Get the path pinned to a node
+ *
+ * @param dst_node Destination node ID
+ * @param hops Output: nodes after this one, the last being dst_node
+ * @param max Entries in hops
+ * @return Number of hops, 0 if none is pinned
+ */
+int winc_mesh_get_path(uint8_t dst_node, uint8_t *hops, int max);
+
+/**
+ * Send any data frames still waiting for aggregation
+ *
+ * winc_mesh_process() does this on its own after WINC_MESH_AGG_DELAY_US;
+ * call it to skip the wait, e.g. before sleeping.
+ *
+ * Example:
+ *   winc_mesh_send(2, reading, sizeof(reading));
+ *   winc_mesh_flush();
+ */
+void winc_mesh_flush(void);
+
+/**
+ * Print routing table to stdout (for debugging)
+ *
+ * Example output:
+ *   Mesh Routing Table (Node 1 - "Pico1"):
+ *     Node 2: 1 hop (direct)
+ *     Node 3: 2 hops via node 2
+ */
+void winc_mesh_print_routes(void);
+
+/**
+ * Get number of active routes
+ *
+ * @return Number of nodes in routing table
+ */
+uint8_t winc_mesh_get_node_count(void);
+
+/**
+ * Beacon scheduler statistics
+ */
+typedef struct {
+    uint32_t beacons_sent;
+    uint32_t beacons_suppressed;  // Trickle: enough consistent beacons heard
+    uint32_t beacons_received;
+    uint32_t inconsistencies;     // Topology changes that reset the interval
+    uint32_t interval_ms;         // Current beacon interval
+    uint32_t last_change_ms;      // Time of last inconsistency (ms since boot)
+    uint32_t convergence_ms;      // Last change -> interval back at maximum
+    uint32_t bytes_sent;          // Beacon datagram bytes, header included
+    uint32_t full_sent;           // Beacons that listed the whole table
+    uint32_t requests_sent;       // Full beacons asked of neighbours we lost track of
+    uint32_t requests_received;
+} winc_mesh_beacon_stats_t;
+
+/**
+ * Get beacon scheduler statistics
+ *
+ * @param stats Output: beacon counters and convergence time
+ *
+ * Example:
+ *   winc_mesh_beacon_stats_t bs;
+ *   winc_mesh_get_beacon_stats(&bs);
+ *   printf("sent %lu, suppressed %lu\n", bs.beacons_sent, bs.beacons_suppressed);
+ */
+void winc_mesh_get_beacon_stats(winc_mesh_beacon_stats_t *stats);
+
+/**
+ * Reliable transmission statistics
+ */
+typedef struct {
+    uint32_t reliable_sent;       // Reliable frames sent (first attempt)
+    uint32_t retransmits;
+    uint32_t acks_sent;           // Frames we ACKed
+    uint32_t acks_received;       // Our frames ACKed by the next hop
+    uint32_t dropped;             // Given up after WINC_MESH_MAX_RETRIES
+    uint32_t duplicates;          // Resent frames we had already received
+    uint32_t queue_full;          // Sends refused, retransmit queue full
+} winc_mesh_tx_stats_t;
+
+/**
+ * Get reliable transmission statistics
+ *
+ * @param stats Output: retransmission and ACK counters
+ *
+ * Example:
+ *   winc_mesh_tx_stats_t ts;
+ *   winc_mesh_get_tx_stats(&ts);
+ *   printf("retransmits %lu, dropped %lu\n", ts.retransmits, ts.dropped);
+ */
+void winc_mesh_get_tx_stats(winc_mesh_tx_stats_t *stats);
+
+/**
+ * Broadcast statistics
+ */
+typedef struct {
+    uint32_t sent;                // Broadcasts we originated
+    uint32_t received;            // Broadcasts delivered to us
+    uint32_t duplicates;          // Copies heard again and dropped
+    uint32_t relayed;             // Sent on as one of the sender's relays
+    uint32_t dropped;             // Not sent: too long or queue full
+    uint8_t neighbors;            // At the last relay choice: usable links,
+    uint8_t two_hop;              //   nodes reachable only through them,
+    uint8_t relays;               //   and the neighbours chosen to cover those
+} winc_mesh_flood_stats_t;
+
+/**
+ * Get broadcast statistics
+ *
+ * @param stats Output: broadcast counters and the last relay choice
+ *
+ * Example:
+ *   winc_mesh_flood_stats_t fs;
+ *   winc_mesh_get_flood_stats(&fs);
+ *   printf("%u relays for %u neighbours\n", fs.relays, fs.neighbors);
+ */
+void winc_mesh_get_flood_stats(winc_mesh_flood_stats_t *stats);
+
+/**
+ * Backpressure statistics
+ */
+typedef struct {
+    uint8_t level;                // Our own queue pressure now, 0-3
+    uint8_t busy_neighbors;       // Neighbours reporting level 2 or more
+    uint32_t throttled;           // Sends refused because the next hop is busy
+    uint32_t rerouted;            // Frames sent via an alternate neighbour
+    uint32_t held;                // Times queued bulk frames were held back
+    uint32_t announced;           // Extra beacons sent to report our pressure
+} winc_mesh_bp_stats_t;
+
+/**
+ * Get backpressure statistics
+ *
+ * @param stats Output: our pressure level and throttling counters
+ *
+ * Example:
+ *   winc_mesh_bp_stats_t bs;
+ *   winc_mesh_get_bp_stats(&bs);
+ *   printf("level %u, throttled %lu, rerouted %lu\n", bs.level,
+ *          bs.throttled, bs.rerouted);
+ */
+void winc_mesh_get_bp_stats(winc_mesh_bp_stats_t *stats);
+
+/**
+ * In-order delivery statistics, for WINC_MESH_ORDERED frames received
+ */
+typedef struct {
+    uint32_t delivered;           // Handed to data_callback
+    uint32_t reordered;           // Of those, held for an earlier frame first
+    uint32_t gaps;                // Missing frames given up on
+    uint32_t late;                // Dropped: arrived after a later frame went up
+    uint8_t depth;                // Frames held now, all sources
+    uint8_t max_depth;            // Most frames ever held for one source
+} winc_mesh_order_stats_t;
+
+/**
+ * Get in-order delivery statistics
+ *
+ * @param stats Output: reordering depth, gaps and late drops
+ *
+ * Example:
+ *   winc_mesh_order_stats_t os;
+ *   winc_mesh_get_order_stats(&os);
+ *   printf("reordered %lu (depth %u), late %lu\n", os.reordered,
+ *          os.max_depth, os.late);
+ */
+void winc_mesh_get_order_stats(winc_mesh_order_stats_t *stats);
+
+/**
+ * Turn backpressure on or off
+ *
+ * Off, we advertise level 0 and ignore the levels neighbours report, so
+ * every frame is queued until the queues themselves are full.
+ * WINC_MESH_BACKPRESSURE sets the default.
+ *
+ * @param on Whether to act on queue pressure
+ *
+ * Example:
+ *   winc_mesh_set_backpressure(false);
+ */
+void winc_mesh_set_backpressure(bool on);
+
+// Stream states, from winc_mesh_stream_state()
+#define WINC_MESH_STREAM_CLOSED      0  // No such stream
+#define WINC_MESH_STREAM_CONNECTING  1  // Handshake under way
+#define WINC_MESH_STREAM_OPEN        2
+#define WINC_MESH_STREAM_CLOSING     3  // Closed by the peer; data may remain to read
+#define WINC_MESH_STREAM_RESET       4  // Refused, reset by the peer or timed out
+
+/**
+ * Accept streams opened to a port
+ *
+ * Connections to the port are set up as they arrive and wait to be taken
+ * with winc_mesh_stream_accept(). Up to four ports can be listened on.
+ *
+ * @param port Port number (1-127)
+ * @return false if the port is out of range or no listen slot is free
+ *
+ * Example:
+ *   winc_mesh_stream_listen(7);
+ */
+bool winc_mesh_stream_listen(uint8_t port);
+
+/**
+ * Take a stream that was opened to a listening port
+ *
+ * @param port Port passed to winc_mesh_stream_listen()
+ * @return Stream handle, or -1 if no new connection is waiting
+ *
+ * Example:
+ *   int s = winc_mesh_stream_accept(7);
+ *   if (s >= 0)
+ *       printf("stream from node %u\n", winc_mesh_stream_peer(s));
+ */
+int winc_mesh_stream_accept(uint8_t port);
+
+/**
+ * Open a stream to a port on another node
+ *
+ * Returns at once; the handshake completes from winc_poll() and
+ * winc_mesh_stream_state() turns WINC_MESH_STREAM_OPEN, or
+ * WINC_MESH_STREAM_RESET if the node refuses or never answers. Data
+ * written before then goes out once the stream is open.
+ *
+ * Segments are sent with the given options: WINC_MESH_RELIABLE adds
+ * per-hop retransmission underneath the stream's own, and WINC_MESH_BULK
+ * or WINC_MESH_ALARM sets the priority class. The accepting node answers
+ * with the same options.
+ *
+ * @param dst_node Node to connect to
+ * @param port Port it listens on
+ * @param flags WINC_MESH_RELIABLE and a class, or 0
+ * @return Stream handle, or -1 if there is no route or no free stream
+ *
+ * Example:
+ *   int s = winc_mesh_stream_connect(4, 7, WINC_MESH_BULK);
+ */
+int winc_mesh_stream_connect(uint8_t dst_node, uint8_t port, uint8_t flags);
+
+/**
+ * Queue bytes on a stream
+ *
+ * Copies as much as fits in the send buffer; the rest must be written
+ * again once the peer has acknowledged some.
+ *
+ * @param s Stream handle
+ * @param data Bytes to send
+ * @param len Number of bytes
+ * @return Bytes taken (possibly 0), or -1 if the stream cannot send
+ *
+ * Example:
+ *   while (off < len) {
+ *       int n = winc_mesh_stream_write(s, buf + off, len - off);
+ *       if (n < 0)
+ *           break;
+ *       off += n;
+ *       winc_poll();
+ *   }
+ */
+int winc_mesh_stream_write(int s, const uint8_t *data, uint16_t len);
+
+/**
+ * Read bytes that have arrived in order on a stream
+ *
+ * @param s Stream handle
+ * @param buf Output buffer
+ * @param len Buffer size
+ * @return Bytes read (0 if none are waiting), or -1 once the peer has
+ *         closed and everything has been read, or the stream was reset
+ *
+ * Example:
+ *   int n = winc_mesh_stream_read(s, buf, sizeof(buf));
+ *   if (n < 0)
+ *       winc_mesh_stream_close(s);
+ */
+int winc_mesh_stream_read(int s, uint8_t *buf, uint16_t len);
+
+/**
+ * Close a stream
+ *
+ * Bytes already written are still delivered, then the peer sees the end
+ * of the stream; unread bytes are discarded. The handle must not be used
+ * afterwards.
+ *
+ * @param s Stream handle
+ */
+void winc_mesh_stream_close(int s);
+
+/**
+ * Get a stream's state
+ *
+ * @param s Stream handle
+ * @return WINC_MESH_STREAM_*
+ */
+int winc_mesh_stream_state(int s);
+
+/**
+ * Get the node at the other end of a stream
+ *
+ * @param s Stream handle
+ * @return Node id, 0 if the handle is not in use
+ */
+uint8_t winc_mesh_stream_peer(int s);
+
+/**
+ * Stream statistics
+ */
+typedef struct {
+    uint8_t state;                // WINC_MESH_STREAM_*
+    uint32_t bytes_acked;         // Sent and acknowledged by the peer
+    uint32_t bytes_received;      // Arrived in order
+    uint32_t segments_sent;
+    uint32_t retransmits;         // Segments sent again
+    uint32_t fast_recoveries;     // Losses repaired from SACKs, no timeout
+    uint32_t timeouts;
+    uint32_t out_of_order;        // Segments that arrived beyond a gap
+    uint32_t srtt_us;             // Smoothed round trip
+    uint32_t rto_ms;
+    uint32_t cwnd;                // Congestion window (bytes)
+    uint32_t peer_window;         // Receive window the peer last offered
+} winc_mesh_stream_stats_t;
+
+/**
+ * Get stream statistics
+ *
+ * @param s Stream handle
+ * @param stats Output: byte, segment and retransmission counters
+ * @return false if the handle is not in use
+ *
+ * Example:
+ *   winc_mesh_stream_stats_t ss;
+ *   if (winc_mesh_get_stream_stats(s, &ss))
+ *       printf("srtt %lu us, cwnd %lu, retransmits %lu\n", ss.srtt_us,
+ *              ss.cwnd, ss.retransmits);
+ */
+bool winc_mesh_get_stream_stats(int s, winc_mesh_stream_stats_t *stats);
+
+// Handler for one subscribed topic
+typedef void (*winc_mesh_topic_handler_t)(uint8_t src_node, uint16_t topic,
+                                          uint8_t *data, uint16_t len);
+
+// Largest publication: one frame, room left for a full subscriber list
+#define WINC_MESH_PUBLISH_MAX  (WINC_MESH_MTU - sizeof(winc_mesh_publish_t) - WINC_MESH_MAX_NODES)
+
+/**
+ * Get the id of a topic name
+ *
+ * Every node hashes the same name to the same id; ids are never 0.
+ *
+ * @param name Topic name
+ * @return Topic id
+ *
+ * Example:
+ *   uint16_t temp = winc_mesh_topic("sensors/temperature");
+ */
+uint16_t winc_mesh_topic(const char *name);
+
+/**
+ * Subscribe to a topic
+ *
+ * Publications on the topic from any node, this one included, go to the
+ * handler instead of the data callback. The other nodes learn of the
+ * subscription from our beacons, within a few beacon intervals.
+ * Subscribing again replaces the handler.
+ *
+ * @param topic Topic id from winc_mesh_topic()
+ * @param handler Function to call for each publication
+ * @return false if the topic is 0 or WINC_MESH_TOPICS are already taken
+ *
+ * Example:
+ *   void on_temp(uint8_t src, uint16_t topic, uint8_t *data, uint16_t len) {
+ *       printf("node %u: %.*s C\n", src, len, data);
+ *   }
+ *   winc_mesh_subscribe(winc_mesh_topic("sensors/temperature"), on_temp);
+ */
+bool winc_mesh_subscribe(uint16_t topic, winc_mesh_topic_handler_t handler);
+
+/**
+ * Stop receiving a topic
+ *
+ * @param topic Topic id
+ * @return false if we did not subscribe to it
+ */
+bool winc_mesh_unsubscribe(uint16_t topic);
+
+/**
+ * Publish data on a topic
+ *
+ * Sends one copy per next hop that leads to subscribers, however many
+ * there are behind it, and calls our own handler if we subscribe too.
+ *
+ * @param topic Topic id
+ * @param data Data to publish
+ * @param len Length (max WINC_MESH_PUBLISH_MAX)
+ * @param flags WINC_MESH_RELIABLE and a class, or 0
+ * @return Copies sent (0 if no other node subscribes), or -1 on error
+ *
+ * Example:
+ *   char msg[] = "21.5";
+ *   winc_mesh_publish(temp, (uint8_t*)msg, strlen(msg), 0);
+ */
+int winc_mesh_publish(uint16_t topic, const uint8_t *data, uint16_t len, uint8_t flags);
+
+/**
+ * Publish/subscribe statistics
+ */
+typedef struct {
+    uint32_t published;           // winc_mesh_publish() calls
+    uint32_t copies_sent;         // Frames sent for them, one per branch
+    uint32_t relayed;             // Copies sent on for other nodes
+    uint32_t delivered;           // Handed to one of our handlers
+    uint32_t unwanted;            // Named us for a topic we no longer take
+    uint32_t dropped;             // Not sent: too long, no route or queue full
+    uint8_t topics;               // Topics we subscribe to
+    uint8_t subscribers;          // Other nodes known to subscribe to any
+} winc_mesh_pubsub_stats_t;
+
+/**
+ * Get publish/subscribe statistics
+ *
+ * @param stats Output: publication counters and subscription counts
+ *
+ * Example:
+ *   winc_mesh_pubsub_stats_t ps;
+ *   winc_mesh_get_pubsub_stats(&ps);
+ *   printf("%lu copies for %lu publications\n", ps.copies_sent, ps.published);
+ */
+void winc_mesh_get_pubsub_stats(winc_mesh_pubsub_stats_t *stats);
+
+// RPC call outcomes. A handler's own errors, below these, reach the caller
+// unchanged.
+#define WINC_MESH_RPC_OK          0
+#define WINC_MESH_RPC_TIMEOUT    -1  // No reply by the deadline
+#define WINC_MESH_RPC_NO_METHOD  -2  // Nothing registered for the method there
+
+/**
+ * Handler for one RPC method
+ *
+ * Runs from winc_poll() on the node called. Writes the result to result
+ * (up to max bytes) and returns its length, or returns a negative error
+ * below WINC_MESH_RPC_NO_METHOD that the caller receives as its status.
+ */
+typedef int (*winc_mesh_rpc_handler_t)(uint8_t src_node, const uint8_t *args, uint16_t len,
+                                       uint8_t *result, uint16_t max);
+
+/**
+ * Completion of an RPC call
+ *
+ * status is WINC_MESH_RPC_OK with the result, or an error with none.
+ */
+typedef void (*winc_mesh_rpc_done_t)(int status, uint8_t *result, uint16_t len, void *arg);
 
 /**
- * Initialize WINC1500 and start mesh network
+ * Register the handler for a method
  *
- * @param node_id Unique node ID (1-255)
- * @param node_name Human-readable name (max 15 chars)
- * @return true on success, false on failure
+ * @param method Method id (1-255)
+ * @param handler Function that serves it, or NULL to stop serving it
+ * @return false if method is 0 or WINC_MESH_RPC_METHODS are already taken
  *
  * Example:
- *   if (!winc_init(1, "Pico1")) {
- *       printf("WINC init failed\n");
- *       return -1;
+ *   int get_temp(uint8_t src, const uint8_t *args, uint16_t len,
+ *                uint8_t *result, uint16_t max) {
+ *       return snprintf((char*)result, max, "%.1f", read_temp());
  *   }
+ *   winc_mesh_rpc_register(METHOD_GET_TEMP, get_temp);
  */
-bool winc_init(uint8_t node_id, const char *node_name);
+bool winc_mesh_rpc_register(uint8_t method, winc_mesh_rpc_handler_t handler);
 
 /**
- * Poll for events - CALL THIS IN YOUR MAIN LOOP
+ * Call a method on another node
  *
- * Handles:
- * - Interrupt processing
- * - Beacon sending
- * - Route maintenance
- * - Data reception
+ * Returns at once. The request is sent again while unanswered, and done
+ * is called exactly once: with the reply, or with WINC_MESH_RPC_TIMEOUT
+ * once deadline_ms have passed.
+ *
+ * @param dst_node Node to call
+ * @param method Method id registered there
+ * @param args Arguments, passed to the handler as they are
+ * @param len Length of args (max WINC_MESH_RPC_MAX)
+ * @param flags WINC_MESH_RELIABLE and a class, or 0; the reply uses the same
+ * @param deadline_ms Time allowed for the whole call, retries included
+ * @param done Completion callback
+ * @param arg Passed to done
+ * @return Call id, or -1 if args are too long or no call slot is free
  *
  * Example:
- *   while (1) {
- *       winc_poll();
- *       // Your application code
+ *   void got_temp(int status, uint8_t *result, uint16_t len, void *arg) {
+ *       if (status == WINC_MESH_RPC_OK)
+ *           printf("temp %.*s\n", len, result);
  *   }
+ *   winc_mesh_rpc_call(3, METHOD_GET_TEMP, NULL, 0, 0, 1000, got_temp, NULL);
  */
-void winc_poll(void);
+int winc_mesh_rpc_call(uint8_t dst_node, uint8_t method, const uint8_t *args, uint16_t len,
+                       uint8_t flags, uint32_t deadline_ms, winc_mesh_rpc_done_t done, void *arg);
 
 /**
- * Set callback for received mesh data
+ * Give up on a call without its callback running
  *
- * @param callback Function to call when data received
- *                 Parameters: src_node, data, len
+ * @param call Call id from winc_mesh_rpc_call()
+ * @return false if the call has already completed
+ */
+bool winc_mesh_rpc_cancel(int call);
+
+/**
+ * RPC statistics
+ */
+typedef struct {
+    uint32_t calls;               // Calls started
+    uint32_t completed;           // Answered, whatever the status
+    uint32_t timeouts;
+    uint32_t retries;             // Requests sent again
+    uint32_t served;              // Requests we ran a handler for
+    uint32_t replayed;            // Repeated requests answered from the reply cache
+    uint32_t late;                // Replies for no outstanding call
+    uint32_t latency_avg_us;      // Call to answer, over answered calls
+    uint32_t latency_max_us;
+    uint8_t outstanding;
+} winc_mesh_rpc_stats_t;
+
+/**
+ * Get RPC statistics
+ *
+ * @param stats Output: call and server counters, latency of answered calls
  *
  * Example:
- *   void my_handler(uint8_t src, uint8_t *data, uint16_t len) {
- *       printf("From %u: %.*s\n", src, len, data);
- *   }
- *   winc_mesh_set_callback(my_handler);
+ *   winc_mesh_rpc_stats_t rs;
+ *   winc_mesh_get_rpc_stats(&rs);
+ *   printf("%lu calls, avg %lu us\n", rs.completed, rs.latency_avg_us);
  */
-void winc_mesh_set_callback(void (*callback)(uint8_t src_node, uint8_t *data, uint16_t len));
+void winc_mesh_get_rpc_stats(winc_mesh_rpc_stats_t *stats);
 
 /**
- * Send data to another mesh node
+ * Change to the replicated store, made on another node
  *
- * @param dst_node Destination node ID
- * @param data Data buffer to send
- * @param len Length of data (max ~1400 bytes)
- * @return true if sent, false if no route or error
+ * Runs from winc_poll() once the new value is in the store.
+ */
+typedef void (*winc_mesh_kv_handler_t)(uint16_t key, const uint8_t *value, uint8_t len,
+                                       uint8_t origin);
+
+/**
+ * Get the key for a name
+ *
+ * Same hash as winc_mesh_topic(): every node gets the same key, never 0.
+ *
+ * @param name Key name
+ * @return Key
  *
  * Example:
- *   char msg[] = "Hello from node 1!";
- *   if (winc_mesh_send(2, (uint8_t*)msg, strlen(msg))) {
- *       printf("Sent to node 2\n");
- *   } else {
- *       printf("No route to node 2\n");
- *   }
+ *   uint16_t setpoint = winc_mesh_kv_key("heater/setpoint");
  */
-bool winc_mesh_send(uint8_t dst_node, uint8_t *data, uint16_t len);
+uint16_t winc_mesh_kv_key(const char *name);
 
 /**
- * Print routing table to stdout (for debugging)
+ * Write a key of the replicated store
  *
- * Example output:
- *   Mesh Routing Table (Node 1 - "Pico1"):
- *     Node 2: 1 hop (direct)
- *     Node 3: 2 hops via node 2
+ * Takes effect here at once and reaches every node through beacon gossip.
+ * If two nodes write a key at about the same time, every node keeps the
+ * same one of the two values.
+ *
+ * @param key Key (non-zero)
+ * @param value Value bytes
+ * @param len Length of value (max WINC_MESH_KV_VALUE_MAX)
+ * @return false if the value is too long or the store is full
+ *
+ * Example:
+ *   int16_t c = 215;
+ *   winc_mesh_kv_set(winc_mesh_kv_key("heater/setpoint"), (uint8_t*)&c, sizeof(c));
  */
-void winc_mesh_print_routes(void);
+bool winc_mesh_kv_set(uint16_t key, const uint8_t *value, uint8_t len);
 
 /**
- * Get number of active routes
+ * Read a key of the replicated store
  *
- * @return Number of nodes in routing table
+ * @param key Key
+ * @param value Output: the value, up to max bytes
+ * @param max Size of value
+ * @return Length of the value, or -1 if the key is not in the store
  */
-uint8_t winc_mesh_get_node_count(void);
+int winc_mesh_kv_get(uint16_t key, uint8_t *value, uint8_t max);
+
+/**
+ * Set the handler called when another node's write reaches us
+ *
+ * @param handler Change handler, or NULL for none
+ */
+void winc_mesh_kv_set_callback(winc_mesh_kv_handler_t handler);
+
+/**
+ * Replicated store statistics
+ */
+typedef struct {
+    uint8_t keys;                 // Entries in the store
+    uint32_t sets;                // Local writes
+    uint32_t applied;             // Newer entries taken from neighbours
+    uint32_t exchanges;           // Digest mismatches we answered with a summary
+    uint32_t entries_sent;        // Entries sent to neighbours
+    uint32_t bytes_sent;          // Summaries, entries and requests
+    uint32_t beacon_bytes;        // Store blocks, and beacons sent early for them
+    uint32_t refused;             // Entries not taken for lack of room
+} winc_mesh_kv_stats_t;
+
+/**
+ * Get replicated store statistics
+ *
+ * @param stats Output: store size and gossip counters
+ *
+ * Example:
+ *   winc_mesh_kv_stats_t ks;
+ *   winc_mesh_get_kv_stats(&ks);
+ *   printf("%u keys, %lu entries sent\n", ks.keys, ks.entries_sent);
+ */
+void winc_mesh_get_kv_stats(winc_mesh_kv_stats_t *stats);
+
+/**
+ * Traffic counters for one neighbour
+ *
+ * Frames are credited to the neighbour that handed them to us, which every
+ * sender stamps into the header's prev_hop.
+ */
+typedef struct {
+    uint8_t node_id;
+    uint32_t beacons_heard;
+    uint32_t beacons_missed;      // Gaps in its beacon sequence numbers
+    uint32_t rx_frames;           // Data frames it handed us
+    uint32_t rx_bytes;
+    uint32_t forwarded;           // Of those, passed on to another hop
+    uint32_t drop_no_route;       // Of those, dropped: no route onward
+    uint32_t drop_max_hops;       //   ... WINC_MESH_MAX_HOPS reached
+    uint32_t drop_queue_full;     //   ... no pool frame or queue space
+    uint32_t tx_frames;           // Datagrams we sent it
+    uint32_t tx_bytes;
+    uint32_t retransmits;         // Reliable frames resent to it
+    uint32_t tx_lost;             // Reliable frames it never ACKed
+} winc_mesh_neighbor_stats_t;
+
+/**
+ * Get per-neighbour traffic counters
+ *
+ * Counters start when a neighbour is first heard and are kept while it
+ * stays in the link table.
+ *
+ * @param stats Output array
+ * @param max Entries in stats
+ * @return Number of entries filled
+ *
+ * Example:
+ *   winc_mesh_neighbor_stats_t ns[8];
+ *   int n = winc_mesh_get_neighbor_stats(ns, 8);
+ *   for (int i = 0; i < n; i++)
+ *       printf("node %u: fwd %lu, no route %lu\n", ns[i].node_id,
+ *              ns[i].forwarded, ns[i].drop_no_route);
+ */
+int winc_mesh_get_neighbor_stats(winc_mesh_neighbor_stats_t *stats, int max);
+
+/**
+ * Get a neighbour's node name
+ *
+ * Names are not repeated in every beacon: a neighbour sends its name with
+ * its full table, which we ask for when we first hear it.
+ *
+ * @param node_id Neighbour to look up
+ * @return Its name, or NULL until one has arrived
+ *
+ * Example:
+ *   const char *name = winc_mesh_get_neighbor_name(2);
+ *   printf("node 2 is %s\n", name ? name : "?");
+ */
+const char *winc_mesh_get_neighbor_name(uint8_t node_id);
+
+/**
+ * Rename this node
+ *
+ * The next beacon carries the new name with the full table, and the
+ * table's epoch moves on so neighbours that miss it ask again.
+ *
+ * @param node_name New name (max 15 chars)
+ *
+ * Example:
+ *   winc_mesh_set_name("Pump-House");
+ */
+void winc_mesh_set_name(const char *node_name);
+
+/**
+ * Transmit queue statistics, indexed by WINC_MESH_CLASS_*
+ */
+typedef struct {
+    uint8_t depth[WINC_MESH_CLASSES];       // Frames queued now
+    uint8_t max_depth[WINC_MESH_CLASSES];   // Highest depth seen
+    uint32_t sent[WINC_MESH_CLASSES];       // Frames handed to the WINC
+    uint32_t dropped[WINC_MESH_CLASSES];    // Refused when full, or evicted
+} winc_mesh_queue_stats_t;
+
+/**
+ * Get per-class transmit queue statistics
+ *
+ * @param stats Output: queue depths and counters per class
+ *
+ * Example:
+ *   winc_mesh_queue_stats_t qs;
+ *   winc_mesh_get_queue_stats(&qs);
+ *   printf("bulk depth %u, dropped %lu\n", qs.depth[WINC_MESH_CLASS_BULK],
+ *          qs.dropped[WINC_MESH_CLASS_BULK]);
+ */
+void winc_mesh_get_queue_stats(winc_mesh_queue_stats_t *stats);
+
+/**
+ * Frame pool statistics
+ */
+typedef struct {
+    uint8_t size;             // WINC_MESH_POOL_FRAMES
+    uint8_t in_use;           // Frames taken now
+    uint8_t high_water;       // Most frames ever taken at once
+    uint32_t exhausted;       // Times a frame was wanted and none was free
+} winc_mesh_pool_stats_t;
+
+/**
+ * Get frame pool statistics
+ *
+ * @param stats Output: pool occupancy and exhaustion count
+ *
+ * Example:
+ *   winc_mesh_pool_stats_t ps;
+ *   winc_mesh_get_pool_stats(&ps);
+ *   printf("pool %u/%u, peak %u\n", ps.in_use, ps.size, ps.high_water);
+ */
+void winc_mesh_get_pool_stats(winc_mesh_pool_stats_t *stats);
+
+// Mesh roles, see winc_mesh_role_stats_t
+#define WINC_MESH_ROLE_JOINING   0  // Looking for the group owner's AP
+#define WINC_MESH_ROLE_CLIENT    1  // Joined the group owner's AP
+#define WINC_MESH_ROLE_STARTING  2  // Starting our own AP
+#define WINC_MESH_ROLE_OWNER     3  // Running the AP (group owner)
+
+/**
+ * Group owner election state and failover timings
+ */
+typedef struct {
+    uint8_t role;             // WINC_MESH_ROLE_*
+    uint8_t go_node;          // Current group owner, 0 = unknown
+    uint32_t elections;       // Group owner losses handled
+    uint32_t handovers;       // Times we gave the AP up to a lower-id owner
+    uint32_t takeover_at;     // While joining, when we start our own AP (ms)
+    uint32_t last_detect_ms;  // Owner's last beacon to our noticing it was gone
+    uint32_t last_outage_ms;  // Noticing the loss to being back on a network
+    uint32_t max_outage_ms;
+} winc_mesh_role_stats_t;
+
+/**
+ * Get group owner election state and failover timings
+ *
+ * Example:
+ *   winc_mesh_role_stats_t rs;
+ *   winc_mesh_get_role_stats(&rs);
+ *   printf("owner %u, last outage %lu ms\n", rs.go_node, rs.last_outage_ms);
+ */
+void winc_mesh_get_role_stats(winc_mesh_role_stats_t *stats);
+
+/**
+ * Hold normal and bulk traffic for this node's transmit slot
+ *
+ * Every node must use the same slots and slot_us. The node's slot is
+ * (node id - 1) % slots, so give the mesh at least as many slots as nodes
+ * sending, and slots long enough for what a node sends per superframe.
+ *
+ * @param slots Slots per superframe, 0 = no schedule
+ * @param slot_us Slot length in microseconds
+ *
+ * Example:
+ *   winc_mesh_set_tdma(16, 2000);   // 32 ms superframe, 16 nodes
+ */
+void winc_mesh_set_tdma(uint8_t slots, uint32_t slot_us);
+
+/**
+ * Mesh-wide time. Returns the time root's clock in microseconds, as
+ * estimated from this node's clock. Until the node has synchronised this is
+ * its own time_us_64() and *err_us is UINT32_MAX.
+ *
+ * @param err_us Output: bound on the error versus the root, or NULL
+ * @return Mesh time in microseconds
+ *
+ * Example:
+ *   uint32_t err;
+ *   uint64_t t = winc_mesh_time_us(&err);
+ *   if (err < 1000) log_sample(t, reading);
+ */
+uint64_t winc_mesh_time_us(uint32_t *err_us);
+
+/**
+ * Time synchronisation state
+ */
+typedef struct {
+    bool synced;
+    uint8_t root;             // Time root, 0 = none yet
+    uint8_t parent;           // Neighbour we take time from, 0 = we are root
+    uint8_t depth;            // Hops from the root
+    uint8_t samples;          // Readings in the fit
+    int32_t skew_ppb;         // Our clock's rate error versus the root
+    int64_t offset_us;        // Mesh time minus our clock, now
+    uint32_t err_us;          // As winc_mesh_time_us() reports it
+    uint32_t delay_us;        // One-way delay from the parent, 0 = unmeasured
+    uint32_t steps;           // Fits restarted after a jump
+} winc_mesh_sync_stats_t;
+
+/**
+ * Get time synchronisation state
+ *
+ * Example:
+ *   winc_mesh_sync_stats_t ss;
+ *   winc_mesh_get_sync_stats(&ss);
+ *   printf("root %u depth %u skew %ld ppb\n", ss.root, ss.depth, ss.skew_ppb);
+ */
+void winc_mesh_get_sync_stats(winc_mesh_sync_stats_t *stats);
+
+/**
+ * Ping results. Round trips are measured in microseconds from the echo
+ * request leaving the sender to the reply being handled there; jitter is
+ * the mean difference between consecutive round trips.
+ */
+typedef struct {
+    bool done;                          // All replies in, or timed out
+    uint8_t sent;
+    uint8_t received;
+    uint32_t min_us;
+    uint32_t avg_us;
+    uint32_t max_us;
+    uint32_t jitter_us;
+    uint8_t hops;                       // Forward path length
+    uint8_t path[WINC_MESH_MAX_HOPS];   // Node ids from our first hop to dst
+} winc_mesh_ping_result_t;
+
+/**
+ * Ping a node and trace the route there (blocking)
+ *
+ * Sends count echo requests of size bytes (at least
+ * sizeof(winc_mesh_echo_t)), calling winc_poll() until every reply is in
+ * or WINC_MESH_PING_TIMEOUT_MS after the last request. Each hop on the way
+ * records its node id, so result->path shows the route the requests took.
+ *
+ * @param dst_node Node to ping
+ * @param count Echo requests to send (1-255)
+ * @param size Payload bytes per request, up to WINC_MESH_MTU
+ * @param result Output: round-trip statistics and forward path
+ * @return true if at least one reply came back
+ *
+ * Example:
+ *   winc_mesh_ping_result_t pr;
+ *   if (winc_mesh_ping(4, 10, 64, &pr))
+ *       printf("%u/%u, avg %lu us, jitter %lu us, %u hops\n",
+ *              pr.received, pr.sent, pr.avg_us, pr.jitter_us, pr.hops);
+ */
+bool winc_mesh_ping(uint8_t dst_node, uint8_t count, uint16_t size,
+                    winc_mesh_ping_result_t *result);
+
+/**
+ * Start a ping without waiting for it
+ *
+ * Same as winc_mesh_ping() but returns at once; the echo requests go out
+ * from winc_poll(). Starting a new ping abandons one still running.
+ *
+ * @return false if there is no route to dst_node or the arguments are bad
+ */
+bool winc_mesh_ping_start(uint8_t dst_node, uint8_t count, uint16_t size);
+
+/**
+ * Get the results of the current or last ping
+ *
+ * @param result Output: statistics so far
+ * @return true once the ping has finished
+ */
+bool winc_mesh_ping_result(winc_mesh_ping_result_t *result);
+
+/**
+ * Time until the mesh layer next has work
+ *
+ * @return Milliseconds until the next beacon, retransmit, aggregation or
+ *         expiry deadline, or until paced frames can go to the WINC; 0 if
+ *         work is due now, UINT32_MAX if the mesh is not running
+ *
+ * Example:
+ *   uint32_t ms = winc_mesh_next_deadline_ms();
+ *   if (ms > 0)
+ *       sleep_ms(MIN(ms, 100));  // Received frames still need winc_poll()
+ */
+uint32_t winc_mesh_next_deadline_ms(void);
 
 /**
  * Set verbose level
@@ -216,6 +1634,26 @@ bool winc_stop_ap(void);
  */
 bool winc_connect_sta(const char *ssid, const char *password);
 
+/**
+ * Start AP mode without waiting for it
+ *
+ * Clears the connection state; it is set again when the WINC reports the
+ * AP up, as winc_is_network_ready() shows.
+ *
+ * @return false if the request could not be sent
+ */
+bool winc_ap_begin(const char *ssid, const char *password, uint8_t channel);
+
+/**
+ * Start joining an AP without waiting for it
+ *
+ * Clears the connection state; it is set again on association and DHCP.
+ *
+ * @param channel Channel to look on, or ANY_CHAN to scan them all
+ * @return false if the request could not be sent
+ */
+bool winc_sta_begin(const char *ssid, const char *password, uint8_t channel);
+
 /**
  * Check if network is ready
  *
@@ -223,6 +1661,15 @@ bool winc_connect_sta(const char *ssid, const char *password);
  */
 bool winc_is_network_ready(void);
 
+/**
+ * Check if the WiFi link is up
+ *
+ * True once associated (or once our AP is up), before DHCP completes.
+ *
+ * @return true if associated or hosting the AP
+ */
+bool winc_is_connected(void);
+
 /**
  * Wait for network to be ready with timeout
  *
@@ -243,23 +1690,244 @@ typedef struct __attribute__((packed)) {
     uint8_t hop_count;
     uint16_t seq_num;
     uint16_t payload_len;
+    uint8_t next_hop;      // Node that should act on the frame (0xFF = any)
+    uint8_t flags;         // WINC_MESH_RELIABLE, WINC_MESH_PINNED, class in bits 2-3,
+                           // sender's queue pressure in bits 4-5, WINC_MESH_ORDERED
+    uint8_t prev_hop;      // Node that transmitted this copy, set on every send
 } winc_mesh_hdr_t;
 
+#define MESH_PRESSURE(level)         ((level) << 4)
+#define MESH_FLAGS_PRESSURE(flags)   (((flags) >> 4) & 3)
+
 // Mesh message types
 #define MESH_MSG_BEACON     0x01
 #define MESH_MSG_DATA       0x02
-#define MESH_MSG_ROUTE_REQ  0x03
-#define MESH_MSG_ROUTE_RESP 0x04
+#define MESH_MSG_ROUTE_REQ  0x03  // winc_mesh_route_rec_t, recording the way out
+#define MESH_MSG_ROUTE_RESP 0x04  // The completed record, back to the requester
+#define MESH_MSG_ACK        0x05  // winc_mesh_ack_t list for reliable frames
+#define MESH_MSG_FRAGMENT   0x06  // Part of a payload above WINC_MESH_MTU
+#define MESH_MSG_AGGREGATE  0x07  // Several data frames for one next hop
+#define MESH_MSG_ECHO_REQ   0x08  // winc_mesh_echo_t, answered with an ECHO_REPLY
+#define MESH_MSG_ECHO_REPLY 0x09
+#define MESH_MSG_BEACON_REQ 0x0A  // Header only: next_hop asked for a full beacon
+#define MESH_MSG_FLOOD      0x0B  // winc_mesh_flood_t, relay ids, then the data
+#define MESH_MSG_STREAM     0x0C  // winc_mesh_stream_t, SACK blocks, then stream bytes
+#define MESH_MSG_PUBLISH    0x0D  // winc_mesh_publish_t, subscriber ids, then the data
+#define MESH_MSG_RPC        0x0E  // winc_mesh_rpc_t, then arguments or result
+#define MESH_MSG_KV         0x0F  // winc_mesh_kv_t, then records or keys
 
-// Mesh beacon packet
+// Distance-vector entry carried in beacons
+typedef struct __attribute__((packed)) {
+    uint8_t node_id;
+    uint8_t next_hop;      // Advertiser's next hop (receiver applies poisoned reverse),
+                           // 0 = entry withdrawn from the table
+    uint8_t hops;          // Hop count
+    uint8_t metric;        // Cumulative ETX, WINC_MESH_METRIC_INFINITY = unreachable
+} winc_mesh_dv_entry_t;
+
+// Link block entry: the advertiser's beacon reception from one neighbour
 typedef struct __attribute__((packed)) {
-    winc_mesh_hdr_t hdr;
     uint8_t node_id;
-    uint8_t node_name[16];
-    uint8_t neighbors[WINC_MESH_MAX_NODES];
-    uint8_t neighbor_count;
+    uint8_t link_q;        // 0-255, 0 = none
+} winc_mesh_link_q_t;
+
+// Beacon flags
+#define MESH_BEACON_FULL    0x01  // Entries are the complete table
+#define MESH_BEACON_OWNER   0x02  // Sender runs the AP (group owner)
+#define MESH_BEACON_TIME    0x04  // winc_mesh_time_t ends the beacon
+#define MESH_BEACON_LINKS   0x08  // Link block follows the entries
+#define MESH_BEACON_NAME    0x10  // Node name follows the link block
+#define MESH_BEACON_SUBS    0x20  // Subscription block follows the name
+#define MESH_BEACON_KV      0x40  // Store block before the time block
+
+// Subscription block record: node_id's topic list as of seq; count topic
+// ids (uint16_t) follow. A full beacon has one for every node we know to
+// have a list, an incremental one those changed since the last beacon.
+typedef struct __attribute__((packed)) {
+    uint8_t node_id;
+    uint16_t seq;          // node_id bumps it with every change to its list
+    uint8_t count;
+} winc_mesh_sub_rec_t;
+
+// Digest of the sender's key-value store, ending its store block. The
+// entries it changed since its last beacon come first, as in a
+// MESH_KV_UPDATE. Beacons of a node with an empty store leave it out.
+typedef struct __attribute__((packed)) {
+    uint32_t hash;         // Over every key, version and origin, in any order
+    uint8_t count;
+    uint16_t changed_len;  // Bytes of changed entries before the digest
+} winc_mesh_kv_digest_t;
+
+// Time block at the end of a beacon. tx_us is filled in as the beacon is
+// handed to the WINC. The echo fields return the stamp of a beacon we
+// heard from echo_node and how long we held it, from which that node
+// measures its round trip to us.
+typedef struct __attribute__((packed)) {
+    uint8_t root;          // Time root, 0 = sender not synchronised
+    uint8_t depth;         // Sender's hops from the root
+    uint16_t seq;          // Root's sync round, passed down unchanged
+    uint16_t err_us;       // Sender's error bound (saturates)
+    uint64_t tx_us;        // Sender's mesh time at transmission
+    uint8_t echo_node;     // 0 = no echo
+    uint32_t echo_stamp;   // Low 32 bits of echo_node's tx_us
+    uint32_t echo_hold_us; // Our receive to this transmission, in mesh time
+} winc_mesh_time_t;
+
+// Mesh beacon packet. epoch changes with every change to the sender's
+// table: a full beacon lists the table, an incremental one the entries
+// changed since epoch - 1, and a beacon with no entries says the table is
+// still the one of that epoch. Only the first entry_count entries are sent,
+// then as flagged the link block (a count, then winc_mesh_link_q_t each),
+// the name (a length, then the bytes), the subscription block (a count,
+// then winc_mesh_sub_rec_t each with its topics), the store block and the
+// time block.
+typedef struct __attribute__((packed)) {
+    winc_mesh_hdr_t hdr;
+    uint8_t flags;         // MESH_BEACON_*
+    uint16_t epoch;        // Sender's table version
+    uint8_t entry_count;
+    winc_mesh_dv_entry_t entries[WINC_MESH_MAX_NODES];
+    uint8_t tail[1 + WINC_MESH_MAX_NODES * sizeof(winc_mesh_link_q_t) + 16 +
+                 1 + (WINC_MESH_MAX_NODES + 1) * (sizeof(winc_mesh_sub_rec_t) + 2 * WINC_MESH_TOPICS) +
+                 WINC_MESH_KV_BEACON_MAX + sizeof(winc_mesh_kv_digest_t) + sizeof(winc_mesh_time_t)];
 } winc_mesh_beacon_t;
 
+// Frame inside a MESH_MSG_AGGREGATE datagram; the payload follows and
+// next_hop comes from the outer header
+typedef struct __attribute__((packed)) {
+    uint8_t msg_type;      // MESH_MSG_DATA or another unicast type
+    uint8_t src_node;
+    uint8_t dst_node;
+    uint8_t hop_count;
+    uint16_t seq_num;
+    uint16_t payload_len;
+    uint8_t flags;
+} winc_mesh_sub_hdr_t;
+
+// One acknowledged frame in a MESH_MSG_ACK payload
+typedef struct __attribute__((packed)) {
+    uint8_t src_node;      // Originator of the ACKed frame
+    uint16_t seq_num;
+} winc_mesh_ack_t;
+
+// Start of a MESH_MSG_FRAGMENT payload; the fragment's bytes follow
+typedef struct __attribute__((packed)) {
+    uint16_t msg_id;       // Per-source message number
+    uint8_t index;         // Fragment number, 0..count-1
+    uint8_t count;         // Fragments in the message
+    uint16_t offset;       // Byte offset of this fragment in the message
+    uint16_t total_len;    // Length of the whole message
+} winc_mesh_frag_hdr_t;
+
+// Start of a MESH_MSG_FLOOD payload. relay_count node ids follow: the
+// neighbours of sender that must send it on, then the broadcast data.
+typedef struct __attribute__((packed)) {
+    uint8_t sender;        // Node that transmitted this copy
+    uint8_t relay_count;
+} winc_mesh_flood_t;
+
+// Start of the payload of a WINC_MESH_PINNED frame; count node ids follow,
+// the last being the destination, then the data. Each forwarder advances
+// next and sends the frame to the node it then points at.
+typedef struct __attribute__((packed)) {
+    uint8_t count;
+    uint8_t next;          // Index of the node the frame is going to
+} winc_mesh_srcroute_t;
+
+// Start of a WINC_MESH_ORDERED frame's data (after any pinned path). A
+// prev_seq equal to the frame's own seq_num starts the sequence afresh.
+typedef struct __attribute__((packed)) {
+    uint16_t prev_seq;     // seq_num of the previous ordered frame to dst_node
+} winc_mesh_order_t;
+
+// Start of a MESH_MSG_STREAM payload; sack_count winc_mesh_sack_t follow,
+// then the segment's bytes. seq and ack count bytes as in TCP: SYN and FIN
+// each take one. ts_echo returns the ts of the latest segment that arrived
+// in order, from which the peer measures its round trip.
+typedef struct __attribute__((packed)) {
+    uint8_t src_port;      // Sender's port
+    uint8_t dst_port;      // Receiver's port
+    uint8_t flags;         // MESH_STREAM_*
+    uint8_t sack_count;
+    uint16_t window;       // Bytes the sender can still take in beyond ack
+    uint32_t seq;          // Stream offset of the first byte (or SYN/FIN)
+    uint32_t ack;          // Next byte expected, with MESH_STREAM_ACK
+    uint32_t ts;           // Sender's time_us_32()
+    uint32_t ts_echo;
+} winc_mesh_stream_t;
+
+// Bytes [start, end) received beyond a gap
+typedef struct __attribute__((packed)) {
+    uint32_t start;
+    uint32_t end;
+} winc_mesh_sack_t;
+
+// Stream segment flags
+#define MESH_STREAM_SYN     0x01
+#define MESH_STREAM_ACK     0x02
+#define MESH_STREAM_FIN     0x04
+#define MESH_STREAM_RST     0x08
+
+// Start of a MESH_MSG_PUBLISH payload; dst_count node ids follow, the
+// subscribers this copy is for, then the data. Each copy goes to one
+// neighbour (dst_node and next_hop), which delivers it if it is named and
+// splits the others between its own next hops.
+typedef struct __attribute__((packed)) {
+    uint16_t topic;
+    uint8_t dst_count;
+} winc_mesh_publish_t;
+
+// Start of a MESH_MSG_RPC payload; the arguments or result follow
+typedef struct __attribute__((packed)) {
+    uint8_t kind;          // MESH_RPC_REQUEST or MESH_RPC_REPLY
+    uint8_t method;
+    uint16_t call_id;      // Caller's correlation id, returned unchanged
+    int8_t status;         // Reply: WINC_MESH_RPC_OK or an error
+} winc_mesh_rpc_t;
+
+#define MESH_RPC_REQUEST    1
+#define MESH_RPC_REPLY      2
+
+// Start of a MESH_MSG_KV payload, sent to a neighbour
+typedef struct __attribute__((packed)) {
+    uint8_t kind;          // MESH_KV_*
+    uint8_t count;
+} winc_mesh_kv_t;
+
+#define MESH_KV_SUMMARY     1  // winc_mesh_kv_rec_t for every entry, no values
+#define MESH_KV_UPDATE      2  // winc_mesh_kv_rec_t, each followed by its value
+#define MESH_KV_WANT        3  // Keys (uint16_t) to send in an update
+
+// Store entry as sent; a later version, or the same from a higher origin,
+// replaces an earlier one
+typedef struct __attribute__((packed)) {
+    uint16_t key;
+    uint32_t version;      // Lamport clock of the write
+    uint8_t origin;        // Node that wrote it
+    uint8_t len;           // Of the value
+} winc_mesh_kv_rec_t;
+
+// MESH_MSG_ROUTE_REQ/RESP payload. Every node a request passes appends its
+// id, the destination included; count beyond WINC_MESH_MAX_PATH means the
+// route was too long to record.
+typedef struct __attribute__((packed)) {
+    uint16_t id;           // Request number, returned unchanged
+    uint8_t count;
+    uint8_t hops[WINC_MESH_MAX_PATH];
+} winc_mesh_route_rec_t;
+
+// Start of a MESH_MSG_ECHO_REQ/REPLY payload; padding to the ping size
+// follows. With record set, each node the echo passes through appends its
+// id to path: the forward hops, the responder, then the return hops.
+typedef struct __attribute__((packed)) {
+    uint16_t id;           // Ping run
+    uint16_t seq;          // Request number within the run
+    uint32_t sent_us;      // Sender's time_us_32(), returned unchanged
+    uint8_t record;
+    uint8_t path_len;
+    uint8_t path[2 * WINC_MESH_MAX_HOPS + 1];
+} winc_mesh_echo_t;
+
 // Routing table entry
 typedef struct {
     uint8_t node_id;
@@ -5,114 +5,15 @@
 // Extracted and fixed from winc_p2p.c
 
 #include <stdio.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "pico/stdlib.h"
 #include "winc_lib.h"
-
-// Forward declarations for functions from winc_lib.c
-// Note: winc_lib.c has global context, these functions don't need fd param
-
-// P2P operation codes (from winc_lib.c internal defines)
-#define GID_WIFI        1
-#define GID_IP          2
-#define GIDOP(gid, op) ((gid << 8) | op)
-#define GOP_P2P_ENABLE      GIDOP(GID_WIFI, 85)
-#define GOP_P2P_DISABLE     GIDOP(GID_WIFI, 86)
-
-// P2P enable command
-typedef struct {
-    uint8_t channel;
-} P2P_ENABLE_CMD;
-
-// Socket address
-typedef struct {
-    uint16_t family, port;
-    uint32_t ip;
-} SOCK_ADDR;
-
-// Socket storage
-typedef struct {
-    SOCK_ADDR addr;
-    uint16_t localport, session;
-    int state, conn_sock;
-    uint32_t hif_data_addr;
-    void (*handler)(uint8_t sock, int rxlen);
-} SOCKET;
-
-// Response message types
-typedef union {
-    uint8_t data[16];
-    int val;
-} RESP_MSG;
-
-// P2P connection state tracking
-static volatile bool p2p_connected = false;
-static volatile bool p2p_dhcp_done = false;
-static uint32_t p2p_my_ip = 0;
-static uint32_t p2p_peer_ip = 0;
-
-// External context from winc_lib.c
-typedef struct {
-    // Hardware pins
-    struct {
-        uint8_t sck, mosi, miso, cs, wake, reset, irq;
-    } pins;
-
-    // SPI buffers
-    uint8_t txbuf[1600];
-    uint8_t rxbuf[1600];
-    uint8_t tx_zeros[1024];
-
-    // Sockets
-    SOCKET sockets[10];
-    uint8_t databuf[1600];
-    RESP_MSG resp_msg;
-
-    // Config
-    int verbose;
-    bool use_crc;
-
-    // Firmware info
-    uint8_t fw_major, fw_minor, fw_patch;
-    uint8_t mac[6];
-
-    // Connection state
-    struct {
-        bool connected;
-        bool dhcp_done;
-        bool ap_mode;
-    } connection_state;
-
-    // Mesh state
-    struct {
-        uint8_t my_node_id;
-        char my_name[16];
-        bool enabled;
-        int udp_socket;  // IMPORTANT: UDP socket for mesh
-
-        // Routing table
-        struct {
-            uint8_t node_id;
-            uint8_t next_hop;
-            uint8_t hop_count;
-            uint32_t last_seen;
-            bool active;
-        } routes[WINC_MESH_MAX_NODES];
-        uint8_t route_count;
-
-        uint16_t seq_num;
-        uint32_t last_beacon;
-
-        // Data callback
-        void (*data_callback)(uint8_t, uint8_t*, uint16_t);
-    } mesh;
-} winc_ctx_t;
-
-// External functions from winc_lib.c (they use global context, no fd param)
-extern winc_ctx_t g_ctx;
+#include "winc_timer.h"
+#include "winc_ctx.h"
 
 // Declare internal functions from winc_lib.c that we need
 bool hif_put(uint16_t gop, void *dp1, int dlen1, void *dp2, int dlen2, int oset);
@@ -120,82 +21,669 @@ bool put_sock_sendto(uint8_t sock, void *data, int len);
 bool get_sock_data(uint8_t sock, void *data, int len);
 int open_sock_server(int portnum, bool tcp, void (*handler)(uint8_t, int));
 
-// Forward declarations
-static void mesh_packet_handler(uint8_t sock, int rxlen);
-static bool mesh_send_beacon(void);
-static void mesh_handle_beacon(winc_mesh_beacon_t *beacon);
-static bool mesh_route_packet(winc_mesh_hdr_t *hdr, uint8_t *data);
-static int mesh_find_route(uint8_t dst_node);
-static void mesh_update_route(uint8_t node_id, uint8_t next_hop, uint8_t hop_count);
+// Trickle beacon timer state
+typedef struct {
+    uint32_t interval;        // Current interval I (ms)
+    uint32_t interval_start;  // Start of current interval
+    uint32_t fire_at;         // Offset t within interval, in [I/2, I)
+    bool fired;               // Beacon decision already taken this interval
+    uint8_t counter;          // Consistent beacons heard this interval (c)
+    uint32_t last_sent;       // Time our last beacon actually went out
+    bool converging;          // Waiting for interval to climb back to IMAX
+} mesh_trickle_t;
+
+// Destination whose route recently failed
+typedef struct {
+    uint8_t node_id;
+    uint8_t next_hop;         // Next hop before the failure
+    uint8_t hops;             // Hop count before the failure
+    uint8_t metric;           // ETX metric before the failure
+    uint32_t until;           // Hold-down expiry
+    bool active;
+} mesh_holddown_t;
+
+// Beacon reception from one neighbour, tracked from beacon seq_num gaps
+typedef struct {
+    uint8_t node_id;
+    uint8_t rx_ratio;         // Share of its beacons we hear (0-255)
+    uint8_t tx_ratio;         // Share of our beacons it hears, as it reports (0 = unknown)
+    uint8_t span;             // Sequence numbers covered by window (<= 32)
+    uint16_t last_seq;
+    uint32_t window;          // Bit n set = beacon last_seq - n received
+    uint32_t last_heard;
+    uint32_t srtt_us;         // Smoothed ACK round trip, 0 = no sample yet
+    uint32_t rttvar_us;
+    uint32_t sync_stamp;      // Its last beacon's tx_us, echoed back to it
+    uint32_t sync_rx_us;      // Our clock when that beacon arrived
+    uint32_t delay_us;        // One-way delay from beacon echoes, 0 = unmeasured
+    uint32_t delay_dev_us;    // Its mean deviation
+    uint8_t reported_q;       // rx_ratio as we last sent it in a link block
+    uint8_t pressure;         // Queue pressure in its last datagram, 0-3
+    uint32_t pressure_at;     // When that arrived (ms)
+    uint32_t kv_asked_at;     // Our last store summary to it (ms)
+    bool kv_asked;
+    bool reported;
+    bool sync_heard;
+    bool active;
+} mesh_link_t;
+
+// A neighbour's table as of its epoch, so a beacon that only repeats the
+// epoch is handled as if it listed the table again
+typedef struct {
+    winc_mesh_dv_entry_t entries[WINC_MESH_MAX_NODES];
+    uint8_t count;
+    uint16_t epoch;
+    bool valid;               // entries are the table of epoch
+    bool requested;           // Full beacon asked for at req_at
+    uint32_t req_at;
+    char name[16];            // "" = not heard yet
+} mesh_adv_t;
+
+// Per route slot extras
+typedef struct {
+    uint8_t metric;           // Cumulative ETX in 1/WINC_MESH_ETX_ONE units
+    uint32_t nbr_hash;        // Digest of the neighbour's last full vector
+} mesh_route_ext_t;
+
+// Distance-vector advertisement state
+typedef struct {
+    mesh_holddown_t holddown[WINC_MESH_MAX_NODES];
+    uint8_t dirty[32];        // Bitmap of node ids changed since last beacon
+    uint8_t dirty_count;
+    uint16_t epoch;           // Table version in our beacons
+    bool full_pending;        // Next beacon must be full
+    uint32_t full_sent;       // Last full beacon (ms)
+} mesh_dv_t;
+
+// Frame buffer from the pool. While free, next links the free list; while
+// queued for the radio, it links the class queue.
+typedef struct {
+    int8_t next;
+    uint16_t len;             // Bytes used in buf
+    uint8_t buf[sizeof(winc_mesh_hdr_t) + WINC_MESH_MTU];
+} mesh_frame_t;
 
-// ===== P2P CONTROL FUNCTIONS =====
+typedef struct {
+    mesh_frame_t frames[WINC_MESH_POOL_FRAMES];
+    int8_t free_head;         // -1 = exhausted
+    winc_mesh_pool_stats_t stats;
+} mesh_pool_t;
 
-// Define P2P/WPS operations if not already defined
-#ifndef GOP_WPS_REQ
-#define GOP_WPS_REQ GIDOP(GID_WIFI, 73)
+#if WINC_MESH_POOL_FRAMES > 127
+#error "WINC_MESH_POOL_FRAMES must be at most 127 (int8_t frame links)"
 #endif
 
-// Enable P2P mode on ATWINC1500
-static bool p2p_enable(uint8_t channel) {
-    P2P_ENABLE_CMD cmd;
-    bool ok;
+#if WINC_MESH_AGG_MAX_BYTES > WINC_MESH_MTU
+#error "WINC_MESH_AGG_MAX_BYTES must fit in one pool frame (WINC_MESH_MTU)"
+#endif
 
-    if (g_ctx.verbose)
-        printf("Enabling P2P mode on channel %u\n", channel);
+// Data frames waiting to share a datagram to one next hop. The pool frame
+// starts with room for the outer header, then winc_mesh_sub_hdr_t + payload
+// per frame.
+typedef struct {
+    uint8_t next_hop;         // 0 = free
+    uint8_t cls;              // WINC_MESH_CLASS_NORMAL or _BULK
+    uint8_t count;            // Frames queued
+    int8_t frame;             // Pool frame, valid while count > 0
+    uint16_t len;             // Sub-frame bytes after the outer header
+    uint32_t due_us;          // Send deadline, in time_us_32()
+} mesh_agg_t;
 
-    memset(&cmd, 0, sizeof(cmd));
-    cmd.channel = channel;
+// Bytes of message data per fragment, and fragments per message at most
+#define MESH_FRAG_CHUNK  (WINC_MESH_MTU - sizeof(winc_mesh_frag_hdr_t))
+#define MESH_FRAG_MAX    ((WINC_MESH_MAX_MESSAGE + MESH_FRAG_CHUNK - 1) / MESH_FRAG_CHUNK)
 
-    ok = hif_put(GOP_P2P_ENABLE, &cmd, sizeof(cmd), 0, 0, 0);
+#if WINC_MESH_REASM_SLOTS
+_Static_assert(MESH_FRAG_MAX <= WINC_MESH_POOL_FRAMES - WINC_MESH_POOL_FRAMES / 4,
+               "A WINC_MESH_MAX_MESSAGE message must fit in three quarters of the frame pool");
+#endif
 
-    if (ok && g_ctx.verbose)
-        printf("P2P mode enabled\n");
-    else if (!ok)
-        printf("Failed to enable P2P mode\n");
+// Message being reassembled from fragments. Each fragment that has arrived
+// waits in a pool frame, header and all; only a complete message is copied
+// out, into the one buffer every slot shares.
+typedef struct {
+    bool active;
+    uint8_t src_node;
+    uint16_t msg_id;
+    uint16_t total_len;
+    uint8_t count;            // Fragments expected
+    uint8_t received;         // Distinct fragments so far
+    int8_t frame[MESH_FRAG_MAX];  // Pool frame per fragment index, -1 = missing
+    uint32_t started;         // First fragment arrival (ms)
+} mesh_reasm_t;
 
-    return ok;
-}
+// Reliable frame waiting for the next hop's ACK
+typedef struct {
+    bool active;
+    bool queued;              // A copy still waits in our transmit queue
+    uint8_t retries;
+    uint8_t held;             // RTOs skipped because the copy had not left
+    uint32_t sent_us;         // Last transmission, for the RTT sample
+    uint32_t rto_us;          // Current timeout, doubled on every retry
+    winc_timer_t timer;       // Fires when rto_us runs out
+    int8_t frame;             // Pool frame holding header + payload
+} mesh_rtx_t;
 
-// Disable P2P mode
-static bool p2p_disable(void) {
-    bool ok;
+// Reliable frames received from one source, so a resend is ACKed but not
+// handled again
+typedef struct {
+    uint8_t src_node;         // 0 = free
+    uint16_t top_seq;         // Highest seq_num seen
+    uint64_t window;          // Bit n set = top_seq - n received
+    uint32_t last_used;
+} mesh_dup_t;
 
-    if (g_ctx.verbose)
-        printf("Disabling P2P mode\n");
+// A broadcast seen recently, so later copies are neither delivered nor
+// relayed again
+typedef struct {
+    uint8_t src_node;         // 0 = free
+    uint16_t seq_num;
+    bool relayed;             // We sent it on (or sent it first)
+    uint32_t at;
+} mesh_flood_seen_t;
 
-    ok = hif_put(GOP_P2P_DISABLE, NULL, 0, 0, 0, 0);
+typedef struct {
+    mesh_flood_seen_t seen[WINC_MESH_FLOOD_CACHE];
+    uint8_t next;             // Oldest entry, overwritten next
+    winc_mesh_flood_stats_t stats;
+} mesh_flood_t;
 
-    if (ok && g_ctx.verbose)
-        printf("P2P mode disabled\n");
+// Path pinned to one destination
+typedef struct {
+    uint8_t dst_node;         // 0 = free
+    uint8_t count;            // Hops in the path, 0 = none yet
+    uint8_t hops[WINC_MESH_MAX_PATH];
+    uint16_t learn_id;        // Route request awaiting its reply, 0 = none
+} mesh_path_t;
 
-    return ok;
-}
+// Last ordered frame sent to one destination
+typedef struct {
+    uint8_t dst_node;         // 0 = free
+    uint16_t last_seq;
+    uint32_t used;            // When (ms), for reuse
+} mesh_order_tx_t;
 
-// Start WPS connection (for P2P pairing)
-static bool p2p_start_wps_connection(void) {
-    // WPS request structure
-    typedef struct {
-        uint8_t trigger_type;  // 4 = WPS_PBC
-        uint8_t x[3];
-        uint8_t pin[8];
-    } WPS_REQ;
+// Ordered frame that arrived early, waiting for the ones before it
+typedef struct {
+    int8_t frame;             // Pool frame holding the data
+    uint16_t seq;
+    uint16_t prev_seq;
+    uint16_t len;
+    uint32_t at;              // Arrival (ms)
+} mesh_reorder_frame_t;
 
-    WPS_REQ req;
-    bool ok;
+// Ordered frames from one source
+typedef struct {
+    uint8_t src_node;         // 0 = free
+    uint16_t last_seq;        // Last frame handed to data_callback
+    uint16_t expect;          // With no history, the frame the first one named
+    bool expecting;           // Until something is handed up
+    uint8_t count;            // Frames held
+    uint32_t used;            // Last arrival (ms), for reuse
+    mesh_reorder_frame_t held[WINC_MESH_REORDER_WINDOW];
+    winc_timer_t timer;       // The longest held frame's wait runs out
+} mesh_reorder_t;
 
-    printf("Initiating WPS Push Button Configuration...\n");
+typedef struct {
+    mesh_order_tx_t tx[WINC_MESH_REORDER_SLOTS];
+    mesh_reorder_t rx[WINC_MESH_REORDER_SLOTS];
+    uint8_t buf[WINC_MESH_MTU];  // Order header + data being sent
+    winc_mesh_order_stats_t stats;
+} mesh_order_t;
 
-    memset(&req, 0, sizeof(req));
-    req.trigger_type = 4;  // WPS_PBC
+#if WINC_MESH_STREAMS
+// SACK blocks carried per segment and remembered each way
+#define MESH_STREAM_SACKS   4
+#define MESH_STREAM_LISTEN  4     // Ports listened on at once
+#define MESH_STREAM_MASK    (WINC_MESH_STREAM_BUF - 1)
 
-    ok = hif_put(GOP_WPS_REQ, &req, sizeof(req), 0, 0, 0);
+#if WINC_MESH_STREAM_BUF & MESH_STREAM_MASK
+#error "WINC_MESH_STREAM_BUF must be a power of two"
+#endif
+// 24 and 8 being sizeof winc_mesh_stream_t and winc_mesh_sack_t
+#if WINC_MESH_STREAM_MSS + 24 + MESH_STREAM_SACKS * 8 > WINC_MESH_MTU
+#error "A WINC_MESH_STREAM_MSS segment must fit in one frame (WINC_MESH_MTU)"
+#endif
 
-    if (!ok) {
-        printf("ERROR: WPS request failed\n");
-    }
+// Stream socket states
+#define MESH_STREAM_FREE       0
+#define MESH_STREAM_SYN_SENT   1
+#define MESH_STREAM_SYN_RCVD   2
+#define MESH_STREAM_OPEN       3
+#define MESH_STREAM_TIME_WAIT  4  // Both ends closed; lingers to re-ACK a lost FIN
+#define MESH_STREAM_RESET      5  // Waiting for the application to close it
 
-    return ok;
-}
+// One end of a stream. Sequence numbers count bytes from the SYN: the send
+// buffer holds [snd_una, snd_wr) at offset seq - (iss + 1), the receive
+// buffer [rcv_rd, rcv_nxt) plus out-of-order blocks at seq - (irs + 1).
+typedef struct {
+    uint8_t state;            // MESH_STREAM_*
+    bool user;                // Handle held by the application
+    bool fin_out;             // Closed by the application: FIN follows the data
+    bool fin_in;              // Peer's FIN has arrived in order
+    bool fin_seen;            // Peer's FIN has arrived, maybe ahead of data
+    uint8_t peer;
+    uint8_t lport, rport;
+    uint8_t flags;            // WINC_MESH_RELIABLE and class for our segments
+
+    // Sending
+    uint32_t iss;
+    uint32_t snd_una;         // Oldest byte not acknowledged
+    uint32_t snd_max;         // Next byte never sent
+    uint32_t snd_wr;          // End of the bytes written so far
+    uint32_t snd_wnd;         // Peer's window beyond snd_una
+    uint32_t cwnd, ssthresh;
+    bool recovering;          // Repairing losses up to recover
+    bool rto_recovery;        // ...after a timeout: all unsacked bytes are lost
+    uint32_t recover;
+    uint32_t rtx_next;        // Next byte to consider resending
+    uint8_t dupacks;
+    uint8_t retries;          // Timeouts in a row
+    uint8_t sack_count;
+    winc_mesh_sack_t sacked[MESH_STREAM_SACKS];  // Peer has these, sorted
+    uint32_t srtt_us, rttvar_us;
+    uint32_t rto_ms;
+    uint32_t rto_at;          // When the oldest unacknowledged byte times out (ms)
+    bool blocked;             // A send was refused; try again shortly
+    winc_timer_t timer;       // Retransmit, window probe, retry or linger
+
+    // Receiving
+    uint32_t irs;
+    uint32_t rcv_nxt;         // Next byte expected in order
+    uint32_t rcv_rd;          // Next byte the application reads
+    uint32_t rcv_adv;         // Right edge of the window last advertised
+    uint32_t fin_seq;         // Where the peer's FIN sits, once fin_seen
+    uint32_t ts_recent;       // Echoed back for the peer's round trips
+    uint8_t ooo_count;
+    winc_mesh_sack_t ooo[MESH_STREAM_SACKS];     // Held beyond a gap, newest first
+    uint8_t unacked;          // Segments arrived since our last ACK
+    bool ack_now;
+    winc_timer_t ack_timer;   // Delayed ACK
+
+    winc_mesh_stream_stats_t stats;
+    uint8_t txbuf[WINC_MESH_STREAM_BUF];
+    uint8_t rxbuf[WINC_MESH_STREAM_BUF];
+} mesh_stream_t;
+
+typedef struct {
+    mesh_stream_t socks[WINC_MESH_STREAMS];
+    uint8_t listen[MESH_STREAM_LISTEN];  // 0 = free
+    uint8_t next_port;        // Last local port picked for a connect
+    uint8_t buf[WINC_MESH_MTU];          // Segment being sent
+} mesh_streams_t;
+#endif
+
+// Buckets of the local topic index; chains stay short at up to half full
+#define MESH_TOPIC_BUCKETS  32
+
+#if WINC_MESH_TOPICS > MESH_TOPIC_BUCKETS / 2 || WINC_MESH_TOPICS > 255
+#error "WINC_MESH_TOPICS must be at most MESH_TOPIC_BUCKETS / 2"
+#endif
+
+// Topic we subscribe to, chained from its bucket of the index
+typedef struct {
+    uint16_t topic;           // 0 = free
+    uint8_t next;             // Next subscription in the bucket + 1, 0 = end
+    winc_mesh_topic_handler_t handler;
+} mesh_sub_t;
+
+// Topic list another node advertises
+typedef struct {
+    uint8_t node_id;          // 0 = free
+    uint16_t seq;
+    uint8_t count;
+    bool dirty;               // Changed since our last beacon
+    uint16_t topics[WINC_MESH_TOPICS];
+} mesh_sub_rec_t;
+
+typedef struct {
+    mesh_sub_t subs[WINC_MESH_TOPICS];
+    uint8_t bucket[MESH_TOPIC_BUCKETS];  // First subscription + 1, 0 = none
+    uint8_t count;
+    uint16_t seq;             // Version of our own list
+    bool announced;           // We have a list to advertise
+    bool dirty;               // Our list changed since our last beacon
+    mesh_sub_rec_t nodes[WINC_MESH_MAX_NODES];
+    uint8_t buf[WINC_MESH_MTU];          // Publication being sent
+    winc_mesh_pubsub_stats_t stats;
+} mesh_pubsub_t;
+
+// Call ids carry the call's slot in their low bits
+#define MESH_RPC_MASK  (WINC_MESH_RPC_CALLS - 1)
+
+#if WINC_MESH_RPC_CALLS & MESH_RPC_MASK || WINC_MESH_RPC_CALLS > 256
+#error "WINC_MESH_RPC_CALLS must be a power of two, at most 256"
+#endif
+// 5 being sizeof winc_mesh_rpc_t
+#if WINC_MESH_RPC_MAX + 5 > WINC_MESH_MTU
+#error "WINC_MESH_RPC_MAX arguments must fit in one frame (WINC_MESH_MTU)"
+#endif
+
+// Call waiting for its reply
+typedef struct {
+    bool active;
+    uint16_t id;              // Correlation id, slot index in the low bits
+    uint8_t dst_node;
+    uint8_t method;
+    uint8_t flags;
+    uint16_t len;
+    uint32_t deadline;        // ms
+    uint32_t retry_ms;        // Wait after the next attempt
+    uint32_t started_us;
+    winc_mesh_rpc_done_t done;
+    void *arg;
+    winc_timer_t timer;       // Next attempt, or the deadline
+    uint8_t args[WINC_MESH_RPC_MAX];
+} mesh_rpc_call_t;
+
+typedef struct {
+    uint8_t method;           // 0 = free
+    winc_mesh_rpc_handler_t handler;
+} mesh_rpc_method_t;
+
+// Reply sent lately, sent again for a repeated request
+typedef struct {
+    uint8_t src_node;         // Caller, 0 = free
+    uint16_t call_id;
+    int8_t status;
+    uint16_t len;
+    uint8_t result[WINC_MESH_RPC_MAX];
+} mesh_rpc_reply_t;
+
+typedef struct {
+    mesh_rpc_call_t calls[WINC_MESH_RPC_CALLS];
+    mesh_rpc_method_t methods[WINC_MESH_RPC_METHODS];
+    mesh_rpc_reply_t replies[WINC_MESH_RPC_REPLIES];
+    uint8_t next_reply;       // Oldest reply, overwritten next
+    uint16_t gen;             // High bits of the next call id
+    uint64_t latency_sum_us;
+    uint8_t buf[WINC_MESH_MTU];          // Request or reply being sent
+    winc_mesh_rpc_stats_t stats;
+} mesh_rpc_t;
+
+// 8 being sizeof winc_mesh_kv_rec_t and 2 sizeof winc_mesh_kv_t: an update
+// carrying the whole store must fit in one frame
+#if WINC_MESH_KV_KEYS * (8 + WINC_MESH_KV_VALUE_MAX) + 2 > WINC_MESH_MTU
+#error "WINC_MESH_KV_KEYS entries of WINC_MESH_KV_VALUE_MAX bytes must fit in one frame (WINC_MESH_MTU)"
+#endif
+#if WINC_MESH_KV_KEYS > 255 || WINC_MESH_KV_VALUE_MAX > 255
+#error "WINC_MESH_KV_KEYS and WINC_MESH_KV_VALUE_MAX must be at most 255"
+#endif
+#if WINC_MESH_KV_BEACON_MAX < 8 + WINC_MESH_KV_VALUE_MAX
+#error "WINC_MESH_KV_BEACON_MAX must hold at least one entry"
+#endif
+
+typedef struct {
+    winc_mesh_kv_rec_t rec;   // key 0 = free
+    bool dirty;               // Changed since our last beacon
+    bool beaconed;            // In the beacon being sent
+    uint8_t value[WINC_MESH_KV_VALUE_MAX];
+} mesh_kv_entry_t;
+
+typedef struct {
+    mesh_kv_entry_t entries[WINC_MESH_KV_KEYS];
+    uint32_t clock;           // Highest version written or taken
+    uint32_t hash;            // Digest of the entries, as beacons carry it
+    uint32_t changed_at;      // Last write or newer entry taken
+    uint16_t block_len;       // Store block of the last beacon built
+    winc_timer_t timer;       // Beacon with changed entries
+    winc_mesh_kv_handler_t callback;
+    uint8_t buf[WINC_MESH_MTU];          // Summary, update or request being sent
+    winc_mesh_kv_stats_t stats;
+} mesh_kv_t;
+
+typedef struct {
+    int8_t head, tail;        // -1 = empty
+    uint32_t deficit;         // DRR byte credit (normal and bulk only)
+} mesh_txq_class_t;
+
+// Ping in progress; result fills in as replies arrive
+typedef struct {
+    bool active;
+    uint16_t id;              // Stamped in every request of this run
+    uint8_t dst;
+    uint8_t count;            // Requests to send
+    uint16_t size;            // Payload bytes per request
+    uint8_t got[32];          // Bitmap of seq numbers answered
+    uint32_t last_rtt_us;     // Previous round trip, for jitter
+    uint32_t rtt_sum_us;
+    uint32_t jitter_sum_us;
+    winc_timer_t timer;       // Next request, then the final timeout
+    winc_mesh_ping_result_t result;
+} mesh_ping_t;
+
+// Group owner election
+typedef struct {
+    uint8_t state;            // WINC_MESH_ROLE_*
+    uint8_t go_node;          // Current group owner, 0 = unknown
+    uint32_t go_heard;        // Last beacon from go_node (ms)
+    uint32_t takeover_at;     // Start our own AP unless joined by then
+    uint32_t attempt_at;      // Last join or AP start request
+    uint32_t lost_at;         // When we noticed the owner gone, while out
+    bool out;                 // Between losing the owner and being back
+    bool booting;             // Still on the first join attempt since init
+    winc_timer_t timer;
+    winc_mesh_role_stats_t stats;
+} mesh_role_t;
+
+#if WINC_MESH_GO_TAKEOVER_MS < WINC_MESH_AP_START_MS + WINC_MESH_JOIN_RETRY_MS
+#error "WINC_MESH_GO_TAKEOVER_MS must cover an AP start (WINC_MESH_AP_START_MS) plus a join"
+#endif
+
+// Time synchronisation: mesh time = local + offset + (local - ref) * skew
+typedef struct {
+    uint64_t local_us;        // Our clock at reception
+    int64_t offset_us;        // Sender's mesh time plus link delay, less local_us
+} mesh_sync_sample_t;
+
+typedef struct {
+    uint32_t stamp;           // Low 32 bits of the tx_us we sent
+    uint32_t local_us;        // Our clock then
+} mesh_sync_sent_t;
+
+typedef struct {
+    uint8_t root;             // 0 = not synchronised
+    uint8_t parent;
+    uint8_t depth;
+    uint16_t seq;             // Latest root round we took a reading from
+    uint16_t parent_err_us;
+    uint32_t delay_dev_us;    // Uncertainty of the parent's delay
+    uint32_t last_sample;     // ms
+    uint32_t since;           // When we started looking for a root (ms)
+    uint64_t ref_us;
+    int64_t offset_us;
+    int32_t skew_ppb;
+    uint32_t resid_us;        // Largest residual of the fit
+    mesh_sync_sample_t samples[WINC_MESH_SYNC_SAMPLES];
+    uint8_t count;
+    uint8_t head;             // Next sample to overwrite
+    uint8_t outliers;         // Readings in a row far off the fit
+    mesh_sync_sent_t sent[4]; // Our last beacons, to match echoes against
+    uint8_t sent_head;
+    uint8_t echo_next;        // links[] slot to echo next
+    uint64_t rx_us;           // Our clock when the datagram being handled arrived
+    uint32_t steps;
+} mesh_sync_t;
+
+#if WINC_MESH_SYNC_SAMPLES < 1 || WINC_MESH_SYNC_SAMPLES > 64
+#error "WINC_MESH_SYNC_SAMPLES must be 1-64 for the fit's 64-bit sums"
+#endif
+
+// Queue pressure we report and how we act on our neighbours' reports
+typedef struct {
+    bool enabled;
+    bool holding;             // Bulk queue waiting for its next hop to drain
+    uint8_t level;            // As our last beacon carried it
+    uint32_t paced_at;        // Last normal frame let through to a level 3 hop (ms)
+    uint32_t announced_at;    // Last beacon sent to report our pressure (ms)
+    winc_timer_t timer;       // That beacon, once due
+    winc_mesh_bp_stats_t stats;
+} mesh_bp_t;
+
+// Per-class transmit queues and the radio pacing estimate
+typedef struct {
+    mesh_txq_class_t cls[WINC_MESH_CLASSES];
+    uint8_t drr_cur;          // Weighted class whose turn it is
+    bool drr_fresh;           // Turn just started, credit not yet added
+    uint32_t radio_free_us;   // When the WINC should have sent all we gave it
+    uint8_t tdma_slots;       // Slots per superframe, 0 = send any time
+    uint32_t tdma_slot_us;
+    winc_mesh_queue_stats_t stats;
+} mesh_txq_t;
+
+// Mesh-layer private state (kept here so winc_ctx_t stays shared with winc_lib.c)
+typedef struct {
+    winc_timer_wheel_t timers;
+    winc_timer_t beacon_timer;
+    winc_timer_t full_timer;  // Full beacon a neighbour asked for
+    winc_timer_t housekeeping_timer;
+    winc_timer_t route_timer[WINC_MESH_MAX_NODES];  // Expiry, per route slot
+    mesh_trickle_t trickle;
+    winc_mesh_beacon_stats_t beacon_stats;
+    mesh_dv_t dv;
+    mesh_route_ext_t route_ext[WINC_MESH_MAX_NODES];
+    mesh_link_t links[WINC_MESH_MAX_NODES];
+    winc_mesh_neighbor_stats_t nbr[WINC_MESH_MAX_NODES];  // Counters, by links[] slot
+    mesh_adv_t adv[WINC_MESH_MAX_NODES];                  // Tables, by links[] slot
+    uint8_t rx_from;          // Neighbour that sent the datagram being handled
+    uint16_t beacon_seq;      // Own counter so data frames leave no gaps
+    uint32_t rand_state;
+#if WINC_MESH_AGGREGATE
+    mesh_agg_t agg[WINC_MESH_AGG_QUEUES];
+#endif
+    mesh_pool_t pool;
+    mesh_txq_t txq;
+    mesh_bp_t bp;
+    uint8_t rxbuf[1600];      // Datagram being handled
+    uint8_t fragbuf[WINC_MESH_MTU];  // Fragment header + chunk being sent
+    uint16_t frag_msg_id;
+#if WINC_MESH_REASM_SLOTS
+    mesh_reasm_t reasm[WINC_MESH_REASM_SLOTS];
+    uint8_t reasm_buf[WINC_MESH_MAX_MESSAGE];  // Complete message being handed up
+#endif
+    mesh_rtx_t rtx[WINC_MESH_RTX_SLOTS];
+    mesh_dup_t dup[WINC_MESH_DUP_CACHE];
+    winc_mesh_ack_t acks[32];  // ACKs to send once the datagram is handled
+    uint8_t ack_count;
+    winc_mesh_tx_stats_t tx_stats;
+    mesh_flood_t flood;
+    mesh_path_t paths[WINC_MESH_PATH_SLOTS];
+    uint16_t path_req_id;
+    mesh_order_t order;
+#if WINC_MESH_STREAMS
+    mesh_streams_t stream;
+#endif
+    mesh_pubsub_t pubsub;
+    mesh_rpc_t rpc;
+    mesh_kv_t kv;
+    mesh_ping_t ping;
+    mesh_role_t role;
+    mesh_sync_t sync;
+} mesh_ctx_t;
+
+// A full beacon, subscription and store blocks included, goes out as one
+// pool frame and comes back in through rxbuf
+_Static_assert(sizeof(winc_mesh_beacon_t) <= sizeof(winc_mesh_hdr_t) + WINC_MESH_MTU,
+               "A full beacon must fit in one frame (WINC_MESH_MTU): lower WINC_MESH_MAX_NODES, "
+               "WINC_MESH_TOPICS or WINC_MESH_KV_BEACON_MAX");
+_Static_assert(sizeof(winc_mesh_beacon_t) <= sizeof(((mesh_ctx_t*)0)->rxbuf),
+               "A full beacon must fit in the receive buffer");
+
+static mesh_ctx_t mesh_ctx;
+
+#define MESH_NOW_MS()      to_ms_since_boot(get_absolute_time())
+#define MESH_US_TO_MS(us)  (((us) + 999) / 1000)
+
+// Route expiry, hold-downs, silent neighbours and stale reassembly are
+// swept this often rather than on every poll
+#define MESH_HOUSEKEEPING_MS  1000
+
+// A neighbour's reception of our beacons is re-sent once it moves this much
+// (out of 255), below the metric hysteresis
+#define MESH_LINK_Q_STEP      16
+
+// Uncertainty charged for a link delay not yet measured by beacon echoes,
+// about one WINC datagram's latency
+#define MESH_SYNC_DELAY_GUESS_US  1000
+
+// Connection state is checked this often during elections and for owner loss
+#define MESH_ROLE_POLL_MS     100
+
+// Longest we stay silent: the group owner's heartbeat, else short enough
+// that neighbours never time our route out over one lost beacon
+#define MESH_BEACON_MAX_GAP_MS()  (mesh_ctx.role.state == WINC_MESH_ROLE_OWNER ? \
+    MIN(WINC_MESH_GO_HEARTBEAT_MS, WINC_MESH_ROUTE_TIMEOUT_MS / 3) : WINC_MESH_ROUTE_TIMEOUT_MS / 3)
+
+// Forward declarations
+static void mesh_packet_handler(uint8_t sock, int rxlen);
+static bool mesh_send_beacon(void);
+static void mesh_handle_beacon(winc_mesh_beacon_t *beacon, int rxlen);
+static bool mesh_route_packet(winc_mesh_hdr_t *hdr, uint8_t *data);
+static void mesh_handle_data(winc_mesh_hdr_t *hdr, uint8_t *data);
+static void mesh_frag_input(winc_mesh_hdr_t *hdr, uint8_t *data);
+static void mesh_handle_echo(winc_mesh_hdr_t *hdr, uint8_t *data);
+static bool mesh_tx_data(winc_mesh_hdr_t *hdr, const uint8_t *data);
+static bool mesh_tx_frame(const winc_mesh_hdr_t *hdr, const uint8_t *data);
+static bool mesh_tx_raw(const winc_mesh_hdr_t *hdr, const uint8_t *data);
+static int mesh_rtx_room(void);
+static void mesh_rtx_sent(const uint8_t *buf, uint32_t now_us);
+static void mesh_pool_init(void);
+static void mesh_timers_init(uint32_t now);
+static void mesh_trickle_arm(void);
+static uint32_t mesh_rand(void);
+static int mesh_find_route(uint8_t dst_node);
+static bool mesh_dv_update(uint8_t neighbor, uint8_t dst, uint8_t adv_next_hop,
+                           uint8_t adv_hops, uint8_t adv_metric, uint32_t now);
+static bool mesh_route_add(uint8_t node_id, uint8_t next_hop, uint8_t hop_count,
+                           uint8_t metric, uint32_t now);
+static mesh_link_t *mesh_link_find(uint8_t node_id);
+static mesh_link_t *mesh_link_heard(uint8_t node_id, uint16_t seq, uint32_t now);
+static winc_mesh_neighbor_stats_t *mesh_nbr(uint8_t node_id);
+static uint8_t mesh_link_etx(uint8_t node_id);
+static uint8_t mesh_etx_hysteresis(uint8_t metric);
+static void mesh_route_invalidate(int slot, uint32_t now);
+static mesh_holddown_t *mesh_holddown_find(uint8_t node_id, uint32_t now);
+static int mesh_route_slot(uint8_t node_id);
+static void mesh_trickle_reset(uint32_t now);
+static void mesh_role_join(uint32_t now, uint32_t takeover_ms);
+static void mesh_sync_heard(uint8_t sender, mesh_link_t *link, const winc_mesh_time_t *t, uint32_t now);
+static void mesh_sync_stamp(uint8_t *buf, int len);
+static void mesh_sync_check(uint32_t now);
+static uint64_t mesh_sync_global(uint64_t local_us);
+static void mesh_txq_run(void);
+static uint32_t mesh_tdma_wait_us(uint32_t now_us, int len);
+static bool mesh_flood_send(const uint8_t *data, uint16_t len, uint8_t flags);
+static void mesh_handle_flood(winc_mesh_hdr_t *hdr, uint8_t *data);
+static bool mesh_path_send(uint8_t dst_node, const uint8_t *data, uint16_t len, uint8_t flags);
+static bool mesh_send_routed(uint8_t dst_node, const uint8_t *data, uint16_t len, uint8_t flags);
+static bool mesh_order_send(uint8_t dst_node, const uint8_t *data, uint16_t len, uint8_t flags);
+static void mesh_order_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len);
+static void mesh_stream_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len);
+#if WINC_MESH_STREAMS
+static void mesh_stream_timer_fn(winc_timer_t *t, void *arg);
+static void mesh_stream_ack_timer_fn(winc_timer_t *t, void *arg);
+#endif
+static bool mesh_subs_dirty(void);
+static int mesh_build_subs(uint8_t *p, bool full);
+static void mesh_subs_sent(void);
+static bool mesh_subs_heard(const uint8_t *p, const uint8_t *end);
+static void mesh_pub_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len);
+static void mesh_rpc_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len);
+static void mesh_rpc_timer_fn(winc_timer_t *t, void *arg);
+static int mesh_kv_build(uint8_t *p);
+static void mesh_kv_sent(void);
+static void mesh_kv_heard(mesh_link_t *link, const winc_mesh_kv_digest_t *d, uint32_t now);
+static void mesh_kv_timer_fn(winc_timer_t *t, void *arg);
+static void mesh_kv_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len);
+static bool mesh_path_parse(const winc_mesh_hdr_t *hdr, const uint8_t *data, winc_mesh_srcroute_t *sr);
+static bool mesh_path_forward(winc_mesh_hdr_t *hdr, uint8_t *data, winc_mesh_srcroute_t *sr);
+static void mesh_handle_route_rec(winc_mesh_hdr_t *hdr, uint8_t *data);
+static void mesh_route_rec_append(winc_mesh_route_rec_t *rec);
+static void mesh_bp_stamp(uint8_t *buf);
+static void mesh_bp_update(void);
+static void mesh_bp_heard(uint8_t node_id, uint8_t flags);
+static int mesh_bp_next_hop(uint8_t dst_node, int next_hop, int cls, bool source);
+static uint32_t mesh_bp_hold_ms(int cls);
 
 // ===== MESH INITIALIZATION =====
 bool winc_mesh_init(uint8_t node_id, const char *node_name) {
@@ -208,424 +696,5528 @@ bool winc_mesh_init(uint8_t node_id, const char *node_name) {
     strncpy(g_ctx.mesh.my_name, node_name, sizeof(g_ctx.mesh.my_name) - 1);
     g_ctx.mesh.my_name[sizeof(g_ctx.mesh.my_name) - 1] = '\0';
 
-    // Initialize routing table
-    memset(g_ctx.mesh.routes, 0, sizeof(g_ctx.mesh.routes));
-    g_ctx.mesh.route_count = 0;
-    g_ctx.mesh.seq_num = 0;
-    g_ctx.mesh.last_beacon = 0;
+    // Initialize routing table
+    memset(g_ctx.mesh.routes, 0, sizeof(g_ctx.mesh.routes));
+    g_ctx.mesh.route_count = 0;
+    g_ctx.mesh.seq_num = 0;
+    g_ctx.mesh.last_beacon = 0;
+
+    memset(&mesh_ctx, 0, sizeof(mesh_ctx));
+    mesh_pool_init();
+    mesh_timers_init(to_ms_since_boot(get_absolute_time()));
+    for (int i = 0; i < WINC_MESH_CLASSES; i++)
+        mesh_ctx.txq.cls[i].head = mesh_ctx.txq.cls[i].tail = -1;
+    mesh_ctx.txq.tdma_slots = WINC_MESH_TDMA_SLOTS;
+    mesh_ctx.txq.tdma_slot_us = WINC_MESH_TDMA_SLOT_US;
+    mesh_ctx.bp.enabled = WINC_MESH_BACKPRESSURE;
+    mesh_ctx.rand_state = 0x9E3779B9u ^ ((uint32_t)node_id << 16) ^
+                          to_us_since_boot(get_absolute_time());
+    // A restarted node must not reuse the epoch neighbours remember
+    mesh_ctx.dv.epoch = (uint16_t)mesh_rand();
+    // Nor the version of its topic list
+    mesh_ctx.pubsub.seq = (uint16_t)mesh_rand();
+
+    // Enable verbose for debugging
+    g_ctx.verbose = 1;
+
+    // Join the group owner's AP, or become the owner if no lower id does.
+    // The rest happens on timers; winc_init() waits for mesh.enabled.
+    g_ctx.mesh.udp_socket = -1;
+    g_ctx.mesh.enabled = false;
+    winc_timer_start(&mesh_ctx.timers, &mesh_ctx.role.timer, to_ms_since_boot(get_absolute_time()));
+    mesh_ctx.role.booting = true;
+    mesh_role_join(to_ms_since_boot(get_absolute_time()), WINC_MESH_BOOT_JOIN_MS);
+    return true;
+}
+
+// ===== MESH BEACON FUNCTIONS =====
+
+// Beacons carry distance-vector entries (node, next hop, metric) under an
+// epoch that moves on whenever our table changes. A change goes out as the
+// entries changed since the previous beacon; after that each beacon only
+// repeats the epoch and neighbours replay the table they hold for it. A
+// neighbour that missed a change, or has never heard us, sees an epoch it
+// can't account for and asks for a full beacon, which also carries our name.
+// Our reception of each neighbour rides along only once it has moved.
+
+static void mesh_mark_dirty(uint8_t node_id) {
+    mesh_ctx.dv.dirty[node_id >> 3] |= (uint8_t)(1 << (node_id & 7));
+    mesh_ctx.dv.dirty_count++;
+}
+
+static bool mesh_is_dirty(uint8_t node_id) {
+    return (mesh_ctx.dv.dirty[node_id >> 3] >> (node_id & 7)) & 1;
+}
+
+// Fill beacon entries from hold-down poisons and live routes. An incremental
+// beacon lists the dirty ones and withdraws dirty nodes that have neither;
+// returns -1 if those don't all fit, and a full one is needed instead. A
+// full beacon that overflows is cut short; poisons go first so that what
+// gets cut is a live route, missing only until the hold-downs expire,
+// never a withdrawal neighbours would otherwise not hear.
+static int mesh_build_vector(winc_mesh_beacon_t *beacon, bool full) {
+    uint8_t listed[32] = {0};
+    int n = 0;
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_holddown_t *h = &mesh_ctx.dv.holddown[i];
+        if (h->active && (full || mesh_is_dirty(h->node_id))) {
+            if (n == WINC_MESH_MAX_NODES)
+                return full ? n : -1;
+            beacon->entries[n].node_id = h->node_id;
+            beacon->entries[n].next_hop = h->next_hop;
+            beacon->entries[n].hops = h->hops;
+            beacon->entries[n].metric = WINC_MESH_METRIC_INFINITY;
+            listed[h->node_id >> 3] |= 1 << (h->node_id & 7);
+            n++;
+        }
+    }
+
+    for (int i = 0; i < g_ctx.mesh.route_count; i++) {
+        if (g_ctx.mesh.routes[i].active &&
+            (full || mesh_is_dirty(g_ctx.mesh.routes[i].node_id))) {
+            if (n == WINC_MESH_MAX_NODES)
+                return full ? n : -1;
+            beacon->entries[n].node_id = g_ctx.mesh.routes[i].node_id;
+            beacon->entries[n].next_hop = g_ctx.mesh.routes[i].next_hop;
+            beacon->entries[n].hops = g_ctx.mesh.routes[i].hop_count;
+            beacon->entries[n].metric = mesh_ctx.route_ext[i].metric;
+            listed[beacon->entries[n].node_id >> 3] |= 1 << (beacon->entries[n].node_id & 7);
+            n++;
+        }
+    }
+
+    for (int id = 1; id < 0xFF && !full && mesh_ctx.dv.dirty_count; id++) {
+        if (!mesh_is_dirty(id) || ((listed[id >> 3] >> (id & 7)) & 1))
+            continue;
+        if (n == WINC_MESH_MAX_NODES)
+            return -1;
+        beacon->entries[n].node_id = id;
+        beacon->entries[n].next_hop = 0;
+        beacon->entries[n].hops = 0;
+        beacon->entries[n].metric = WINC_MESH_METRIC_INFINITY;
+        n++;
+    }
+    return n;
+}
+
+// Link block: our reception of every neighbour, when a full beacon goes out
+// or one has moved by MESH_LINK_Q_STEP since we last sent it. Returns the
+// bytes written at p.
+static int mesh_build_links(uint8_t *p, bool full) {
+    winc_mesh_link_q_t *q = (winc_mesh_link_q_t*)(p + 1);
+    bool due = full;
+    int n = 0;
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES && !due; i++) {
+        mesh_link_t *l = &mesh_ctx.links[i];
+        if (l->active && (!l->reported ||
+                          abs((int)l->rx_ratio - l->reported_q) >= MESH_LINK_Q_STEP))
+            due = true;
+    }
+    if (!due)
+        return 0;
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        if (mesh_ctx.links[i].active) {
+            q[n].node_id = mesh_ctx.links[i].node_id;
+            q[n].link_q = mesh_ctx.links[i].rx_ratio;
+            n++;
+        }
+    }
+    p[0] = n;
+    return 1 + n * sizeof(winc_mesh_link_q_t);
+}
+
+static bool mesh_send_beacon(void) {
+    winc_mesh_beacon_t beacon;
+    uint16_t epoch = mesh_ctx.dv.epoch + (mesh_ctx.dv.dirty_count || mesh_subs_dirty() ? 1 : 0);
+    uint8_t *p;
+    bool full;
+    int n, len;
+
+    // Comprehensive checks before sending
+    if (!g_ctx.mesh.enabled) {
+        printf("[BEACON] ERROR: Mesh not enabled!\n");
+        return false;
+    }
+
+    if (g_ctx.mesh.udp_socket < 0) {
+        printf("[BEACON] ERROR: Invalid socket (%d)\n", g_ctx.mesh.udp_socket);
+        return false;
+    }
+
+    if (g_ctx.sockets[g_ctx.mesh.udp_socket].state != STATE_BOUND) {
+        printf("[BEACON] ERROR: Socket not bound (state=%d)\n",
+               g_ctx.sockets[g_ctx.mesh.udp_socket].state);
+        return false;
+    }
+
+    memset(&beacon, 0, sizeof(beacon));
+
+    // Build beacon data
+    full = mesh_ctx.dv.full_pending;
+    n = mesh_build_vector(&beacon, full);
+    if (n < 0) {
+        full = true;
+        n = mesh_build_vector(&beacon, true);
+    }
+    beacon.flags = full ? MESH_BEACON_FULL : 0;
+    if (mesh_ctx.role.state == WINC_MESH_ROLE_OWNER)
+        beacon.flags |= MESH_BEACON_OWNER;
+    beacon.epoch = epoch;
+    beacon.entry_count = n;
+    p = (uint8_t*)&beacon.entries[n];
+
+    len = mesh_build_links(p, full);
+    if (len)
+        beacon.flags |= MESH_BEACON_LINKS;
+    p += len;
+
+    if (full) {
+        len = strlen(g_ctx.mesh.my_name);
+        beacon.flags |= MESH_BEACON_NAME;
+        *p++ = len;
+        memcpy(p, g_ctx.mesh.my_name, len);
+        p += len;
+    }
+
+    len = mesh_build_subs(p, full);
+    if (len)
+        beacon.flags |= MESH_BEACON_SUBS;
+    p += len;
+
+    len = mesh_kv_build(p);
+    if (len)
+        beacon.flags |= MESH_BEACON_KV;
+    p += len;
+
+    // Time block, stamped when the beacon leaves the queue
+    beacon.flags |= MESH_BEACON_TIME;
+    p += sizeof(winc_mesh_time_t);
+    len = p - (uint8_t*)&beacon;
+
+    // Build beacon header
+    beacon.hdr.msg_type = MESH_MSG_BEACON;
+    beacon.hdr.src_node = g_ctx.mesh.my_node_id;
+    beacon.hdr.dst_node = 0xFF;  // Broadcast
+    beacon.hdr.next_hop = 0xFF;
+    beacon.hdr.seq_num = mesh_ctx.beacon_seq++;
+    beacon.hdr.payload_len = len - sizeof(beacon.hdr);
+    beacon.hdr.flags = WINC_MESH_PRIO(WINC_MESH_CLASS_CONTROL);
+
+    printf("[BEACON] Sending %s beacon from node %u (epoch %u, %u entries, socket=%d, size=%d)\n",
+           full ? "full" : n ? "incremental" : "steady", g_ctx.mesh.my_node_id, epoch, n,
+           g_ctx.mesh.udp_socket, len);
+
+    bool result = mesh_tx_raw(&beacon.hdr, (uint8_t*)&beacon + sizeof(beacon.hdr));
+    if (!result) {
+        printf("[BEACON] ERROR: Failed to send beacon!\n");
+    } else {
+        mesh_ctx.beacon_stats.beacons_sent++;
+        mesh_ctx.beacon_stats.bytes_sent += len;
+        if (full) {
+            mesh_ctx.beacon_stats.full_sent++;
+            mesh_ctx.dv.full_sent = MESH_NOW_MS();
+        }
+        memset(mesh_ctx.dv.dirty, 0, sizeof(mesh_ctx.dv.dirty));
+        mesh_ctx.dv.dirty_count = 0;
+        mesh_ctx.dv.full_pending = false;
+        mesh_ctx.dv.epoch = epoch;
+        mesh_subs_sent();
+        mesh_kv_sent();
+        for (int i = 0; i < WINC_MESH_MAX_NODES && (beacon.flags & MESH_BEACON_LINKS); i++) {
+            mesh_ctx.links[i].reported = true;
+            mesh_ctx.links[i].reported_q = mesh_ctx.links[i].rx_ratio;
+        }
+    }
+    return result;
+}
+
+static void mesh_full_timer_fn(winc_timer_t *t, void *arg) {
+    if (mesh_ctx.dv.full_pending && g_ctx.mesh.enabled)
+        mesh_send_beacon();
+}
+
+// Send a full beacon soon. Requests arriving together share one, and full
+// beacons go out at most once per WINC_MESH_TRICKLE_IMIN_MS.
+static void mesh_full_schedule(uint32_t now) {
+    uint32_t at = mesh_ctx.dv.full_sent + WINC_MESH_TRICKLE_IMIN_MS;
+
+    mesh_ctx.dv.full_pending = true;
+    if (winc_timer_pending(&mesh_ctx.full_timer))
+        return;
+    if (!mesh_ctx.beacon_stats.full_sent || (int32_t)(at - now) < 0)
+        at = now;
+    winc_timer_start(&mesh_ctx.timers, &mesh_ctx.full_timer, at);
+}
+
+// Ask a neighbour whose table we lost track of for a full beacon
+static void mesh_adv_request(mesh_link_t *l, mesh_adv_t *a, uint32_t now) {
+    winc_mesh_hdr_t hdr;
+
+    if (a->requested && now - a->req_at < 2 * WINC_MESH_TRICKLE_IMIN_MS)
+        return;
+    a->requested = true;
+    a->req_at = now;
+
+    hdr.msg_type = MESH_MSG_BEACON_REQ;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = l->node_id;
+    hdr.hop_count = 0;
+    hdr.seq_num = 0;
+    hdr.payload_len = 0;
+    hdr.next_hop = l->node_id;
+    hdr.flags = WINC_MESH_PRIO(WINC_MESH_CLASS_CONTROL);
+    if (mesh_tx_raw(&hdr, (uint8_t*)&hdr))
+        mesh_ctx.beacon_stats.requests_sent++;
+    if (g_ctx.verbose > 1)
+        printf("[BEACON] Asking node %u for its full table\n", l->node_id);
+}
+
+// Apply an incremental beacon to our copy of the sender's table; false if
+// it no longer fits
+static bool mesh_adv_merge(mesh_adv_t *a, const winc_mesh_dv_entry_t *entries, uint8_t count) {
+    for (int i = 0; i < count; i++) {
+        int j = 0;
+
+        while (j < a->count && a->entries[j].node_id != entries[i].node_id)
+            j++;
+        if (!entries[i].next_hop) {
+            if (j < a->count)
+                a->entries[j] = a->entries[--a->count];
+        } else if (j < WINC_MESH_MAX_NODES) {
+            a->entries[j] = entries[i];
+            if (j == a->count)
+                a->count++;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Digest of a neighbour's table, used to spot changes in it. Entries are
+// summed so the digest doesn't depend on their order.
+static uint32_t mesh_vector_hash(const winc_mesh_dv_entry_t *entries, uint8_t count) {
+    uint32_t h = count;
+
+    for (int i = 0; i < count; i++) {
+        uint32_t x = ((uint32_t)entries[i].node_id << 8 | entries[i].hops) * 2654435761u;
+        h += x ^ (x >> 15);
+    }
+    return h;
+}
+
+// Handle received beacon
+static void mesh_handle_beacon(winc_mesh_beacon_t *beacon, int rxlen) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint8_t sender = beacon->hdr.src_node;
+    uint8_t *p, *end = (uint8_t*)beacon + rxlen;
+    const winc_mesh_dv_entry_t *entries;
+    winc_mesh_time_t *time = NULL;
+    winc_mesh_kv_digest_t *kv = NULL;
+    mesh_link_t *link;
+    mesh_adv_t *adv;
+    uint8_t count;
+    bool changed, intact, whole, subs;
+    int slot;
+
+    if (sender == g_ctx.mesh.my_node_id)
+        return;
+
+    if ((beacon->flags & MESH_BEACON_TIME) &&
+        end - (uint8_t*)beacon->entries >= (int)sizeof(winc_mesh_time_t)) {
+        end -= sizeof(winc_mesh_time_t);
+        time = (winc_mesh_time_t*)end;
+    }
+    if ((beacon->flags & MESH_BEACON_KV) &&
+        end - (uint8_t*)beacon->entries >= (int)sizeof(winc_mesh_kv_digest_t)) {
+        end -= sizeof(winc_mesh_kv_digest_t);
+        kv = (winc_mesh_kv_digest_t*)end;
+        if (end - (uint8_t*)beacon->entries >= kv->changed_len)
+            end -= kv->changed_len;
+        else
+            kv = NULL;
+    }
+
+    // Never trust entry_count beyond what actually arrived
+    count = (end - (uint8_t*)beacon->entries) / sizeof(winc_mesh_dv_entry_t);
+    intact = beacon->entry_count <= count && beacon->entry_count <= WINC_MESH_MAX_NODES;
+    if (beacon->entry_count < count)
+        count = beacon->entry_count;
+    if (count > WINC_MESH_MAX_NODES)
+        count = WINC_MESH_MAX_NODES;
+    p = (uint8_t*)&beacon->entries[count];
+
+    mesh_ctx.beacon_stats.beacons_received++;
+
+    // Another owner: an owner keeps its own AP unless this one outranks it
+    if ((beacon->flags & MESH_BEACON_OWNER) &&
+        (mesh_ctx.role.state != WINC_MESH_ROLE_OWNER || sender < g_ctx.mesh.my_node_id)) {
+        mesh_ctx.role.go_node = sender;
+        mesh_ctx.role.go_heard = now;
+    }
+
+    link = mesh_link_heard(sender, beacon->hdr.seq_num, now);
+    adv = &mesh_ctx.adv[link - mesh_ctx.links];
+
+    // Link quality the other way: its report of our beacons
+    if ((beacon->flags & MESH_BEACON_LINKS) && intact && p < end) {
+        int n = *p++;
+        winc_mesh_link_q_t q;
+
+        for (int i = 0; i < n && p + sizeof(q) <= end; i++, p += sizeof(q)) {
+            memcpy(&q, p, sizeof(q));
+            if (q.node_id == g_ctx.mesh.my_node_id)
+                link->tx_ratio = q.link_q;
+        }
+    }
+
+    if ((beacon->flags & MESH_BEACON_NAME) && intact && p < end) {
+        int n = *p++, k = MIN(n, (int)sizeof(adv->name) - 1);
+
+        if (p + n <= end) {
+            memcpy(adv->name, p, k);
+            adv->name[k] = '\0';
+        }
+        p += n;
+    }
+
+    // Topic lists: a newer one anywhere is news worth passing on quickly
+    subs = (beacon->flags & MESH_BEACON_SUBS) && intact && p < end && mesh_subs_heard(p, end);
+
+    printf("[BEACON] Received %s beacon from node %u (%s), epoch %u, %u entries\n",
+           (beacon->flags & MESH_BEACON_FULL) ? "full" : count ? "incremental" : "steady",
+           sender, adv->name[0] ? adv->name : "?", beacon->epoch, count);
+
+    if (time && intact)
+        mesh_sync_heard(sender, link, time, now);
+    if (intact)
+        mesh_kv_heard(link, kv, now);
+
+    // Bring our copy of its table up to the beacon's epoch. If we can't,
+    // use what the beacon lists and ask for the rest.
+    if (!intact) {
+        adv->valid = false;
+    } else if (beacon->flags & MESH_BEACON_FULL) {
+        memcpy(adv->entries, beacon->entries, count * sizeof(winc_mesh_dv_entry_t));
+        adv->count = count;
+        adv->epoch = beacon->epoch;
+        adv->valid = true;
+    } else if (adv->valid && (count || (beacon->flags & MESH_BEACON_SUBS)) &&
+               beacon->epoch == (uint16_t)(adv->epoch + 1)) {
+        adv->valid = mesh_adv_merge(adv, beacon->entries, count);
+        adv->epoch = beacon->epoch;
+    } else if (count || beacon->epoch != adv->epoch) {
+        adv->valid = false;
+    }
+
+    whole = adv->valid;
+    if (whole) {
+        adv->requested = false;
+        entries = adv->entries;
+        count = adv->count;
+    } else {
+        mesh_adv_request(link, adv, now);
+        entries = beacon->entries;
+    }
+
+    // Direct route to beacon sender (1 hop)
+    changed = mesh_dv_update(sender, sender, sender, 0, 0, now);
+
+    // Routes through beacon sender
+    for (int i = 0; i < count; i++) {
+        const winc_mesh_dv_entry_t *e = &entries[i];
+        changed |= mesh_dv_update(sender, e->node_id, e->next_hop, e->hops, e->metric, now);
+    }
+
+    if (whole) {
+        // Anything we reach via the sender that it no longer lists is gone
+        for (int i = 0; i < g_ctx.mesh.route_count; i++) {
+            bool listed = false;
+
+            if (!g_ctx.mesh.routes[i].active ||
+                g_ctx.mesh.routes[i].next_hop != sender ||
+                g_ctx.mesh.routes[i].node_id == sender)
+                continue;
+
+            for (int j = 0; j < count && !listed; j++)
+                listed = entries[j].node_id == g_ctx.mesh.routes[i].node_id;
+
+            if (!listed) {
+                mesh_route_invalidate(i, now);
+                changed = true;
+            }
+        }
+
+        // A changed neighbour table is an inconsistency even if our routes survive it
+        uint32_t hash = mesh_vector_hash(entries, count);
+        slot = mesh_route_slot(sender);
+        if (slot >= 0) {
+            if (mesh_ctx.route_ext[slot].nbr_hash != hash)
+                changed = true;
+            mesh_ctx.route_ext[slot].nbr_hash = hash;
+        }
+    }
+
+    if (changed || subs)
+        mesh_trickle_reset(now);
+    else if (mesh_ctx.trickle.counter < 255)
+        mesh_ctx.trickle.counter++;
+}
+
+const char *winc_mesh_get_neighbor_name(uint8_t node_id) {
+    mesh_link_t *l = mesh_link_find(node_id);
+
+    return l && mesh_ctx.adv[l - mesh_ctx.links].name[0] ? mesh_ctx.adv[l - mesh_ctx.links].name : NULL;
+}
+
+void winc_mesh_set_name(const char *node_name) {
+    strncpy(g_ctx.mesh.my_name, node_name, sizeof(g_ctx.mesh.my_name) - 1);
+    g_ctx.mesh.my_name[sizeof(g_ctx.mesh.my_name) - 1] = '\0';
+
+    // A new epoch makes neighbours that miss the full beacon ask for it
+    mesh_ctx.dv.epoch++;
+    if (g_ctx.mesh.enabled)
+        mesh_full_schedule(MESH_NOW_MS());
+    else
+        mesh_ctx.dv.full_pending = true;
+}
+
+// ===== MESH DATA FUNCTIONS =====
+
+static bool mesh_send_fragments(winc_mesh_hdr_t *hdr, const uint8_t *data);
+bool winc_mesh_send(uint8_t dst_node, uint8_t *data, uint16_t len) {
+    return winc_mesh_send_ex(dst_node, data, len, 0);
+}
+
+bool winc_mesh_send_ex(uint8_t dst_node, uint8_t *data, uint16_t len, uint8_t flags) {
+    if (!g_ctx.mesh.enabled) {
+        printf("ERROR: Mesh not enabled (P2P mode or UDP socket failed during init)\n");
+        return false;
+    }
+
+    if (g_ctx.mesh.udp_socket < 0) {
+        printf("ERROR: UDP socket invalid (socket=%d)\n", g_ctx.mesh.udp_socket);
+        return false;
+    }
+
+    if (len > WINC_MESH_MAX_MESSAGE) {
+        printf("ERROR: Mesh payload too long (%u bytes, max %u)\n", len, WINC_MESH_MAX_MESSAGE);
+        return false;
+    }
+
+    if (dst_node == WINC_MESH_BROADCAST)
+        return mesh_flood_send(data, len, flags);
+    if (flags & WINC_MESH_ORDERED)
+        return mesh_order_send(dst_node, data, len, flags);
+    if (flags & WINC_MESH_PINNED)
+        return mesh_path_send(dst_node, data, len, flags);
+    return mesh_send_routed(dst_node, data, len, flags);
+}
+
+// Send a unicast frame along our route to dst_node
+static bool mesh_send_routed(uint8_t dst_node, const uint8_t *data, uint16_t len, uint8_t flags) {
+    winc_mesh_hdr_t hdr;
+    int next_hop;
+
+    // Find route to destination
+    next_hop = mesh_find_route(dst_node);
+    if (next_hop < 0) {
+        printf("ERROR: No route to node %u (known nodes: %u)\n", dst_node, g_ctx.mesh.route_count);
+        return false;
+    }
+
+    // Go round a busy next hop, or hold back until it drains
+    next_hop = mesh_bp_next_hop(dst_node, next_hop, WINC_MESH_FLAGS_CLASS(flags), true);
+    if (next_hop < 0)
+        return false;
+
+    // Build packet header
+    hdr.msg_type = MESH_MSG_DATA;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = dst_node;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.payload_len = len;
+    hdr.next_hop = next_hop;
+    hdr.flags = flags & (WINC_MESH_RELIABLE | WINC_MESH_ORDERED | WINC_MESH_PRIO(3));
+
+    if (g_ctx.verbose)
+        printf("Sending %u bytes to node %u via hop %d\n", len, dst_node, next_hop);
+
+    if (len > WINC_MESH_MTU)
+        return mesh_send_fragments(&hdr, data);
+    return mesh_tx_data(&hdr, data);
+}
+
+// ===== FRAME POOL =====
+
+#define MESH_FRAME(i)  (&mesh_ctx.pool.frames[i])
+
+static void mesh_pool_init(void) {
+    for (int i = 0; i < WINC_MESH_POOL_FRAMES; i++)
+        mesh_ctx.pool.frames[i].next = i + 1 < WINC_MESH_POOL_FRAMES ? i + 1 : -1;
+    mesh_ctx.pool.free_head = 0;
+    mesh_ctx.pool.stats.size = WINC_MESH_POOL_FRAMES;
+}
+
+// Take a frame buffer, or -1 if the pool is exhausted. O(1).
+static int mesh_frame_get(void) {
+    mesh_pool_t *p = &mesh_ctx.pool;
+    int i = p->free_head;
+
+    if (i < 0) {
+        p->stats.exhausted++;
+        return -1;
+    }
+    p->free_head = p->frames[i].next;
+    p->frames[i].next = -1;
+    p->frames[i].len = 0;
+    if (++p->stats.in_use > p->stats.high_water)
+        p->stats.high_water = p->stats.in_use;
+    return i;
+}
+
+// Return a frame buffer. O(1).
+static void mesh_frame_put(int i) {
+    mesh_pool_t *p = &mesh_ctx.pool;
+
+    p->frames[i].next = p->free_head;
+    p->free_head = i;
+    p->stats.in_use--;
+}
+
+static int mesh_pool_free(void) {
+    return mesh_ctx.pool.stats.size - mesh_ctx.pool.stats.in_use;
+}
+
+void winc_mesh_get_pool_stats(winc_mesh_pool_stats_t *stats) {
+    *stats = mesh_ctx.pool.stats;
+}
+
+// ===== TRANSMIT QUEUES =====
+
+// Next class to serve: control, then alarm, then normal and bulk by DRR
+static int mesh_txq_pick(void) {
+    mesh_txq_t *t = &mesh_ctx.txq;
+
+    if (t->cls[WINC_MESH_CLASS_CONTROL].head >= 0)
+        return WINC_MESH_CLASS_CONTROL;
+    if (t->cls[WINC_MESH_CLASS_ALARM].head >= 0)
+        return WINC_MESH_CLASS_ALARM;
+
+    // A quantum always covers one frame, so three steps settle it
+    for (int i = 0; i < 3; i++) {
+        int c = t->drr_cur;
+        mesh_txq_class_t *q = &t->cls[c];
+
+        if (q->head < 0) {
+            q->deficit = 0;
+        } else if (!mesh_bp_hold_ms(c)) {
+            if (t->drr_fresh) {
+                q->deficit += (c == WINC_MESH_CLASS_NORMAL ? WINC_MESH_WEIGHT_NORMAL :
+                               WINC_MESH_WEIGHT_BULK) * sizeof(MESH_FRAME(0)->buf);
+                t->drr_fresh = false;
+            }
+            if (q->deficit >= MESH_FRAME(q->head)->len)
+                return c;
+        }
+        t->drr_cur = c == WINC_MESH_CLASS_NORMAL ? WINC_MESH_CLASS_BULK : WINC_MESH_CLASS_NORMAL;
+        t->drr_fresh = true;
+    }
+    return -1;
+}
+
+// Microseconds until a frame of len bytes handed to the WINC now would go
+// out inside our slot, 0 if it would. Frames too long for the slot may
+// start in its first half.
+static uint32_t mesh_tdma_wait_us(uint32_t now_us, int len) {
+    mesh_txq_t *t = &mesh_ctx.txq;
+    uint32_t frame_us, pos, open, close, air;
+    int32_t backlog = t->radio_free_us - now_us;
+
+    if (!t->tdma_slots || !mesh_ctx.sync.root)
+        return 0;
+    frame_us = t->tdma_slots * t->tdma_slot_us;
+    open = (g_ctx.mesh.my_node_id - 1) % t->tdma_slots * t->tdma_slot_us + WINC_MESH_TDMA_GUARD_US;
+    close = open + t->tdma_slot_us - 2 * WINC_MESH_TDMA_GUARD_US;
+    air = MIN(WINC_MESH_TX_FRAME_US + (uint32_t)len * WINC_MESH_TX_BYTE_NS / 1000, (close - open) / 2);
+    pos = (mesh_sync_global(time_us_64()) + MAX(backlog, 0)) % frame_us;
+
+    if (pos >= open && pos + air <= close)
+        return 0;
+    return pos < open ? open - pos : open + frame_us - pos;
+}
+
+void winc_mesh_set_tdma(uint8_t slots, uint32_t slot_us) {
+    mesh_ctx.txq.tdma_slots = slot_us > 2 * WINC_MESH_TDMA_GUARD_US ? slots : 0;
+    mesh_ctx.txq.tdma_slot_us = slot_us;
+    mesh_txq_run();
+}
+
+// Hand queued frames to the WINC while its estimated backlog is short
+static void mesh_txq_run(void) {
+    mesh_txq_t *t = &mesh_ctx.txq;
+    uint32_t now_us = time_us_32();
+    int c;
+
+    while ((int32_t)(t->radio_free_us - now_us) < WINC_MESH_TX_BACKLOG_US &&
+           (c = mesh_txq_pick()) >= 0) {
+        mesh_txq_class_t *q = &t->cls[c];
+        int i = q->head;
+        mesh_frame_t *f = MESH_FRAME(i);
+        winc_mesh_hdr_t *hdr = (winc_mesh_hdr_t*)f->buf;
+
+        // Control and alarm classes were served first, so all that waits
+        // for our slot now is normal and bulk traffic
+        if ((c == WINC_MESH_CLASS_NORMAL || c == WINC_MESH_CLASS_BULK) &&
+            mesh_tdma_wait_us(now_us, f->len))
+            break;
+
+        if (hdr->msg_type == MESH_MSG_BEACON)
+            mesh_sync_stamp(f->buf, f->len);
+        mesh_bp_stamp(f->buf);
+        if (!put_sock_sendto(g_ctx.mesh.udp_socket, f->buf, f->len)) {
+            printf("ERROR: put_sock_sendto failed (socket=%d, len=%u)\n",
+                   g_ctx.mesh.udp_socket, f->len);
+            break;              // Stays at the head for the next poll
+        }
+
+        mesh_rtx_sent(f->buf, now_us);
+        if (hdr->next_hop != 0xFF) {
+            winc_mesh_neighbor_stats_t *n = mesh_nbr(hdr->next_hop);
+            n->tx_frames++;
+            n->tx_bytes += f->len;
+        }
+
+        if ((int32_t)(t->radio_free_us - now_us) < 0)
+            t->radio_free_us = now_us;
+        t->radio_free_us += WINC_MESH_TX_FRAME_US + f->len * WINC_MESH_TX_BYTE_NS / 1000;
+
+        if (c == WINC_MESH_CLASS_NORMAL || c == WINC_MESH_CLASS_BULK)
+            q->deficit -= f->len;
+        q->head = f->next;
+        if (q->head < 0)
+            q->tail = -1;
+        mesh_frame_put(i);
+        t->stats.depth[c]--;
+        t->stats.sent[c]++;
+    }
+    mesh_bp_update();
+}
+
+// Drop the newest frame of the least important class below cls back into
+// the pool; false if there is none
+static bool mesh_txq_evict(int cls) {
+    static const uint8_t by_rank[] = {WINC_MESH_CLASS_BULK, WINC_MESH_CLASS_NORMAL,
+                                      WINC_MESH_CLASS_ALARM, WINC_MESH_CLASS_CONTROL};
+    mesh_txq_t *t = &mesh_ctx.txq;
+
+    for (int r = 0; by_rank[r] != cls; r++) {
+        mesh_txq_class_t *q = &t->cls[by_rank[r]];
+        int i = q->head, prev = -1;
+
+        if (i < 0)
+            continue;
+        while (MESH_FRAME(i)->next >= 0) {
+            prev = i;
+            i = MESH_FRAME(i)->next;
+        }
+        if (prev < 0)
+            q->head = -1;
+        else
+            MESH_FRAME(prev)->next = -1;
+        q->tail = prev;
+        mesh_frame_put(i);
+        t->stats.depth[by_rank[r]]--;
+        t->stats.dropped[by_rank[r]]++;
+        return true;
+    }
+    return false;
+}
+
+// Frames a class can still queue without evicting anything
+static int mesh_txq_room(int cls) {
+    return MIN(mesh_pool_free(), WINC_MESH_TXQ_DEPTH - mesh_ctx.txq.stats.depth[cls]);
+}
+
+// Append a filled pool frame to its class queue and try to send. On false
+// the caller still owns the frame.
+static bool mesh_txq_put(int i, int cls) {
+    mesh_txq_t *t = &mesh_ctx.txq;
+
+    if (t->stats.depth[cls] >= WINC_MESH_TXQ_DEPTH) {
+        t->stats.dropped[cls]++;
+        if (g_ctx.verbose > 1)
+            printf("[MESH] TX queue %d full\n", cls);
+        return false;
+    }
+
+    MESH_FRAME(i)->next = -1;
+    if (t->cls[cls].tail >= 0)
+        MESH_FRAME(t->cls[cls].tail)->next = i;
+    else
+        t->cls[cls].head = i;
+    t->cls[cls].tail = i;
+    if (++t->stats.depth[cls] > t->stats.max_depth[cls])
+        t->stats.max_depth[cls] = t->stats.depth[cls];
+
+    mesh_txq_run();
+    return true;
+}
+
+// Take a pool frame for class cls; when the pool is dry, less important
+// queued traffic makes room
+static int mesh_frame_get_for(int cls) {
+    int i = mesh_frame_get();
+
+    if (i < 0 && mesh_txq_evict(cls))
+        i = mesh_frame_get();
+    return i;
+}
+
+// Queue one datagram (header + payload) in its class and try to send it
+static bool mesh_tx_raw(const winc_mesh_hdr_t *hdr, const uint8_t *data) {
+    int cls = WINC_MESH_FLAGS_CLASS(hdr->flags);
+    int len = sizeof(winc_mesh_hdr_t) + hdr->payload_len;
+    int i;
+
+    if (len > (int)sizeof(MESH_FRAME(0)->buf)) {
+        if (g_ctx.verbose)
+            printf("[MESH] Type %u frame of %d bytes exceeds WINC_MESH_MTU, dropped\n", hdr->msg_type, len);
+        return false;
+    }
+    if (mesh_ctx.txq.stats.depth[cls] >= WINC_MESH_TXQ_DEPTH ||
+        (i = mesh_frame_get_for(cls)) < 0) {
+        mesh_ctx.txq.stats.dropped[cls]++;
+        if (g_ctx.verbose > 1)
+            printf("[MESH] TX queue %d full, dropping frame to hop %u\n", cls, hdr->next_hop);
+        return false;
+    }
+
+    memcpy(MESH_FRAME(i)->buf, hdr, sizeof(winc_mesh_hdr_t));
+    memcpy(MESH_FRAME(i)->buf + sizeof(winc_mesh_hdr_t), data, hdr->payload_len);
+    MESH_FRAME(i)->len = len;
+    return mesh_txq_put(i, cls);
+}
+
+void winc_mesh_get_queue_stats(winc_mesh_queue_stats_t *stats) {
+    *stats = mesh_ctx.txq.stats;
+}
+
+// ===== FRAGMENTATION =====
+
+// Split a payload above WINC_MESH_MTU into fragments; hdr is the header the
+// payload would have had as one frame. Each fragment is routed on its own.
+static bool mesh_send_fragments(winc_mesh_hdr_t *hdr, const uint8_t *data) {
+    winc_mesh_frag_hdr_t *fh = (winc_mesh_frag_hdr_t*)mesh_ctx.fragbuf;
+    uint16_t total = hdr->payload_len;
+    uint8_t count = (total + MESH_FRAG_CHUNK - 1) / MESH_FRAG_CHUNK;
+    uint16_t chunk;
+
+    // All or nothing: half a message only wastes airtime. A reliable
+    // fragment holds two pool frames, the queued one and the kept copy.
+    if (mesh_txq_room(WINC_MESH_FLAGS_CLASS(hdr->flags)) < count ||
+        ((hdr->flags & WINC_MESH_RELIABLE) &&
+         (mesh_rtx_room() < count || mesh_pool_free() < 2 * count))) {
+        if (g_ctx.verbose)
+            printf("[MESH] No queue room for %u fragments, try again later\n", count);
+        return false;
+    }
+
+    fh->msg_id = mesh_ctx.frag_msg_id++;
+    fh->count = count;
+    fh->total_len = total;
+    hdr->msg_type = MESH_MSG_FRAGMENT;
+
+    for (fh->index = 0; fh->index < fh->count; fh->index++) {
+        fh->offset = fh->index * MESH_FRAG_CHUNK;
+        chunk = MIN(MESH_FRAG_CHUNK, (size_t)(total - fh->offset));
+        memcpy(fh + 1, data + fh->offset, chunk);
+
+        hdr->payload_len = sizeof(*fh) + chunk;
+        if (fh->index)
+            hdr->seq_num = g_ctx.mesh.seq_num++;
+        if (!mesh_tx_data(hdr, mesh_ctx.fragbuf)) {
+            printf("ERROR: Fragment %u/%u of message %u not sent\n",
+                   fh->index + 1, fh->count, fh->msg_id);
+            return false;
+        }
+    }
+    return true;
+}
+
+#if WINC_MESH_REASM_SLOTS
+// Free a reassembly slot and the fragments it holds
+static void mesh_reasm_drop(mesh_reasm_t *r, const char *why) {
+    if (why && g_ctx.verbose)
+        printf("[MESH] Dropping message %u from node %u: %s (%u/%u fragments)\n",
+               r->msg_id, r->src_node, why, r->received, r->count);
+    for (int i = 0; i < r->count; i++) {
+        if (r->frame[i] >= 0)
+            mesh_frame_put(r->frame[i]);
+    }
+    r->active = false;
+}
+
+// Store a fragment addressed to us; deliver the message once complete
+static void mesh_frag_input(winc_mesh_hdr_t *hdr, uint8_t *data) {
+    winc_mesh_frag_hdr_t fh;
+    mesh_reasm_t *r = NULL, *oldest = NULL;
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    uint16_t chunk;
+    int f;
+
+    if (hdr->payload_len < sizeof(fh))
+        return;
+    memcpy(&fh, data, sizeof(fh));
+    chunk = hdr->payload_len - sizeof(fh);
+
+    if (fh.total_len > WINC_MESH_MAX_MESSAGE || fh.count > MESH_FRAG_MAX ||
+        fh.index >= fh.count || fh.offset + chunk > fh.total_len) {
+        printf("[RX] ERROR: Bad fragment %u/%u of message %u from node %u\n",
+               fh.index, fh.count, fh.msg_id, hdr->src_node);
+        return;
+    }
+
+    // Find the message, else a free slot, else evict the oldest
+    for (int i = 0; i < WINC_MESH_REASM_SLOTS; i++) {
+        mesh_reasm_t *e = &mesh_ctx.reasm[i];
+        if (e->active && e->src_node == hdr->src_node && e->msg_id == fh.msg_id)
+            r = e;
+    }
+    for (int i = 0; !r && i < WINC_MESH_REASM_SLOTS; i++) {
+        mesh_reasm_t *e = &mesh_ctx.reasm[i];
+        if (!oldest || !e->active ||
+            (oldest->active && (int32_t)(e->started - oldest->started) < 0))
+            oldest = e;
+        if (!e->active)
+            break;
+    }
+
+    if (r && (r->total_len != fh.total_len || r->count != fh.count)) {
+        // Same id, different message: the sender restarted
+        mesh_reasm_drop(r, "superseded");
+        oldest = r;
+        r = NULL;
+    }
+
+    if (!r) {
+        r = oldest;
+        if (r->active)
+            mesh_reasm_drop(r, "table full");
+        memset(r->frame, -1, sizeof(r->frame));
+        r->active = true;
+        r->src_node = hdr->src_node;
+        r->msg_id = fh.msg_id;
+        r->total_len = fh.total_len;
+        r->count = fh.count;
+        r->received = 0;
+        r->started = now;
+    }
+
+    if (r->frame[fh.index] >= 0)
+        return;                 // Duplicate
+
+    // Partial messages may not starve the transmit queues: keep a quarter
+    // of the pool for them
+    f = mesh_pool_free() > WINC_MESH_POOL_FRAMES / 4 ? mesh_frame_get() : -1;
+    if (f < 0) {
+        if (g_ctx.verbose)
+            printf("[MESH] No pool frame for fragment %u/%u of message %u\n",
+                   fh.index + 1, fh.count, fh.msg_id);
+        return;
+    }
+    memcpy(MESH_FRAME(f)->buf, data, hdr->payload_len);
+    MESH_FRAME(f)->len = hdr->payload_len;
+    r->frame[fh.index] = f;
+    r->received++;
+
+    if (r->received < r->count)
+        return;
+
+    for (int i = 0; i < r->count; i++) {
+        mesh_frame_t *fr = MESH_FRAME(r->frame[i]);
+        memcpy(&fh, fr->buf, sizeof(fh));
+        memcpy(mesh_ctx.reasm_buf + fh.offset, fr->buf + sizeof(fh), fr->len - sizeof(fh));
+    }
+    if (g_ctx.verbose > 1)
+        printf("[MESH] Reassembled %u bytes from node %u\n", r->total_len, r->src_node);
+    mesh_reasm_drop(r, NULL);
+    if (g_ctx.mesh.data_callback)
+        g_ctx.mesh.data_callback(r->src_node, mesh_ctx.reasm_buf, r->total_len);
+}
+
+// Drop messages whose fragments stopped arriving
+static void mesh_reasm_process(uint32_t now) {
+    for (int i = 0; i < WINC_MESH_REASM_SLOTS; i++) {
+        mesh_reasm_t *r = &mesh_ctx.reasm[i];
+        if (r->active && now - r->started > WINC_MESH_REASM_TIMEOUT_MS)
+            mesh_reasm_drop(r, "timed out");
+    }
+}
+#else
+// Fragmentation is off on the receiving side
+static void mesh_frag_input(winc_mesh_hdr_t *hdr, uint8_t *data) {
+    if (g_ctx.verbose)
+        printf("[MESH] Dropping fragment from node %u: WINC_MESH_REASM_SLOTS is 0\n",
+               hdr->src_node);
+}
+#endif
+
+// ===== HOP-BY-HOP RELIABILITY =====
+
+// Retransmission timeout for a neighbour: SRTT + 4 * RTTVAR (RFC 6298)
+static uint32_t mesh_link_rto_us(uint8_t node_id) {
+    mesh_link_t *l = mesh_link_find(node_id);
+    uint32_t rto;
+
+    if (!l || !l->srtt_us)
+        return WINC_MESH_RTO_INIT_MS * 1000u;
+    rto = l->srtt_us + 4 * l->rttvar_us;
+    if (rto < WINC_MESH_RTO_MIN_MS * 1000u)
+        rto = WINC_MESH_RTO_MIN_MS * 1000u;
+    if (rto > WINC_MESH_RTO_MAX_MS * 1000u)
+        rto = WINC_MESH_RTO_MAX_MS * 1000u;
+    return rto;
+}
+
+static void mesh_link_rtt_sample(uint8_t node_id, uint32_t rtt_us) {
+    mesh_link_t *l = mesh_link_find(node_id);
+    uint32_t err;
+
+    if (!l)
+        return;
+    if (!l->srtt_us) {
+        l->srtt_us = rtt_us ? rtt_us : 1;
+        l->rttvar_us = rtt_us / 2;
+        return;
+    }
+    err = l->srtt_us > rtt_us ? l->srtt_us - rtt_us : rtt_us - l->srtt_us;
+    l->rttvar_us = (3 * l->rttvar_us + err) / 4;
+    l->srtt_us = (7 * l->srtt_us + rtt_us) / 8;
+    if (!l->srtt_us)
+        l->srtt_us = 1;
+}
+
+#define MESH_RTX_HDR(e)  ((winc_mesh_hdr_t*)MESH_FRAME((e)->frame)->buf)
+#define MESH_RTX_DATA(e) (MESH_FRAME((e)->frame)->buf + sizeof(winc_mesh_hdr_t))
+
+static void mesh_rtx_free(mesh_rtx_t *e) {
+    winc_timer_cancel(&e->timer);
+    mesh_frame_put(e->frame);
+    e->active = false;
+}
+
+// Keep a copy of a reliable frame until the next hop ACKs it
+static mesh_rtx_t *mesh_rtx_add(const winc_mesh_hdr_t *hdr, const uint8_t *data) {
+    uint32_t now_us = time_us_32();
+
+    for (int i = 0; i < WINC_MESH_RTX_SLOTS; i++) {
+        mesh_rtx_t *e = &mesh_ctx.rtx[i];
+        if (e->active)
+            continue;
+
+        e->frame = mesh_frame_get();
+        if (e->frame < 0)
+            break;
+        // The RTO restarts when the frame actually leaves (mesh_rtx_sent)
+        e->active = true;
+        e->queued = false;
+        e->retries = 0;
+        e->held = 0;
+        e->sent_us = now_us;
+        e->rto_us = mesh_link_rto_us(hdr->next_hop);
+        winc_timer_start(&mesh_ctx.timers, &e->timer,
+                         MESH_NOW_MS() + MESH_US_TO_MS(e->rto_us));
+        memcpy(MESH_RTX_HDR(e), hdr, sizeof(winc_mesh_hdr_t));
+        memcpy(MESH_RTX_DATA(e), data, hdr->payload_len);
+        mesh_ctx.tx_stats.reliable_sent++;
+        return e;
+    }
+
+    mesh_ctx.tx_stats.queue_full++;
+    if (g_ctx.verbose)
+        printf("[MESH] Retransmit queue full, refusing frame to node %u\n", hdr->dst_node);
+    return NULL;
+}
+
+// Restart the RTO of a reliable frame now that it has left the queue, so
+// time spent waiting behind other frames or for our slot is not charged
+static void mesh_rtx_restart(uint8_t next_hop, uint8_t src_node, uint16_t seq_num, uint32_t now_us) {
+    for (int i = 0; i < WINC_MESH_RTX_SLOTS; i++) {
+        mesh_rtx_t *e = &mesh_ctx.rtx[i];
+        if (e->active && MESH_RTX_HDR(e)->next_hop == next_hop &&
+            MESH_RTX_HDR(e)->src_node == src_node && MESH_RTX_HDR(e)->seq_num == seq_num) {
+            e->queued = false;
+            e->held = 0;
+            e->sent_us = now_us;
+            winc_timer_start(&mesh_ctx.timers, &e->timer, MESH_NOW_MS() + MESH_US_TO_MS(e->rto_us));
+            return;
+        }
+    }
+}
+
+// A datagram went to the WINC: restart the RTO of each reliable frame in it
+static void mesh_rtx_sent(const uint8_t *buf, uint32_t now_us) {
+    const winc_mesh_hdr_t *hdr = (const winc_mesh_hdr_t*)buf;
+    int off = sizeof(winc_mesh_hdr_t);
+    int end = off + hdr->payload_len;
+    winc_mesh_sub_hdr_t sub;
+
+    if (hdr->next_hop == 0xFF)
+        return;
+    if (hdr->msg_type != MESH_MSG_AGGREGATE) {
+        if (hdr->flags & WINC_MESH_RELIABLE)
+            mesh_rtx_restart(hdr->next_hop, hdr->src_node, hdr->seq_num, now_us);
+        return;
+    }
+    while (off + (int)sizeof(sub) <= end) {
+        memcpy(&sub, buf + off, sizeof(sub));
+        if (sub.flags & WINC_MESH_RELIABLE)
+            mesh_rtx_restart(hdr->next_hop, sub.src_node, sub.seq_num, now_us);
+        off += sizeof(sub) + sub.payload_len;
+    }
+}
+
+// RTO expired: resend with exponential backoff
+static void mesh_rtx_timer_fn(winc_timer_t *t, void *arg) {
+    mesh_rtx_t *e = arg;
+    winc_mesh_hdr_t *hdr = MESH_RTX_HDR(e);
+    int next_hop;
+
+    if (e->retries >= WINC_MESH_MAX_RETRIES) {
+        if (g_ctx.verbose)
+            printf("[MESH] Giving up on frame %u from node %u to hop %u\n",
+                   hdr->seq_num, hdr->src_node, hdr->next_hop);
+        mesh_ctx.tx_stats.dropped++;
+        mesh_nbr(hdr->next_hop)->tx_lost++;
+        mesh_rtx_free(e);
+        return;
+    }
+
+    // The last copy is still queued behind other traffic or our TDMA slot;
+    // another one would only queue behind it. Bounded, in case the queue
+    // dropped it.
+    if (e->queued && e->held < WINC_MESH_MAX_RETRIES) {
+        e->held++;
+        winc_timer_start(&mesh_ctx.timers, t, MESH_NOW_MS() + MESH_US_TO_MS(e->rto_us));
+        return;
+    }
+
+    // The route may have moved while we waited; a pinned path stays
+    next_hop = hdr->flags & WINC_MESH_PINNED ? -1 : mesh_find_route(hdr->dst_node);
+    if (next_hop >= 0)
+        hdr->next_hop = next_hop;
+
+    e->retries++;
+    e->rto_us = MIN(e->rto_us * 2, WINC_MESH_RTO_MAX_MS * 1000u);
+    e->held = 0;
+    winc_timer_start(&mesh_ctx.timers, t, MESH_NOW_MS() + MESH_US_TO_MS(e->rto_us));
+    mesh_ctx.tx_stats.retransmits++;
+    mesh_nbr(hdr->next_hop)->retransmits++;
+    if (g_ctx.verbose > 1)
+        printf("[MESH] Retransmit %u of frame %u to hop %u\n",
+               e->retries, hdr->seq_num, hdr->next_hop);
+    e->queued = mesh_tx_frame(hdr, MESH_RTX_DATA(e));
+}
+
+// ACKs from a neighbour release our copies of the frames it received
+static void mesh_handle_ack(winc_mesh_hdr_t *hdr, uint8_t *data) {
+    uint32_t now_us = time_us_32();
+    winc_mesh_ack_t ack;
+
+    for (int n = 0; n + sizeof(ack) <= hdr->payload_len; n += sizeof(ack)) {
+        memcpy(&ack, data + n, sizeof(ack));
+
+        for (int i = 0; i < WINC_MESH_RTX_SLOTS; i++) {
+            mesh_rtx_t *e = &mesh_ctx.rtx[i];
+            if (!e->active || MESH_RTX_HDR(e)->next_hop != hdr->src_node ||
+                MESH_RTX_HDR(e)->src_node != ack.src_node ||
+                MESH_RTX_HDR(e)->seq_num != ack.seq_num)
+                continue;
+
+            // Karn: a resent frame's ACK could belong to any copy
+            if (!e->retries)
+                mesh_link_rtt_sample(hdr->src_node, now_us - e->sent_us);
+            mesh_ctx.tx_stats.acks_received++;
+            mesh_rtx_free(e);
+            break;
+        }
+    }
+}
+
+// Send the ACKs collected while handling a datagram
+static void mesh_ack_flush(void) {
+    winc_mesh_hdr_t hdr;
+
+    if (!mesh_ctx.ack_count)
+        return;
+
+    hdr.msg_type = MESH_MSG_ACK;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = 0xFF;
+    hdr.hop_count = 0;
+    hdr.seq_num = 0;
+    hdr.payload_len = mesh_ctx.ack_count * sizeof(winc_mesh_ack_t);
+    hdr.next_hop = 0xFF;
+    hdr.flags = WINC_MESH_PRIO(WINC_MESH_CLASS_CONTROL);
+
+    mesh_ctx.tx_stats.acks_sent += mesh_ctx.ack_count;
+    mesh_ctx.ack_count = 0;
+    mesh_tx_raw(&hdr, (uint8_t*)mesh_ctx.acks);
+}
+
+// Queue an ACK for a reliable frame
+static void mesh_ack_queue(const winc_mesh_hdr_t *hdr) {
+    winc_mesh_ack_t *ack;
+
+    if (mesh_ctx.ack_count == sizeof(mesh_ctx.acks) / sizeof(mesh_ctx.acks[0]))
+        mesh_ack_flush();
+    ack = &mesh_ctx.acks[mesh_ctx.ack_count++];
+    ack->src_node = hdr->src_node;
+    ack->seq_num = hdr->seq_num;
+}
+
+// Frames the retransmit queue can still hold
+static int mesh_rtx_room(void) {
+    int n = 0;
+
+    for (int i = 0; i < WINC_MESH_RTX_SLOTS; i++) {
+        if (!mesh_ctx.rtx[i].active)
+            n++;
+    }
+    return MIN(n, mesh_pool_free());
+}
+
+// Returns true if this reliable frame was received before, else remembers it.
+// Frames more than 64 behind the newest from their source count as seen.
+static bool mesh_dup_check(const winc_mesh_hdr_t *hdr) {
+    uint32_t now = to_ms_since_boot(get_absolute_time());
+    mesh_dup_t *d = NULL, *lru = &mesh_ctx.dup[0];
+    int16_t diff;
+
+    for (int i = 0; i < WINC_MESH_DUP_CACHE; i++) {
+        if (mesh_ctx.dup[i].src_node == hdr->src_node) {
+            d = &mesh_ctx.dup[i];
+            break;
+        }
+        if (!mesh_ctx.dup[i].src_node ||
+            (lru->src_node && (int32_t)(mesh_ctx.dup[i].last_used - lru->last_used) < 0))
+            lru = &mesh_ctx.dup[i];
+    }
+
+    diff = (int16_t)(hdr->seq_num - (d ? d->top_seq : 0));
+    if (!d || diff < -1024) {
+        // New source, or it restarted its sequence numbers
+        d = d ? d : lru;
+        d->src_node = hdr->src_node;
+        d->top_seq = hdr->seq_num;
+        d->window = 1;
+        d->last_used = now;
+        return false;
+    }
+    d->last_used = now;
+
+    if (diff > 0) {
+        d->window = diff >= 64 ? 1 : (d->window << diff) | 1;
+        d->top_seq = hdr->seq_num;
+        return false;
+    }
+    if (-diff >= 64 || (d->window & (1ull << -diff))) {
+        mesh_ctx.tx_stats.duplicates++;
+        return true;
+    }
+    d->window |= 1ull << -diff;
+    return false;
+}
+
+void winc_mesh_get_tx_stats(winc_mesh_tx_stats_t *stats) {
+    *stats = mesh_ctx.tx_stats;
+}
+
+// ===== DATA AGGREGATION =====
+
+#if WINC_MESH_AGGREGATE
+static mesh_agg_t *mesh_agg_find(uint8_t next_hop, uint8_t cls) {
+    for (int i = 0; i < WINC_MESH_AGG_QUEUES; i++) {
+        if (mesh_ctx.agg[i].next_hop == next_hop &&
+            (!next_hop || mesh_ctx.agg[i].cls == cls))
+            return &mesh_ctx.agg[i];
+    }
+    return NULL;
+}
+
+// Hand a queue's pool frame to the radio queue without copying; if the
+// class queue is full the frames stay here for the next attempt
+static bool mesh_agg_flush(mesh_agg_t *q) {
+    mesh_frame_t *f;
+    winc_mesh_hdr_t *hdr;
+
+    if (!q->count)
+        return true;
+    if (mesh_ctx.txq.stats.depth[q->cls] >= WINC_MESH_TXQ_DEPTH) {
+        mesh_ctx.txq.stats.dropped[q->cls]++;
+        return false;
+    }
+
+    f = MESH_FRAME(q->frame);
+    hdr = (winc_mesh_hdr_t*)f->buf;
+    if (q->count == 1) {
+        // Alone after all: a plain data frame is smaller
+        winc_mesh_sub_hdr_t sub;
+        memcpy(&sub, f->buf + sizeof(winc_mesh_hdr_t), sizeof(sub));
+        memmove(f->buf + sizeof(winc_mesh_hdr_t),
+                f->buf + sizeof(winc_mesh_hdr_t) + sizeof(sub), sub.payload_len);
+        hdr->msg_type = sub.msg_type;
+        hdr->src_node = sub.src_node;
+        hdr->dst_node = sub.dst_node;
+        hdr->hop_count = sub.hop_count;
+        hdr->seq_num = sub.seq_num;
+        hdr->payload_len = sub.payload_len;
+        hdr->next_hop = q->next_hop;
+        hdr->flags = sub.flags;
+    } else {
+        hdr->msg_type = MESH_MSG_AGGREGATE;
+        hdr->src_node = g_ctx.mesh.my_node_id;
+        hdr->dst_node = q->next_hop;
+        hdr->hop_count = 0;
+        hdr->seq_num = 0;       // Sub-frames carry their own
+        hdr->payload_len = q->len;
+        hdr->next_hop = q->next_hop;
+        hdr->flags = WINC_MESH_PRIO(q->cls);
+
+        if (g_ctx.verbose > 1)
+            printf("[MESH] Aggregate of %u frames (%u bytes) to hop %u\n",
+                   q->count, q->len, q->next_hop);
+    }
+    f->len = sizeof(winc_mesh_hdr_t) + hdr->payload_len;
+    mesh_txq_put(q->frame, q->cls);
+
+    q->next_hop = 0;
+    q->count = 0;
+    q->len = 0;
+    q->frame = -1;
+    return true;
+}
+
+// Queue a small data frame behind others for the same next hop and class
+static bool mesh_agg_add(const winc_mesh_hdr_t *hdr, const uint8_t *data) {
+    uint8_t cls = WINC_MESH_FLAGS_CLASS(hdr->flags);
+    mesh_agg_t *q = mesh_agg_find(hdr->next_hop, cls);
+    uint16_t need = sizeof(winc_mesh_sub_hdr_t) + hdr->payload_len;
+    winc_mesh_sub_hdr_t sub;
+
+    if (!q) {
+        // Free queue, else make one free by sending the oldest
+        q = mesh_agg_find(0, 0);
+        if (!q) {
+            q = &mesh_ctx.agg[0];
+            for (int i = 1; i < WINC_MESH_AGG_QUEUES; i++) {
+                if ((int32_t)(mesh_ctx.agg[i].due_us - q->due_us) < 0)
+                    q = &mesh_ctx.agg[i];
+            }
+            if (!mesh_agg_flush(q))
+                return false;
+        }
+        q->next_hop = hdr->next_hop;
+        q->cls = cls;
+    }
+
+    if (q->len + need > WINC_MESH_AGG_MAX_BYTES && !mesh_agg_flush(q))
+        return false;
+
+    if (!q->count) {
+        q->frame = mesh_frame_get_for(cls);
+        if (q->frame < 0) {
+            q->next_hop = 0;
+            return false;
+        }
+        q->next_hop = hdr->next_hop;
+        q->cls = cls;
+        q->due_us = time_us_32() + WINC_MESH_AGG_DELAY_US;
+    }
+
+    sub.msg_type = hdr->msg_type;
+    sub.src_node = hdr->src_node;
+    sub.dst_node = hdr->dst_node;
+    sub.hop_count = hdr->hop_count;
+    sub.seq_num = hdr->seq_num;
+    sub.payload_len = hdr->payload_len;
+    sub.flags = hdr->flags;
+    memcpy(MESH_FRAME(q->frame)->buf + sizeof(winc_mesh_hdr_t) + q->len, &sub, sizeof(sub));
+    memcpy(MESH_FRAME(q->frame)->buf + sizeof(winc_mesh_hdr_t) + q->len + sizeof(sub),
+           data, hdr->payload_len);
+    q->len += need;
+    q->count++;
+
+    // Full: no point waiting for the deadline. A failed send is retried by
+    // winc_mesh_process(); the frame itself is already queued.
+    if (q->len + sizeof(winc_mesh_sub_hdr_t) >= WINC_MESH_AGG_MAX_BYTES)
+        mesh_agg_flush(q);
+    return true;
+}
+
+// Send the queues whose deadline has passed, retrying a millisecond later
+// if the class queue is full. Checked on every poll rather than on the
+// timer wheel, whose millisecond ticks would round the deadline up.
+static void mesh_agg_run(uint32_t now_us) {
+    for (int i = 0; i < WINC_MESH_AGG_QUEUES; i++) {
+        mesh_agg_t *q = &mesh_ctx.agg[i];
+
+        if (q->count && (int32_t)(now_us - q->due_us) >= 0 && !mesh_agg_flush(q))
+            q->due_us = now_us + 1000;
+    }
+}
+#endif
+
+// Send a data frame to hdr->next_hop, keeping a copy if it must be ACKed
+static bool mesh_tx_data(winc_mesh_hdr_t *hdr, const uint8_t *data) {
+    if (hdr->flags & WINC_MESH_RELIABLE) {
+        mesh_rtx_t *e = mesh_rtx_add(hdr, data);
+        if (!e)
+            return false;
+        e->queued = mesh_tx_frame(hdr, data);
+        return true;            // A failed send is retried on RTO
+    }
+    return mesh_tx_frame(hdr, data);
+}
+
+// Queue a frame for the air, batching it with others if small. Alarm and
+// control frames never wait for company.
+static bool mesh_tx_frame(const winc_mesh_hdr_t *hdr, const uint8_t *data) {
+#if WINC_MESH_AGGREGATE
+    uint8_t cls = WINC_MESH_FLAGS_CLASS(hdr->flags);
+    mesh_agg_t *q;
+
+    if (cls == WINC_MESH_CLASS_ALARM || cls == WINC_MESH_CLASS_CONTROL)
+        return mesh_tx_raw(hdr, data);
+
+    if (hdr->payload_len <= WINC_MESH_AGG_MAX_FRAME)
+        return mesh_agg_add(hdr, data);
+
+    // Too big to batch; frames queued ahead of it still go first
+    q = mesh_agg_find(hdr->next_hop, cls);
+    if (q && !mesh_agg_flush(q))
+        return false;
+#endif
+    return mesh_tx_raw(hdr, data);
+}
+
+void winc_mesh_flush(void) {
+#if WINC_MESH_AGGREGATE
+    for (int i = 0; i < WINC_MESH_AGG_QUEUES; i++)
+        mesh_agg_flush(&mesh_ctx.agg[i]);
+#endif
+}
+
+// Route a packet through the mesh
+static bool mesh_route_packet(winc_mesh_hdr_t *hdr, uint8_t *data) {
+    int next_hop;
+
+    // Check if packet is for us
+    if (hdr->dst_node == g_ctx.mesh.my_node_id) {
+        // Deliver to application
+        if (g_ctx.mesh.data_callback) {
+            g_ctx.mesh.data_callback(hdr->src_node, data, hdr->payload_len);
+        }
+        return true;
+    }
+
+    // Check hop count
+    if (hdr->hop_count >= WINC_MESH_MAX_HOPS) {
+        if (g_ctx.verbose)
+            printf("Packet exceeded max hops, dropping\n");
+        mesh_nbr(mesh_ctx.rx_from)->drop_max_hops++;
+        return false;
+    }
+
+    // Find next hop
+    next_hop = mesh_find_route(hdr->dst_node);
+    if (next_hop < 0) {
+        if (g_ctx.verbose)
+            printf("No route to node %u, dropping packet\n", hdr->dst_node);
+        mesh_nbr(mesh_ctx.rx_from)->drop_no_route++;
+        return false;
+    }
+    next_hop = mesh_bp_next_hop(hdr->dst_node, next_hop, WINC_MESH_FLAGS_CLASS(hdr->flags), false);
+
+    // Increment hop count and forward
+    hdr->hop_count++;
+    hdr->next_hop = next_hop;
+
+    if (g_ctx.verbose > 1)
+        printf("Forwarding packet to node %u via hop %d\n", hdr->dst_node, next_hop);
+
+    // Forward packet
+    if (!mesh_tx_data(hdr, data)) {
+        mesh_nbr(mesh_ctx.rx_from)->drop_queue_full++;
+        return false;
+    }
+    mesh_nbr(mesh_ctx.rx_from)->forwarded++;
+    return true;
+}
+
+// Deliver a data frame or fragment addressed to us, or pass it on
+static void mesh_handle_data(winc_mesh_hdr_t *hdr, uint8_t *data) {
+    bool for_us = hdr->dst_node == g_ctx.mesh.my_node_id || hdr->dst_node == 0xFF;
+    winc_mesh_srcroute_t sr;
+    winc_mesh_neighbor_stats_t *n;
+
+    if ((hdr->flags & WINC_MESH_PINNED) && !mesh_path_parse(hdr, data, &sr)) {
+        if (g_ctx.verbose)
+            printf("[MESH] Bad pinned path in frame %u from node %u\n", hdr->seq_num, hdr->src_node);
+        return;
+    }
+    n = mesh_nbr(mesh_ctx.rx_from);
+
+    n->rx_frames++;
+    n->rx_bytes += hdr->payload_len;
+
+    if (hdr->flags & WINC_MESH_RELIABLE) {
+        // No room to hold it for the next hop: stay quiet so the sender retries
+        if (!for_us && !mesh_rtx_room()) {
+            n->drop_queue_full++;
+            return;
+        }
+        mesh_ack_queue(hdr);
+        if (mesh_dup_check(hdr))
+            return;
+    }
+
+    if (for_us) {
+        // Packet is for us
+        if (hdr->flags & WINC_MESH_PINNED) {
+            data += sizeof(sr) + sr.count;
+            hdr->payload_len -= sizeof(sr) + sr.count;
+        }
+        if (hdr->msg_type == MESH_MSG_FRAGMENT)
+            mesh_frag_input(hdr, data);
+        else if (hdr->msg_type == MESH_MSG_ECHO_REQ || hdr->msg_type == MESH_MSG_ECHO_REPLY)
+            mesh_handle_echo(hdr, data);
+        else if (hdr->msg_type == MESH_MSG_ROUTE_REQ || hdr->msg_type == MESH_MSG_ROUTE_RESP)
+            mesh_handle_route_rec(hdr, data);
+        else if (hdr->msg_type == MESH_MSG_STREAM)
+            mesh_stream_input(hdr, data, hdr->payload_len);
+        else if (hdr->msg_type == MESH_MSG_PUBLISH)
+            mesh_pub_input(hdr, data, hdr->payload_len);
+        else if (hdr->msg_type == MESH_MSG_RPC)
+            mesh_rpc_input(hdr, data, hdr->payload_len);
+        else if (hdr->msg_type == MESH_MSG_KV)
+            mesh_kv_input(hdr, data, hdr->payload_len);
+        else if (hdr->flags & WINC_MESH_ORDERED)
+            mesh_order_input(hdr, data, hdr->payload_len);
+        else if (g_ctx.mesh.data_callback)
+            g_ctx.mesh.data_callback(hdr->src_node, data, hdr->payload_len);
+    } else if (hdr->flags & WINC_MESH_PINNED) {
+        mesh_path_forward(hdr, data, &sr);
+    } else {
+        // Echoes note every hop they pass; the padding leaves room in place
+        if ((hdr->msg_type == MESH_MSG_ECHO_REQ || hdr->msg_type == MESH_MSG_ECHO_REPLY) &&
+            hdr->payload_len >= sizeof(winc_mesh_echo_t)) {
+            winc_mesh_echo_t *echo = (winc_mesh_echo_t*)data;
+            if (echo->record && echo->path_len < sizeof(echo->path))
+                echo->path[echo->path_len++] = g_ctx.mesh.my_node_id;
+        }
+        // So do route requests, to learn a path from
+        if (hdr->msg_type == MESH_MSG_ROUTE_REQ && hdr->payload_len >= sizeof(winc_mesh_route_rec_t))
+            mesh_route_rec_append((winc_mesh_route_rec_t*)data);
+        // Route to next hop
+        mesh_route_packet(hdr, data);
+    }
+}
+
+// Split an aggregate and handle each frame as if it had arrived alone
+static void mesh_handle_aggregate(uint8_t *buf, int rxlen) {
+    winc_mesh_hdr_t *outer = (winc_mesh_hdr_t*)buf;
+    int off = sizeof(winc_mesh_hdr_t);
+    int end = off + outer->payload_len;
+    winc_mesh_sub_hdr_t sub;
+    winc_mesh_hdr_t hdr;
+
+    if (end > rxlen) {
+        printf("[RX] ERROR: Truncated aggregate (%d of %d bytes)\n", rxlen, end);
+        return;
+    }
+
+    while (off + (int)sizeof(sub) <= end) {
+        memcpy(&sub, buf + off, sizeof(sub));
+        off += sizeof(sub);
+        if (off + sub.payload_len > end) {
+            printf("[RX] ERROR: Bad aggregate sub-frame length %u\n", sub.payload_len);
+            return;
+        }
+
+        hdr.msg_type = sub.msg_type;
+        hdr.src_node = sub.src_node;
+        hdr.dst_node = sub.dst_node;
+        hdr.hop_count = sub.hop_count;
+        hdr.seq_num = sub.seq_num;
+        hdr.payload_len = sub.payload_len;
+        hdr.next_hop = outer->next_hop;
+        hdr.flags = sub.flags;
+        hdr.prev_hop = outer->prev_hop;
+        mesh_handle_data(&hdr, buf + off);
+        off += sub.payload_len;
+    }
+}
+
+// ===== BROADCAST =====
+
+// Copies of a broadcast die out within a few hops; remember it this long
+#define MESH_FLOOD_HOLD_MS  5000
+
+#define MESH_ID_SET(set, id)  ((set)[(id) / 32] |= 1u << ((id) % 32))
+#define MESH_ID_CLR(set, id)  ((set)[(id) / 32] &= ~(1u << ((id) % 32)))
+#define MESH_ID_HAS(set, id)  ((set)[(id) / 32] & (1u << ((id) % 32)))
+
+// A neighbour's table entry for a node it hears directly
+static bool mesh_adv_direct(const winc_mesh_dv_entry_t *e) {
+    return e->next_hop == e->node_id && e->hops == 1 && e->metric < WINC_MESH_METRIC_INFINITY;
+}
+
+// Choose the neighbours that must relay a broadcast so it reaches all our
+// two-hop neighbours, as listed in the tables their beacons carry. Greedy
+// as in RFC 3626 8.3.1: take the neighbour covering most nodes still
+// uncovered until none are left. from (0 = none) sent the copy we got, so
+// it and its own neighbours need no cover. A neighbour whose table we
+// don't have is always chosen. Returns the number of ids written to relays.
+static int mesh_mpr_select(uint8_t from, uint8_t *relays) {
+    winc_mesh_flood_stats_t *st = &mesh_ctx.flood.stats;
+    uint32_t n1[8] = {0}, need[8] = {0};
+    bool usable[WINC_MESH_MAX_NODES];
+    int count = 0;
+
+    st->neighbors = st->two_hop = 0;
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_link_t *l = &mesh_ctx.links[i];
+        usable[i] = l->active && mesh_link_etx(l->node_id) < WINC_MESH_METRIC_INFINITY;
+        if (usable[i]) {
+            MESH_ID_SET(n1, l->node_id);
+            st->neighbors++;
+        }
+    }
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_adv_t *a = &mesh_ctx.adv[i];
+        if (!usable[i] || !a->valid)
+            continue;
+        for (int k = 0; k < a->count; k++) {
+            uint8_t id = a->entries[k].node_id;
+            if (mesh_adv_direct(&a->entries[k]) && id != g_ctx.mesh.my_node_id &&
+                !MESH_ID_HAS(n1, id) && !MESH_ID_HAS(need, id)) {
+                MESH_ID_SET(need, id);
+                st->two_hop++;
+            }
+        }
+    }
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_adv_t *a = &mesh_ctx.adv[i];
+        if (!usable[i] || mesh_ctx.links[i].node_id != from || !a->valid)
+            continue;
+        for (int k = 0; k < a->count; k++) {
+            if (mesh_adv_direct(&a->entries[k]))
+                MESH_ID_CLR(need, a->entries[k].node_id);
+        }
+    }
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        if (usable[i] && mesh_ctx.links[i].node_id != from &&
+            (!WINC_MESH_MPR || !mesh_ctx.adv[i].valid)) {
+            relays[count++] = mesh_ctx.links[i].node_id;
+            usable[i] = false;
+        }
+    }
+
+    for (;;) {
+        int best = -1, best_gain = 0;
+
+        for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+            mesh_adv_t *a = &mesh_ctx.adv[i];
+            int gain = 0;
+
+            if (!usable[i] || mesh_ctx.links[i].node_id == from)
+                continue;
+            for (int k = 0; k < a->count; k++) {
+                if (mesh_adv_direct(&a->entries[k]) && MESH_ID_HAS(need, a->entries[k].node_id))
+                    gain++;
+            }
+            // Equal cover: the better link
+            if (gain > best_gain || (gain && gain == best_gain &&
+                mesh_link_etx(mesh_ctx.links[i].node_id) < mesh_link_etx(mesh_ctx.links[best].node_id))) {
+                best = i;
+                best_gain = gain;
+            }
+        }
+        if (best < 0)
+            break;
+
+        relays[count++] = mesh_ctx.links[best].node_id;
+        usable[best] = false;
+        for (int k = 0; k < mesh_ctx.adv[best].count; k++) {
+            if (mesh_adv_direct(&mesh_ctx.adv[best].entries[k]))
+                MESH_ID_CLR(need, mesh_ctx.adv[best].entries[k].node_id);
+        }
+    }
+
+    st->relays = count;
+    return count;
+}
+
+// Cache entry of a broadcast seen lately, or NULL
+static mesh_flood_seen_t *mesh_flood_find(uint8_t src_node, uint16_t seq_num, uint32_t now) {
+    for (int i = 0; i < WINC_MESH_FLOOD_CACHE; i++) {
+        mesh_flood_seen_t *e = &mesh_ctx.flood.seen[i];
+        if (e->src_node == src_node && e->seq_num == seq_num && now - e->at < MESH_FLOOD_HOLD_MS)
+            return e;
+    }
+    return NULL;
+}
+
+// Remember a broadcast in place of the oldest one
+static mesh_flood_seen_t *mesh_flood_remember(uint8_t src_node, uint16_t seq_num, uint32_t now) {
+    mesh_flood_seen_t *e = &mesh_ctx.flood.seen[mesh_ctx.flood.next];
+
+    mesh_ctx.flood.next = (mesh_ctx.flood.next + 1) % WINC_MESH_FLOOD_CACHE;
+    e->src_node = src_node;
+    e->seq_num = seq_num;
+    e->relayed = false;
+    e->at = now;
+    return e;
+}
+
+// Send a broadcast to our neighbours, naming the ones that relay it
+static bool mesh_flood_tx(winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len, uint8_t from) {
+    winc_mesh_flood_t *fh = (winc_mesh_flood_t*)mesh_ctx.fragbuf;
+    uint8_t *relays = mesh_ctx.fragbuf + sizeof(winc_mesh_flood_t);
+
+    fh->sender = g_ctx.mesh.my_node_id;
+    fh->relay_count = mesh_mpr_select(from, relays);
+    memcpy(relays + fh->relay_count, data, len);
+    hdr->payload_len = sizeof(winc_mesh_flood_t) + fh->relay_count + len;
+    hdr->next_hop = 0xFF;
+
+    if (!mesh_tx_raw(hdr, mesh_ctx.fragbuf)) {
+        mesh_ctx.flood.stats.dropped++;
+        return false;
+    }
+    if (g_ctx.verbose > 1)
+        printf("[MESH] Broadcast %u from node %u, %u relays\n",
+               hdr->seq_num, hdr->src_node, fh->relay_count);
+    return true;
+}
+
+static bool mesh_flood_send(const uint8_t *data, uint16_t len, uint8_t flags) {
+    winc_mesh_hdr_t hdr;
+
+    if (len > WINC_MESH_BROADCAST_MAX) {
+        printf("ERROR: Broadcast too long (%u bytes, max %u)\n", len, (unsigned)WINC_MESH_BROADCAST_MAX);
+        mesh_ctx.flood.stats.dropped++;
+        return false;
+    }
+
+    hdr.msg_type = MESH_MSG_FLOOD;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = WINC_MESH_BROADCAST;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.flags = flags & WINC_MESH_PRIO(3);
+
+    // Our own copy coming back is a duplicate
+    mesh_flood_remember(hdr.src_node, hdr.seq_num, MESH_NOW_MS())->relayed = true;
+    mesh_ctx.flood.stats.sent++;
+    return mesh_flood_tx(&hdr, data, len, 0);
+}
+
+// Deliver a broadcast the first time we hear it, and send it on once if
+// the node we heard it from chose us as a relay
+static void mesh_handle_flood(winc_mesh_hdr_t *hdr, uint8_t *data) {
+    winc_mesh_flood_t fh;
+    winc_mesh_flood_stats_t *st = &mesh_ctx.flood.stats;
+    uint32_t now = MESH_NOW_MS();
+    mesh_flood_seen_t *e;
+    bool relay = false;
+    uint16_t len;
+
+    if (hdr->payload_len < sizeof(fh))
+        return;
+    memcpy(&fh, data, sizeof(fh));
+    if (sizeof(fh) + fh.relay_count > hdr->payload_len)
+        return;
+    len = hdr->payload_len - sizeof(fh) - fh.relay_count;
+    for (int i = 0; i < fh.relay_count; i++)
+        relay |= data[sizeof(fh) + i] == g_ctx.mesh.my_node_id;
+    mesh_nbr(fh.sender)->rx_frames++;
+    mesh_nbr(fh.sender)->rx_bytes += len;
+
+    e = mesh_flood_find(hdr->src_node, hdr->seq_num, now);
+    if (e) {
+        st->duplicates++;
+    } else {
+        e = mesh_flood_remember(hdr->src_node, hdr->seq_num, now);
+        st->received++;
+        if (g_ctx.mesh.data_callback)
+            g_ctx.mesh.data_callback(hdr->src_node, data + sizeof(fh) + fh.relay_count, len);
+    }
+
+    if (!relay || e->relayed)
+        return;
+    e->relayed = true;
+    if (hdr->hop_count >= WINC_MESH_MAX_HOPS) {
+        mesh_nbr(fh.sender)->drop_max_hops++;
+        return;
+    }
+    hdr->hop_count++;
+    if (mesh_flood_tx(hdr, data + sizeof(fh) + fh.relay_count, len, fh.sender)) {
+        st->relayed++;
+        mesh_nbr(fh.sender)->forwarded++;
+    }
+}
+
+void winc_mesh_get_flood_stats(winc_mesh_flood_stats_t *stats) {
+    *stats = mesh_ctx.flood.stats;
+}
+
+// ===== BACKPRESSURE =====
+
+// Our queue pressure, 0-3, from the fuller of the frame pool and the normal
+// and bulk queues. Retransmit slots are left out: reliable senders already
+// wait for room there.
+static uint8_t mesh_bp_level(void) {
+    mesh_txq_t *t = &mesh_ctx.txq;
+    uint32_t eighths;
+
+    if (!mesh_ctx.bp.enabled)
+        return 0;
+    eighths = 8u * mesh_ctx.pool.stats.in_use / WINC_MESH_POOL_FRAMES;
+    eighths = MAX(eighths, 8u * MAX(t->stats.depth[WINC_MESH_CLASS_NORMAL],
+                                    t->stats.depth[WINC_MESH_CLASS_BULK]) / WINC_MESH_TXQ_DEPTH);
+    return eighths >= 7 ? 3 : eighths >= 5 ? 2 : eighths >= 3 ? 1 : 0;
+}
+
+static void mesh_bp_timer_fn(winc_timer_t *t, void *arg) {
+    if (mesh_send_beacon())
+        mesh_ctx.bp.stats.announced++;
+}
+
+// Put our pressure, and ourselves as the hop it came from, in a datagram
+// about to leave
+static void mesh_bp_stamp(uint8_t *buf) {
+    winc_mesh_hdr_t *hdr = (winc_mesh_hdr_t*)buf;
+    uint8_t level = mesh_bp_level();
+
+    hdr->prev_hop = g_ctx.mesh.my_node_id;
+    hdr->flags = (hdr->flags & ~MESH_PRESSURE(3)) | MESH_PRESSURE(level);
+    if (hdr->msg_type == MESH_MSG_BEACON) {
+        mesh_ctx.bp.level = level;
+        mesh_ctx.bp.announced_at = MESH_NOW_MS();
+    }
+}
+
+// The neighbours feeding us may hear nothing from us but beacons, so one
+// goes out as soon as our pressure crosses a level they act on, either
+// way, and every half hold while it stays there
+static void mesh_bp_update(void) {
+    mesh_bp_t *bp = &mesh_ctx.bp;
+    uint8_t level = mesh_bp_level();
+    uint32_t now = MESH_NOW_MS();
+
+    if (winc_timer_pending(&bp->timer))
+        return;
+    if ((level < 2 ? 0 : level) != (bp->level < 2 ? 0 : bp->level) ||
+        (level >= 2 && now - bp->announced_at >= WINC_MESH_BP_HOLD_MS / 2))
+        winc_timer_start(&mesh_ctx.timers, &bp->timer,
+                         MAX((int32_t)(bp->announced_at + WINC_MESH_BP_PACE_MS - now), 0) + now);
+}
+
+// Note the pressure a neighbour reported in a datagram it sent us
+static void mesh_bp_heard(uint8_t node_id, uint8_t flags) {
+    mesh_link_t *l = mesh_link_find(node_id);
+
+    if (!l)
+        return;
+    l->pressure = MESH_FLAGS_PRESSURE(flags);
+    l->pressure_at = MESH_NOW_MS();
+}
+
+// A neighbour's pressure, 0 once its report is stale
+static uint8_t mesh_bp_of(uint8_t node_id) {
+    mesh_link_t *l = mesh_link_find(node_id);
+
+    if (!mesh_ctx.bp.enabled || !l || MESH_NOW_MS() - l->pressure_at >= WINC_MESH_BP_HOLD_MS)
+        return 0;
+    return l->pressure;
+}
+
+// Least-cost neighbour other than next_hop that is not busy and whose
+// route to dst_node, as its table has it, neither runs back through us nor
+// costs more than one ETX above ours; -1 if there is none
+static int mesh_bp_alternate(uint8_t dst_node, int next_hop) {
+    int slot = mesh_route_slot(dst_node), alt = -1;
+    uint32_t limit, best = UINT32_MAX;
+
+    if (slot < 0)
+        return -1;
+    limit = mesh_ctx.route_ext[slot].metric + WINC_MESH_ETX_ONE;
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_link_t *l = &mesh_ctx.links[i];
+        mesh_adv_t *a = &mesh_ctx.adv[i];
+        uint32_t cost = mesh_link_etx(l->node_id);
+        int j = 0;
+
+        if (!l->active || l->node_id == next_hop || cost >= WINC_MESH_METRIC_INFINITY ||
+            mesh_bp_of(l->node_id) >= 2)
+            continue;
+        if (l->node_id != dst_node) {
+            if (!a->valid)
+                continue;
+            while (j < a->count && a->entries[j].node_id != dst_node)
+                j++;
+            if (j == a->count || a->entries[j].next_hop == g_ctx.mesh.my_node_id ||
+                a->entries[j].metric >= WINC_MESH_METRIC_INFINITY)
+                continue;
+            cost += a->entries[j].metric;
+        }
+        if (cost <= limit && cost < best) {
+            best = cost;
+            alt = l->node_id;
+        }
+    }
+    return alt;
+}
+
+// Next hop for a normal or bulk frame towards dst_node whose route goes
+// through next_hop. A busy next hop is avoided if there is an alternate;
+// failing that a source refuses bulk frames and paces normal ones while
+// the hop is at level 3 (-1 = refused). Forwarders never refuse: the hold
+// on the bulk queue slows them down instead.
+static int mesh_bp_next_hop(uint8_t dst_node, int next_hop, int cls, bool source) {
+    mesh_bp_t *bp = &mesh_ctx.bp;
+    uint8_t level = mesh_bp_of(next_hop);
+    uint32_t now;
+    int alt;
+
+    if (level < 2 || (cls != WINC_MESH_CLASS_NORMAL && cls != WINC_MESH_CLASS_BULK))
+        return next_hop;
+
+    alt = mesh_bp_alternate(dst_node, next_hop);
+    if (alt >= 0) {
+        if (g_ctx.verbose > 1)
+            printf("[MESH] Node %d busy (level %u), sending to %u via %d\n",
+                   next_hop, level, dst_node, alt);
+        bp->stats.rerouted++;
+        return alt;
+    }
+    if (!source)
+        return next_hop;
+
+    now = MESH_NOW_MS();
+    if (cls == WINC_MESH_CLASS_BULK || (level == 3 && now - bp->paced_at < WINC_MESH_BP_PACE_MS)) {
+        if (g_ctx.verbose > 1)
+            printf("[MESH] Node %d busy (level %u), holding back frame for %u\n",
+                   next_hop, level, dst_node);
+        bp->stats.throttled++;
+        return -1;
+    }
+    if (level == 3)
+        bp->paced_at = now;
+    return next_hop;
+}
+
+// Milliseconds until the head of class cls may be sent, as far as pressure
+// goes: bulk frames wait while their next hop is at level 3, at most until
+// its report runs out
+static uint32_t mesh_bp_hold_ms(int cls) {
+    mesh_bp_t *bp = &mesh_ctx.bp;
+    int head = mesh_ctx.txq.cls[cls].head;
+    mesh_link_t *l;
+    uint32_t age;
+
+    if (cls != WINC_MESH_CLASS_BULK || head < 0 ||
+        mesh_bp_of(((winc_mesh_hdr_t*)MESH_FRAME(head)->buf)->next_hop) < 3) {
+        if (cls == WINC_MESH_CLASS_BULK)
+            bp->holding = false;
+        return 0;
+    }
+    if (!bp->holding) {
+        bp->holding = true;
+        bp->stats.held++;
+    }
+    l = mesh_link_find(((winc_mesh_hdr_t*)MESH_FRAME(head)->buf)->next_hop);
+    age = MESH_NOW_MS() - l->pressure_at;
+    return WINC_MESH_BP_HOLD_MS - age;
+}
+
+void winc_mesh_get_bp_stats(winc_mesh_bp_stats_t *stats) {
+    *stats = mesh_ctx.bp.stats;
+    stats->level = mesh_bp_level();
+    stats->busy_neighbors = 0;
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        if (mesh_ctx.links[i].active && mesh_bp_of(mesh_ctx.links[i].node_id) >= 2)
+            stats->busy_neighbors++;
+    }
+}
+
+void winc_mesh_set_backpressure(bool on) {
+    mesh_ctx.bp.enabled = on;
+    mesh_txq_run();
+}
+
+// ===== PINNED PATHS =====
+
+// Path slot of a destination, optionally claiming a free one
+static mesh_path_t *mesh_path_slot(uint8_t dst_node, bool create) {
+    mesh_path_t *free_slot = NULL;
+
+    for (int i = 0; i < WINC_MESH_PATH_SLOTS; i++) {
+        mesh_path_t *p = &mesh_ctx.paths[i];
+        if (p->dst_node == dst_node)
+            return p;
+        if (!p->dst_node && !free_slot)
+            free_slot = p;
+    }
+    if (!create || !free_slot)
+        return NULL;
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->dst_node = dst_node;
+    return free_slot;
+}
+
+bool winc_mesh_set_path(uint8_t dst_node, const uint8_t *hops, uint8_t count) {
+    mesh_path_t *p;
+
+    if (!dst_node || dst_node == WINC_MESH_BROADCAST || dst_node == g_ctx.mesh.my_node_id ||
+        count > WINC_MESH_MAX_PATH || (count && hops[count - 1] != dst_node))
+        return false;
+
+    if (!count) {
+        p = mesh_path_slot(dst_node, false);
+        if (p)
+            memset(p, 0, sizeof(*p));
+        return true;
+    }
+    p = mesh_path_slot(dst_node, true);
+    if (!p)
+        return false;
+    memcpy(p->hops, hops, count);
+    p->count = count;
+    return true;
+}
+
+int winc_mesh_get_path(uint8_t dst_node, uint8_t *hops, int max) {
+    mesh_path_t *p = mesh_path_slot(dst_node, false);
+
+    if (!p || !p->count || p->count > max)
+        return 0;
+    memcpy(hops, p->hops, p->count);
+    return p->count;
+}
+
+bool winc_mesh_learn_path(uint8_t dst_node) {
+    winc_mesh_route_rec_t rec;
+    winc_mesh_hdr_t hdr;
+    mesh_path_t *p;
+    int next_hop = mesh_find_route(dst_node);
+
+    if (next_hop < 0) {
+        printf("ERROR: No route to node %u\n", dst_node);
+        return false;
+    }
+    p = mesh_path_slot(dst_node, true);
+    if (!p) {
+        printf("ERROR: No free path slot for node %u\n", dst_node);
+        return false;
+    }
+
+    memset(&rec, 0, sizeof(rec));
+    if (!++mesh_ctx.path_req_id)
+        mesh_ctx.path_req_id++;
+    rec.id = p->learn_id = mesh_ctx.path_req_id;
+
+    hdr.msg_type = MESH_MSG_ROUTE_REQ;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = dst_node;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.payload_len = sizeof(rec);
+    hdr.next_hop = next_hop;
+    hdr.flags = WINC_MESH_PRIO(WINC_MESH_CLASS_NORMAL);
+    return mesh_tx_data(&hdr, (uint8_t*)&rec);
+}
+
+// Add us to a route record; past WINC_MESH_MAX_PATH only the count grows
+static void mesh_route_rec_append(winc_mesh_route_rec_t *rec) {
+    if (rec->count < WINC_MESH_MAX_PATH)
+        rec->hops[rec->count] = g_ctx.mesh.my_node_id;
+    if (rec->count <= WINC_MESH_MAX_PATH)
+        rec->count++;
+}
+
+// A route request reached us: send the record back. A reply: pin its path.
+static void mesh_handle_route_rec(winc_mesh_hdr_t *hdr, uint8_t *data) {
+    winc_mesh_route_rec_t rec;
+    mesh_path_t *p;
+
+    if (hdr->payload_len < sizeof(rec))
+        return;
+    memcpy(&rec, data, sizeof(rec));
+
+    if (hdr->msg_type == MESH_MSG_ROUTE_REQ) {
+        winc_mesh_hdr_t reply;
+        int next_hop = mesh_find_route(hdr->src_node);
+
+        if (next_hop < 0)
+            return;
+        mesh_route_rec_append(&rec);
+        reply.msg_type = MESH_MSG_ROUTE_RESP;
+        reply.src_node = g_ctx.mesh.my_node_id;
+        reply.dst_node = hdr->src_node;
+        reply.hop_count = 0;
+        reply.seq_num = g_ctx.mesh.seq_num++;
+        reply.payload_len = sizeof(rec);
+        reply.next_hop = next_hop;
+        reply.flags = WINC_MESH_PRIO(WINC_MESH_CLASS_NORMAL);
+        mesh_tx_data(&reply, (uint8_t*)&rec);
+        return;
+    }
+
+    p = mesh_path_slot(hdr->src_node, false);
+    if (!p || !rec.id || rec.id != p->learn_id)
+        return;
+    p->learn_id = 0;
+    if (!rec.count || rec.count > WINC_MESH_MAX_PATH) {
+        printf("[MESH] Path to node %u longer than %u hops, not pinned\n",
+               hdr->src_node, WINC_MESH_MAX_PATH);
+        return;
+    }
+    memcpy(p->hops, rec.hops, rec.count);
+    p->count = rec.count;
+    if (g_ctx.verbose) {
+        printf("[MESH] Pinned path to node %u:", hdr->src_node);
+        for (int i = 0; i < p->count; i++)
+            printf(" %u", p->hops[i]);
+        printf("\n");
+    }
+}
+
+static bool mesh_path_send(uint8_t dst_node, const uint8_t *data, uint16_t len, uint8_t flags) {
+    mesh_path_t *p = mesh_path_slot(dst_node, false);
+    winc_mesh_srcroute_t *sr = (winc_mesh_srcroute_t*)mesh_ctx.fragbuf;
+    winc_mesh_hdr_t hdr;
+
+    if (!p || !p->count) {
+        printf("ERROR: No path pinned to node %u\n", dst_node);
+        return false;
+    }
+    if (sizeof(*sr) + p->count + len > WINC_MESH_MTU) {
+        printf("ERROR: Pinned payload too long (%u bytes, max %u)\n",
+               len, (unsigned)(WINC_MESH_MTU - sizeof(*sr) - p->count));
+        return false;
+    }
+
+    sr->count = p->count;
+    sr->next = 0;
+    memcpy(mesh_ctx.fragbuf + sizeof(*sr), p->hops, p->count);
+    memcpy(mesh_ctx.fragbuf + sizeof(*sr) + p->count, data, len);
+
+    hdr.msg_type = MESH_MSG_DATA;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = dst_node;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.payload_len = sizeof(*sr) + p->count + len;
+    hdr.next_hop = p->hops[0];
+    hdr.flags = flags & (WINC_MESH_RELIABLE | WINC_MESH_PINNED | WINC_MESH_ORDERED | WINC_MESH_PRIO(3));
+    return mesh_tx_data(&hdr, mesh_ctx.fragbuf);
+}
+
+// Check the path of a pinned frame we received: it must name us as the
+// node the frame is going to, and end at the destination
+static bool mesh_path_parse(const winc_mesh_hdr_t *hdr, const uint8_t *data, winc_mesh_srcroute_t *sr) {
+    if (hdr->payload_len < sizeof(*sr))
+        return false;
+    memcpy(sr, data, sizeof(*sr));
+    return sr->next < sr->count && sizeof(*sr) + sr->count <= hdr->payload_len &&
+           data[sizeof(*sr) + sr->next] == g_ctx.mesh.my_node_id &&
+           data[sizeof(*sr) + sr->count - 1] == hdr->dst_node;
+}
+
+// Send a pinned frame on to the next node of its path. No route lookup.
+static bool mesh_path_forward(winc_mesh_hdr_t *hdr, uint8_t *data, winc_mesh_srcroute_t *sr) {
+    if (hdr->hop_count >= WINC_MESH_MAX_HOPS) {
+        mesh_nbr(mesh_ctx.rx_from)->drop_max_hops++;
+        return false;
+    }
+
+    sr->next++;
+    memcpy(data, sr, sizeof(*sr));
+    hdr->hop_count++;
+    hdr->next_hop = data[sizeof(*sr) + sr->next];
+
+    if (!mesh_tx_data(hdr, data)) {
+        mesh_nbr(mesh_ctx.rx_from)->drop_queue_full++;
+        return false;
+    }
+    mesh_nbr(mesh_ctx.rx_from)->forwarded++;
+    return true;
+}
+
+// ===== IN-ORDER DELIVERY =====
+
+// Send with a winc_mesh_order_t naming the previous ordered frame to
+// dst_node. The frame takes the next seq_num, so a first frame, or one
+// after the destination's entry was reused, names itself.
+static bool mesh_order_send(uint8_t dst_node, const uint8_t *data, uint16_t len, uint8_t flags) {
+    mesh_order_tx_t *o = NULL, *lru = &mesh_ctx.order.tx[0];
+    winc_mesh_order_t *oh = (winc_mesh_order_t*)mesh_ctx.order.buf;
+    uint16_t seq = g_ctx.mesh.seq_num;
+    bool ok;
+
+    if (len + sizeof(*oh) > WINC_MESH_MTU) {
+        printf("ERROR: Ordered payload too long (%u bytes, max %u)\n",
+               len, (unsigned)(WINC_MESH_MTU - sizeof(*oh)));
+        return false;
+    }
+
+    for (int i = 0; i < WINC_MESH_REORDER_SLOTS; i++) {
+        mesh_order_tx_t *t = &mesh_ctx.order.tx[i];
+        if (t->dst_node == dst_node) {
+            o = t;
+            break;
+        }
+        if (!t->dst_node || (lru->dst_node && (int32_t)(t->used - lru->used) < 0))
+            lru = t;
+    }
+
+    oh->prev_seq = o ? o->last_seq : seq;
+    memcpy(mesh_ctx.order.buf + sizeof(*oh), data, len);
+    if (flags & WINC_MESH_PINNED)
+        ok = mesh_path_send(dst_node, mesh_ctx.order.buf, len + sizeof(*oh), flags);
+    else
+        ok = mesh_send_routed(dst_node, mesh_ctx.order.buf, len + sizeof(*oh), flags);
+
+    // A refused frame never took its seq_num, so the next one names the
+    // same predecessor
+    if (ok) {
+        o = o ? o : lru;
+        o->dst_node = dst_node;
+        o->last_seq = seq;
+        o->used = MESH_NOW_MS();
+    }
+    return ok;
+}
+
+static void mesh_order_deliver(mesh_reorder_t *r, uint16_t seq, uint8_t *data, uint16_t len) {
+    r->last_seq = seq;
+    r->expecting = false;
+    mesh_ctx.order.stats.delivered++;
+    if (g_ctx.mesh.data_callback)
+        g_ctx.mesh.data_callback(r->src_node, data, len);
+}
+
+// Hand up held frame k and free its place
+static void mesh_order_release(mesh_reorder_t *r, int k) {
+    mesh_reorder_frame_t h = r->held[k];
+
+    r->held[k] = r->held[--r->count];
+    mesh_ctx.order.stats.depth--;
+    mesh_ctx.order.stats.reordered++;
+    mesh_order_deliver(r, h.seq, MESH_FRAME(h.frame)->buf, h.len);
+    mesh_frame_put(h.frame);
+}
+
+// Whether a frame is next: it names the last one handed up, or it is the
+// one we were told to expect, whatever it names in turn
+static bool mesh_order_next(const mesh_reorder_t *r, uint16_t seq, uint16_t prev_seq) {
+    return r->expecting ? seq == r->expect : prev_seq == r->last_seq;
+}
+
+// Hand up every held frame that now follows on
+static void mesh_order_drain(mesh_reorder_t *r) {
+    for (int k = 0; k < r->count; k++) {
+        if (mesh_order_next(r, r->held[k].seq, r->held[k].prev_seq)) {
+            mesh_order_release(r, k);
+            k = -1;
+        }
+    }
+}
+
+// Held frame with the lowest seq_num, or -1
+static int mesh_order_oldest(const mesh_reorder_t *r) {
+    int oldest = r->count ? 0 : -1;
+
+    for (int k = 1; k < r->count; k++) {
+        if ((int16_t)(r->held[k].seq - r->held[oldest].seq) < 0)
+            oldest = k;
+    }
+    return oldest;
+}
+
+// Give up on whatever is missing before the oldest held frame
+static void mesh_order_skip(mesh_reorder_t *r) {
+    mesh_ctx.order.stats.gaps++;
+    mesh_order_release(r, mesh_order_oldest(r));
+    mesh_order_drain(r);
+}
+
+// Wake when the frame held longest has waited WINC_MESH_REORDER_TIMEOUT_MS
+static void mesh_order_arm(mesh_reorder_t *r) {
+    uint32_t first;
+
+    if (!r->count) {
+        winc_timer_cancel(&r->timer);
+        return;
+    }
+    first = r->held[0].at;
+    for (int k = 1; k < r->count; k++) {
+        if ((int32_t)(r->held[k].at - first) < 0)
+            first = r->held[k].at;
+    }
+    winc_timer_start(&mesh_ctx.timers, &r->timer, first + WINC_MESH_REORDER_TIMEOUT_MS);
+}
+
+static void mesh_order_timer_fn(winc_timer_t *t, void *arg) {
+    mesh_reorder_t *r = arg;
+    uint32_t now = MESH_NOW_MS();
+
+    for (int k = 0; k < r->count; k++) {
+        if (now - r->held[k].at >= WINC_MESH_REORDER_TIMEOUT_MS) {
+            mesh_order_skip(r);
+            k = -1;
+        }
+    }
+    mesh_order_arm(r);
+}
+
+// Reorder entry for a source: its own, else a free one, else the one
+// idle longest after handing up what it holds
+static mesh_reorder_t *mesh_order_slot(uint8_t src_node, bool *fresh) {
+    mesh_reorder_t *lru = &mesh_ctx.order.rx[0];
+
+    for (int i = 0; i < WINC_MESH_REORDER_SLOTS; i++) {
+        mesh_reorder_t *r = &mesh_ctx.order.rx[i];
+        if (r->src_node == src_node) {
+            *fresh = false;
+            return r;
+        }
+        if (!r->src_node || (lru->src_node && (int32_t)(r->used - lru->used) < 0))
+            lru = r;
+    }
+    while (lru->count)
+        mesh_order_skip(lru);
+    winc_timer_cancel(&lru->timer);
+    lru->src_node = src_node;
+    lru->expecting = false;
+    *fresh = true;
+    return lru;
+}
+
+// An ordered frame for us: hand it up if it follows the last one, else
+// hold it until the frames before it arrive or are given up on
+static void mesh_order_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len) {
+    winc_mesh_order_stats_t *st = &mesh_ctx.order.stats;
+    winc_mesh_order_t oh;
+    mesh_reorder_t *r;
+    mesh_reorder_frame_t *h;
+    uint16_t seq = hdr->seq_num;
+    uint32_t now = MESH_NOW_MS();
+    bool fresh;
+    int i, oldest;
+
+    if (len < sizeof(oh))
+        return;
+    memcpy(&oh, data, sizeof(oh));
+    data += sizeof(oh);
+    len -= sizeof(oh);
+
+    r = mesh_order_slot(hdr->src_node, &fresh);
+
+    // No history for the source: the frame before this one may still be
+    // on its way, so wait for it as for any other gap. seq_nums are shared
+    // by all destinations, so that frame names a predecessor we cannot
+    // guess; it is recognised by its own seq_num instead.
+    if (fresh && oh.prev_seq != seq) {
+        r->last_seq = oh.prev_seq - 1;
+        r->expect = oh.prev_seq;
+        r->expecting = true;
+    }
+
+    // Behind what we already handed up. A frame naming itself there is
+    // also late, unless the source went quiet first and so may have
+    // restarted its numbering.
+    if (!fresh && (int16_t)(seq - r->last_seq) <= 0 &&
+        (oh.prev_seq != seq || now - r->used < WINC_MESH_REORDER_TIMEOUT_MS)) {
+        st->late++;
+        r->used = now;
+        return;
+    }
+    r->used = now;
+
+    // The source started over: frames held from before can no longer be
+    // completed, those after may follow on
+    if (oh.prev_seq == seq) {
+        while ((oldest = mesh_order_oldest(r)) >= 0 && (int16_t)(r->held[oldest].seq - seq) < 0)
+            mesh_order_skip(r);
+        mesh_order_deliver(r, seq, (uint8_t*)data, len);
+        mesh_order_drain(r);
+        mesh_order_arm(r);
+        return;
+    }
+
+    for (;;) {
+        if (mesh_order_next(r, seq, oh.prev_seq)) {
+            mesh_order_deliver(r, seq, (uint8_t*)data, len);
+            mesh_order_drain(r);
+            break;
+        }
+        for (int k = 0; k < r->count; k++) {
+            if (r->held[k].seq == seq)
+                return;         // Copy of a frame already waiting
+        }
+        if (r->count < WINC_MESH_REORDER_WINDOW && mesh_pool_free() > WINC_MESH_POOL_FRAMES / 4 &&
+            (i = mesh_frame_get()) >= 0) {
+            h = &r->held[r->count++];
+            h->frame = i;
+            h->seq = seq;
+            h->prev_seq = oh.prev_seq;
+            h->len = len;
+            h->at = r->used;
+            memcpy(MESH_FRAME(i)->buf, data, len);
+            st->depth++;
+            if (r->count > st->max_depth)
+                st->max_depth = r->count;
+            break;
+        }
+
+        // No room to wait: give up on the oldest gap, which is the one
+        // before this frame if it is older than everything held
+        oldest = mesh_order_oldest(r);
+        if (oldest < 0 || (int16_t)(seq - r->held[oldest].seq) < 0) {
+            st->gaps++;
+            mesh_order_deliver(r, seq, (uint8_t*)data, len);
+            mesh_order_drain(r);
+            break;
+        }
+        mesh_order_skip(r);
+        if ((int16_t)(seq - r->last_seq) <= 0) {
+            st->late++;
+            break;
+        }
+    }
+    mesh_order_arm(r);
+}
+
+void winc_mesh_get_order_stats(winc_mesh_order_stats_t *stats) {
+    *stats = mesh_ctx.order.stats;
+}
+
+// ===== STREAMS =====
+
+#if WINC_MESH_STREAMS
+#define MESH_SEQ_LT(a, b)   ((int32_t)((a) - (b)) < 0)
+#define MESH_SEQ_LEQ(a, b)  ((int32_t)((a) - (b)) <= 0)
+#define MESH_SEQ_MIN(a, b)  (MESH_SEQ_LT(a, b) ? (a) : (b))
+#define MESH_SEQ_MAX(a, b)  (MESH_SEQ_LT(a, b) ? (b) : (a))
+
+// How long a closed stream whose FIN was acknowledged waits for the peer's
+static const uint32_t mesh_stream_fin_wait_ms = WINC_MESH_ROUTE_TIMEOUT_MS;
+
+static void mesh_stream_output(mesh_stream_t *s);
+
+static void mesh_stream_free(mesh_stream_t *s) {
+    winc_timer_cancel(&s->timer);
+    winc_timer_cancel(&s->ack_timer);
+    s->state = MESH_STREAM_FREE;
+    s->user = false;
+}
+
+// Handle held by the application, or NULL
+static mesh_stream_t *mesh_stream_get(int s) {
+    if (s < 0 || s >= WINC_MESH_STREAMS || !mesh_ctx.stream.socks[s].user)
+        return NULL;
+    return &mesh_ctx.stream.socks[s];
+}
+
+static mesh_stream_t *mesh_stream_find(uint8_t peer, uint8_t lport, uint8_t rport) {
+    for (int i = 0; i < WINC_MESH_STREAMS; i++) {
+        mesh_stream_t *s = &mesh_ctx.stream.socks[i];
+        if (s->state != MESH_STREAM_FREE && s->peer == peer && s->lport == lport && s->rport == rport)
+            return s;
+    }
+    return NULL;
+}
+
+// A free socket set up to talk to peer, or NULL
+static mesh_stream_t *mesh_stream_alloc(uint8_t peer, uint8_t lport, uint8_t rport, uint8_t flags) {
+    for (int i = 0; i < WINC_MESH_STREAMS; i++) {
+        mesh_stream_t *s = &mesh_ctx.stream.socks[i];
+        if (s->state != MESH_STREAM_FREE)
+            continue;
+
+        memset(s, 0, offsetof(mesh_stream_t, txbuf));
+        winc_timer_init(&s->timer, mesh_stream_timer_fn, s);
+        winc_timer_init(&s->ack_timer, mesh_stream_ack_timer_fn, s);
+        s->peer = peer;
+        s->lport = lport;
+        s->rport = rport;
+        s->flags = flags & (WINC_MESH_RELIABLE | WINC_MESH_PRIO(3));
+        s->iss = mesh_rand();
+        s->snd_una = s->iss;
+        s->snd_max = s->iss + 1;    // The SYN, sent by the caller
+        s->snd_wr = s->iss + 1;
+        s->cwnd = 2 * WINC_MESH_STREAM_MSS;
+        s->ssthresh = WINC_MESH_STREAM_BUF;
+        s->rto_ms = WINC_MESH_STREAM_RTO_INIT_MS;
+        s->rto_at = MESH_NOW_MS() + s->rto_ms;
+        return s;
+    }
+    return NULL;
+}
+
+// Bytes we can still take in beyond rcv_nxt
+static uint32_t mesh_stream_window(const mesh_stream_t *s) {
+    return MIN(s->rcv_rd + WINC_MESH_STREAM_BUF - s->rcv_nxt, 0xFFFF);
+}
+
+// Send the segment built in stream.buf. Only segments carrying data are
+// held back for a busy next hop; ACKs are what lets it drain.
+static bool mesh_stream_send(uint8_t peer, uint8_t flags, uint16_t len, bool data) {
+    winc_mesh_hdr_t hdr;
+    int next_hop = mesh_find_route(peer);
+
+    if (next_hop < 0)
+        return false;
+    next_hop = mesh_bp_next_hop(peer, next_hop, WINC_MESH_FLAGS_CLASS(flags), data);
+    if (next_hop < 0)
+        return false;
+
+    hdr.msg_type = MESH_MSG_STREAM;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = peer;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.payload_len = len;
+    hdr.next_hop = next_hop;
+    hdr.flags = flags;
+    return mesh_tx_data(&hdr, mesh_ctx.stream.buf);
+}
+
+// Send len bytes from seq with our ACK, window and SACK blocks
+static bool mesh_stream_xmit(mesh_stream_t *s, uint32_t seq, uint16_t len, uint8_t flags) {
+    winc_mesh_stream_t *sh = (winc_mesh_stream_t*)mesh_ctx.stream.buf;
+    winc_mesh_sack_t *sack = (winc_mesh_sack_t*)(sh + 1);
+    uint32_t win = mesh_stream_window(s);
+    uint16_t off = (seq - s->iss - 1) & MESH_STREAM_MASK;
+    uint16_t n = MIN(len, WINC_MESH_STREAM_BUF - off);
+    uint8_t *p;
+
+    if (s->state != MESH_STREAM_SYN_SENT)
+        flags |= MESH_STREAM_ACK;
+    sh->src_port = s->lport;
+    sh->dst_port = s->rport;
+    sh->flags = flags;
+    sh->sack_count = s->ooo_count;
+    sh->window = win;
+    sh->seq = seq;
+    sh->ack = s->rcv_nxt;
+    sh->ts = time_us_32();
+    sh->ts_echo = s->ts_recent;
+    memcpy(sack, s->ooo, s->ooo_count * sizeof(*sack));
+
+    // The bytes, in two pieces where the buffer wraps
+    p = (uint8_t*)(sack + s->ooo_count);
+    memcpy(p, s->txbuf + off, n);
+    memcpy(p + n, s->txbuf, len - n);
+
+    if (!mesh_stream_send(s->peer, s->flags, p + len - mesh_ctx.stream.buf, len > 0))
+        return false;
+    s->stats.segments_sent++;
+    s->unacked = 0;
+    s->ack_now = false;
+    winc_timer_cancel(&s->ack_timer);
+    s->rcv_adv = s->rcv_nxt + win;
+    return true;
+}
+
+// Send [seq, end), the end being our FIN once the application has closed
+static bool mesh_stream_xmit_range(mesh_stream_t *s, uint32_t seq, uint32_t end) {
+    bool fin = s->fin_out && end == s->snd_wr + 1;
+
+    return mesh_stream_xmit(s, seq, end - seq - fin, fin ? MESH_STREAM_FIN : 0);
+}
+
+// Answer a segment for no stream of ours
+static void mesh_stream_refuse(uint8_t peer, const winc_mesh_stream_t *in, uint16_t len) {
+    winc_mesh_stream_t *sh = (winc_mesh_stream_t*)mesh_ctx.stream.buf;
+
+    memset(sh, 0, sizeof(*sh));
+    sh->src_port = in->dst_port;
+    sh->dst_port = in->src_port;
+    sh->flags = MESH_STREAM_RST | MESH_STREAM_ACK;
+    sh->seq = in->ack;
+    sh->ack = in->seq + len + !!(in->flags & (MESH_STREAM_SYN | MESH_STREAM_FIN));
+    mesh_stream_send(peer, WINC_MESH_PRIO(WINC_MESH_CLASS_NORMAL), sizeof(*sh), false);
+}
+
+// Connection refused, reset or given up on
+static void mesh_stream_reset(mesh_stream_t *s) {
+    if (g_ctx.verbose)
+        printf("Stream %u:%u to node %u reset\n", s->lport, s->rport, s->peer);
+    if (!s->user) {
+        mesh_stream_free(s);
+        return;
+    }
+    winc_timer_cancel(&s->timer);
+    winc_timer_cancel(&s->ack_timer);
+    s->state = MESH_STREAM_RESET;
+}
+
+static void mesh_stream_abort(mesh_stream_t *s) {
+    mesh_stream_xmit(s, s->snd_max, 0, MESH_STREAM_RST);
+    mesh_stream_reset(s);
+}
+
+// Round trip sample, RFC 6298 smoothing
+static void mesh_stream_rtt(mesh_stream_t *s, uint32_t rtt_us) {
+    if (!s->srtt_us) {
+        s->srtt_us = MAX(rtt_us, 1);
+        s->rttvar_us = rtt_us / 2;
+    } else {
+        uint32_t delta = rtt_us > s->srtt_us ? rtt_us - s->srtt_us : s->srtt_us - rtt_us;
+        s->rttvar_us = (3 * s->rttvar_us + delta) / 4;
+        s->srtt_us = MAX((7 * s->srtt_us + rtt_us) / 8, 1);
+    }
+    s->rto_ms = MESH_US_TO_MS(s->srtt_us + 4 * s->rttvar_us);
+    s->rto_ms = MIN(MAX(s->rto_ms, WINC_MESH_STREAM_RTO_MIN_MS), WINC_MESH_STREAM_RTO_MAX_MS);
+}
+
+// Bytes of [from, to) the peer has SACKed
+static uint32_t mesh_stream_sacked(const mesh_stream_t *s, uint32_t from, uint32_t to) {
+    uint32_t sum = 0;
+
+    for (int k = 0; k < s->sack_count; k++) {
+        uint32_t a = MESH_SEQ_MAX(s->sacked[k].start, from);
+        uint32_t b = MESH_SEQ_MIN(s->sacked[k].end, to);
+        if (MESH_SEQ_LT(a, b))
+            sum += b - a;
+    }
+    return sum;
+}
+
+// Where the bytes presumed lost end: everything sent before a timeout,
+// else the holes below the highest SACK (at least the first segment)
+static uint32_t mesh_stream_lost_end(const mesh_stream_t *s) {
+    uint32_t high;
+
+    if (s->rto_recovery)
+        return s->recover;
+    high = s->sack_count ? s->sacked[s->sack_count - 1].end : s->snd_una;
+    return MESH_SEQ_MIN(s->snd_max, MESH_SEQ_MAX(high, s->snd_una + WINC_MESH_STREAM_MSS));
+}
+
+// Bytes still in the network: sent, not acknowledged, not SACKed and not
+// presumed lost
+static uint32_t mesh_stream_pipe(const mesh_stream_t *s) {
+    uint32_t pipe = s->snd_max - s->snd_una - mesh_stream_sacked(s, s->snd_una, s->snd_max);
+
+    if (s->recovering) {
+        uint32_t from = MESH_SEQ_MAX(s->rtx_next, s->snd_una), to = mesh_stream_lost_end(s);
+        if (MESH_SEQ_LT(from, to))
+            pipe -= (to - from) - mesh_stream_sacked(s, from, to);
+    }
+    return pipe;
+}
+
+// First byte at or after from that the peer lacks, and the end of its hole
+static uint32_t mesh_stream_hole(const mesh_stream_t *s, uint32_t from, uint32_t *end) {
+    uint32_t seq = MESH_SEQ_MAX(from, s->snd_una);
+
+    *end = s->snd_max;
+    for (int k = 0; k < s->sack_count; k++) {
+        if (MESH_SEQ_LEQ(s->sacked[k].start, seq) && MESH_SEQ_LT(seq, s->sacked[k].end)) {
+            seq = s->sacked[k].end;
+        } else if (MESH_SEQ_LT(seq, s->sacked[k].start)) {
+            *end = s->sacked[k].start;
+            break;
+        }
+    }
+    return seq;
+}
+
+// Merge the peer's SACK blocks into ours, sorted and clipped to what is
+// outstanding; the highest blocks go if there are too many
+static void mesh_stream_sack_update(mesh_stream_t *s, const winc_mesh_sack_t *in, int n) {
+    winc_mesh_sack_t all[2 * MESH_STREAM_SACKS];
+    int count = 0, out = 0;
+
+    for (int k = 0; k < s->sack_count + n; k++) {
+        winc_mesh_sack_t b = k < s->sack_count ? s->sacked[k] : in[k - s->sack_count];
+        int j;
+
+        b.start = MESH_SEQ_MAX(b.start, s->snd_una);
+        b.end = MESH_SEQ_MIN(b.end, s->snd_max);
+        if (!MESH_SEQ_LT(b.start, b.end))
+            continue;
+        for (j = count; j > 0 && MESH_SEQ_LT(b.start, all[j - 1].start); j--)
+            all[j] = all[j - 1];
+        all[j] = b;
+        count++;
+    }
+    for (int k = 0; k < count; k++) {
+        if (out && MESH_SEQ_LEQ(all[k].start, s->sacked[out - 1].end)) {
+            s->sacked[out - 1].end = MESH_SEQ_MAX(s->sacked[out - 1].end, all[k].end);
+        } else if (out < MESH_STREAM_SACKS) {
+            s->sacked[out++] = all[k];
+        }
+    }
+    s->sack_count = out;
+}
+
+// Handle the ACK, window and SACK blocks of a segment
+static void mesh_stream_ack(mesh_stream_t *s, const winc_mesh_stream_t *sh,
+                            const winc_mesh_sack_t *sacks, int n, uint16_t len) {
+    uint32_t ack = sh->ack, acked, flight, segs, thresh;
+    uint32_t now = MESH_NOW_MS();
+
+    if (MESH_SEQ_LT(ack, s->snd_una) || MESH_SEQ_LT(s->snd_max, ack))
+        return;                 // Old, or for bytes never sent
+
+    acked = ack - s->snd_una;
+    if (acked) {
+        if (sh->ts_echo)
+            mesh_stream_rtt(s, time_us_32() - sh->ts_echo);
+        s->stats.bytes_acked += acked - (s->fin_out && ack == s->snd_wr + 1);
+        s->snd_una = ack;
+        s->retries = 0;
+        s->dupacks = 0;
+        s->rto_at = now + s->rto_ms;
+        if (s->fin_out && ack == s->snd_wr + 1)
+            s->rto_at = now + mesh_stream_fin_wait_ms;
+
+        if (s->recovering && !MESH_SEQ_LT(ack, s->recover)) {
+            if (!s->rto_recovery)
+                s->cwnd = s->ssthresh;
+            s->recovering = s->rto_recovery = false;
+        }
+        if (s->recovering) {
+            s->rtx_next = MESH_SEQ_MAX(s->rtx_next, ack);
+        }
+        if (!s->recovering || s->rto_recovery) {
+            // Slow start below ssthresh, then one segment per round trip
+            if (s->cwnd < s->ssthresh)
+                s->cwnd += MIN(acked, WINC_MESH_STREAM_MSS);
+            else
+                s->cwnd += MAX(WINC_MESH_STREAM_MSS * WINC_MESH_STREAM_MSS / s->cwnd, 1);
+            s->cwnd = MIN(s->cwnd, WINC_MESH_STREAM_BUF);
+        }
+    } else if (!len && !(sh->flags & (MESH_STREAM_SYN | MESH_STREAM_FIN)) &&
+               s->snd_max != s->snd_una && sh->window == s->snd_wnd) {
+        s->dupacks++;
+    }
+    s->snd_wnd = sh->window;
+    if (!s->snd_wnd)
+        s->retries = 0;         // Alive, only slow to read
+    mesh_stream_sack_update(s, sacks, n);
+
+    // Loss: three duplicate ACKs, or more than two segments SACKed beyond
+    // a hole; with fewer segments out, one less than there are (RFC 5827)
+    segs = (s->snd_max - s->snd_una + WINC_MESH_STREAM_MSS - 1) / WINC_MESH_STREAM_MSS;
+    thresh = MIN(3, MAX(segs, 2) - 1);
+    if (!s->recovering && s->snd_max != s->snd_una &&
+        (s->dupacks >= thresh ||
+         mesh_stream_sacked(s, s->snd_una, s->snd_max) > (thresh - 1) * WINC_MESH_STREAM_MSS)) {
+        flight = s->snd_max - s->snd_una - mesh_stream_sacked(s, s->snd_una, s->snd_max);
+        s->ssthresh = MAX(flight / 2, 2 * WINC_MESH_STREAM_MSS);
+        s->cwnd = s->ssthresh;
+        s->recovering = true;
+        s->rto_recovery = false;
+        s->recover = s->snd_max;
+        s->rtx_next = s->snd_una;
+        s->stats.fast_recoveries++;
+    }
+}
+
+// Take in a block that arrived beyond a gap, merged with any it touches;
+// the oldest is forgotten when there are too many
+static void mesh_stream_ooo_add(mesh_stream_t *s, uint32_t start, uint32_t end) {
+    for (int k = 0; k < s->ooo_count; k++) {
+        if (MESH_SEQ_LEQ(s->ooo[k].start, end) && MESH_SEQ_LEQ(start, s->ooo[k].end)) {
+            start = MESH_SEQ_MIN(start, s->ooo[k].start);
+            end = MESH_SEQ_MAX(end, s->ooo[k].end);
+            s->ooo[k--] = s->ooo[--s->ooo_count];
+        }
+    }
+    if (s->ooo_count == MESH_STREAM_SACKS)
+        s->ooo_count--;
+    memmove(&s->ooo[1], &s->ooo[0], s->ooo_count * sizeof(s->ooo[0]));
+    s->ooo[0].start = start;
+    s->ooo[0].end = end;
+    s->ooo_count++;
+}
+
+// Advance rcv_nxt over blocks the filled gap has joined up
+static void mesh_stream_ooo_pull(mesh_stream_t *s) {
+    for (int k = 0; k < s->ooo_count; k++) {
+        if (MESH_SEQ_LEQ(s->ooo[k].start, s->rcv_nxt)) {
+            s->rcv_nxt = MESH_SEQ_MAX(s->rcv_nxt, s->ooo[k].end);
+            memmove(&s->ooo[k], &s->ooo[k + 1], (s->ooo_count - k - 1) * sizeof(s->ooo[0]));
+            s->ooo_count--;
+            k = -1;
+        }
+    }
+}
+
+// Store a segment's bytes and decide when to ACK them
+static void mesh_stream_data(mesh_stream_t *s, uint32_t seq, const uint8_t *data, uint16_t len, bool fin) {
+    uint32_t edge = s->rcv_rd + WINC_MESH_STREAM_BUF, before = s->rcv_nxt;
+    uint16_t off, n;
+
+    if (fin && !s->fin_seen) {
+        s->fin_seen = true;
+        s->fin_seq = seq + len;
+    }
+
+    // Trim what we already have and what does not fit
+    if (MESH_SEQ_LT(seq, s->rcv_nxt)) {
+        uint32_t skip = s->rcv_nxt - seq;
+        skip = MIN(skip, len);
+        data += skip;
+        len -= skip;
+        seq += skip;
+    }
+    if (MESH_SEQ_LT(edge, seq + len))
+        len = MESH_SEQ_LT(seq, edge) ? edge - seq : 0;
+
+    if (!len) {
+        s->ack_now = true;      // A copy, or past the window: tell the peer where we are
+    } else {
+        off = (seq - s->irs - 1) & MESH_STREAM_MASK;
+        n = MIN(len, WINC_MESH_STREAM_BUF - off);
+        memcpy(s->rxbuf + off, data, n);
+        memcpy(s->rxbuf, data + n, len - n);
+
+        if (seq == s->rcv_nxt) {
+            s->rcv_nxt += len;
+            if (s->ooo_count) {
+                mesh_stream_ooo_pull(s);
+                s->ack_now = true;  // Filled a gap: the sender is waiting to hear
+            }
+        } else {
+            mesh_stream_ooo_add(s, seq, seq + len);
+            s->stats.out_of_order++;
+            s->ack_now = true;
+        }
+    }
+    s->stats.bytes_received += s->rcv_nxt - before;
+
+    if (s->fin_seen && !s->fin_in && s->rcv_nxt == s->fin_seq) {
+        s->fin_in = true;
+        s->rcv_nxt++;
+        s->ack_now = true;
+    }
+    if (s->fin_out)
+        s->rcv_rd = s->rcv_nxt - s->fin_in;     // Nobody will read it
+
+    // ACK every second segment, or once the delay runs out
+    if (s->rcv_nxt != before && ++s->unacked >= 2)
+        s->ack_now = true;
+    if (!s->ack_now && s->unacked && !winc_timer_pending(&s->ack_timer))
+        winc_timer_start(&mesh_ctx.timers, &s->ack_timer, MESH_NOW_MS() + WINC_MESH_STREAM_ACK_DELAY_MS);
+}
+
+// Nothing in flight, bytes waiting and the peer's window shut
+static bool mesh_stream_probing(const mesh_stream_t *s) {
+    return s->state == MESH_STREAM_OPEN && s->snd_max == s->snd_una && !s->snd_wnd &&
+           MESH_SEQ_LT(s->snd_max, s->snd_wr);
+}
+
+// Both ends closed and our FIN acknowledged
+static bool mesh_stream_fin_acked(const mesh_stream_t *s) {
+    return s->fin_out && s->snd_una == s->snd_wr + 1;
+}
+
+// Wake for the retransmit timeout, a window probe, the end of a linger, or
+// soon if a send was refused
+static void mesh_stream_arm(mesh_stream_t *s) {
+    uint32_t now = MESH_NOW_MS(), at;
+    bool due = s->state == MESH_STREAM_TIME_WAIT || s->snd_max != s->snd_una ||
+               mesh_stream_probing(s) || mesh_stream_fin_acked(s);
+
+    if (s->state == MESH_STREAM_FREE || s->state == MESH_STREAM_RESET || (!due && !s->blocked)) {
+        winc_timer_cancel(&s->timer);
+        return;
+    }
+    at = due ? s->rto_at : now + WINC_MESH_BP_PACE_MS;
+    if (s->blocked && (int32_t)(at - (now + WINC_MESH_BP_PACE_MS)) > 0)
+        at = now + WINC_MESH_BP_PACE_MS;
+    winc_timer_start(&mesh_ctx.timers, &s->timer, at);
+}
+
+// Send what the windows allow: holes first while repairing losses, then
+// new bytes; an ACK on its own if nothing else went
+static void mesh_stream_output(mesh_stream_t *s) {
+    bool sent = false;
+
+    s->blocked = false;
+    while (s->state == MESH_STREAM_OPEN) {
+        uint32_t pipe = mesh_stream_pipe(s), lost = mesh_stream_lost_end(s);
+        uint32_t seq, end, edge;
+        bool rtx = s->recovering && MESH_SEQ_LT(s->rtx_next, lost);
+
+        if (rtx) {
+            seq = mesh_stream_hole(s, s->rtx_next, &end);
+            if (!MESH_SEQ_LT(seq, lost)) {
+                s->rtx_next = lost;
+                continue;
+            }
+            end = MESH_SEQ_MIN(end, MESH_SEQ_MIN(lost, seq + WINC_MESH_STREAM_MSS));
+            if (s->fin_out && end == s->snd_wr)
+                end = MESH_SEQ_MIN(lost, s->snd_wr + 1);
+            // The first hole goes at once, the rest as the pipe empties
+            if (pipe && pipe + (end - seq) > s->cwnd && s->rtx_next != s->snd_una)
+                break;
+        } else {
+            bool fin;
+
+            seq = s->snd_max;
+            if (!MESH_SEQ_LT(seq, s->snd_wr + s->fin_out))
+                break;          // Everything sent, FIN included
+            end = MESH_SEQ_MIN(s->snd_wr, seq + WINC_MESH_STREAM_MSS);
+            edge = s->snd_una + s->snd_wnd;
+            if (MESH_SEQ_LT(edge, end))
+                end = MESH_SEQ_LT(seq, edge) ? edge : seq;
+            fin = s->fin_out && end == s->snd_wr;
+            if (end == seq && !fin)
+                break;          // Window shut
+            // A short segment waits while others are unacknowledged
+            if (!fin && end - seq < WINC_MESH_STREAM_MSS && s->snd_max != s->snd_una)
+                break;
+            end += fin;
+            if (pipe && pipe + (end - seq) > s->cwnd)
+                break;
+        }
+
+        if (!mesh_stream_xmit_range(s, seq, end)) {
+            s->blocked = true;
+            break;
+        }
+        sent = true;
+        if (rtx) {
+            s->rtx_next = end;
+            s->stats.retransmits++;
+        } else {
+            if (s->snd_max == s->snd_una)
+                s->rto_at = MESH_NOW_MS() + s->rto_ms;
+            s->snd_max = end;
+        }
+    }
+
+    if (!sent && s->ack_now && (s->state == MESH_STREAM_OPEN || s->state == MESH_STREAM_TIME_WAIT))
+        mesh_stream_xmit(s, s->snd_max, 0, 0);
+    mesh_stream_arm(s);
+}
+
+// Both directions finished: linger to ACK a repeated FIN, then let go
+static void mesh_stream_check_done(mesh_stream_t *s) {
+    if (s->state != MESH_STREAM_OPEN || !s->fin_in || !mesh_stream_fin_acked(s))
+        return;
+    s->state = MESH_STREAM_TIME_WAIT;
+    s->rto_at = MESH_NOW_MS() + MIN(2 * s->rto_ms, WINC_MESH_STREAM_RTO_MAX_MS);
+}
+
+// Retransmit timeout: resend the handshake, or count everything unSACKed
+// as lost and start again from one segment
+static bool mesh_stream_timeout(mesh_stream_t *s, uint32_t now) {
+    uint32_t flight;
+
+    if (mesh_stream_fin_acked(s) && s->snd_max == s->snd_una) {
+        mesh_stream_abort(s);   // The peer never closed its end
+        return false;
+    }
+    if (++s->retries > WINC_MESH_STREAM_RETRIES) {
+        if (g_ctx.verbose)
+            printf("Stream to node %u: no answer after %u tries\n", s->peer, WINC_MESH_STREAM_RETRIES);
+        mesh_stream_abort(s);
+        return false;
+    }
+    s->rto_ms = MIN(2 * s->rto_ms, WINC_MESH_STREAM_RTO_MAX_MS);
+    s->rto_at = now + s->rto_ms;
+
+    if (s->state != MESH_STREAM_OPEN) {
+        mesh_stream_xmit(s, s->iss, 0, MESH_STREAM_SYN);
+        s->stats.retransmits++;
+        s->stats.timeouts++;
+        return true;
+    }
+    if (mesh_stream_probing(s)) {
+        // One byte past the window, to learn when it opens
+        if (mesh_stream_xmit(s, s->snd_max, 1, 0))
+            s->snd_max++;
+        return true;
+    }
+
+    s->stats.timeouts++;
+    flight = s->snd_max - s->snd_una - mesh_stream_sacked(s, s->snd_una, s->snd_max);
+    s->ssthresh = MAX(flight / 2, 2 * WINC_MESH_STREAM_MSS);
+    s->cwnd = WINC_MESH_STREAM_MSS;
+    s->recovering = s->rto_recovery = true;
+    s->recover = s->snd_max;
+    s->rtx_next = s->snd_una;
+    s->dupacks = 0;
+    return true;
+}
+
+static void mesh_stream_timer_fn(winc_timer_t *t, void *arg) {
+    mesh_stream_t *s = arg;
+    uint32_t now = MESH_NOW_MS();
+
+    if (s->state == MESH_STREAM_TIME_WAIT) {
+        mesh_stream_free(s);
+        return;
+    }
+    if ((s->snd_max != s->snd_una || mesh_stream_probing(s) || mesh_stream_fin_acked(s)) &&
+        (int32_t)(now - s->rto_at) >= 0 && !mesh_stream_timeout(s, now))
+        return;
+    mesh_stream_output(s);
+}
+
+static void mesh_stream_ack_timer_fn(winc_timer_t *t, void *arg) {
+    mesh_stream_t *s = arg;
+
+    s->ack_now = true;
+    mesh_stream_output(s);
+}
+
+static bool mesh_stream_listening(uint8_t port) {
+    for (int i = 0; i < MESH_STREAM_LISTEN; i++) {
+        if (mesh_ctx.stream.listen[i] == port)
+            return true;
+    }
+    return false;
+}
+
+// A SYN to a port we listen on: answer it with our own
+static void mesh_stream_spawn(const winc_mesh_hdr_t *hdr, const winc_mesh_stream_t *sh) {
+    mesh_stream_t *s = mesh_stream_alloc(hdr->src_node, sh->dst_port, sh->src_port, hdr->flags);
+
+    if (!s) {
+        if (g_ctx.verbose)
+            printf("Stream from node %u refused: no free stream\n", hdr->src_node);
+        mesh_stream_refuse(hdr->src_node, sh, 0);
+        return;
+    }
+    s->state = MESH_STREAM_SYN_RCVD;
+    s->irs = sh->seq;
+    s->rcv_nxt = s->rcv_rd = sh->seq + 1;
+    s->ts_recent = sh->ts;
+    s->snd_wnd = sh->window;
+    mesh_stream_xmit(s, s->iss, 0, MESH_STREAM_SYN);
+    mesh_stream_arm(s);
+}
+
+// A segment for us: find its stream and run it through the state machine
+static void mesh_stream_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len) {
+    winc_mesh_stream_t sh;
+    winc_mesh_sack_t sacks[MESH_STREAM_SACKS];
+    mesh_stream_t *s;
+    int n;
+
+    if (len < sizeof(sh))
+        return;
+    memcpy(&sh, data, sizeof(sh));
+    if (len < sizeof(sh) + sh.sack_count * sizeof(winc_mesh_sack_t))
+        return;
+    n = MIN(sh.sack_count, MESH_STREAM_SACKS);
+    memcpy(sacks, data + sizeof(sh), n * sizeof(winc_mesh_sack_t));
+    data += sizeof(sh) + sh.sack_count * sizeof(winc_mesh_sack_t);
+    len -= sizeof(sh) + sh.sack_count * sizeof(winc_mesh_sack_t);
+
+    s = mesh_stream_find(hdr->src_node, sh.dst_port, sh.src_port);
+    if (!s) {
+        if ((sh.flags & (MESH_STREAM_SYN | MESH_STREAM_ACK)) == MESH_STREAM_SYN &&
+            mesh_stream_listening(sh.dst_port))
+            mesh_stream_spawn(hdr, &sh);
+        else if (!(sh.flags & MESH_STREAM_RST))
+            mesh_stream_refuse(hdr->src_node, &sh, len);
+        return;
+    }
+    if (sh.flags & MESH_STREAM_RST) {
+        mesh_stream_reset(s);
+        return;
+    }
+
+    switch (s->state) {
+        case MESH_STREAM_SYN_SENT:
+            if ((sh.flags & (MESH_STREAM_SYN | MESH_STREAM_ACK)) != (MESH_STREAM_SYN | MESH_STREAM_ACK) ||
+                sh.ack != s->iss + 1)
+                return;
+            s->irs = sh.seq;
+            s->rcv_nxt = s->rcv_rd = sh.seq + 1;
+            s->ts_recent = sh.ts;
+            s->snd_una = sh.ack;
+            s->snd_wnd = sh.window;
+            s->retries = 0;
+            if (sh.ts_echo)
+                mesh_stream_rtt(s, time_us_32() - sh.ts_echo);
+            s->state = MESH_STREAM_OPEN;
+            s->ack_now = true;
+            mesh_stream_output(s);
+            return;
+
+        case MESH_STREAM_SYN_RCVD:
+            if (sh.flags & MESH_STREAM_SYN) {
+                // Our answer was lost; time the round trip from this SYN
+                if (sh.seq == s->irs) {
+                    s->ts_recent = sh.ts;
+                    mesh_stream_xmit(s, s->iss, 0, MESH_STREAM_SYN);
+                }
+                return;
+            }
+            if (!(sh.flags & MESH_STREAM_ACK) || sh.ack != s->iss + 1)
+                return;
+            s->state = MESH_STREAM_OPEN;
+            s->snd_una = sh.ack;
+            s->retries = 0;
+            if (sh.ts_echo)
+                mesh_stream_rtt(s, time_us_32() - sh.ts_echo);
+            break;
+
+        case MESH_STREAM_OPEN:
+            if (sh.flags & MESH_STREAM_SYN) {
+                s->ack_now = true;  // The peer missed the end of the handshake
+                mesh_stream_output(s);
+                return;
+            }
+            break;
+
+        case MESH_STREAM_TIME_WAIT:
+            if (sh.flags & MESH_STREAM_FIN) {
+                s->ack_now = true;
+                mesh_stream_output(s);
+            }
+            return;
+
+        default:
+            return;
+    }
+
+    if (MESH_SEQ_LEQ(sh.seq, s->rcv_nxt))
+        s->ts_recent = sh.ts;
+    if (sh.flags & MESH_STREAM_ACK)
+        mesh_stream_ack(s, &sh, sacks, n, len);
+    if (len || (sh.flags & MESH_STREAM_FIN))
+        mesh_stream_data(s, sh.seq, data, len, sh.flags & MESH_STREAM_FIN);
+    mesh_stream_check_done(s);
+    mesh_stream_output(s);
+}
+
+bool winc_mesh_stream_listen(uint8_t port) {
+    int free_slot = -1;
+
+    if (!port || port > 127)
+        return false;
+    for (int i = 0; i < MESH_STREAM_LISTEN; i++) {
+        if (mesh_ctx.stream.listen[i] == port)
+            return true;
+        if (!mesh_ctx.stream.listen[i] && free_slot < 0)
+            free_slot = i;
+    }
+    if (free_slot < 0)
+        return false;
+    mesh_ctx.stream.listen[free_slot] = port;
+    return true;
+}
+
+int winc_mesh_stream_accept(uint8_t port) {
+    for (int i = 0; i < WINC_MESH_STREAMS; i++) {
+        mesh_stream_t *s = &mesh_ctx.stream.socks[i];
+        if (s->state == MESH_STREAM_OPEN && !s->user && !s->fin_out && s->lport == port) {
+            s->user = true;
+            return i;
+        }
+    }
+    return -1;
+}
+
+int winc_mesh_stream_connect(uint8_t dst_node, uint8_t port, uint8_t flags) {
+    mesh_stream_t *s;
+    uint8_t lport;
+
+    if (!g_ctx.mesh.enabled || !port || port > 127)
+        return -1;
+    if (mesh_find_route(dst_node) < 0) {
+        printf("ERROR: No route to node %u\n", dst_node);
+        return -1;
+    }
+
+    // Local ports 128-255, not one a live stream to the same place uses
+    do {
+        lport = 128 | ++mesh_ctx.stream.next_port;
+    } while (mesh_stream_find(dst_node, lport, port));
+
+    s = mesh_stream_alloc(dst_node, lport, port, flags);
+    if (!s) {
+        printf("ERROR: No free stream (max %d)\n", WINC_MESH_STREAMS);
+        return -1;
+    }
+    s->state = MESH_STREAM_SYN_SENT;
+    s->user = true;
+    // A SYN that cannot go now is sent again on the retransmit timeout
+    mesh_stream_xmit(s, s->iss, 0, MESH_STREAM_SYN);
+    mesh_stream_arm(s);
+    return s - mesh_ctx.stream.socks;
+}
+
+int winc_mesh_stream_write(int sd, const uint8_t *data, uint16_t len) {
+    mesh_stream_t *s = mesh_stream_get(sd);
+    uint32_t used, off, n;
+
+    if (!s || (s->state != MESH_STREAM_OPEN && s->state != MESH_STREAM_SYN_SENT))
+        return -1;
+
+    used = s->snd_wr - MESH_SEQ_MAX(s->snd_una, s->iss + 1);
+    len = MIN(len, WINC_MESH_STREAM_BUF - used);
+    off = (s->snd_wr - s->iss - 1) & MESH_STREAM_MASK;
+    n = MIN(len, WINC_MESH_STREAM_BUF - off);
+    memcpy(s->txbuf + off, data, n);
+    memcpy(s->txbuf, data + n, len - n);
+    s->snd_wr += len;
+
+    if (len && s->state == MESH_STREAM_OPEN)
+        mesh_stream_output(s);
+    return len;
+}
+
+int winc_mesh_stream_read(int sd, uint8_t *buf, uint16_t len) {
+    mesh_stream_t *s = mesh_stream_get(sd);
+    uint32_t off, n;
+
+    if (!s)
+        return -1;
+
+    len = MIN(len, s->rcv_nxt - s->fin_in - s->rcv_rd);
+    if (!len)
+        return s->fin_in || s->state == MESH_STREAM_RESET ? -1 : 0;
+    off = (s->rcv_rd - s->irs - 1) & MESH_STREAM_MASK;
+    n = MIN(len, WINC_MESH_STREAM_BUF - off);
+    memcpy(buf, s->rxbuf + off, n);
+    memcpy(buf + n, s->rxbuf, len - n);
+    s->rcv_rd += len;
+
+    // Tell the peer once the window has opened well beyond what it knows
+    if (s->state == MESH_STREAM_OPEN && !s->fin_in &&
+        s->rcv_rd + WINC_MESH_STREAM_BUF - s->rcv_adv >= MIN(WINC_MESH_STREAM_BUF / 2, 2 * WINC_MESH_STREAM_MSS)) {
+        s->ack_now = true;
+        mesh_stream_output(s);
+    }
+    return len;
+}
+
+void winc_mesh_stream_close(int sd) {
+    mesh_stream_t *s = mesh_stream_get(sd);
+
+    if (!s)
+        return;
+    s->user = false;
+    if (s->state != MESH_STREAM_OPEN) {
+        mesh_stream_free(s);
+        return;
+    }
+    s->fin_out = true;
+    s->rcv_rd = s->rcv_nxt - s->fin_in;
+    mesh_stream_check_done(s);
+    mesh_stream_output(s);
+}
+
+int winc_mesh_stream_state(int sd) {
+    mesh_stream_t *s = mesh_stream_get(sd);
+
+    if (!s)
+        return WINC_MESH_STREAM_CLOSED;
+    switch (s->state) {
+        case MESH_STREAM_SYN_SENT:
+        case MESH_STREAM_SYN_RCVD:
+            return WINC_MESH_STREAM_CONNECTING;
+        case MESH_STREAM_OPEN:
+            return s->fin_in ? WINC_MESH_STREAM_CLOSING : WINC_MESH_STREAM_OPEN;
+        case MESH_STREAM_RESET:
+            return WINC_MESH_STREAM_RESET;
+        default:
+            return WINC_MESH_STREAM_CLOSED;
+    }
+}
+
+uint8_t winc_mesh_stream_peer(int sd) {
+    mesh_stream_t *s = mesh_stream_get(sd);
+
+    return s ? s->peer : 0;
+}
+
+bool winc_mesh_get_stream_stats(int sd, winc_mesh_stream_stats_t *stats) {
+    mesh_stream_t *s = mesh_stream_get(sd);
+
+    if (!s)
+        return false;
+    *stats = s->stats;
+    stats->state = winc_mesh_stream_state(sd);
+    stats->srtt_us = s->srtt_us;
+    stats->rto_ms = s->rto_ms;
+    stats->cwnd = s->cwnd;
+    stats->peer_window = s->snd_wnd;
+    return true;
+}
+#else
+// Streams are compiled out: every call fails and a peer's SYN goes
+// unanswered, so its connect times out as refused
+static void mesh_stream_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len) {
+    if (g_ctx.verbose)
+        printf("[MESH] Dropping stream segment from node %u: WINC_MESH_STREAMS is 0\n",
+               hdr->src_node);
+}
+
+bool winc_mesh_stream_listen(uint8_t port) {
+    return false;
+}
+
+int winc_mesh_stream_accept(uint8_t port) {
+    return -1;
+}
+
+int winc_mesh_stream_connect(uint8_t dst_node, uint8_t port, uint8_t flags) {
+    return -1;
+}
+
+int winc_mesh_stream_write(int sd, const uint8_t *data, uint16_t len) {
+    return -1;
+}
+
+int winc_mesh_stream_read(int sd, uint8_t *buf, uint16_t len) {
+    return -1;
+}
+
+void winc_mesh_stream_close(int sd) {
+}
+
+int winc_mesh_stream_state(int sd) {
+    return WINC_MESH_STREAM_CLOSED;
+}
+
+uint8_t winc_mesh_stream_peer(int sd) {
+    return 0;
+}
+
+bool winc_mesh_get_stream_stats(int sd, winc_mesh_stream_stats_t *stats) {
+    return false;
+}
+#endif
+
+// ===== PUBLISH/SUBSCRIBE =====
+
+// Each node's topic list travels in beacons under that node's own version
+// number, so a list heard from any neighbour replaces an older one however
+// it got here, and is passed on in our next beacon. Our own version jumps
+// past any newer one we hear for our id, left behind by an earlier run.
+
+// FNV-1a, folded to 16 bits
+uint16_t winc_mesh_topic(const char *name) {
+    uint32_t h = 2166136261u;
+
+    while (*name) {
+        h ^= (uint8_t)*name++;
+        h *= 16777619u;
+    }
+    h = (h >> 16) ^ (h & 0xFFFF);
+    return h ? h : 1;
+}
+
+static mesh_sub_t *mesh_sub_find(uint16_t topic) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+    uint8_t k = ps->bucket[topic & (MESH_TOPIC_BUCKETS - 1)];
+
+    while (k && ps->subs[k - 1].topic != topic)
+        k = ps->subs[k - 1].next;
+    return k ? &ps->subs[k - 1] : NULL;
+}
+
+// Our list changed: advertise it under a new version
+static void mesh_sub_changed(void) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+
+    ps->seq++;
+    ps->announced = true;
+    ps->dirty = true;
+}
+
+// Record of another node's list, a free one, or one of a node we no longer
+// reach; NULL if all are taken
+static mesh_sub_rec_t *mesh_sub_rec(uint8_t node_id) {
+    mesh_sub_rec_t *free_rec = NULL, *stale = NULL;
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_sub_rec_t *r = &mesh_ctx.pubsub.nodes[i];
+        if (r->node_id == node_id)
+            return r;
+        if (!r->node_id && !free_rec)
+            free_rec = r;
+        else if (r->node_id && !stale && mesh_find_route(r->node_id) < 0)
+            stale = r;
+    }
+    return free_rec ? free_rec : stale;
+}
+
+static bool mesh_subs_dirty(void) {
+    if (mesh_ctx.pubsub.dirty)
+        return true;
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        if (mesh_ctx.pubsub.nodes[i].node_id && mesh_ctx.pubsub.nodes[i].dirty)
+            return true;
+    }
+    return false;
+}
+
+static uint8_t *mesh_sub_put(uint8_t *p, uint8_t node_id, uint16_t seq,
+                             const uint16_t *topics, uint8_t count) {
+    winc_mesh_sub_rec_t rec = { .node_id = node_id, .seq = seq, .count = count };
+
+    memcpy(p, &rec, sizeof(rec));
+    memcpy(p + sizeof(rec), topics, count * sizeof(uint16_t));
+    return p + sizeof(rec) + count * sizeof(uint16_t);
+}
+
+// Subscription block: on a full beacon our list and those of the nodes we
+// reach, else only lists changed since our last beacon. Returns the bytes
+// written at p.
+static int mesh_build_subs(uint8_t *p, bool full) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+    uint8_t *q = p + 1;
+    int n = 0;
+
+    if (ps->announced && (full || ps->dirty)) {
+        uint16_t own[WINC_MESH_TOPICS];
+        uint8_t count = 0;
+
+        for (int i = 0; i < WINC_MESH_TOPICS; i++) {
+            if (ps->subs[i].topic)
+                own[count++] = ps->subs[i].topic;
+        }
+        q = mesh_sub_put(q, g_ctx.mesh.my_node_id, ps->seq, own, count);
+        n++;
+    }
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_sub_rec_t *r = &ps->nodes[i];
+        if (r->node_id && (r->dirty || (full && mesh_find_route(r->node_id) >= 0))) {
+            q = mesh_sub_put(q, r->node_id, r->seq, r->topics, r->count);
+            n++;
+        }
+    }
+    if (!n)
+        return 0;
+    p[0] = n;
+    return q - p;
+}
+
+static void mesh_subs_sent(void) {
+    mesh_ctx.pubsub.dirty = false;
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++)
+        mesh_ctx.pubsub.nodes[i].dirty = false;
+}
+
+// Take one list from a beacon if it is newer than ours; true if it was
+static bool mesh_sub_learn(const winc_mesh_sub_rec_t *rec, const uint16_t *topics) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+    mesh_sub_rec_t *r;
+
+    if (rec->node_id == g_ctx.mesh.my_node_id) {
+        if (ps->announced && (int16_t)(rec->seq - ps->seq) <= 0)
+            return false;
+        if ((int16_t)(rec->seq - ps->seq) > 0)
+            ps->seq = rec->seq;
+        mesh_sub_changed();
+        return true;
+    }
+
+    r = mesh_sub_rec(rec->node_id);
+    if (!r || (r->node_id == rec->node_id && (int16_t)(rec->seq - r->seq) <= 0))
+        return false;
+    r->node_id = rec->node_id;
+    r->seq = rec->seq;
+    r->count = rec->count;
+    memcpy(r->topics, topics, rec->count * sizeof(uint16_t));
+    r->dirty = true;
+    if (g_ctx.verbose > 1)
+        printf("[PUBSUB] Node %u subscribes to %u topics (version %u)\n",
+               rec->node_id, rec->count, rec->seq);
+    return true;
+}
+
+// Subscription block of a received beacon, from its count byte at p;
+// true if any list was news to us
+static bool mesh_subs_heard(const uint8_t *p, const uint8_t *end) {
+    uint16_t topics[WINC_MESH_TOPICS];
+    winc_mesh_sub_rec_t rec;
+    bool changed = false;
+    int n = *p++;
+
+    for (int i = 0; i < n && p + sizeof(rec) <= end; i++) {
+        memcpy(&rec, p, sizeof(rec));
+        p += sizeof(rec);
+        if (rec.count > WINC_MESH_TOPICS || !rec.node_id ||
+            p + rec.count * sizeof(uint16_t) > end)
+            break;
+        memcpy(topics, p, rec.count * sizeof(uint16_t));
+        p += rec.count * sizeof(uint16_t);
+        changed |= mesh_sub_learn(&rec, topics);
+    }
+    return changed;
+}
+
+// Send one copy of a publication to each next hop towards the n nodes in
+// dsts, naming those behind it. Returns the copies sent.
+static int mesh_pub_fanout(winc_mesh_hdr_t *hdr, uint16_t topic, const uint8_t *dsts, int n,
+                           const uint8_t *data, uint16_t len) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+    winc_mesh_publish_t *ph = (winc_mesh_publish_t*)ps->buf;
+    uint8_t *ids = ps->buf + sizeof(winc_mesh_publish_t);
+    int hop[WINC_MESH_MAX_NODES];
+    int sent = 0;
+
+    for (int i = 0; i < n; i++) {
+        hop[i] = mesh_find_route(dsts[i]);
+        if (hop[i] < 0) {
+            if (g_ctx.verbose)
+                printf("[PUBSUB] No route to subscriber %u\n", dsts[i]);
+            ps->stats.dropped++;
+        }
+    }
+
+    for (int i = 0; i < n; i++) {
+        int next_hop = hop[i];
+
+        if (next_hop < 0)
+            continue;
+        ph->topic = topic;
+        ph->dst_count = 0;
+        for (int j = i; j < n; j++) {
+            if (hop[j] == next_hop) {
+                ids[ph->dst_count++] = dsts[j];
+                hop[j] = -1;
+            }
+        }
+        memcpy(ids + ph->dst_count, data, len);
+        hdr->dst_node = next_hop;
+        hdr->next_hop = next_hop;
+        hdr->payload_len = sizeof(winc_mesh_publish_t) + ph->dst_count + len;
+
+        if (g_ctx.verbose > 1)
+            printf("[PUBSUB] Topic %04x from node %u to %u subscribers via %d\n",
+                   topic, hdr->src_node, ph->dst_count, next_hop);
+        if (mesh_tx_data(hdr, ps->buf))
+            sent++;
+        else
+            ps->stats.dropped++;
+    }
+    return sent;
+}
+
+// A copy handed to us: pass it on towards the other subscribers it names,
+// then deliver it if it names us
+static void mesh_pub_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+    uint8_t dsts[WINC_MESH_MAX_NODES];
+    winc_mesh_publish_t ph;
+    winc_mesh_hdr_t out;
+    mesh_sub_t *sub;
+    bool named = false;
+    int n = 0;
+
+    if (len < sizeof(ph))
+        return;
+    memcpy(&ph, data, sizeof(ph));
+    if (ph.dst_count > WINC_MESH_MAX_NODES || sizeof(ph) + ph.dst_count > len)
+        return;
+    for (int i = 0; i < ph.dst_count; i++) {
+        uint8_t id = data[sizeof(ph) + i];
+        if (id == g_ctx.mesh.my_node_id)
+            named = true;
+        else
+            dsts[n++] = id;
+    }
+    data += sizeof(ph) + ph.dst_count;
+    len -= sizeof(ph) + ph.dst_count;
+
+    if (n && hdr->hop_count >= WINC_MESH_MAX_HOPS) {
+        mesh_nbr(mesh_ctx.rx_from)->drop_max_hops++;
+    } else if (n) {
+        int sent;
+
+        out = *hdr;
+        out.hop_count++;
+        sent = mesh_pub_fanout(&out, ph.topic, dsts, n, data, len);
+        ps->stats.relayed += sent;
+        mesh_nbr(mesh_ctx.rx_from)->forwarded += sent;
+    }
+
+    if (!named)
+        return;
+    sub = mesh_sub_find(ph.topic);
+    if (!sub) {
+        ps->stats.unwanted++;
+        return;
+    }
+    ps->stats.delivered++;
+    sub->handler(hdr->src_node, ph.topic, (uint8_t*)data, len);
+}
+
+bool winc_mesh_subscribe(uint16_t topic, winc_mesh_topic_handler_t handler) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+    uint8_t *head = &ps->bucket[topic & (MESH_TOPIC_BUCKETS - 1)];
+    mesh_sub_t *sub = mesh_sub_find(topic);
+    int i = 0;
+
+    if (!topic || !handler)
+        return false;
+    if (sub) {
+        sub->handler = handler;
+        return true;
+    }
+    while (i < WINC_MESH_TOPICS && ps->subs[i].topic)
+        i++;
+    if (i == WINC_MESH_TOPICS) {
+        printf("ERROR: No room for topic %04x (%u subscribed)\n", topic, ps->count);
+        return false;
+    }
+
+    sub = &ps->subs[i];
+    sub->topic = topic;
+    sub->handler = handler;
+    sub->next = *head;
+    *head = i + 1;
+    ps->count++;
+    mesh_sub_changed();
+    mesh_trickle_reset(MESH_NOW_MS());
+    return true;
+}
+
+bool winc_mesh_unsubscribe(uint16_t topic) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+    uint8_t *link = &ps->bucket[topic & (MESH_TOPIC_BUCKETS - 1)];
+    mesh_sub_t *sub;
+
+    while (*link && ps->subs[*link - 1].topic != topic)
+        link = &ps->subs[*link - 1].next;
+    if (!topic || !*link)
+        return false;
+
+    sub = &ps->subs[*link - 1];
+    *link = sub->next;
+    memset(sub, 0, sizeof(*sub));
+    ps->count--;
+    mesh_sub_changed();
+    mesh_trickle_reset(MESH_NOW_MS());
+    return true;
+}
+
+int winc_mesh_publish(uint16_t topic, const uint8_t *data, uint16_t len, uint8_t flags) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+    uint8_t dsts[WINC_MESH_MAX_NODES];
+    winc_mesh_hdr_t hdr;
+    mesh_sub_t *sub;
+    int n = 0, sent;
+
+    if (!g_ctx.mesh.enabled || !topic)
+        return -1;
+    if (len > WINC_MESH_PUBLISH_MAX) {
+        printf("ERROR: Publication too long (%u bytes, max %u)\n", len, (unsigned)WINC_MESH_PUBLISH_MAX);
+        ps->stats.dropped++;
+        return -1;
+    }
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_sub_rec_t *r = &ps->nodes[i];
+        for (int k = 0; r->node_id && k < r->count; k++) {
+            if (r->topics[k] == topic) {
+                dsts[n++] = r->node_id;
+                break;
+            }
+        }
+    }
+
+    hdr.msg_type = MESH_MSG_PUBLISH;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.flags = flags & (WINC_MESH_RELIABLE | WINC_MESH_PRIO(3));
+
+    ps->stats.published++;
+    sent = mesh_pub_fanout(&hdr, topic, dsts, n, data, len);
+    ps->stats.copies_sent += sent;
+
+    // Our own handler last, in case it publishes in turn
+    sub = mesh_sub_find(topic);
+    if (sub) {
+        ps->stats.delivered++;
+        sub->handler(g_ctx.mesh.my_node_id, topic, (uint8_t*)data, len);
+    }
+    return sent;
+}
+
+void winc_mesh_get_pubsub_stats(winc_mesh_pubsub_stats_t *stats) {
+    mesh_pubsub_t *ps = &mesh_ctx.pubsub;
+
+    *stats = ps->stats;
+    stats->topics = ps->count;
+    stats->subscribers = 0;
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        if (ps->nodes[i].node_id && ps->nodes[i].count && mesh_find_route(ps->nodes[i].node_id) >= 0)
+            stats->subscribers++;
+    }
+}
+
+// ===== RPC =====
+
+// Send the request or reply in mesh_ctx.rpc.buf. Replies, like stream
+// ACKs, are never held back by a busy next hop: the call they answer has
+// already been let through.
+static bool mesh_rpc_send(uint8_t dst_node, uint8_t flags, uint16_t len, bool request) {
+    winc_mesh_hdr_t hdr;
+    int next_hop = mesh_find_route(dst_node);
+
+    if (next_hop < 0)
+        return false;
+    next_hop = mesh_bp_next_hop(dst_node, next_hop, WINC_MESH_FLAGS_CLASS(flags), request);
+    if (next_hop < 0)
+        return false;
+
+    hdr.msg_type = MESH_MSG_RPC;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = dst_node;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.payload_len = sizeof(winc_mesh_rpc_t) + len;
+    hdr.next_hop = next_hop;
+    hdr.flags = flags;
+    return mesh_tx_data(&hdr, mesh_ctx.rpc.buf);
+}
+
+// Send a call's request and wait for the reply until the next attempt or
+// the deadline, whichever comes first
+static void mesh_rpc_attempt(mesh_rpc_call_t *c, uint32_t now) {
+    winc_mesh_rpc_t *rh = (winc_mesh_rpc_t*)mesh_ctx.rpc.buf;
+    uint32_t at = now + c->retry_ms;
+
+    rh->kind = MESH_RPC_REQUEST;
+    rh->method = c->method;
+    rh->call_id = c->id;
+    rh->status = WINC_MESH_RPC_OK;
+    memcpy(rh + 1, c->args, c->len);
+    // A failed send is retried like a lost one
+    mesh_rpc_send(c->dst_node, c->flags, c->len, true);
+
+    c->retry_ms *= 2;
+    if ((int32_t)(at - c->deadline) > 0)
+        at = c->deadline;
+    winc_timer_start(&mesh_ctx.timers, &c->timer, at);
+}
+
+// Free a call's slot, then tell its caller, who may start another in it
+static void mesh_rpc_finish(mesh_rpc_call_t *c, int status, uint8_t *result, uint16_t len) {
+    winc_mesh_rpc_done_t done = c->done;
+    void *arg = c->arg;
+
+    winc_timer_cancel(&c->timer);
+    c->active = false;
+    mesh_ctx.rpc.stats.outstanding--;
+    done(status, result, len, arg);
+}
+
+static void mesh_rpc_timer_fn(winc_timer_t *t, void *arg) {
+    mesh_rpc_call_t *c = arg;
+    uint32_t now = MESH_NOW_MS();
+
+    if ((int32_t)(now - c->deadline) >= 0) {
+        if (g_ctx.verbose)
+            printf("[RPC] Call %04x to node %u timed out\n", c->id, c->dst_node);
+        mesh_ctx.rpc.stats.timeouts++;
+        mesh_rpc_finish(c, WINC_MESH_RPC_TIMEOUT, NULL, 0);
+        return;
+    }
+    mesh_ctx.rpc.stats.retries++;
+    mesh_rpc_attempt(c, now);
+}
+
+// A reply: its call id leads straight to the call's slot
+static void mesh_rpc_reply_input(uint8_t src_node, const winc_mesh_rpc_t *rh,
+                                 uint8_t *data, uint16_t len) {
+    mesh_rpc_t *rpc = &mesh_ctx.rpc;
+    mesh_rpc_call_t *c = &rpc->calls[rh->call_id & MESH_RPC_MASK];
+    uint32_t latency_us;
+
+    if (!c->active || c->id != rh->call_id || c->dst_node != src_node) {
+        rpc->stats.late++;
+        return;
+    }
+
+    latency_us = time_us_32() - c->started_us;
+    rpc->stats.completed++;
+    rpc->latency_sum_us += latency_us;
+    rpc->stats.latency_avg_us = rpc->latency_sum_us / rpc->stats.completed;
+    if (latency_us > rpc->stats.latency_max_us)
+        rpc->stats.latency_max_us = latency_us;
+    mesh_rpc_finish(c, rh->status, data, rh->status == WINC_MESH_RPC_OK ? len : 0);
+}
+
+// A request: answer a repeat from the reply cache, else run the handler
+// and remember what it returned
+static void mesh_rpc_request_input(const winc_mesh_hdr_t *hdr, const winc_mesh_rpc_t *rh,
+                                   const uint8_t *data, uint16_t len) {
+    mesh_rpc_t *rpc = &mesh_ctx.rpc;
+    winc_mesh_rpc_t *out = (winc_mesh_rpc_t*)rpc->buf;
+    mesh_rpc_reply_t *r = NULL;
+
+    for (int i = 0; i < WINC_MESH_RPC_REPLIES && !r; i++) {
+        if (rpc->replies[i].src_node == hdr->src_node && rpc->replies[i].call_id == rh->call_id)
+            r = &rpc->replies[i];
+    }
+
+    if (r) {
+        rpc->stats.replayed++;
+    } else {
+        winc_mesh_rpc_handler_t handler = NULL;
+        int ret;
+
+        for (int i = 0; i < WINC_MESH_RPC_METHODS && !handler; i++) {
+            if (rpc->methods[i].method == rh->method)
+                handler = rpc->methods[i].handler;
+        }
+
+        r = &rpc->replies[rpc->next_reply];
+        rpc->next_reply = (rpc->next_reply + 1) % WINC_MESH_RPC_REPLIES;
+        r->src_node = hdr->src_node;
+        r->call_id = rh->call_id;
+        r->len = 0;
+        if (!handler) {
+            if (g_ctx.verbose)
+                printf("[RPC] No handler for method %u (from node %u)\n", rh->method, hdr->src_node);
+            r->status = WINC_MESH_RPC_NO_METHOD;
+        } else {
+            rpc->stats.served++;
+            ret = handler(hdr->src_node, data, len, r->result, WINC_MESH_RPC_MAX);
+            r->status = ret < 0 ? (int8_t)MAX(ret, INT8_MIN) : WINC_MESH_RPC_OK;
+            r->len = ret < 0 ? 0 : MIN(ret, WINC_MESH_RPC_MAX);
+        }
+    }
+
+    out->kind = MESH_RPC_REPLY;
+    out->method = rh->method;
+    out->call_id = rh->call_id;
+    out->status = r->status;
+    memcpy(out + 1, r->result, r->len);
+    mesh_rpc_send(hdr->src_node, hdr->flags & (WINC_MESH_RELIABLE | WINC_MESH_PRIO(3)), r->len, false);
+}
+
+static void mesh_rpc_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len) {
+    winc_mesh_rpc_t rh;
+
+    if (len < sizeof(rh))
+        return;
+    memcpy(&rh, data, sizeof(rh));
+    data += sizeof(rh);
+    len -= sizeof(rh);
+    if (len > WINC_MESH_RPC_MAX)
+        return;
+
+    if (rh.kind == MESH_RPC_REPLY)
+        mesh_rpc_reply_input(hdr->src_node, &rh, (uint8_t*)data, len);
+    else if (rh.kind == MESH_RPC_REQUEST)
+        mesh_rpc_request_input(hdr, &rh, data, len);
+}
+
+bool winc_mesh_rpc_register(uint8_t method, winc_mesh_rpc_handler_t handler) {
+    mesh_rpc_method_t *slot = NULL;
+
+    if (!method)
+        return false;
+    for (int i = 0; i < WINC_MESH_RPC_METHODS; i++) {
+        mesh_rpc_method_t *m = &mesh_ctx.rpc.methods[i];
+        if (m->method == method) {
+            slot = m;
+            break;
+        }
+        if (!m->method && !slot)
+            slot = m;
+    }
+    if (!handler) {
+        if (slot && slot->method == method)
+            memset(slot, 0, sizeof(*slot));
+        return true;
+    }
+    if (!slot) {
+        printf("ERROR: No room for RPC method %u\n", method);
+        return false;
+    }
+    slot->method = method;
+    slot->handler = handler;
+    return true;
+}
+
+int winc_mesh_rpc_call(uint8_t dst_node, uint8_t method, const uint8_t *args, uint16_t len,
+                       uint8_t flags, uint32_t deadline_ms, winc_mesh_rpc_done_t done, void *arg) {
+    mesh_rpc_t *rpc = &mesh_ctx.rpc;
+    uint32_t now = MESH_NOW_MS();
+    mesh_rpc_call_t *c = NULL;
+
+    if (!g_ctx.mesh.enabled || !done)
+        return -1;
+    if (len > WINC_MESH_RPC_MAX) {
+        printf("ERROR: RPC arguments too long (%u bytes, max %u)\n", len, WINC_MESH_RPC_MAX);
+        return -1;
+    }
+    for (int i = 0; i < WINC_MESH_RPC_CALLS && !c; i++) {
+        if (!rpc->calls[i].active)
+            c = &rpc->calls[i];
+    }
+    if (!c)
+        return -1;
+
+    // Ids start at a random point, drawn on first use, so that after a
+    // reboot we do not repeat ones a server may still hold replies for
+    if (!rpc->gen)
+        rpc->gen = (uint16_t)mesh_rand();
+
+    c->active = true;
+    c->id = (uint16_t)(rpc->gen++ * WINC_MESH_RPC_CALLS) | (c - rpc->calls);
+    c->dst_node = dst_node;
+    c->method = method;
+    c->flags = flags & (WINC_MESH_RELIABLE | WINC_MESH_PRIO(3));
+    c->len = len;
+    if (len)
+        memcpy(c->args, args, len);
+    c->deadline = now + deadline_ms;
+    c->retry_ms = WINC_MESH_RPC_RETRY_MS;
+    c->started_us = time_us_32();
+    c->done = done;
+    c->arg = arg;
+    rpc->stats.calls++;
+    rpc->stats.outstanding++;
+
+    if (g_ctx.verbose > 1)
+        printf("[RPC] Call %04x: method %u on node %u, %u bytes\n", c->id, method, dst_node, len);
+    mesh_rpc_attempt(c, now);
+    return c->id;
+}
+
+bool winc_mesh_rpc_cancel(int call) {
+    mesh_rpc_call_t *c = &mesh_ctx.rpc.calls[call & MESH_RPC_MASK];
+
+    if (call < 0 || !c->active || c->id != call)
+        return false;
+    winc_timer_cancel(&c->timer);
+    c->active = false;
+    mesh_ctx.rpc.stats.outstanding--;
+    return true;
+}
+
+void winc_mesh_get_rpc_stats(winc_mesh_rpc_stats_t *stats) {
+    *stats = mesh_ctx.rpc.stats;
+}
+
+// ===== KEY-VALUE STORE =====
+
+static mesh_kv_entry_t *mesh_kv_find(uint16_t key) {
+    for (int i = 0; i < WINC_MESH_KV_KEYS; i++) {
+        if (mesh_ctx.kv.entries[i].rec.key == key)
+            return &mesh_ctx.kv.entries[i];
+    }
+    return NULL;
+}
+
+// True if a is a later write than b
+static bool mesh_kv_newer(const winc_mesh_kv_rec_t *a, const winc_mesh_kv_rec_t *b) {
+    return a->version != b->version ? a->version > b->version : a->origin > b->origin;
+}
+
+// Recount the store and its digest. Entries are summed so the digest
+// doesn't depend on where each one sits.
+static void mesh_kv_changed(void) {
+    mesh_kv_t *kv = &mesh_ctx.kv;
+
+    kv->hash = 0;
+    kv->stats.keys = 0;
+    for (int i = 0; i < WINC_MESH_KV_KEYS; i++) {
+        const winc_mesh_kv_rec_t *r = &kv->entries[i].rec;
+        uint32_t x;
+
+        if (!r->key)
+            continue;
+        x = ((uint32_t)r->key << 8 | r->origin) * 2654435761u ^ r->version * 2246822519u;
+        kv->hash += x ^ (x >> 15);
+        kv->stats.keys++;
+    }
+    kv->changed_at = MESH_NOW_MS();
+}
+
+// Beacon early for changed entries; the store pays for all of it
+static void mesh_kv_timer_fn(winc_timer_t *t, void *arg) {
+    uint32_t before = mesh_ctx.beacon_stats.bytes_sent;
+
+    if (g_ctx.mesh.enabled && mesh_send_beacon())
+        mesh_ctx.kv.stats.beacon_bytes += mesh_ctx.beacon_stats.bytes_sent - before -
+                                          mesh_ctx.kv.block_len;
+}
+
+// Send a beacon with our changed entries soon. Neighbours that took them
+// from the same beacon pass them on at different times.
+static void mesh_kv_announce(void) {
+    if (!g_ctx.mesh.enabled || winc_timer_pending(&mesh_ctx.kv.timer))
+        return;
+    winc_timer_start(&mesh_ctx.timers, &mesh_ctx.kv.timer,
+                     MESH_NOW_MS() + WINC_MESH_KV_PACE_MS / 2 +
+                     mesh_rand() % (WINC_MESH_KV_PACE_MS / 2 + 1));
+}
+
+// Store block for our next beacon at p: the changed entries that fit, then
+// the digest. Returns the bytes written, none while the store is empty.
+static int mesh_kv_build(uint8_t *p) {
+    mesh_kv_t *kv = &mesh_ctx.kv;
+    winc_mesh_kv_digest_t d = { .hash = kv->hash, .count = kv->stats.keys };
+
+    kv->block_len = 0;
+    if (!d.count)
+        return 0;
+    for (int i = 0; i < WINC_MESH_KV_KEYS; i++) {
+        mesh_kv_entry_t *e = &kv->entries[i];
+
+        e->beaconed = e->dirty && e->rec.key &&
+                      d.changed_len + sizeof(e->rec) + e->rec.len <= WINC_MESH_KV_BEACON_MAX;
+        if (!e->beaconed)
+            continue;
+        memcpy(p + d.changed_len, &e->rec, sizeof(e->rec));
+        memcpy(p + d.changed_len + sizeof(e->rec), e->value, e->rec.len);
+        d.changed_len += sizeof(e->rec) + e->rec.len;
+    }
+    memcpy(p + d.changed_len, &d, sizeof(d));
+    kv->block_len = d.changed_len + sizeof(d);
+    return kv->block_len;
+}
+
+// Our beacon went out: what did not fit goes in the next one
+static void mesh_kv_sent(void) {
+    bool left = false;
+
+    mesh_ctx.kv.stats.beacon_bytes += mesh_ctx.kv.block_len;
+    for (int i = 0; i < WINC_MESH_KV_KEYS; i++) {
+        mesh_kv_entry_t *e = &mesh_ctx.kv.entries[i];
+
+        if (e->beaconed)
+            e->dirty = e->beaconed = false;
+        left |= e->dirty;
+    }
+    if (left)
+        mesh_kv_announce();
+}
+
+// Send the len bytes in mesh_ctx.kv.buf to a neighbour
+static bool mesh_kv_send(uint8_t node_id, uint16_t len) {
+    winc_mesh_hdr_t hdr;
+
+    hdr.msg_type = MESH_MSG_KV;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = node_id;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.payload_len = len;
+    hdr.next_hop = node_id;
+    hdr.flags = 0;
+    if (!mesh_tx_data(&hdr, mesh_ctx.kv.buf))
+        return false;
+    mesh_ctx.kv.stats.bytes_sent += len;
+    return true;
+}
+
+// Versions of everything we hold, values left out
+static void mesh_kv_send_summary(uint8_t node_id) {
+    mesh_kv_t *kv = &mesh_ctx.kv;
+    winc_mesh_kv_t *kh = (winc_mesh_kv_t*)kv->buf;
+    uint8_t *p = kv->buf + sizeof(*kh);
+
+    kh->kind = MESH_KV_SUMMARY;
+    kh->count = 0;
+    for (int i = 0; i < WINC_MESH_KV_KEYS; i++) {
+        if (kv->entries[i].rec.key) {
+            memcpy(p, &kv->entries[i].rec, sizeof(winc_mesh_kv_rec_t));
+            p += sizeof(winc_mesh_kv_rec_t);
+            kh->count++;
+        }
+    }
+    mesh_kv_send(node_id, p - kv->buf);
+}
+
+// The entries flagged in send[], with their values
+static void mesh_kv_send_update(uint8_t node_id, const bool *send) {
+    mesh_kv_t *kv = &mesh_ctx.kv;
+    winc_mesh_kv_t *kh = (winc_mesh_kv_t*)kv->buf;
+    uint8_t *p = kv->buf + sizeof(*kh);
+
+    kh->kind = MESH_KV_UPDATE;
+    kh->count = 0;
+    for (int i = 0; i < WINC_MESH_KV_KEYS; i++) {
+        const mesh_kv_entry_t *e = &kv->entries[i];
+
+        if (!send[i] || !e->rec.key)
+            continue;
+        memcpy(p, &e->rec, sizeof(e->rec));
+        memcpy(p + sizeof(e->rec), e->value, e->rec.len);
+        p += sizeof(e->rec) + e->rec.len;
+        kh->count++;
+    }
+    if (kh->count && mesh_kv_send(node_id, p - kv->buf))
+        kv->stats.entries_sent += kh->count;
+}
+
+// Entries from a neighbour, in an update or its beacon: keep those newer
+// than ours and pass them on in our next beacon
+static void mesh_kv_apply(const uint8_t *p, int count, const uint8_t *end) {
+    mesh_kv_t *kv = &mesh_ctx.kv;
+
+    for (int i = 0; i < count && p + sizeof(winc_mesh_kv_rec_t) <= end; i++) {
+        winc_mesh_kv_rec_t rec;
+        mesh_kv_entry_t *e;
+
+        memcpy(&rec, p, sizeof(rec));
+        p += sizeof(rec);
+        if (!rec.key || rec.len > WINC_MESH_KV_VALUE_MAX || p + rec.len > end)
+            break;
+        e = mesh_kv_find(rec.key);
+        if (!e)
+            e = mesh_kv_find(0);
+        if (!e) {
+            kv->stats.refused++;
+        } else if (!e->rec.key || mesh_kv_newer(&rec, &e->rec)) {
+            e->rec = rec;
+            e->dirty = true;
+            memcpy(e->value, p, rec.len);
+            if ((int32_t)(rec.version - kv->clock) > 0)
+                kv->clock = rec.version;
+            kv->stats.applied++;
+            mesh_kv_changed();
+            mesh_kv_announce();
+            if (g_ctx.verbose > 1)
+                printf("[KV] Key %04x = %u bytes from node %u (version %lu)\n", rec.key, rec.len,
+                       rec.origin, (unsigned long)rec.version);
+            if (kv->callback)
+                kv->callback(rec.key, e->value, rec.len, rec.origin);
+        }
+        p += rec.len;
+    }
+}
+
+// A neighbour's beacon store block, or NULL if it had none. Take the
+// entries it changed. If neither of us has changed anything for a while
+// and its digest still differs from ours, gossip missed it: send our
+// versions so it can answer with what we lack and ask for what it lacks.
+// A neighbour with an empty store simply gets everything.
+static void mesh_kv_heard(mesh_link_t *link, const winc_mesh_kv_digest_t *d, uint32_t now) {
+    mesh_kv_t *kv = &mesh_ctx.kv;
+    uint32_t hash = d ? d->hash : 0;
+    uint8_t count = d ? d->count : 0;
+    bool all[WINC_MESH_KV_KEYS];
+
+    if (d && d->changed_len) {
+        mesh_kv_apply((const uint8_t*)d - d->changed_len, WINC_MESH_KV_KEYS, (const uint8_t*)d);
+        return;
+    }
+    if (hash == kv->hash && count == kv->stats.keys)
+        return;
+    if (now - kv->changed_at < WINC_MESH_KV_HOLD_MS)
+        return;
+    if (link->kv_asked && now - link->kv_asked_at < WINC_MESH_KV_HOLD_MS)
+        return;
+    link->kv_asked = true;
+    link->kv_asked_at = now;
+
+    if (g_ctx.verbose > 1)
+        printf("[KV] Node %u holds %u keys, we %u: comparing\n", link->node_id, count,
+               kv->stats.keys);
+    if (!count) {
+        memset(all, true, sizeof(all));
+        mesh_kv_send_update(link->node_id, all);
+    } else {
+        kv->stats.exchanges++;
+        mesh_kv_send_summary(link->node_id);
+    }
+}
+
+// A neighbour's versions: send it what it lacks or holds older, ask for
+// what we lack or hold older and have room for
+static void mesh_kv_summary_input(uint8_t src_node, const uint8_t *p, int count) {
+    mesh_kv_t *kv = &mesh_ctx.kv;
+    winc_mesh_kv_t *kh = (winc_mesh_kv_t*)kv->buf;
+    uint16_t *want = (uint16_t*)(kv->buf + sizeof(*kh));
+    bool send[WINC_MESH_KV_KEYS];
+    int room = WINC_MESH_KV_KEYS - kv->stats.keys, n = 0;
+
+    memset(send, true, sizeof(send));
+    for (int i = 0; i < count; i++, p += sizeof(winc_mesh_kv_rec_t)) {
+        winc_mesh_kv_rec_t rec;
+        mesh_kv_entry_t *e;
+
+        memcpy(&rec, p, sizeof(rec));
+        if (!rec.key)
+            continue;
+        e = mesh_kv_find(rec.key);
+        if (e) {
+            send[e - kv->entries] = mesh_kv_newer(&e->rec, &rec);
+            if (mesh_kv_newer(&rec, &e->rec))
+                want[n++] = rec.key;
+        } else if (room) {
+            room--;
+            want[n++] = rec.key;
+        } else {
+            kv->stats.refused++;
+        }
+    }
+
+    if (n) {
+        kh->kind = MESH_KV_WANT;
+        kh->count = n;
+        mesh_kv_send(src_node, sizeof(*kh) + n * sizeof(uint16_t));
+    }
+    mesh_kv_send_update(src_node, send);
+}
+
+static void mesh_kv_want_input(uint8_t src_node, const uint8_t *p, int count) {
+    bool send[WINC_MESH_KV_KEYS] = {false};
+
+    for (int i = 0; i < count; i++, p += sizeof(uint16_t)) {
+        uint16_t key;
+        mesh_kv_entry_t *e;
+
+        memcpy(&key, p, sizeof(key));
+        e = key ? mesh_kv_find(key) : NULL;
+        if (e)
+            send[e - mesh_ctx.kv.entries] = true;
+    }
+    mesh_kv_send_update(src_node, send);
+}
+
+static void mesh_kv_input(const winc_mesh_hdr_t *hdr, const uint8_t *data, uint16_t len) {
+    const uint8_t *end = data + len;
+    winc_mesh_kv_t kh;
+
+    if (len < sizeof(kh))
+        return;
+    memcpy(&kh, data, sizeof(kh));
+    data += sizeof(kh);
+    if (kh.count > WINC_MESH_KV_KEYS)
+        return;
+
+    if (kh.kind == MESH_KV_SUMMARY && data + kh.count * sizeof(winc_mesh_kv_rec_t) <= end)
+        mesh_kv_summary_input(hdr->src_node, data, kh.count);
+    else if (kh.kind == MESH_KV_WANT && data + kh.count * sizeof(uint16_t) <= end)
+        mesh_kv_want_input(hdr->src_node, data, kh.count);
+    else if (kh.kind == MESH_KV_UPDATE)
+        mesh_kv_apply(data, kh.count, end);
+}
+
+uint16_t winc_mesh_kv_key(const char *name) {
+    return winc_mesh_topic(name);
+}
+
+bool winc_mesh_kv_set(uint16_t key, const uint8_t *value, uint8_t len) {
+    mesh_kv_t *kv = &mesh_ctx.kv;
+    mesh_kv_entry_t *e;
+
+    if (!key || len > WINC_MESH_KV_VALUE_MAX) {
+        printf("ERROR: Bad key-value write (key %04x, %u bytes, max %u)\n", key, len,
+               WINC_MESH_KV_VALUE_MAX);
+        return false;
+    }
+    e = mesh_kv_find(key);
+    if (e && e->rec.len == len && !memcmp(e->value, value, len))
+        return true;
+    if (!e)
+        e = mesh_kv_find(0);
+    if (!e) {
+        printf("ERROR: Key-value store full (%u keys)\n", WINC_MESH_KV_KEYS);
+        return false;
+    }
+
+    e->rec.key = key;
+    e->rec.version = ++kv->clock;
+    e->rec.origin = g_ctx.mesh.my_node_id;
+    e->rec.len = len;
+    e->dirty = true;
+    memcpy(e->value, value, len);
+    kv->stats.sets++;
+    mesh_kv_changed();
+    mesh_kv_announce();
+    return true;
+}
+
+int winc_mesh_kv_get(uint16_t key, uint8_t *value, uint8_t max) {
+    mesh_kv_entry_t *e = key ? mesh_kv_find(key) : NULL;
+
+    if (!e)
+        return -1;
+    memcpy(value, e->value, MIN(e->rec.len, max));
+    return e->rec.len;
+}
+
+void winc_mesh_kv_set_callback(winc_mesh_kv_handler_t handler) {
+    mesh_ctx.kv.callback = handler;
+}
+
+void winc_mesh_get_kv_stats(winc_mesh_kv_stats_t *stats) {
+    *stats = mesh_ctx.kv.stats;
+}
+
+// ===== PING =====
+
+// Build an echo in fragbuf and send it towards dst
+static bool mesh_echo_send(uint8_t type, uint8_t dst, const winc_mesh_echo_t *echo, uint16_t len) {
+    winc_mesh_hdr_t hdr;
+    int next_hop = mesh_find_route(dst);
+
+    if (next_hop < 0) {
+        if (g_ctx.verbose)
+            printf("Ping: no route to node %u\n", dst);
+        return false;
+    }
+
+    hdr.msg_type = type;
+    hdr.src_node = g_ctx.mesh.my_node_id;
+    hdr.dst_node = dst;
+    hdr.hop_count = 0;
+    hdr.seq_num = g_ctx.mesh.seq_num++;
+    hdr.payload_len = len;
+    hdr.next_hop = next_hop;
+    hdr.flags = WINC_MESH_PRIO(WINC_MESH_CLASS_NORMAL);
+
+    if ((const uint8_t*)echo != mesh_ctx.fragbuf) {
+        memset(mesh_ctx.fragbuf, 0, len);
+        memcpy(mesh_ctx.fragbuf, echo, sizeof(*echo));
+    }
+    return mesh_tx_data(&hdr, mesh_ctx.fragbuf);
+}
+
+static void mesh_ping_finish(void) {
+    mesh_ping_t *p = &mesh_ctx.ping;
+    winc_mesh_ping_result_t *r = &p->result;
+
+    winc_timer_cancel(&p->timer);
+    p->active = false;
+    r->done = true;
+    if (r->received)
+        r->avg_us = p->rtt_sum_us / r->received;
+    if (r->received > 1)
+        r->jitter_us = p->jitter_sum_us / (r->received - 1);
+
+    if (g_ctx.verbose)
+        printf("Ping node %u: %u/%u replies, rtt min/avg/max %lu/%lu/%lu us, jitter %lu us\n",
+               p->dst, r->received, r->sent, (unsigned long)r->min_us,
+               (unsigned long)r->avg_us, (unsigned long)r->max_us,
+               (unsigned long)r->jitter_us);
+}
+
+// Send the next request, or give up on the missing replies
+static void mesh_ping_timer_fn(winc_timer_t *t, void *arg) {
+    mesh_ping_t *p = &mesh_ctx.ping;
+    winc_mesh_echo_t echo;
+    uint32_t now = MESH_NOW_MS();
+
+    if (p->result.sent >= p->count) {
+        mesh_ping_finish();
+        return;
+    }
+
+    memset(&echo, 0, sizeof(echo));
+    echo.id = p->id;
+    echo.seq = p->result.sent++;
+    echo.record = 1;
+    echo.sent_us = time_us_32();
+    // A request with no route is simply lost
+    mesh_echo_send(MESH_MSG_ECHO_REQ, p->dst, &echo, p->size);
+
+    winc_timer_start(&mesh_ctx.timers, t, now + (p->result.sent < p->count ?
+                     WINC_MESH_PING_INTERVAL_MS : WINC_MESH_PING_TIMEOUT_MS));
+}
+
+// Answer a request, or take the round trip of a reply to our ping
+static void mesh_handle_echo(winc_mesh_hdr_t *hdr, uint8_t *data) {
+    mesh_ping_t *p = &mesh_ctx.ping;
+    winc_mesh_ping_result_t *r = &p->result;
+    winc_mesh_echo_t *echo = (winc_mesh_echo_t*)data;
+    uint32_t rtt;
+    uint8_t hops = 0;
+
+    if (hdr->payload_len < sizeof(winc_mesh_echo_t) || hdr->payload_len > WINC_MESH_MTU ||
+        hdr->dst_node == 0xFF)
+        return;
+
+    if (hdr->msg_type == MESH_MSG_ECHO_REQ) {
+        if (echo->record && echo->path_len < sizeof(echo->path))
+            echo->path[echo->path_len++] = g_ctx.mesh.my_node_id;
+        memcpy(mesh_ctx.fragbuf, data, hdr->payload_len);
+        mesh_echo_send(MESH_MSG_ECHO_REPLY, hdr->src_node,
+                       (winc_mesh_echo_t*)mesh_ctx.fragbuf, hdr->payload_len);
+        return;
+    }
+
+    if (!p->active || echo->id != p->id || hdr->src_node != p->dst ||
+        echo->seq >= r->sent || (p->got[echo->seq / 8] & (1 << (echo->seq % 8))))
+        return;
+    p->got[echo->seq / 8] |= 1 << (echo->seq % 8);
+
+    rtt = time_us_32() - echo->sent_us;
+    if (!r->received || rtt < r->min_us)
+        r->min_us = rtt;
+    if (rtt > r->max_us)
+        r->max_us = rtt;
+    if (r->received)
+        p->jitter_sum_us += rtt > p->last_rtt_us ? rtt - p->last_rtt_us : p->last_rtt_us - rtt;
+    p->last_rtt_us = rtt;
+    p->rtt_sum_us += rtt;
+    r->received++;
+
+    // Forward path: everything up to the responder's own entry
+    while (hops < echo->path_len && hops < WINC_MESH_MAX_HOPS) {
+        r->path[hops] = echo->path[hops];
+        if (echo->path[hops++] == p->dst)
+            break;
+    }
+    r->hops = hops;
+
+    if (g_ctx.verbose > 1)
+        printf("Ping reply %u from node %u: %lu us, %u hops\n",
+               echo->seq, hdr->src_node, (unsigned long)rtt, hops);
+
+    if (r->received == p->count)
+        mesh_ping_finish();
+}
+
+bool winc_mesh_ping_start(uint8_t dst_node, uint8_t count, uint16_t size) {
+    mesh_ping_t *p = &mesh_ctx.ping;
+
+    if (!g_ctx.mesh.enabled || !count || size > WINC_MESH_MTU)
+        return false;
+    if (mesh_find_route(dst_node) < 0) {
+        printf("ERROR: No route to node %u\n", dst_node);
+        return false;
+    }
+    if (size < sizeof(winc_mesh_echo_t))
+        size = sizeof(winc_mesh_echo_t);
+
+    winc_timer_cancel(&p->timer);
+    memset(p->got, 0, sizeof(p->got));
+    memset(&p->result, 0, sizeof(p->result));
+    p->id++;
+    p->dst = dst_node;
+    p->count = count;
+    p->size = size;
+    p->rtt_sum_us = 0;
+    p->jitter_sum_us = 0;
+    p->active = true;
+    // First request goes out on the next poll
+    winc_timer_start(&mesh_ctx.timers, &p->timer, MESH_NOW_MS());
+    return true;
+}
+
+bool winc_mesh_ping_result(winc_mesh_ping_result_t *result) {
+    *result = mesh_ctx.ping.result;
+    return result->done;
+}
+
+// ===== ROUTING TABLE FUNCTIONS =====
+
+// Distance-vector update from one advertised entry; returns true if the
+// table changed. The metric is cumulative ETX: the neighbour's advertised
+// metric plus our link ETX to it. Entries whose advertised next hop is us
+// are treated as unreachable (poisoned reverse), and a destination in
+// hold-down only accepts its old next hop or a strictly better metric.
+// Metric wobble within mesh_etx_hysteresis() is absorbed so routes and
+// Trickle don't flap on every beacon.
+static bool mesh_dv_update(uint8_t neighbor, uint8_t dst, uint8_t adv_next_hop,
+                           uint8_t adv_hops, uint8_t adv_metric, uint32_t now) {
+    uint8_t hops = adv_hops + 1;
+    uint8_t link = mesh_link_etx(neighbor);
+    uint32_t metric;
+    mesh_holddown_t *h;
+    int slot;
+
+    if (dst == g_ctx.mesh.my_node_id || dst == 0xFF)
+        return false;
+
+    metric = (uint32_t)adv_metric + link;
+    if (adv_next_hop == g_ctx.mesh.my_node_id || adv_metric >= WINC_MESH_METRIC_INFINITY ||
+        link >= WINC_MESH_METRIC_INFINITY || hops > WINC_MESH_MAX_HOPS ||
+        metric >= WINC_MESH_METRIC_INFINITY)
+        metric = WINC_MESH_METRIC_INFINITY;
+
+    slot = mesh_route_slot(dst);
+    if (slot >= 0) {
+        uint8_t old_next_hop = g_ctx.mesh.routes[slot].next_hop;
+        uint8_t old_hops = g_ctx.mesh.routes[slot].hop_count;
+        uint8_t old_metric = mesh_ctx.route_ext[slot].metric;
+
+        if (old_next_hop == neighbor) {
+            // Our next hop always has the final word on its own route
+            if (metric >= WINC_MESH_METRIC_INFINITY) {
+                mesh_route_invalidate(slot, now);
+                return true;
+            }
+            g_ctx.mesh.routes[slot].last_seen = now;
+            if (old_hops == hops &&
+                (metric > old_metric ? metric - old_metric : old_metric - metric) <=
+                    mesh_etx_hysteresis(old_metric))
+                return false;
+        } else if (metric + mesh_etx_hysteresis(old_metric) >= old_metric) {
+            return false;
+        }
+
+        g_ctx.mesh.routes[slot].next_hop = neighbor;
+        g_ctx.mesh.routes[slot].hop_count = hops;
+        g_ctx.mesh.routes[slot].last_seen = now;
+        mesh_ctx.route_ext[slot].metric = metric;
+        mesh_mark_dirty(dst);
+
+        if (g_ctx.verbose && old_next_hop != neighbor)
+            printf("Route change: Node %u via %u (%u hops, ETX %u.%u), was via %u (%u hops)\n",
+                   dst, neighbor, hops, metric / WINC_MESH_ETX_ONE,
+                   (metric % WINC_MESH_ETX_ONE) * 10 / WINC_MESH_ETX_ONE,
+                   old_next_hop, old_hops);
+        return true;
+    }
+
+    if (metric >= WINC_MESH_METRIC_INFINITY)
+        return false;
+
+    h = mesh_holddown_find(dst, now);
+    if (h) {
+        if (neighbor != h->next_hop && metric >= h->metric)
+            return false;
+        h->active = false;
+    }
+
+    return mesh_route_add(dst, neighbor, hops, metric, now);
+}
+
+// Metric change needed before we act on it: 1/8 of the metric, at least ETX 0.5
+static uint8_t mesh_etx_hysteresis(uint8_t metric) {
+    uint8_t margin = metric / 8;
+    return margin > WINC_MESH_ETX_ONE / 2 ? margin : WINC_MESH_ETX_ONE / 2;
+}
+
+// Add a new route; returns true if it fit in the table
+static bool mesh_route_add(uint8_t node_id, uint8_t next_hop, uint8_t hop_count,
+                           uint8_t metric, uint32_t now) {
+    int free_slot = -1;
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        if (!g_ctx.mesh.routes[i].active) {
+            free_slot = i;
+            break;
+        }
+    }
+
+    if (free_slot < 0) {
+        if (g_ctx.verbose)
+            printf("Routing table full, ignoring node %u\n", node_id);
+        return false;
+    }
+
+    g_ctx.mesh.routes[free_slot].node_id = node_id;
+    g_ctx.mesh.routes[free_slot].next_hop = next_hop;
+    g_ctx.mesh.routes[free_slot].hop_count = hop_count;
+    g_ctx.mesh.routes[free_slot].last_seen = now;
+    g_ctx.mesh.routes[free_slot].active = true;
+    winc_timer_start(&mesh_ctx.timers, &mesh_ctx.route_timer[free_slot],
+                     now + WINC_MESH_ROUTE_TIMEOUT_MS + 1);
+
+    if (free_slot >= g_ctx.mesh.route_count) {
+        g_ctx.mesh.route_count = free_slot + 1;
+    }
+
+    mesh_ctx.route_ext[free_slot].metric = metric;
+    mesh_ctx.route_ext[free_slot].nbr_hash = 0;
+    mesh_mark_dirty(node_id);
+
+    if (g_ctx.verbose)
+        printf("New route: Node %u via %u (%u hops)\n", node_id, next_hop, hop_count);
+    return true;
+}
+
+// Drop a route and hold its destination down so stale paths can't return
+static void mesh_route_invalidate(int slot, uint32_t now) {
+    uint8_t node_id = g_ctx.mesh.routes[slot].node_id;
+    mesh_holddown_t *h = mesh_holddown_find(node_id, now);
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES && !h; i++) {
+        if (!mesh_ctx.dv.holddown[i].active)
+            h = &mesh_ctx.dv.holddown[i];
+    }
+    if (!h) {
+        // Table full: reuse the entry closest to expiry
+        h = &mesh_ctx.dv.holddown[0];
+        for (int i = 1; i < WINC_MESH_MAX_NODES; i++) {
+            if ((int32_t)(mesh_ctx.dv.holddown[i].until - h->until) < 0)
+                h = &mesh_ctx.dv.holddown[i];
+        }
+    }
+
+    h->node_id = node_id;
+    h->next_hop = g_ctx.mesh.routes[slot].next_hop;
+    h->hops = g_ctx.mesh.routes[slot].hop_count;
+    h->metric = mesh_ctx.route_ext[slot].metric;
+    h->until = now + WINC_MESH_HOLDDOWN_MS;
+    h->active = true;
+
+    g_ctx.mesh.routes[slot].active = false;
+    winc_timer_cancel(&mesh_ctx.route_timer[slot]);
+    mesh_mark_dirty(node_id);
+
+    if (g_ctx.verbose)
+        printf("Route to node %u lost, hold-down %u ms\n", node_id, WINC_MESH_HOLDDOWN_MS);
+}
+
+// Find an unexpired hold-down entry for a node
+static mesh_holddown_t *mesh_holddown_find(uint8_t node_id, uint32_t now) {
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_holddown_t *h = &mesh_ctx.dv.holddown[i];
+        if (h->active && (int32_t)(now - h->until) >= 0) {
+            h->active = false;
+            mesh_mark_dirty(h->node_id);  // Withdraw the poison
+        }
+        if (h->active && h->node_id == node_id)
+            return h;
+    }
+    return NULL;
+}
+
+// ===== LINK QUALITY (ETX) =====
+
+static mesh_link_t *mesh_link_find(uint8_t node_id) {
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        if (mesh_ctx.links[i].active && mesh_ctx.links[i].node_id == node_id)
+            return &mesh_ctx.links[i];
+    }
+    return NULL;
+}
+
+// Counters of a neighbour in the link table. Unknown senders share a
+// scratch entry so callers need not check.
+static winc_mesh_neighbor_stats_t *mesh_nbr(uint8_t node_id) {
+    static winc_mesh_neighbor_stats_t scratch;
+    mesh_link_t *l = mesh_link_find(node_id);
+
+    return l ? &mesh_ctx.nbr[l - mesh_ctx.links] : &scratch;
+}
+
+int winc_mesh_get_neighbor_stats(winc_mesh_neighbor_stats_t *stats, int max) {
+    int n = 0;
+
+    for (int i = 0; i < WINC_MESH_MAX_NODES && n < max; i++) {
+        if (mesh_ctx.links[i].active)
+            stats[n++] = mesh_ctx.nbr[i];
+    }
+    return n;
+}
+
+// Record a beacon from a neighbour and refresh its reception ratio
+static mesh_link_t *mesh_link_heard(uint8_t node_id, uint16_t seq, uint32_t now) {
+    mesh_link_t *l = mesh_link_find(node_id);
+    uint16_t gap;
+    int bits;
+
+    if (!l) {
+        // New neighbour: take a free entry, else the longest silent one
+        l = &mesh_ctx.links[0];
+        for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+            if (!mesh_ctx.links[i].active) {
+                l = &mesh_ctx.links[i];
+                break;
+            }
+            if ((int32_t)(mesh_ctx.links[i].last_heard - l->last_heard) < 0)
+                l = &mesh_ctx.links[i];
+        }
+        memset(l, 0, sizeof(*l));
+        l->node_id = node_id;
+        l->active = true;
+        memset(&mesh_ctx.nbr[l - mesh_ctx.links], 0, sizeof(winc_mesh_neighbor_stats_t));
+        memset(&mesh_ctx.adv[l - mesh_ctx.links], 0, sizeof(mesh_adv_t));
+        mesh_ctx.nbr[l - mesh_ctx.links].node_id = node_id;
+        gap = 0;
+    } else {
+        gap = seq - l->last_seq;
+        if (gap == 0)
+            return l;           // Duplicate
+        if (gap >= 0x8000) {
+            gap = 0;            // Sequence went backwards: neighbour restarted
+            mesh_ctx.adv[l - mesh_ctx.links].valid = false;
+        }
+    }
+
+    mesh_ctx.nbr[l - mesh_ctx.links].beacons_heard++;
+    if (gap == 0) {
+        l->window = 1;
+        l->span = 1;
+    } else {
+        mesh_ctx.nbr[l - mesh_ctx.links].beacons_missed += gap - 1;
+        l->window = gap >= 32 ? 1 : (l->window << gap) | 1;
+        l->span = l->span + gap > 32 ? 32 : l->span + gap;
+    }
+    l->last_seq = seq;
+    l->last_heard = now;
+
+    // Ratio over the window. A young window says little about loss, so pad it
+    // to 8 beacons with half-received ones rather than trusting a lucky start.
+    uint32_t w = l->span < 32 ? l->window & ((1u << l->span) - 1) : l->window;
+    for (bits = 0; w; w &= w - 1)
+        bits++;
+    int pad = l->span < 8 ? 8 - l->span : 0;
+    l->rx_ratio = (uint8_t)(((bits * 2 + pad) * 255 + l->span + pad) / (2 * (l->span + pad)));
+    return l;
+}
+
+// ETX of the link to a neighbour, 1/(df * dr), in 1/WINC_MESH_ETX_ONE units
+static uint8_t mesh_link_etx(uint8_t node_id) {
+    mesh_link_t *l = mesh_link_find(node_id);
+    uint32_t df, dr, etx;
+
+    if (!l || !l->rx_ratio)
+        return WINC_MESH_METRIC_INFINITY;
+
+    dr = l->rx_ratio;
+    df = l->tx_ratio ? l->tx_ratio : dr;  // No report yet: assume symmetric
+    etx = (WINC_MESH_ETX_ONE * 255u * 255u + df * dr / 2) / (df * dr);
+    return etx > WINC_MESH_ETX_MAX_LINK ? WINC_MESH_METRIC_INFINITY : (uint8_t)etx;
+}
+
+// Find routing table slot for a node, or -1
+static int mesh_route_slot(uint8_t node_id) {
+    for (int i = 0; i < g_ctx.mesh.route_count; i++) {
+        if (g_ctx.mesh.routes[i].active && g_ctx.mesh.routes[i].node_id == node_id)
+            return i;
+    }
+    return -1;
+}
+
+// Find best route to destination
+static int mesh_find_route(uint8_t dst_node) {
+    int best = -1;
+    uint8_t min_hops = 255;
+
+    for (int i = 0; i < g_ctx.mesh.route_count; i++) {
+        if (g_ctx.mesh.routes[i].active &&
+            g_ctx.mesh.routes[i].node_id == dst_node &&
+            g_ctx.mesh.routes[i].hop_count < min_hops) {
+            best = i;
+            min_hops = g_ctx.mesh.routes[i].hop_count;
+        }
+    }
+
+    return (best >= 0) ? g_ctx.mesh.routes[best].next_hop : -1;
+}
+
+// ===== PACKET HANDLER =====
+
+// Handle incoming mesh packets (called by socket layer)
+static void mesh_packet_handler(uint8_t sock, int rxlen) {
+    uint8_t *buf = mesh_ctx.rxbuf;
+    winc_mesh_hdr_t *hdr;
+
+    mesh_ctx.sync.rx_us = time_us_64();
+    printf("[RX] Packet received on socket %u, length=%d\n", sock, rxlen);
+
+    if (rxlen <= 0) {
+        if (rxlen < 0)
+            printf("[RX] ERROR: Socket error %d\n", rxlen);
+        return;
+    }
+
+    if (rxlen < (int)sizeof(winc_mesh_hdr_t) || rxlen > (int)sizeof(mesh_ctx.rxbuf)) {
+        printf("[RX] ERROR: Bad mesh packet length %d\n", rxlen);
+        return;
+    }
+
+    // Get packet data
+    if (!get_sock_data(sock, buf, rxlen)) {
+        printf("[RX] ERROR: Failed to get mesh packet data\n");
+        return;
+    }
+
+    hdr = (winc_mesh_hdr_t*)buf;
+
+    printf("[RX] Mesh packet: type=%u, src=%u, dst=%u, hops=%u, len=%u\n",
+           hdr->msg_type, hdr->src_node, hdr->dst_node,
+           hdr->hop_count, hdr->payload_len);
+
+    // Process based on message type
+    switch (hdr->msg_type) {
+        case MESH_MSG_BEACON:
+            printf("[RX] Processing BEACON from node %u\n", hdr->src_node);
+            if (rxlen >= (int)offsetof(winc_mesh_beacon_t, entries))
+                mesh_handle_beacon((winc_mesh_beacon_t*)buf, rxlen);
+            mesh_bp_heard(hdr->src_node, hdr->flags);
+            break;
+
+        case MESH_MSG_DATA:
+        case MESH_MSG_FRAGMENT:
+        case MESH_MSG_AGGREGATE:
+        case MESH_MSG_ECHO_REQ:
+        case MESH_MSG_ECHO_REPLY:
+        case MESH_MSG_ROUTE_REQ:
+        case MESH_MSG_ROUTE_RESP:
+        case MESH_MSG_STREAM:
+        case MESH_MSG_PUBLISH:
+        case MESH_MSG_RPC:
+        case MESH_MSG_KV:
+            // Overheard a frame addressed to another hop
+            if (hdr->next_hop != g_ctx.mesh.my_node_id && hdr->next_hop != 0xFF) {
+                if (g_ctx.verbose > 1)
+                    printf("[RX] Frame for hop %u, ignoring\n", hdr->next_hop);
+                break;
+            }
+
+            // The sender stamped itself, which with ETX routes need not be
+            // our way back to the source
+            mesh_ctx.rx_from = hdr->prev_hop;
+            mesh_bp_heard(hdr->prev_hop, hdr->flags);
+
+            if (hdr->msg_type == MESH_MSG_AGGREGATE)
+                mesh_handle_aggregate(buf, rxlen);
+            else if (sizeof(winc_mesh_hdr_t) + hdr->payload_len <= (unsigned)rxlen)
+                mesh_handle_data(hdr, buf + sizeof(winc_mesh_hdr_t));
+            mesh_ack_flush();
+            break;
+
+        case MESH_MSG_ACK:
+            mesh_bp_heard(hdr->src_node, hdr->flags);
+            if (sizeof(winc_mesh_hdr_t) + hdr->payload_len <= (unsigned)rxlen)
+                mesh_handle_ack(hdr, buf + sizeof(winc_mesh_hdr_t));
+            break;
+
+        case MESH_MSG_BEACON_REQ:
+            mesh_bp_heard(hdr->src_node, hdr->flags);
+            if (hdr->next_hop == g_ctx.mesh.my_node_id) {
+                mesh_ctx.beacon_stats.requests_received++;
+                mesh_full_schedule(MESH_NOW_MS());
+            }
+            break;
+
+        case MESH_MSG_FLOOD:
+            if (sizeof(winc_mesh_hdr_t) + hdr->payload_len <= (unsigned)rxlen) {
+                if (hdr->payload_len >= sizeof(winc_mesh_flood_t))
+                    mesh_bp_heard(buf[sizeof(winc_mesh_hdr_t)], hdr->flags);  // Its sender
+                mesh_handle_flood(hdr, buf + sizeof(winc_mesh_hdr_t));
+            }
+            break;
+
+        default:
+            if (g_ctx.verbose)
+                printf("Unknown mesh message type: %u\n", hdr->msg_type);
+            break;
+    }
+}
+
+// ===== TRICKLE BEACON SCHEDULER =====
 
-    // Enable verbose for debugging
-    g_ctx.verbose = 1;
+// xorshift32, good enough to de-synchronise beacon times between nodes
+static uint32_t mesh_rand(void) {
+    uint32_t x = mesh_ctx.rand_state ? mesh_ctx.rand_state : 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    mesh_ctx.rand_state = x;
+    return x;
+}
 
-    bool network_ready = false;
+// Wake the beacon timer at the next Trickle event: t, the end of the
+// interval, or the forced beacon, whichever comes first
+static void mesh_trickle_arm(void) {
+    mesh_trickle_t *tr = &mesh_ctx.trickle;
+    uint32_t at = tr->interval_start + tr->interval;
+    uint32_t forced = tr->last_sent + MESH_BEACON_MAX_GAP_MS();
 
-    if (node_id == 1) {
-        // Node 1: Start as AP
-        printf("\n*** ROLE: ACCESS POINT (GROUP OWNER) ***\n");
-        g_ctx.connection_state.ap_mode = true;
+    if (!tr->fired && (int32_t)(tr->interval_start + tr->fire_at - at) < 0)
+        at = tr->interval_start + tr->fire_at;
+    if ((int32_t)(forced - at) < 0)
+        at = forced;
+    winc_timer_start(&mesh_ctx.timers, &mesh_ctx.beacon_timer, at);
+}
 
-        network_ready = winc_start_ap("CAPSULE-MESH", "capsule123", WINC_P2P_CHANNEL);
+// Begin a new interval: pick t uniformly in [I/2, I) and clear the counter
+static void mesh_trickle_start_interval(uint32_t now) {
+    mesh_trickle_t *tr = &mesh_ctx.trickle;
+    uint32_t half = tr->interval / 2;
 
-        if (!network_ready) {
-            printf("ERROR: Failed to start AP mode\n");
-            return false;
-        }
+    tr->interval_start = now;
+    tr->fire_at = half + (half ? mesh_rand() % half : 0);
+    tr->fired = false;
+    tr->counter = 0;
+    mesh_ctx.beacon_stats.interval_ms = tr->interval;
+    mesh_trickle_arm();
+}
 
-    } else {
-        // Node 2+: Connect as client
-        printf("\n*** ROLE: CLIENT (STATION) ***\n");
+// Inconsistency heard: drop back to the minimum interval
+static void mesh_trickle_reset(uint32_t now) {
+    mesh_trickle_t *tr = &mesh_ctx.trickle;
 
-        network_ready = winc_connect_sta("CAPSULE-MESH", "capsule123");
+    mesh_ctx.beacon_stats.inconsistencies++;
+    mesh_ctx.beacon_stats.last_change_ms = now;
+    tr->converging = true;
 
-        if (!network_ready) {
-            printf("ERROR: Failed to connect to AP\n");
-            return false;
-        }
+    if (tr->interval != WINC_MESH_TRICKLE_IMIN_MS || tr->interval_start == 0) {
+        tr->interval = WINC_MESH_TRICKLE_IMIN_MS;
+        mesh_trickle_start_interval(now);
     }
+}
 
-    printf("\nWaiting for network to stabilize...\n");
-    uint32_t stabilize_start = to_ms_since_boot(get_absolute_time());
+static void mesh_trickle_process(uint32_t now) {
+    mesh_trickle_t *tr = &mesh_ctx.trickle;
+
+    // Never stay silent long enough for neighbours to time our route out,
+    // even if one beacon is lost on the way
+    if (now - tr->last_sent >= MESH_BEACON_MAX_GAP_MS()) {
+        tr->fired = true;
+        tr->last_sent = now;
+        g_ctx.mesh.last_beacon = now;
+        mesh_send_beacon();
+    }
 
-    while ((to_ms_since_boot(get_absolute_time()) - stabilize_start) < 3000) {
-        winc_poll();
+    if (!tr->fired && now - tr->interval_start >= tr->fire_at) {
+        tr->fired = true;
 
-        if (g_ctx.connection_state.connected && g_ctx.connection_state.dhcp_done) {
-            printf("Network ready (connected=%d, dhcp=%d)\n",
-                   g_ctx.connection_state.connected, g_ctx.connection_state.dhcp_done);
-            break;
+        if (tr->counter < WINC_MESH_TRICKLE_K) {
+            if (g_ctx.verbose > 1)
+                printf("[MESH] Trickle beacon (I=%lu, c=%u)\n", tr->interval, tr->counter);
+            tr->last_sent = now;
+            g_ctx.mesh.last_beacon = now;
+            mesh_send_beacon();
+        } else {
+            mesh_ctx.beacon_stats.beacons_suppressed++;
         }
-        sleep_ms(100);
     }
 
-    if (!g_ctx.connection_state.connected || !g_ctx.connection_state.dhcp_done) {
-        printf("ERROR: Network not ready after stabilization period\n");
-        printf("  connected=%d, dhcp_done=%d\n",
-               g_ctx.connection_state.connected, g_ctx.connection_state.dhcp_done);
-        return false;
+    if (now - tr->interval_start >= tr->interval) {
+        tr->interval *= 2;
+        if (tr->interval >= WINC_MESH_TRICKLE_IMAX_MS) {
+            tr->interval = WINC_MESH_TRICKLE_IMAX_MS;
+            if (tr->converging) {
+                tr->converging = false;
+                mesh_ctx.beacon_stats.convergence_ms = now - mesh_ctx.beacon_stats.last_change_ms;
+                if (g_ctx.verbose)
+                    printf("[MESH] Topology stable, converged in %lu ms\n",
+                           mesh_ctx.beacon_stats.convergence_ms);
+            }
+        }
+        mesh_trickle_start_interval(now);
     }
+    mesh_trickle_arm();
+}
 
-    printf("Creating UDP socket on port %d...\n", WINC_MESH_PORT);
-
-    g_ctx.mesh.udp_socket = open_sock_server(WINC_MESH_PORT, false, mesh_packet_handler);
+void winc_mesh_get_beacon_stats(winc_mesh_beacon_stats_t *stats) {
+    if (stats)
+        *stats = mesh_ctx.beacon_stats;
+}
 
-    if (g_ctx.mesh.udp_socket < 0) {
-        printf("ERROR: Failed to create UDP socket\n");
-        return false;
-    }
+// ===== ROLE ELECTION =====
 
-    printf("UDP socket created: %d\n", g_ctx.mesh.udp_socket);
+static const char *mesh_role_name(uint8_t role) {
+    static const char *names[] = {"joining", "client", "starting AP", "group owner"};
+    return role < 4 ? names[role] : "?";
+}
 
-    // Wait for socket to bind
-    printf("Waiting for socket to bind...\n");
-    uint32_t wait_start = to_ms_since_boot(get_absolute_time());
+static void mesh_role_set(uint8_t state) {
+    if (g_ctx.verbose && state != mesh_ctx.role.state)
+        printf("[ROLE] %s -> %s\n", mesh_role_name(mesh_ctx.role.state), mesh_role_name(state));
+    mesh_ctx.role.state = state;
+}
 
-    while ((to_ms_since_boot(get_absolute_time()) - wait_start) < 5000) {
-        // Use winc_poll() to handle interrupts
-        winc_poll();
+static void mesh_role_start_ap(uint32_t now) {
+    mesh_role_set(WINC_MESH_ROLE_STARTING);
+    mesh_ctx.role.booting = false;
+    mesh_ctx.role.attempt_at = now;
+    winc_ap_begin(WINC_MESH_SSID, WINC_MESH_PASSWORD, WINC_P2P_CHANNEL);
+}
 
-        if (g_ctx.sockets[g_ctx.mesh.udp_socket].state == STATE_BOUND) {
-            printf("Socket bound successfully!\n");
-            break;
-        }
-        sleep_ms(100);
+// Look for the owner's AP, starting our own after takeover_ms. Every AP
+// runs on WINC_P2P_CHANNEL, so joins skip the full scan.
+static void mesh_role_join(uint32_t now, uint32_t takeover_ms) {
+    mesh_ctx.role.takeover_at = now + takeover_ms;
+    if (!takeover_ms) {
+        mesh_role_start_ap(now);
+        return;
     }
+    mesh_role_set(WINC_MESH_ROLE_JOINING);
+    mesh_ctx.role.attempt_at = now;
+    winc_sta_begin(WINC_MESH_SSID, WINC_MESH_PASSWORD, WINC_P2P_CHANNEL);
+}
 
-    g_ctx.mesh.enabled = true;
+// Our place in line for the AP: the lower ids among the nodes we have
+// routes to, leaving out the owner we are replacing
+static int mesh_role_rank(uint8_t skip) {
+    uint8_t me = g_ctx.mesh.my_node_id;
+    int rank = 0;
 
-    printf("\n========================================\n");
-    printf("MESH INITIALIZATION COMPLETE!\n");
-    printf("Role: %s\n", node_id == 1 ? "AP" : "Client");
-    printf("Socket: %d (state=%d)\n",
-           g_ctx.mesh.udp_socket,
-           g_ctx.sockets[g_ctx.mesh.udp_socket].state);
-    printf("========================================\n\n");
+    for (int i = 0; i < g_ctx.mesh.route_count; i++) {
+        uint8_t id = g_ctx.mesh.routes[i].node_id;
+        if (g_ctx.mesh.routes[i].active && id < me && id != skip)
+            rank++;
+    }
+    return rank;
+}
 
-    return true;
+// The owner is gone: give everyone ahead of us a turn at the AP
+static void mesh_role_lost(uint32_t now, const char *why) {
+    mesh_role_t *r = &mesh_ctx.role;
+    int rank = mesh_role_rank(r->go_node);
+
+    printf("[ROLE] Group owner %u lost (%s), %u in line to replace it\n",
+           r->go_node, why, rank);
+    r->stats.elections++;
+    r->stats.last_detect_ms = now - r->go_heard;
+    r->lost_at = now;
+    r->out = true;
+    r->go_node = 0;
+    mesh_role_join(now, rank * WINC_MESH_GO_TAKEOVER_MS);
 }
 
-// ===== MESH BEACON FUNCTIONS =====
-static bool mesh_send_beacon(void) {
-    winc_mesh_beacon_t beacon;
-    uint8_t idx = 0;
+// On a network: make sure the mesh socket is bound, then announce ourselves
+static void mesh_role_online(uint32_t now) {
+    mesh_role_t *r = &mesh_ctx.role;
+    int sock = g_ctx.mesh.udp_socket;
 
-    // Comprehensive checks before sending
-    if (!g_ctx.mesh.enabled) {
-        printf("[BEACON] ERROR: Mesh not enabled!\n");
-        return false;
+    if (r->out) {
+        r->out = false;
+        r->stats.last_outage_ms = now - r->lost_at;
+        if (r->stats.last_outage_ms > r->stats.max_outage_ms)
+            r->stats.max_outage_ms = r->stats.last_outage_ms;
+        printf("[ROLE] Back as %s after %lu ms\n", mesh_role_name(r->state),
+               (unsigned long)r->stats.last_outage_ms);
+        mesh_ctx.dv.full_pending = true;
+        if (g_ctx.mesh.enabled)
+            mesh_trickle_reset(now);
     }
 
-    if (g_ctx.mesh.udp_socket < 0) {
-        printf("[BEACON] ERROR: Invalid socket (%d)\n", g_ctx.mesh.udp_socket);
-        return false;
+    if (sock < 0) {
+        printf("Creating UDP socket on port %d...\n", WINC_MESH_PORT);
+        g_ctx.mesh.udp_socket = open_sock_server(WINC_MESH_PORT, false, mesh_packet_handler);
+        if (g_ctx.mesh.udp_socket < 0) {
+            printf("ERROR: Failed to create UDP socket\n");
+            return;
+        }
+        sock = g_ctx.mesh.udp_socket;
     }
 
-    if (g_ctx.sockets[g_ctx.mesh.udp_socket].state != STATE_BOUND) {
-        printf("[BEACON] ERROR: Socket not bound (state=%d)\n",
-               g_ctx.sockets[g_ctx.mesh.udp_socket].state);
-        return false;
+    if (!g_ctx.mesh.enabled && g_ctx.sockets[sock].state == STATE_BOUND) {
+        g_ctx.mesh.enabled = true;
+        mesh_trickle_reset(now);
+#if !WINC_MESH_TRICKLE
+        winc_timer_start(&mesh_ctx.timers, &mesh_ctx.beacon_timer, now);
+#endif
+        printf("\n========================================\n");
+        printf("MESH INITIALIZATION COMPLETE!\n");
+        printf("Role: %s\n", mesh_role_name(r->state));
+        printf("Socket: %d (state=%d)\n", sock, g_ctx.sockets[sock].state);
+        printf("========================================\n\n");
     }
+}
 
-    memset(&beacon, 0, sizeof(beacon));
+static void mesh_role_timer_fn(winc_timer_t *t, void *arg) {
+    mesh_role_t *r = &mesh_ctx.role;
+    uint32_t now = MESH_NOW_MS();
+    bool up = winc_is_network_ready();
 
-    // Build beacon header
-    beacon.hdr.msg_type = MESH_MSG_BEACON;
-    beacon.hdr.src_node = g_ctx.mesh.my_node_id;
-    beacon.hdr.dst_node = 0xFF;  // Broadcast
-    beacon.hdr.seq_num = g_ctx.mesh.seq_num++;
-    beacon.hdr.payload_len = sizeof(beacon) - sizeof(beacon.hdr);
+    switch (r->state) {
+        case WINC_MESH_ROLE_JOINING:
+            if (up) {
+                mesh_role_set(WINC_MESH_ROLE_CLIENT);
+                r->booting = false;
+                r->go_heard = now;          // Grace until its first beacon
+                mesh_role_online(now);
+            } else if ((int32_t)(now - r->takeover_at) >= 0 && r->booting) {
+                // Nobody's AP at boot: queue up behind the lower ids heard,
+                // or with nobody heard, behind every lower id there may be
+                int rank = g_ctx.mesh.route_count ? mesh_role_rank(0) : g_ctx.mesh.my_node_id - 1;
 
-    // Build beacon data
-    beacon.node_id = g_ctx.mesh.my_node_id;
-    strncpy((char*)beacon.node_name, g_ctx.mesh.my_name, sizeof(beacon.node_name) - 1);
+                r->booting = false;
+                r->takeover_at = now + rank * WINC_MESH_GO_TAKEOVER_MS;
+                if (g_ctx.verbose)
+                    printf("[ROLE] No group owner found, %d in line ahead of us\n", rank);
+            } else if ((int32_t)(now - r->takeover_at) >= 0) {
+                mesh_role_start_ap(now);
+            } else if (!winc_is_connected() &&
+                       now - r->attempt_at >= WINC_MESH_JOIN_RETRY_MS) {
+                r->attempt_at = now;
+                winc_sta_begin(WINC_MESH_SSID, WINC_MESH_PASSWORD, WINC_P2P_CHANNEL);
+            }
+            break;
 
-    // Add direct neighbors (1-hop nodes)
-    for (int i = 0; i < g_ctx.mesh.route_count && idx < WINC_MESH_MAX_NODES; i++) {
-        if (g_ctx.mesh.routes[i].active && g_ctx.mesh.routes[i].hop_count == 1) {
-            beacon.neighbors[idx++] = g_ctx.mesh.routes[i].node_id;
-        }
-    }
-    beacon.neighbor_count = idx;
+        case WINC_MESH_ROLE_STARTING:
+            if (up) {
+                mesh_role_set(WINC_MESH_ROLE_OWNER);
+                r->go_node = g_ctx.mesh.my_node_id;
+                mesh_role_online(now);
+            } else if (now - r->attempt_at >= WINC_MESH_AP_START_MS) {
+                mesh_role_start_ap(now);
+            }
+            break;
 
-    printf("[BEACON] Sending beacon from node %u (%u neighbors, socket=%d, size=%u)\n",
-           g_ctx.mesh.my_node_id, beacon.neighbor_count, g_ctx.mesh.udp_socket, sizeof(beacon));
+        case WINC_MESH_ROLE_CLIENT:
+            if (!winc_is_connected())
+                mesh_role_lost(now, "WiFi disconnected");
+            else if (r->go_node && now - r->go_heard > WINC_MESH_GO_TIMEOUT_MS)
+                mesh_role_lost(now, "no beacons");
+            else
+                mesh_role_online(now);
+            break;
 
-    bool result = put_sock_sendto(g_ctx.mesh.udp_socket, &beacon, sizeof(beacon));
-    if (!result) {
-        printf("[BEACON] ERROR: Failed to send beacon!\n");
+        case WINC_MESH_ROLE_OWNER:
+            if (!up) {
+                r->lost_at = now;
+                r->out = true;
+                mesh_role_start_ap(now);
+            } else if (r->go_node && r->go_node < g_ctx.mesh.my_node_id &&
+                       now - r->go_heard <= WINC_MESH_GO_TIMEOUT_MS) {
+                // Two networks met: join the lower-id owner's, and should
+                // it vanish meanwhile, wait our turn like everyone else
+                printf("[ROLE] Group owner %u outranks us, handing over\n", r->go_node);
+                r->stats.handovers++;
+                r->lost_at = now;
+                r->out = true;
+                mesh_role_join(now, MAX(1, mesh_role_rank(0)) * WINC_MESH_GO_TAKEOVER_MS);
+            } else {
+                mesh_role_online(now);
+            }
+            break;
     }
-    return result;
+    winc_timer_start(&mesh_ctx.timers, t, now + MESH_ROLE_POLL_MS);
 }
 
-// Handle received beacon
-static void mesh_handle_beacon(winc_mesh_beacon_t *beacon) {
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-
-    printf("[BEACON] Received beacon from node %u (%s), %u neighbors\n",
-           beacon->node_id, beacon->node_name, beacon->neighbor_count);
+void winc_mesh_get_role_stats(winc_mesh_role_stats_t *stats) {
+    *stats = mesh_ctx.role.stats;
+    stats->role = mesh_ctx.role.state;
+    stats->go_node = mesh_ctx.role.go_node;
+    stats->takeover_at = mesh_ctx.role.takeover_at;
+}
 
-    if (g_ctx.verbose > 1)
-        printf("Beacon from node %u (%s), %u neighbors\n",
-               beacon->node_id, beacon->node_name, beacon->neighbor_count);
+// ===== TIME SYNC =====
 
-    // Update direct route to beacon sender (1 hop)
-    mesh_update_route(beacon->node_id, beacon->node_id, 1);
+// Mesh time at our clock reading local_us
+static uint64_t mesh_sync_global(uint64_t local_us) {
+    mesh_sync_t *s = &mesh_ctx.sync;
+    int64_t dx = (int64_t)(local_us - s->ref_us);
 
-    // Update indirect routes through beacon sender
-    for (int i = 0; i < beacon->neighbor_count; i++) {
-        uint8_t neighbor_id = beacon->neighbors[i];
-        
-        // Skip ourselves
-        if (neighbor_id == g_ctx.mesh.my_node_id)
-            continue;
+    return local_us + s->offset_us + dx * s->skew_ppb / 1000000000;
+}
 
-        // Update or add 2-hop route through beacon sender
-        mesh_update_route(neighbor_id, beacon->node_id, 2);
-    }
+// A span of our clock in mesh time, which runs at the root's rate
+static uint32_t mesh_sync_span(uint32_t local_us) {
+    return local_us + (int32_t)((int64_t)local_us * mesh_ctx.sync.skew_ppb / 1000000000);
 }
 
-// ===== MESH DATA FUNCTIONS =====
-bool winc_mesh_send(uint8_t dst_node, uint8_t *data, uint16_t len) {
-    struct {
-        winc_mesh_hdr_t hdr;
-        uint8_t payload[];
-    } __attribute__((packed)) *pkt;
+// Error bound at local_us: the parent's, the delay to it, what the fit
+// leaves, and crystal wander (2 ppm) since the last reading
+static uint32_t mesh_sync_err(uint64_t local_us) {
+    mesh_sync_t *s = &mesh_ctx.sync;
+    const mesh_sync_sample_t *last;
 
-    int next_hop;
-    bool result = false;
+    if (!s->root)
+        return UINT32_MAX;
+    if (s->root == g_ctx.mesh.my_node_id || !s->count)
+        return 0;
+    last = &s->samples[(s->head + WINC_MESH_SYNC_SAMPLES - 1) % WINC_MESH_SYNC_SAMPLES];
+    return s->parent_err_us + 2 * s->delay_dev_us + s->resid_us + 1 +
+           (uint32_t)((local_us - last->local_us) / 500000);
+}
 
-    if (!g_ctx.mesh.enabled) {
-        printf("ERROR: Mesh not enabled (P2P mode or UDP socket failed during init)\n");
-        return false;
-    }
+// num * 1e9 / den, a digit group at a time so nothing overflows while
+// |den| < 2^53
+static int64_t mesh_sync_ppb(int64_t num, int64_t den) {
+    int64_t q = num / den, r = num % den;
 
-    if (g_ctx.mesh.udp_socket < 0) {
-        printf("ERROR: UDP socket invalid (socket=%d)\n", g_ctx.mesh.udp_socket);
-        return false;
+    for (int i = 0; i < 3; i++) {
+        r *= 1000;
+        q = q * 1000 + r / den;
+        r %= den;
     }
+    return q;
+}
 
-    // Find route to destination
-    next_hop = mesh_find_route(dst_node);
-    if (next_hop < 0) {
-        printf("ERROR: No route to node %u (known nodes: %u)\n", dst_node, g_ctx.mesh.route_count);
-        return false;
-    }
+// Least-squares line through the readings, anchored at the newest. All in
+// integers, as the RP2040 has no FPU and the RP2350's is single precision:
+// x is centred and shifted down until it fits 20 bits, which keeps the
+// sums well inside 64 bits for up to 64 readings and loses under a
+// nanosecond per reading at 500 ppm
+static void mesh_sync_fit(void) {
+    mesh_sync_t *s = &mesh_ctx.sync;
+    const mesh_sync_sample_t *ref = &s->samples[(s->head + WINC_MESH_SYNC_SAMPLES - 1) %
+                                                WINC_MESH_SYNC_SAMPLES];
+    int64_t sx = 0, sy = 0, su = 0, sv = 0, suu = 0, suv = 0, n = s->count, cx, cy, den, ppb;
+    uint64_t span = 0;
+    uint32_t resid = 0;
+    int shift = 0;
 
-    // Allocate packet buffer
-    pkt = malloc(sizeof(winc_mesh_hdr_t) + len);
-    if (!pkt) {
-        printf("Failed to allocate packet buffer\n");
-        return false;
+    for (int i = 0; i < s->count; i++) {
+        int64_t x = (int64_t)(s->samples[i].local_us - ref->local_us);
+        sx += x;
+        sy += s->samples[i].offset_us - ref->offset_us;
+        if ((uint64_t)-x > span)
+            span = (uint64_t)-x;
     }
+    while ((span >> shift) >= (1u << 19))
+        shift++;
+    cx = sx / n;
+    cy = sy / n;
 
-    // Build packet header
-    pkt->hdr.msg_type = MESH_MSG_DATA;
-    pkt->hdr.src_node = g_ctx.mesh.my_node_id;
-    pkt->hdr.dst_node = dst_node;
-    pkt->hdr.hop_count = 0;
-    pkt->hdr.seq_num = g_ctx.mesh.seq_num++;
-    pkt->hdr.payload_len = len;
+    for (int i = 0; i < s->count; i++) {
+        int64_t u = ((int64_t)(s->samples[i].local_us - ref->local_us) - cx) / (1 << shift);
+        int64_t v = s->samples[i].offset_us - ref->offset_us - cy;
+        su += u;
+        sv += v;
+        suu += u * u;
+        suv += u * v;
+    }
+    den = n * suu - su * su;
+    ppb = s->count > 1 && den > 0 ? mesh_sync_ppb(n * suv - su * sv, den) / (1 << shift)
+                                  : s->skew_ppb;
+    ppb = MAX(-500000, MIN(500000, ppb));     // No crystal is worse
 
-    // Copy payload
-    memcpy(pkt->payload, data, len);
+    s->ref_us = ref->local_us;
+    s->offset_us = ref->offset_us + (sy - sx * ppb / 1000000000) / n;
+    s->skew_ppb = (int32_t)ppb;
 
-    if (g_ctx.verbose)
-        printf("Sending %u bytes to node %u via hop %d\n", len, dst_node, next_hop);
+    for (int i = 0; i < s->count; i++) {
+        int64_t e = (int64_t)mesh_sync_global(s->samples[i].local_us) -
+                    (int64_t)(s->samples[i].local_us + s->samples[i].offset_us);
+        if ((uint64_t)(e < 0 ? -e : e) > resid)
+            resid = (uint32_t)(e < 0 ? -e : e);
+    }
+    s->resid_us = resid;
+}
 
-    result = put_sock_sendto(g_ctx.mesh.udp_socket, pkt, sizeof(winc_mesh_hdr_t) + len);
+// Our clock read local_us when the mesh time was global_us
+static void mesh_sync_sample(uint64_t local_us, uint64_t global_us) {
+    mesh_sync_t *s = &mesh_ctx.sync;
+    int64_t miss = (int64_t)(mesh_sync_global(local_us) - global_us);
 
-    if (!result) {
-        printf("ERROR: put_sock_sendto failed (socket=%d, len=%u)\n",
-               g_ctx.mesh.udp_socket, sizeof(winc_mesh_hdr_t) + len);
+    // Far off the fit: a reading held up in a queue, which we skip, or if
+    // the next ones agree, the timescale itself moved (the root rebooted)
+    if (s->count && (miss > WINC_MESH_SYNC_STEP_US || miss < -WINC_MESH_SYNC_STEP_US)) {
+        if (++s->outliers < 3)
+            return;
+        printf("[SYNC] Mesh time stepped by %lld us, restarting fit\n", (long long)-miss);
+        s->count = 0;
+        s->head = 0;
+        s->steps++;
     }
+    s->outliers = 0;
 
-    free(pkt);
-    return result;
+    s->samples[s->head].local_us = local_us;
+    s->samples[s->head].offset_us = (int64_t)(global_us - local_us);
+    s->head = (s->head + 1) % WINC_MESH_SYNC_SAMPLES;
+    if (s->count < WINC_MESH_SYNC_SAMPLES)
+        s->count++;
+    mesh_sync_fit();
 }
 
-// Route a packet through the mesh
-static bool mesh_route_packet(winc_mesh_hdr_t *hdr, uint8_t *data) {
-    int next_hop;
+// Time block of a beacon from a neighbour
+static void mesh_sync_heard(uint8_t sender, mesh_link_t *link, const winc_mesh_time_t *t, uint32_t now) {
+    mesh_sync_t *s = &mesh_ctx.sync;
+    uint8_t me = g_ctx.mesh.my_node_id;
 
-    // Check if packet is for us
-    if (hdr->dst_node == g_ctx.mesh.my_node_id) {
-        // Deliver to application
-        if (g_ctx.mesh.data_callback) {
-            g_ctx.mesh.data_callback(hdr->src_node, data, hdr->payload_len);
+    // Its echo of one of our beacons: the round trip less its hold time
+    if (t->echo_node == me) {
+        for (int k = 0; k < 4; k++) {
+            if (s->sent[k].local_us && s->sent[k].stamp == t->echo_stamp) {
+                uint32_t rtt = mesh_sync_span((uint32_t)s->rx_us - s->sent[k].local_us) -
+                               t->echo_hold_us;
+                if ((int32_t)rtt > 0 && rtt < 1000000) {
+                    uint32_t owd = rtt / 2 ? rtt / 2 : 1;
+                    if (link->delay_us) {
+                        uint32_t dev = owd > link->delay_us ? owd - link->delay_us : link->delay_us - owd;
+                        link->delay_dev_us = (3 * link->delay_dev_us + dev) / 4;
+                        link->delay_us = (7 * link->delay_us + owd) / 8;
+                    } else {
+                        link->delay_us = owd;
+                        link->delay_dev_us = owd / 2;
+                    }
+                }
+                break;
+            }
         }
-        return true;
     }
+    link->sync_stamp = (uint32_t)t->tx_us;
+    link->sync_rx_us = (uint32_t)s->rx_us;
+    link->sync_heard = true;
 
-    // Check hop count
-    if (hdr->hop_count >= MESH_MSG_ROUTE_RESP) {  // Max 4 hops
-        if (g_ctx.verbose)
-            printf("Packet exceeded max hops, dropping\n");
-        return false;
-    }
+    // Take time only from a newer round of the lowest root we know of
+    if (!t->root || t->root == me || (s->root && t->root > s->root))
+        return;
+    if (t->root == s->root && (int16_t)(t->seq - s->seq) <= 0)
+        return;
 
-    // Find next hop
-    next_hop = mesh_find_route(hdr->dst_node);
-    if (next_hop < 0) {
-        if (g_ctx.verbose)
-            printf("No route to node %u, dropping packet\n", hdr->dst_node);
-        return false;
+    // Another root's timescale: the old readings no longer apply
+    if (t->root != s->root) {
+        printf("[SYNC] Time root %u via node %u, depth %u\n", t->root, sender, t->depth + 1);
+        s->count = 0;
+        s->head = 0;
+        s->outliers = 0;
     }
+    s->root = t->root;
+    s->seq = t->seq;
+    s->parent = sender;
+    s->depth = t->depth + 1;
+    s->parent_err_us = t->err_us;
+    s->delay_dev_us = link->delay_us ? link->delay_dev_us : MESH_SYNC_DELAY_GUESS_US;
+    s->last_sample = now;
+    mesh_sync_sample(s->rx_us, t->tx_us + link->delay_us);
+}
 
-    // Increment hop count and forward
-    hdr->hop_count++;
+// Fill in a queued beacon's time block as it goes to the WINC
+static void mesh_sync_stamp(uint8_t *buf, int len) {
+    winc_mesh_beacon_t *b = (winc_mesh_beacon_t*)buf;
+    int at = len - (int)sizeof(winc_mesh_time_t);
+    winc_mesh_time_t *t = (winc_mesh_time_t*)(buf + at);
+    mesh_sync_t *s = &mesh_ctx.sync;
+    int32_t backlog = (int32_t)(mesh_ctx.txq.radio_free_us - time_us_32());
+    uint64_t now = time_us_64() + MAX(backlog, 0);  // When the WINC should send it
 
-    if (g_ctx.verbose > 1)
-        printf("Forwarding packet to node %u via hop %d\n", hdr->dst_node, next_hop);
+    if (!(b->flags & MESH_BEACON_TIME) || at < (int)offsetof(winc_mesh_beacon_t, entries))
+        return;
 
-    // Forward packet
-    return put_sock_sendto(g_ctx.mesh.udp_socket, hdr, 
-                          sizeof(winc_mesh_hdr_t) + hdr->payload_len);
-}
+    if (s->root == g_ctx.mesh.my_node_id)
+        s->seq++;
+    t->root = s->root;
+    t->depth = s->depth;
+    t->seq = s->seq;
+    t->err_us = MIN(mesh_sync_err(now), 0xFFFF);
+    t->tx_us = mesh_sync_global(now);
 
-// ===== ROUTING TABLE FUNCTIONS =====
-static void mesh_update_route(uint8_t node_id, uint8_t next_hop, uint8_t hop_count) {
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-    int existing = -1;
-    int free_slot = -1;
+    // Echo our neighbours in turn so each can measure its delay to us
+    t->echo_node = 0;
+    for (int k = 0; k < WINC_MESH_MAX_NODES; k++) {
+        int i = (s->echo_next + k) % WINC_MESH_MAX_NODES;
+        mesh_link_t *l = &mesh_ctx.links[i];
 
-    // Find existing entry or free slot
-    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
-        if (g_ctx.mesh.routes[i].active && g_ctx.mesh.routes[i].node_id == node_id) {
-            existing = i;
+        if (l->active && l->sync_heard) {
+            t->echo_node = l->node_id;
+            t->echo_stamp = l->sync_stamp;
+            t->echo_hold_us = mesh_sync_span((uint32_t)now - l->sync_rx_us);
+            s->echo_next = (i + 1) % WINC_MESH_MAX_NODES;
             break;
         }
-        if (!g_ctx.mesh.routes[i].active && free_slot < 0) {
-            free_slot = i;
-        }
     }
 
-    // Update existing or add new
-    if (existing >= 0) {
-        // Update if better route or refresh same route
-        if (hop_count <= g_ctx.mesh.routes[existing].hop_count) {
-            g_ctx.mesh.routes[existing].next_hop = next_hop;
-            g_ctx.mesh.routes[existing].hop_count = hop_count;
-            g_ctx.mesh.routes[existing].last_seen = now;
-        }
-    } else if (free_slot >= 0) {
-        // Add new route
-        g_ctx.mesh.routes[free_slot].node_id = node_id;
-        g_ctx.mesh.routes[free_slot].next_hop = next_hop;
-        g_ctx.mesh.routes[free_slot].hop_count = hop_count;
-        g_ctx.mesh.routes[free_slot].last_seen = now;
-        g_ctx.mesh.routes[free_slot].active = true;
-        
-        if (free_slot >= g_ctx.mesh.route_count) {
-            g_ctx.mesh.route_count = free_slot + 1;
-        }
+    s->sent[s->sent_head].stamp = (uint32_t)t->tx_us;
+    s->sent[s->sent_head].local_us = (uint32_t)now;
+    s->sent_head = (s->sent_head + 1) % 4;
+}
 
-        if (g_ctx.verbose)
-            printf("New route: Node %u via %u (%u hops)\n", node_id, next_hop, hop_count);
+// Become a root when no time reaches us; our fit stays frozen, so the mesh
+// time carries on where the old root left it
+static void mesh_sync_check(uint32_t now) {
+    mesh_sync_t *s = &mesh_ctx.sync;
+
+    if (!g_ctx.mesh.enabled) {
+        s->since = now;
+        return;
+    }
+    if (s->root == g_ctx.mesh.my_node_id)
+        return;
+    if (s->root ? now - s->last_sample > WINC_MESH_SYNC_TIMEOUT_MS
+                : now - s->since > WINC_MESH_SYNC_CLAIM_MS) {
+        printf("[SYNC] %s, taking over as time root\n",
+               s->root ? "Time root silent" : "No time source");
+        s->root = g_ctx.mesh.my_node_id;
+        s->parent = 0;
+        s->depth = 0;
+        s->parent_err_us = 0;
+        s->delay_dev_us = 0;
     }
 }
 
-// Find best route to destination
-static int mesh_find_route(uint8_t dst_node) {
-    int best = -1;
-    uint8_t min_hops = 255;
+uint64_t winc_mesh_time_us(uint32_t *err_us) {
+    uint64_t now = time_us_64();
 
-    for (int i = 0; i < g_ctx.mesh.route_count; i++) {
-        if (g_ctx.mesh.routes[i].active &&
-            g_ctx.mesh.routes[i].node_id == dst_node &&
-            g_ctx.mesh.routes[i].hop_count < min_hops) {
-            best = i;
-            min_hops = g_ctx.mesh.routes[i].hop_count;
-        }
-    }
+    if (err_us)
+        *err_us = mesh_sync_err(now);
+    return mesh_sync_global(now);
+}
 
-    return (best >= 0) ? g_ctx.mesh.routes[best].next_hop : -1;
+void winc_mesh_get_sync_stats(winc_mesh_sync_stats_t *stats) {
+    mesh_sync_t *s = &mesh_ctx.sync;
+    uint64_t now = time_us_64();
+    mesh_link_t *l = s->parent ? mesh_link_find(s->parent) : NULL;
+
+    memset(stats, 0, sizeof(*stats));
+    stats->synced = s->root != 0;
+    stats->root = s->root;
+    stats->parent = s->parent;
+    stats->depth = s->depth;
+    stats->samples = s->count;
+    stats->skew_ppb = s->skew_ppb;
+    stats->offset_us = (int64_t)(mesh_sync_global(now) - now);
+    stats->err_us = mesh_sync_err(now);
+    stats->delay_us = l ? l->delay_us : 0;
+    stats->steps = s->steps;
 }
 
-// ===== PACKET HANDLER =====
+// ===== TIMERS =====
 
-// Handle incoming mesh packets (called by socket layer)
-static void mesh_packet_handler(uint8_t sock, int rxlen) {
-    uint8_t buf[1600];
-    winc_mesh_hdr_t *hdr;
+static void mesh_beacon_timer_fn(winc_timer_t *t, void *arg) {
+    uint32_t now = MESH_NOW_MS();
 
-    printf("[RX] Packet received on socket %u, length=%d\n", sock, rxlen);
+#if WINC_MESH_TRICKLE
+    mesh_trickle_process(now);
+#else
+    if (g_ctx.verbose > 1)
+        printf("[MESH] Time to send beacon (last=%lu, now=%lu, interval=%d)\n",
+               g_ctx.mesh.last_beacon, now, WINC_MESH_BEACON_INTERVAL_MS);
+    mesh_send_beacon();
+    g_ctx.mesh.last_beacon = now;
+    mesh_ctx.beacon_stats.interval_ms = WINC_MESH_BEACON_INTERVAL_MS;
+    winc_timer_start(&mesh_ctx.timers, t, now + WINC_MESH_BEACON_INTERVAL_MS);
+#endif
+}
 
-    if (rxlen <= 0) {
-        if (rxlen < 0)
-            printf("[RX] ERROR: Socket error %d\n", rxlen);
+// A route's timer runs from when it was added; beacons only refresh
+// last_seen, so on expiry the timer either drops the route or re-arms
+static void mesh_route_timer_fn(winc_timer_t *t, void *arg) {
+    int slot = (int)(intptr_t)arg;
+    uint32_t now = MESH_NOW_MS();
+
+    if (!g_ctx.mesh.routes[slot].active)
         return;
+    if (now - g_ctx.mesh.routes[slot].last_seen > WINC_MESH_ROUTE_TIMEOUT_MS) {
+        if (g_ctx.verbose)
+            printf("Route to node %u timed out\n", g_ctx.mesh.routes[slot].node_id);
+        mesh_route_invalidate(slot, now);
+        mesh_trickle_reset(now);
+    } else {
+        winc_timer_start(&mesh_ctx.timers, t,
+                         g_ctx.mesh.routes[slot].last_seen + WINC_MESH_ROUTE_TIMEOUT_MS + 1);
     }
+}
 
-    // Get packet data
-    if (!get_sock_data(sock, buf, rxlen)) {
-        printf("[RX] ERROR: Failed to get mesh packet data\n");
-        return;
+static void mesh_housekeeping_fn(winc_timer_t *t, void *arg) {
+    uint32_t now = MESH_NOW_MS();
+
+    // Expire hold-downs (poisons stop being advertised once they lapse)
+    mesh_holddown_find(0, now);
+
+    // Forget neighbours silent for two route timeouts. Outliving the route
+    // keeps a lossy link's history when it comes back, instead of
+    // restarting it with a clean window.
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        if (mesh_ctx.links[i].active &&
+            now - mesh_ctx.links[i].last_heard > 2 * WINC_MESH_ROUTE_TIMEOUT_MS)
+            mesh_ctx.links[i].active = false;
     }
 
-    hdr = (winc_mesh_hdr_t*)buf;
+#if WINC_MESH_REASM_SLOTS
+    mesh_reasm_process(now);
+#endif
+    mesh_sync_check(now);
+    winc_timer_start(&mesh_ctx.timers, t, now + MESH_HOUSEKEEPING_MS);
+}
 
-    printf("[RX] Mesh packet: type=%u, src=%u, dst=%u, hops=%u, len=%u\n",
-           hdr->msg_type, hdr->src_node, hdr->dst_node,
-           hdr->hop_count, hdr->payload_len);
+static void mesh_timers_init(uint32_t now) {
+    winc_timer_wheel_init(&mesh_ctx.timers, now);
+    winc_timer_init(&mesh_ctx.beacon_timer, mesh_beacon_timer_fn, NULL);
+    winc_timer_init(&mesh_ctx.full_timer, mesh_full_timer_fn, NULL);
+    winc_timer_init(&mesh_ctx.housekeeping_timer, mesh_housekeeping_fn, NULL);
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++)
+        winc_timer_init(&mesh_ctx.route_timer[i], mesh_route_timer_fn, (void*)(intptr_t)i);
+    for (int i = 0; i < WINC_MESH_RTX_SLOTS; i++)
+        winc_timer_init(&mesh_ctx.rtx[i].timer, mesh_rtx_timer_fn, &mesh_ctx.rtx[i]);
+    winc_timer_init(&mesh_ctx.ping.timer, mesh_ping_timer_fn, NULL);
+    winc_timer_init(&mesh_ctx.bp.timer, mesh_bp_timer_fn, NULL);
+    for (int i = 0; i < WINC_MESH_REORDER_SLOTS; i++)
+        winc_timer_init(&mesh_ctx.order.rx[i].timer, mesh_order_timer_fn, &mesh_ctx.order.rx[i]);
+#if WINC_MESH_STREAMS
+    for (int i = 0; i < WINC_MESH_STREAMS; i++) {
+        winc_timer_init(&mesh_ctx.stream.socks[i].timer, mesh_stream_timer_fn, &mesh_ctx.stream.socks[i]);
+        winc_timer_init(&mesh_ctx.stream.socks[i].ack_timer, mesh_stream_ack_timer_fn,
+                        &mesh_ctx.stream.socks[i]);
+    }
+#endif
+    for (int i = 0; i < WINC_MESH_RPC_CALLS; i++)
+        winc_timer_init(&mesh_ctx.rpc.calls[i].timer, mesh_rpc_timer_fn, &mesh_ctx.rpc.calls[i]);
+    winc_timer_init(&mesh_ctx.kv.timer, mesh_kv_timer_fn, NULL);
+    winc_timer_init(&mesh_ctx.role.timer, mesh_role_timer_fn, NULL);
+    winc_timer_start(&mesh_ctx.timers, &mesh_ctx.housekeeping_timer, now + MESH_HOUSEKEEPING_MS);
+}
 
-    // Process based on message type
-    switch (hdr->msg_type) {
-        case MESH_MSG_BEACON:
-            printf("[RX] Processing BEACON from node %u\n", hdr->src_node);
-            mesh_handle_beacon((winc_mesh_beacon_t*)buf);
-            break;
+uint32_t winc_mesh_next_deadline_ms(void) {
+    mesh_txq_t *t = &mesh_ctx.txq;
+    uint32_t next, hold;
 
-        case MESH_MSG_DATA:
-            if (hdr->dst_node == g_ctx.mesh.my_node_id || hdr->dst_node == 0xFF) {
-                // Packet is for us
-                if (g_ctx.mesh.data_callback) {
-                    g_ctx.mesh.data_callback(hdr->src_node,
-                                           buf + sizeof(winc_mesh_hdr_t),
-                                           hdr->payload_len);
-                }
-            } else {
-                // Route to next hop
-                mesh_route_packet(hdr, buf + sizeof(winc_mesh_hdr_t));
-            }
-            break;
+    if (!g_ctx.mesh.my_node_id)
+        return UINT32_MAX;
+    next = winc_timer_next_ms(&mesh_ctx.timers, MESH_NOW_MS());
 
-        default:
-            if (g_ctx.verbose)
-                printf("Unknown mesh message type: %u\n", hdr->msg_type);
+    // Frames held back by radio pacing go out as the WINC's backlog drains
+    for (int c = 0; c < WINC_MESH_CLASSES; c++) {
+        if (t->cls[c].head >= 0 && !mesh_bp_hold_ms(c)) {
+            int32_t wait_us = (int32_t)(t->radio_free_us - time_us_32()) - WINC_MESH_TX_BACKLOG_US;
+            next = MIN(next, wait_us > 0 ? MESH_US_TO_MS((uint32_t)wait_us) : 0);
             break;
+        }
+    }
+
+    // Traffic held for our transmit slot
+    for (int k = 0; k < 2; k++) {
+        int c = k ? WINC_MESH_CLASS_BULK : WINC_MESH_CLASS_NORMAL;
+        if (t->cls[c].head >= 0 && !mesh_bp_hold_ms(c))
+            next = MIN(next, MESH_US_TO_MS(mesh_tdma_wait_us(time_us_32(),
+                                                             MESH_FRAME(t->cls[c].head)->len)));
+    }
+
+#if WINC_MESH_AGGREGATE
+    // Aggregation deadlines, rounded down: better to poll once too early
+    for (int i = 0; i < WINC_MESH_AGG_QUEUES; i++) {
+        if (mesh_ctx.agg[i].count) {
+            int32_t wait_us = (int32_t)(mesh_ctx.agg[i].due_us - time_us_32());
+            next = MIN(next, wait_us > 0 ? (uint32_t)wait_us / 1000 : 0);
+        }
     }
+#endif
+
+    // Bulk traffic held for a busy next hop, until its report runs out
+    hold = mesh_bp_hold_ms(WINC_MESH_CLASS_BULK);
+    if (hold)
+        next = MIN(next, hold);
+    return next;
 }
 
 // ===== MESH PROCESSING =====
 
-// Process mesh events (called from winc_poll)
+// Process mesh events (called from winc_poll). Only timers that are due do
+// any work, so an idle poll is a few comparisons.
 void winc_mesh_process(void) {
     static bool first_call = true;
-    uint32_t now = to_ms_since_boot(get_absolute_time());
 
     if (first_call) {
         printf("[MESH] winc_mesh_process called for first time (enabled=%d)\n", g_ctx.mesh.enabled);
         first_call = false;
     }
 
-    if (!g_ctx.mesh.enabled)
+    // Timers run from winc_mesh_init() on; the role election on them is
+    // what brings the mesh up
+    if (!g_ctx.mesh.my_node_id)
         return;
 
-    // Send periodic beacons
-    if (now - g_ctx.mesh.last_beacon > WINC_MESH_BEACON_INTERVAL_MS) {
-        printf("[MESH] Time to send beacon (last=%lu, now=%lu, interval=%d)\n",
-               g_ctx.mesh.last_beacon, now, WINC_MESH_BEACON_INTERVAL_MS);
-        mesh_send_beacon();
-        g_ctx.mesh.last_beacon = now;
-    }
-
-    // Timeout old routes
-    for (int i = 0; i < g_ctx.mesh.route_count; i++) {
-        if (g_ctx.mesh.routes[i].active &&
-            (now - g_ctx.mesh.routes[i].last_seen > WINC_MESH_ROUTE_TIMEOUT_MS)) {
-            if (g_ctx.verbose)
-                printf("Route to node %u timed out\n", g_ctx.mesh.routes[i].node_id);
-            g_ctx.mesh.routes[i].active = false;
-        }
+    winc_timer_run(&mesh_ctx.timers, MESH_NOW_MS());
+    if (g_ctx.mesh.enabled) {
+#if WINC_MESH_AGGREGATE
+        mesh_agg_run(time_us_32());
+#endif
+        mesh_txq_run();
     }
 }
 
@@ -636,24 +6228,74 @@ void mesh_print_routing_table(void) {
     printf("\n=== Mesh Routing Table ===\n");
     printf("Local Node: %u (%s)\n", g_ctx.mesh.my_node_id, g_ctx.mesh.my_name);
     printf("Active Routes: %u\n", g_ctx.mesh.route_count);
+    if (mesh_ctx.sync.root)
+        printf("Mesh Time: root %u, depth %u, skew %ld ppb, error %lu us\n", mesh_ctx.sync.root,
+               mesh_ctx.sync.depth, (long)mesh_ctx.sync.skew_ppb,
+               (unsigned long)mesh_sync_err(time_us_64()));
     
     if (g_ctx.mesh.route_count > 0) {
-        printf("\nNode  Hops  Next-Hop  Last-Seen  Status\n");
-        printf("----  ----  --------  ---------  ------\n");
+        printf("\nNode  Hops  Next-Hop   ETX  Last-Seen  Status\n");
+        printf("----  ----  --------  ----  ---------  ------\n");
         
         for (int i = 0; i < g_ctx.mesh.route_count; i++) {
             if (g_ctx.mesh.routes[i].active) {
                 uint32_t age = (to_ms_since_boot(get_absolute_time()) - 
                                g_ctx.mesh.routes[i].last_seen) / 1000;
-                printf("%4u  %4u  %8u  %7us  Active\n",
+                uint8_t etx = mesh_ctx.route_ext[i].metric;
+                printf("%4u  %4u  %8u  %2u.%u  %7us  Active\n",
                        g_ctx.mesh.routes[i].node_id,
                        g_ctx.mesh.routes[i].hop_count,
                        g_ctx.mesh.routes[i].next_hop,
+                       etx / WINC_MESH_ETX_ONE,
+                       (etx % WINC_MESH_ETX_ONE) * 10 / WINC_MESH_ETX_ONE,
                        age);
             }
         }
+
+        for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+            mesh_holddown_t *h = &mesh_ctx.dv.holddown[i];
+            if (h->active)
+                printf("%4u  %4u  %8u     -          -  Hold-down\n",
+                       h->node_id, h->hops, h->next_hop);
+        }
     } else {
         printf("No routes discovered yet\n");
     }
+
+    printf("\nNeighbour  Rx%%  Tx%%  Link-ETX  RTT(ms)  RTO(ms)  Name\n");
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        mesh_link_t *l = &mesh_ctx.links[i];
+        if (l->active) {
+            uint8_t etx = mesh_link_etx(l->node_id);
+            printf("%9u  %3u  %3u  ", l->node_id, l->rx_ratio * 100 / 255,
+                   l->tx_ratio * 100 / 255);
+            if (etx >= WINC_MESH_METRIC_INFINITY)
+                printf("     inf");
+            else
+                printf("%6u.%u", etx / WINC_MESH_ETX_ONE,
+                       (etx % WINC_MESH_ETX_ONE) * 10 / WINC_MESH_ETX_ONE);
+            if (l->srtt_us)
+                printf("  %7lu", (unsigned long)(l->srtt_us / 1000));
+            else
+                printf("        -");
+            printf("  %7lu  %s\n", (unsigned long)(mesh_link_rto_us(l->node_id) / 1000),
+                   mesh_ctx.adv[i].name[0] ? mesh_ctx.adv[i].name : "-");
+        }
+    }
+
+    printf("\nNeighbour  Beacons/Missed  Rx-Frames  Forwarded  No-Route  Max-Hops  Q-Full"
+           "  Tx-Frames  Rtx/Lost  Rx-KB  Tx-KB\n");
+    for (int i = 0; i < WINC_MESH_MAX_NODES; i++) {
+        winc_mesh_neighbor_stats_t *n = &mesh_ctx.nbr[i];
+        if (mesh_ctx.links[i].active)
+            printf("%9u  %7lu/%-6lu  %9lu  %9lu  %8lu  %8lu  %6lu  %9lu  %4lu/%-4lu  %5lu  %5lu\n",
+                   n->node_id, (unsigned long)n->beacons_heard,
+                   (unsigned long)n->beacons_missed, (unsigned long)n->rx_frames,
+                   (unsigned long)n->forwarded, (unsigned long)n->drop_no_route,
+                   (unsigned long)n->drop_max_hops, (unsigned long)n->drop_queue_full,
+                   (unsigned long)n->tx_frames, (unsigned long)n->retransmits,
+                   (unsigned long)n->tx_lost, (unsigned long)(n->rx_bytes / 1024),
+                   (unsigned long)(n->tx_bytes / 1024));
+    }
     printf("========================\n\n");
-}
\ No newline at end of file
+}
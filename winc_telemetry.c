@@ -9,6 +9,7 @@
 #include "winc_telemetry.h"
 #include "winc_lib.h"
 #include "winc_mesh.h"
+#include "winc_timer.h"
 
 // Global telemetry context
 static telemetry_ctx_t telem_ctx;
@@ -453,91 +454,107 @@ bool udp_send_telemetry(uint8_t dst_node, void *data, uint16_t len,
 }
 
 // ============= MULTI-CORE THREADING =============
+
+// Core 1 timers; only core1_network_handler() touches them
+static winc_timer_wheel_t core1_timers;
+static winc_timer_t beacon_timer, health_timer, mode_timer;
+
+static uint32_t core1_now(void) {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+static void beacon_timer_fn(winc_timer_t *t, void *arg) {
+    udp_broadcast_beacon();
+    winc_timer_start(&core1_timers, t, core1_now() + telem_ctx.beacon_interval);
+}
+
+// Check TCP connection health
+static void health_timer_fn(winc_timer_t *t, void *arg) {
+    uint32_t now = core1_now();
+
+    for (int i = 0; i < 4; i++) {
+        tcp_connection_t *conn = &telem_ctx.tcp_connections[i];
+        if (conn->connected &&
+            (now - conn->last_activity) > 30000) {  // 30 second timeout
+            printf("[TCP] Connection %d timed out\n", i);
+            conn->connected = false;
+            put_sock_close(conn->sock);
+        }
+    }
+    winc_timer_start(&core1_timers, t, now + 5000);  // Every 5 seconds
+}
+
+// Process network mode
+static void mode_timer_fn(winc_timer_t *t, void *arg) {
+    if (g_ctx.connection_state.is_ap_mode) {
+        process_ap_mode();
+        winc_timer_start(&core1_timers, t, core1_now() + 1000);    // Check every second
+    } else {
+        process_p2p_mode();
+        winc_timer_start(&core1_timers, t, core1_now() + 10000);   // Update routes every 10 seconds
+    }
+}
+
 void core1_network_handler(void) {
     printf("[CORE1] Network handler started\n");
     
+    uint32_t now = core1_now();
+
+    winc_timer_wheel_init(&core1_timers, now);
+    winc_timer_init(&beacon_timer, beacon_timer_fn, NULL);
+    winc_timer_init(&health_timer, health_timer_fn, NULL);
+    winc_timer_init(&mode_timer, mode_timer_fn, NULL);
+    winc_timer_start(&core1_timers, &beacon_timer, now);
+    winc_timer_start(&core1_timers, &health_timer, now + 5000);
+    winc_timer_start(&core1_timers, &mode_timer, now);
+
     // Initialize core 1 resources
     telem_ctx.sync.core1_ready = true;
     
-    uint32_t last_beacon = 0;
-    uint32_t last_health = 0;
-    
     while (!telem_ctx.sync.shutdown) {
-        uint32_t now = to_ms_since_boot(get_absolute_time());
-        
-        // Send beacon every interval
-        if (now - last_beacon >= telem_ctx.beacon_interval) {
-            udp_broadcast_beacon();
-            last_beacon = now;
-        }
-        
-        // Check TCP connection health
-        if (now - last_health >= 5000) {  // Every 5 seconds
-            for (int i = 0; i < 4; i++) {
-                tcp_connection_t *conn = &telem_ctx.tcp_connections[i];
-                if (conn->connected && 
-                    (now - conn->last_activity) > 30000) {  // 30 second timeout
-                    printf("[TCP] Connection %d timed out\n", i);
-                    conn->connected = false;
-                    put_sock_close(conn->sock);
-                }
-            }
-            last_health = now;
-        }
-        
-        // Process network mode
-        if (g_ctx.connection_state.is_ap_mode) {
-            process_ap_mode();
-        } else {
-            process_p2p_mode();
-        }
+        winc_timer_run(&core1_timers, core1_now());
         
         // Process packet queues
-        mutex_enter_blocking(&telem_ctx.sync.queue_mutex);
-        telemetry_packet_t *tx_packet = dequeue_packet(true);
-        mutex_exit(&telem_ctx.sync.queue_mutex);
-        
-        if (tx_packet) {
-            send_with_redundancy(tx_packet);
-        }
+        telemetry_packet_t *tx_packet;
+        do {
+            mutex_enter_blocking(&telem_ctx.sync.queue_mutex);
+            tx_packet = dequeue_packet(true);
+            mutex_exit(&telem_ctx.sync.queue_mutex);
+            
+            if (tx_packet) {
+                send_with_redundancy(tx_packet);
+            }
+        } while (tx_packet);
         
-        // Small delay to prevent CPU hogging
-        sleep_ms(10);
+        // Sleep until the next timer, or until enqueue_packet() or
+        // telemetry_shutdown() signals an event
+        best_effort_wfe_or_timeout(
+            make_timeout_time_ms(winc_timer_next_ms(&core1_timers, core1_now())));
     }
     
     printf("[CORE1] Network handler stopped\n");
 }
 
+// Called every second by the core 1 mode timer
 void process_ap_mode(void) {
     // AP-specific processing
     // Check for new client connections
     // Manage DHCP leases
     // Route packets between clients
     
-    static uint32_t last_client_check = 0;
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-    
-    if (now - last_client_check >= 1000) {  // Check every second
-        // Poll for client changes
-        // This would interface with ATWINC1500 AP status commands
-        last_client_check = now;
-    }
+    // Poll for client changes
+    // This would interface with ATWINC1500 AP status commands
 }
 
+// Called every 10 seconds by the core 1 mode timer
 void process_p2p_mode(void) {
     // P2P-specific processing
     // Maintain peer connections
     // Handle mesh routing
     // Implement hop-by-hop forwarding
     
-    static uint32_t last_route_update = 0;
-    uint32_t now = to_ms_since_boot(get_absolute_time());
-    
-    if (now - last_route_update >= 10000) {  // Update routes every 10 seconds
-        // Update routing table based on received beacons
-        // Clean up stale routes
-        last_route_update = now;
-    }
+    // Update routing table based on received beacons
+    // Clean up stale routes
 }
 
 // ============= QUEUE MANAGEMENT =============
@@ -559,6 +576,9 @@ bool enqueue_packet(telemetry_packet_t *packet, bool is_tx) {
     *head = next_head;
     
     mutex_exit(&telem_ctx.sync.queue_mutex);
+    
+    // Wake core 1 if it is sleeping until its next timer
+    __sev();
     return true;
 }
 
@@ -639,6 +659,7 @@ void telemetry_shutdown(void) {
     
     // Signal Core 1 to stop
     telem_ctx.sync.shutdown = true;
+    __sev();
     sleep_ms(100);
     
     // Close all connections
@@ -0,0 +1,181 @@
+// Hierarchical timer wheel for the Pi Pico
+//
+// Level l slot s holds timers expiring in the 64^l ms block whose index at
+// that level is s. When the clock reaches the start of a block, the block's
+// slot one level up is emptied into the finer level below (a cascade).
+
+#include <string.h>
+#include "winc_timer.h"
+
+#define LEVEL_SHIFT(l)  ((l) * WINC_TIMER_SLOT_BITS)
+#define SLOT_MASK       (WINC_TIMER_SLOTS - 1)
+#define WHEEL_SPAN      (1u << LEVEL_SHIFT(WINC_TIMER_LEVELS))
+
+// Rotate right, so bit n of x becomes bit 0
+static inline uint64_t ror64(uint64_t x, unsigned n) {
+    return n ? (x >> n) | (x << (64 - n)) : x;
+}
+
+static void wheel_insert(winc_timer_wheel_t *w, winc_timer_t *t) {
+    uint32_t at = t->expires;
+    uint32_t delta = at - w->now;
+    int level = 0;
+
+    if ((int32_t)delta < 0) {
+        // Overdue: fire on the next run
+        at = w->now;
+        delta = 0;
+    } else if (delta >= WHEEL_SPAN) {
+        // Beyond the wheel: park in the last slot, re-sorted on cascade
+        at = w->now + WHEEL_SPAN - 1;
+        delta = WHEEL_SPAN - 1;
+    }
+    while (level < WINC_TIMER_LEVELS - 1 && delta >= (1u << LEVEL_SHIFT(level + 1)))
+        level++;
+
+    t->level = level;
+    t->slot = (at >> LEVEL_SHIFT(level)) & SLOT_MASK;
+    t->wheel = w;
+    t->next = w->slots[level][t->slot];
+    if (t->next)
+        t->next->pprev = &t->next;
+    t->pprev = &w->slots[level][t->slot];
+    *t->pprev = t;
+    w->occupied[level] |= 1ull << t->slot;
+    w->pending++;
+}
+
+static void wheel_unlink(winc_timer_t *t) {
+    winc_timer_wheel_t *w = t->wheel;
+
+    *t->pprev = t->next;
+    if (t->next)
+        t->next->pprev = t->pprev;
+    if (!w->slots[t->level][t->slot])
+        w->occupied[t->level] &= ~(1ull << t->slot);
+    t->pprev = NULL;
+    w->pending--;
+}
+
+// Re-file every timer of one slot against the current time
+static void wheel_cascade(winc_timer_wheel_t *w, int level, uint32_t slot) {
+    winc_timer_t *t = w->slots[level][slot];
+
+    w->slots[level][slot] = NULL;
+    w->occupied[level] &= ~(1ull << slot);
+    while (t) {
+        winc_timer_t *next = t->next;
+        w->pending--;
+        wheel_insert(w, t);
+        t = next;
+    }
+}
+
+void winc_timer_wheel_init(winc_timer_wheel_t *w, uint32_t now_ms) {
+    memset(w, 0, sizeof(*w));
+    w->now = now_ms;
+}
+
+void winc_timer_init(winc_timer_t *t, winc_timer_fn fn, void *arg) {
+    memset(t, 0, sizeof(*t));
+    t->fn = fn;
+    t->arg = arg;
+}
+
+void winc_timer_start(winc_timer_wheel_t *w, winc_timer_t *t, uint32_t expires_ms) {
+    if (t->pprev)
+        wheel_unlink(t);
+    t->expires = expires_ms;
+    wheel_insert(w, t);
+}
+
+void winc_timer_cancel(winc_timer_t *t) {
+    if (t->pprev)
+        wheel_unlink(t);
+}
+
+// Distance from the wheel's own clock to its next slot with work
+static uint32_t wheel_next(const winc_timer_wheel_t *w) {
+    uint32_t best = WINC_TIMER_NONE;
+
+    if (w->occupied[0])
+        best = __builtin_ctzll(ror64(w->occupied[0], w->now & SLOT_MASK));
+
+    for (int l = 1; l < WINC_TIMER_LEVELS; l++) {
+        unsigned shift = LEVEL_SHIFT(l);
+        uint32_t cur = (w->now >> shift) & SLOT_MASK;
+        uint64_t rot;
+        uint32_t k, d;
+
+        if (!w->occupied[l])
+            continue;
+        rot = ror64(w->occupied[l], cur);
+        // The current block's slot was already cascaded unless the block
+        // is just starting; what it holds now is 64 blocks away
+        if ((rot & 1) && (w->now & ((1u << shift) - 1)))
+            rot &= ~1ull;
+        k = rot ? __builtin_ctzll(rot) : WINC_TIMER_SLOTS;
+        d = (((w->now >> shift) + k) << shift) - w->now;
+        if (d < best)
+            best = d;
+    }
+    return best;
+}
+
+int winc_timer_run(winc_timer_wheel_t *w, uint32_t now_ms) {
+    int fired = 0;
+
+    while ((int32_t)(now_ms - w->now) >= 0) {
+        uint32_t due = w->pending ? wheel_next(w) : WINC_TIMER_NONE;
+        uint32_t tick, idx;
+        winc_timer_t *list;
+
+        // Jump straight over empty stretches
+        if (due == WINC_TIMER_NONE || due > now_ms - w->now) {
+            w->now = now_ms + 1;
+            break;
+        }
+        tick = w->now + due;
+        idx = tick & SLOT_MASK;
+        w->now = tick;
+
+        if (!idx) {
+            for (int l = 1; l < WINC_TIMER_LEVELS; l++) {
+                uint32_t s = (tick >> LEVEL_SHIFT(l)) & SLOT_MASK;
+                wheel_cascade(w, l, s);
+                if (s)
+                    break;
+            }
+        }
+
+        // Detach the slot so timers restarted by callbacks land in later
+        // slots; the list head moves to a local the timers still link to
+        list = w->slots[0][idx];
+        w->slots[0][idx] = NULL;
+        w->occupied[0] &= ~(1ull << idx);
+        if (list)
+            list->pprev = &list;
+        w->now = tick + 1;
+
+        while (list) {
+            winc_timer_t *t = list;
+            wheel_unlink(t);
+            fired++;
+            w->fired++;
+            t->fn(t, t->arg);
+        }
+    }
+    return fired;
+}
+
+uint32_t winc_timer_next_ms(const winc_timer_wheel_t *w, uint32_t now_ms) {
+    uint32_t due, at;
+
+    if (!w->pending)
+        return WINC_TIMER_NONE;
+    due = wheel_next(w);
+    if (due == WINC_TIMER_NONE)
+        return WINC_TIMER_NONE;
+    at = w->now + due;
+    return (int32_t)(at - now_ms) > 0 ? at - now_ms : 0;
+}
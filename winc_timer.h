@@ -0,0 +1,75 @@
+// Hierarchical timer wheel for the Pi Pico
+//
+// Timers live in doubly linked slot lists, so starting and cancelling one
+// is O(1) whatever the number of timers. Four levels of 64 slots cover
+// 1 ms, 64 ms, 4.1 s and 262 s per slot; a timer sits in the finest level
+// that reaches it and cascades down as its time approaches. Running the
+// wheel costs one step per elapsed 1 ms slot only while level 0 holds
+// timers, otherwise one step per 64 ms, plus the work of the timers that
+// fire.
+//
+// A wheel is not thread safe: each owner (the mesh layer, the core 1
+// network loop) keeps its own and only touches it from its own core.
+
+#ifndef WINC_TIMER_H
+#define WINC_TIMER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define WINC_TIMER_SLOT_BITS  6
+#define WINC_TIMER_SLOTS      (1 << WINC_TIMER_SLOT_BITS)
+#define WINC_TIMER_LEVELS     4
+#define WINC_TIMER_NONE       UINT32_MAX   // winc_timer_next_ms(): nothing pending
+
+struct winc_timer;
+struct winc_timer_wheel;
+
+typedef void (*winc_timer_fn)(struct winc_timer *t, void *arg);
+
+typedef struct winc_timer {
+    struct winc_timer *next;
+    struct winc_timer **pprev;      // NULL while not pending
+    struct winc_timer_wheel *wheel;
+    uint32_t expires;               // ms since boot
+    uint8_t level, slot;
+    winc_timer_fn fn;
+    void *arg;
+} winc_timer_t;
+
+typedef struct winc_timer_wheel {
+    winc_timer_t *slots[WINC_TIMER_LEVELS][WINC_TIMER_SLOTS];
+    uint64_t occupied[WINC_TIMER_LEVELS];  // Bit per non-empty slot
+    uint32_t now;                   // Next ms not yet run
+    uint16_t pending;
+    uint32_t fired;                 // Callbacks run, for statistics
+} winc_timer_wheel_t;
+
+// Prepare a wheel whose clock starts at now_ms
+void winc_timer_wheel_init(winc_timer_wheel_t *w, uint32_t now_ms);
+
+// Bind a timer to its callback; it is not pending afterwards
+void winc_timer_init(winc_timer_t *t, winc_timer_fn fn, void *arg);
+
+// (Re)start a timer to fire at expires_ms; a time already past fires on
+// the next winc_timer_run(). O(1).
+void winc_timer_start(winc_timer_wheel_t *w, winc_timer_t *t, uint32_t expires_ms);
+
+// Stop a timer if pending. O(1).
+void winc_timer_cancel(winc_timer_t *t);
+
+static inline bool winc_timer_pending(const winc_timer_t *t) {
+    return t->pprev != 0;
+}
+
+// Fire every timer due at or before now_ms; returns how many fired.
+// Callbacks may start or cancel any timer, including their own.
+int winc_timer_run(winc_timer_wheel_t *w, uint32_t now_ms);
+
+// Milliseconds from now_ms until winc_timer_run() next has work to do: 0 if
+// something is due, WINC_TIMER_NONE if nothing is pending. Timers above
+// level 0 report the time they cascade, which is never later than when
+// they fire.
+uint32_t winc_timer_next_ms(const winc_timer_wheel_t *w, uint32_t now_ms);
+
+#endif // WINC_TIMER_H